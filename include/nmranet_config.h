@@ -119,6 +119,11 @@ DECLARE_CONST(gridconnect_tcp_use_select);
 /** Number of entries in the remote alias cache */
 DECLARE_CONST(remote_alias_cache_size);
 
+/** Set to CONSTANT_TRUE to make the remote alias cache use hash tables for
+ * lookups instead of a tree map. Recommended for gateways with a large remote
+ * alias cache. */
+DECLARE_CONST(remote_alias_cache_hash_index);
+
 /** Number of entries in the local alias cache */
 DECLARE_CONST(local_alias_cache_size);
 
@@ -137,6 +142,23 @@ DECLARE_CONST(num_datagram_clients);
  * datagram handler. */
 DECLARE_CONST(num_memory_spaces);
 
+/** Number of bytes the MemoryConfig handler moves between the memory space
+ * and the stream in one step when executing a stream read or write
+ * command. This is also the stream buffer size it asks for. */
+DECLARE_CONST(memory_config_stream_buffer_size);
+
+/** Readahead window in bytes for the configuration file memory space
+ * created by the SimpleStack. Small reads (such as 64-byte datagram reads by
+ * a configuration tool) are served from a RAM copy of this size, so that the
+ * file is read once per window. 0 disables the readahead. */
+DECLARE_CONST(memory_config_file_readahead);
+
+/** Largest config file (in bytes) that the ConfigUpdateFlow reads into RAM
+ * while calling the configuration listeners. Larger config files are read
+ * with one syscall per configuration entry. 0 disables the snapshot. Defaults
+ * to 4096 on Linux and Mac hosts, and to 0 on other targets. */
+DECLARE_CONST(update_snapshot_max_size);
+
 /** Set to CONSTANT_TRUE if you want to export an "all memory" memory space
  * from the SimpleStack. */
 DECLARE_CONST(enable_all_memory_space);
@@ -146,5 +168,16 @@ DECLARE_CONST(enable_all_memory_space);
  * standard. */
 DECLARE_CONST(node_init_identify);
 
+/** Number of 8-bit counters in the event registry pre-filter. Incoming event
+ * reports that cannot match any registered event handler are dropped using
+ * this filter before iterating the registry. Set to 0 to disable the
+ * filter. Check EventRegistry::filter()->stats() to tune the size. */
+DECLARE_CONST(event_registry_filter_size);
+
+/** Maximum number of disjoint event ID intervals the routing hub keeps for a
+ * port. When a port's registrations need more intervals than this, event
+ * reports are forwarded to that port unfiltered. 0 for no limit. */
+DECLARE_CONST(routing_max_event_intervals);
+
 
 #endif /* _nmranet_config_h_ */
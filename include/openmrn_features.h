@@ -64,6 +64,14 @@
 #define OPENMRN_FEATURE_EXECUTOR_SELECT 1
 #endif
 
+#if defined(__linux__) && !defined(__EMSCRIPTEN__) &&                         \
+    defined(OPENMRN_HAVE_PSELECT) && !defined(OPENMRN_EXECUTOR_NO_EPOLL)
+/// The Executor keeps the watched file descriptors in an epoll set instead of
+/// rebuilding fd_sets for every ::select call. Define
+/// OPENMRN_EXECUTOR_NO_EPOLL to build with the ::select implementation.
+#define OPENMRN_FEATURE_EXECUTOR_EPOLL 1
+#endif
+
 #if (defined(ARDUINO) && !defined(ESP32)) || defined(ESP_NONOS) ||             \
     defined(__EMSCRIPTEN__)
 /// A loop() function is calling the executor in the single-threaded OS context.
@@ -132,6 +140,12 @@
 #define OPENMRN_HAVE_BSD_SOCKETS_IPV6 1
 #endif
 
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+/// Compiles support for sendmmsg and recvmmsg, which transfer several
+/// datagrams (e.g. socketcan frames) in one system call.
+#define OPENMRN_HAVE_BSD_SOCKETS_MMSG 1
+#endif
+
 #if defined(__linux__) || defined(__MACH__)
 /// Ignores SIGPIPE signals to avoid write failures crashing the program.
 #define OPENMRN_FEATURE_BSD_SOCKETS_IGNORE_SIGPIPE 1
@@ -35,6 +35,7 @@
 #ifndef _EXECUTOR_DISPATCHER_HXX_
 #define _EXECUTOR_DISPATCHER_HXX_
 
+#include <algorithm>
 #include <vector>
 
 #include "executor/Notifiable.hxx"
@@ -46,6 +47,19 @@
    invoked.
 
    Handlers are called in no particular order.
+
+   Every handler but the last gets its own copy of the message, made by
+   assignment. Message types that keep their bulk data in reference-counted
+   storage (such as openlcb::GenMessage with its Payload) share that storage
+   between the copies, so fanning out a message costs one small buffer per
+   handler. A handler that modifies the message data in place has to be
+   registered with private_copy = true; its copy is then detached from the
+   shared storage via dispatch_unshare() before it is sent.
+
+   Incoming messages are matched through an index that groups the handlers by
+   their mask and keeps each group sorted by the masked identifier. The index
+   is rebuilt lazily on the first message after a handler was registered or
+   unregistered.
  */
 template <int NUM_PRIO>
 class DispatchFlowBase : public UntypedStateFlow<QList<NUM_PRIO>>
@@ -83,8 +97,11 @@ protected:
        one
        @param handler is the flow to forward message to. It must stay alive so
        long as *this is alive or the handler is removed.
+       @param private_copy if true, the handler will not share any
+       reference-counted message data with other handlers.
      */
-    void register_handler(UntypedHandler *handler, ID id, ID mask);
+    void register_handler(
+        UntypedHandler *handler, ID id, ID mask, bool private_copy = false);
 
     /// Removes a specific instance of a handler from this dispatcher.
     ///
@@ -140,7 +157,13 @@ protected:
 
 private:
     /// true if this flow should negate the match condition.
-    bool negateMatch_;
+    uint8_t negateMatch_ : 1;
+    /// true if the current message is iterating over matches_ instead of
+    /// handlers_.
+    uint8_t useIndex_ : 1;
+    /// true if the handlers changed since the index was built. Not a bit
+    /// field, because it is written by other threads under lock_.
+    bool indexDirty_;
     template<class T>
     friend class GenericHubFlow;
 
@@ -148,13 +171,16 @@ private:
     /// identifier, mask, handler pointer.
     struct HandlerInfo
     {
-        HandlerInfo() : handler(nullptr)
+        HandlerInfo() : handler(nullptr), privateCopy(false)
         {
         }
         ID id; ///< Bits that this handler is registered for.
         ID mask; ///< Mask that should be applied for the bits check.
         /// Handler to call. NULL if the handler has been removed.
         UntypedHandler *handler;
+        /// True if the handler needs a copy of the message that does not
+        /// share data with other handlers.
+        bool privateCopy;
 
         /// Equality comparison function on the handlers. Used for remove()
         /// calls.
@@ -172,15 +198,76 @@ private:
         }
     };
 
+    /// One entry of the lookup index.
+    struct IndexEntry
+    {
+        ID mask; ///< Mask of the handler.
+        ID key; ///< Identifier of the handler with the mask applied.
+        uint16_t slot; ///< Index of the handler in handlers_.
+
+        /// Sort order of the index: by mask, then key. @param o is the other
+        /// entry. @return true if *this has to come first.
+        bool operator<(const IndexEntry &o) const
+        {
+            if (mask != o.mask)
+            {
+                return mask < o.mask;
+            }
+            return key < o.key;
+        }
+    };
+
+    /// Range of index_ entries that have the same mask.
+    struct MaskGroup
+    {
+        ID mask; ///< Mask shared by the entries.
+        uint16_t begin; ///< First entry in index_.
+        uint16_t end; ///< One past the last entry in index_.
+    };
+
+    /// Recomputes index_ and maskGroups_ from handlers_. Must be called with
+    /// lock_ held.
+    void rebuild_index();
+
+    /// Fills matches_ with the slots of the handlers matching an identifier,
+    /// in ascending order. Must be called with lock_ held. @param id is the
+    /// identifier of the incoming message.
+    void lookup_index(ID id);
+
+    /// @return the handler entry at a given iteration position, or nullptr if
+    /// it does not exist anymore. @param pos is the iteration position.
+    HandlerInfo *handler_at(size_t pos)
+    {
+        size_t slot = useIndex_ ? matches_[pos] : pos;
+        return slot < handlers_.size() ? &handlers_[slot] : nullptr;
+    }
+
+    /// @return the number of positions to iterate over for the current
+    /// message.
+    size_t num_positions()
+    {
+        return useIndex_ ? matches_.size() : handlers_.size();
+    }
+
     /// Registered handlers.
     vector<HandlerInfo> handlers_;
 
-    /// Index of the next handler to look at.
+    /// Handlers that have a handler pointer, sorted by mask and masked
+    /// identifier.
+    vector<IndexEntry> index_;
+    /// The distinct masks in index_.
+    vector<MaskGroup> maskGroups_;
+    /// Slots of the handlers matching the current message.
+    vector<uint16_t> matches_;
+
+    /// Iteration position of the next handler to look at.
     size_t currentIndex_;
 
 protected:
     /// If non-NULL we still need to call this handler.
     UntypedHandler *lastHandlerToCall_;
+    /// True if lastHandlerToCall_ was registered with private_copy.
+    bool lastHandlerPrivate_;
 private:
     /// Protects handler add / remove against iteration.
     OSMutex lock_;
@@ -197,6 +284,14 @@ private:
 #define BASE_NUM_PRIO NUM_PRIO
 #endif
 
+/// Detaches a dispatched message copy from the data it shares with other
+/// copies. Assigning a message makes a deep copy for most message types, so
+/// this default does nothing. Message types with reference-counted data
+/// overload this function in their own namespace. @param m is the message.
+template <class T> inline void dispatch_unshare(T *m)
+{
+}
+
 /// Type-specific implementations of the DispatchFlow methods. see @ref
 /// DispatchFlowBase.
 template <class MessageType, int NUM_PRIO>
@@ -240,9 +335,13 @@ public:
        one
        @param handler is the flow to forward message to. It must stay alive so
        long as *this is alive or the handler is removed.
+       @param private_copy should be true if the handler modifies the message
+       data in place. Its copy will then not share any reference-counted
+       data with the copies of the other handlers.
      */
-    void register_handler(HandlerType *handler, ID id, ID mask) {
-        Base::register_handler(handler, id, mask);
+    void register_handler(
+        HandlerType *handler, ID id, ID mask, bool private_copy = false) {
+        Base::register_handler(handler, id, mask, private_copy);
     }
 
     /// Removes a specific instance of a handler from this dispatcher.
@@ -289,6 +388,9 @@ protected:
         MessageType *copy = this->get_allocation_result(h);
         copy->set_done(this->message()->new_child());
         *copy->data() = *this->message()->data();
+        if (this->lastHandlerPrivate_) {
+            dispatch_unshare(copy->data());
+        }
         h->send(copy);
         return call_immediately(STATE(clone_done));
     }
@@ -297,6 +399,10 @@ protected:
     /// as the last action. Requires: lastHandlerToCall != nullptr.
     void send_transfer() OVERRIDE {
         HandlerType* h = static_cast<HandlerType *>(this->lastHandlerToCall_);
+        if (this->lastHandlerPrivate_) {
+            // Earlier copies may still share data with the original.
+            dispatch_unshare(this->message()->data());
+        }
         h->send(this->transfer_message());
     }
 };
@@ -307,8 +413,11 @@ protected:
 template <int NUM_PRIO>
 DispatchFlowBase<NUM_PRIO>::DispatchFlowBase(Service *service)
     : UntypedStateFlow<QList<NUM_PRIO>>(service)
-    , negateMatch_(false)
+    , negateMatch_(0)
+    , useIndex_(0)
+    , indexDirty_(true)
     , lastHandlerToCall_(nullptr)
+    , lastHandlerPrivate_(false)
 {
 }
 
@@ -334,8 +443,8 @@ size_t DispatchFlowBase<NUM_PRIO>::size()
 }
 
 template<int NUM_PRIO>
-void DispatchFlowBase<NUM_PRIO>::register_handler(UntypedHandler *handler,
-                                                  ID id, ID mask)
+void DispatchFlowBase<NUM_PRIO>::register_handler(
+    UntypedHandler *handler, ID id, ID mask, bool private_copy)
 {
     OSMutexLock h(&lock_);
     size_t idx = 0;
@@ -350,6 +459,8 @@ void DispatchFlowBase<NUM_PRIO>::register_handler(UntypedHandler *handler,
     handlers_[idx].handler = handler;
     handlers_[idx].id = id;
     handlers_[idx].mask = mask;
+    handlers_[idx].privateCopy = private_copy;
+    indexDirty_ = true;
 }
 
 template<int NUM_PRIO>
@@ -375,6 +486,7 @@ DispatchFlowBase<NUM_PRIO>::unregister_handler(UntypedHandler *handler,
     {
         handlers_.resize(handlers_.size() - 1);
     }
+    indexDirty_ = true;
 }
 
 template<int NUM_PRIO>
@@ -393,6 +505,52 @@ void DispatchFlowBase<NUM_PRIO>::unregister_handler_all(
     {
         handlers_.pop_back();
     }
+    indexDirty_ = true;
+}
+
+template<int NUM_PRIO>
+void DispatchFlowBase<NUM_PRIO>::rebuild_index()
+{
+    HASSERT(handlers_.size() <= UINT16_MAX);
+    index_.clear();
+    maskGroups_.clear();
+    for (size_t i = 0; i < handlers_.size(); ++i)
+    {
+        auto &h = handlers_[i];
+        if (h.handler)
+        {
+            index_.push_back({h.mask, h.id & h.mask, (uint16_t)i});
+        }
+    }
+    std::sort(index_.begin(), index_.end());
+    for (size_t i = 0; i < index_.size(); ++i)
+    {
+        if (maskGroups_.empty() || maskGroups_.back().mask != index_[i].mask)
+        {
+            maskGroups_.push_back({index_[i].mask, (uint16_t)i, 0});
+        }
+        maskGroups_.back().end = i + 1;
+    }
+    indexDirty_ = false;
+}
+
+template<int NUM_PRIO>
+void DispatchFlowBase<NUM_PRIO>::lookup_index(ID id)
+{
+    matches_.clear();
+    for (auto &g : maskGroups_)
+    {
+        ID key = id & g.mask;
+        auto it = std::lower_bound(index_.begin() + g.begin,
+            index_.begin() + g.end, key,
+            [](const IndexEntry &e, ID k) { return e.key < k; });
+        for (; it != index_.begin() + g.end && it->key == key; ++it)
+        {
+            matches_.push_back(it->slot);
+        }
+    }
+    // Keeps calling the handlers in registration slot order.
+    std::sort(matches_.begin(), matches_.end());
 }
 
 template<int NUM_PRIO>
@@ -400,6 +558,17 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::entry()
 {
     currentIndex_ = 0;
     lastHandlerToCall_ = nullptr;
+    // The index only knows positive matches.
+    useIndex_ = negateMatch_ ? 0 : 1;
+    if (useIndex_)
+    {
+        OSMutexLock l(&lock_);
+        if (indexDirty_)
+        {
+            rebuild_index();
+        }
+        lookup_index(get_message_id());
+    }
     return call_immediately(STATE(iterate));
 }
 
@@ -411,13 +580,16 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
         // @todo(balazs.racz) make the registered handlers structure for the
         // dispatcher lock-free. This mutex here is very expensive.
         OSMutexLock l(&lock_);
-        for (; currentIndex_ < handlers_.size(); ++currentIndex_)
+        for (; currentIndex_ < num_positions(); ++currentIndex_)
         {
-            auto &h = handlers_[currentIndex_];
-            if (!h.handler)
+            HandlerInfo *hp = handler_at(currentIndex_);
+            if (!hp || !hp->handler)
             {
                 continue;
             }
+            // With the index this re-checks the match, because the slot may
+            // have been reused since the lookup.
+            auto &h = *hp;
             if (negateMatch_ && (id & h.mask) == (h.id & h.mask))
             {
                 continue;
@@ -430,13 +602,14 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
             if (!lastHandlerToCall_)
             {
                 // This was the first we found.
-                lastHandlerToCall_ = handlers_[currentIndex_].handler;
+                lastHandlerToCall_ = h.handler;
+                lastHandlerPrivate_ = h.privateCopy;
                 continue;
             }            
             break;
         }
     }
-    if (currentIndex_ >= handlers_.size())
+    if (currentIndex_ >= num_positions())
     {
         return iteration_done();
     }
@@ -448,7 +621,9 @@ StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::iterate()
 template<int NUM_PRIO>
 StateFlowBase::Action DispatchFlowBase<NUM_PRIO>::clone_done()
 {
-    lastHandlerToCall_ = handlers_[currentIndex_].handler;
+    HandlerInfo *h = handler_at(currentIndex_);
+    lastHandlerToCall_ = h ? h->handler : nullptr;
+    lastHandlerPrivate_ = h && h->privateCopy;
     ++currentIndex_;
     return call_immediately(STATE(iterate));
 }
@@ -45,6 +45,10 @@
 #include <sys/select.h>
 #endif
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
 #endif
@@ -76,10 +80,15 @@ ExecutorBase::ExecutorBase()
     , started_(0)
     , selectPrescaler_(0)
 {
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    HASSERT(epollFd_ >= 0);
+#else
     FD_ZERO(&selectRead_);
     FD_ZERO(&selectWrite_);
     FD_ZERO(&selectExcept_);
     selectNFds_ = 0;
+#endif
 }
 
 /** Lookup an executor by its name.
@@ -327,6 +336,151 @@ void *ExecutorBase::entry()
     return NULL;
 }
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+
+/// Epoll event bits that we register for each select type (indexed by select
+/// type minus one).
+static const uint32_t EPOLL_MASKS[3] = {
+    EPOLLIN | EPOLLRDHUP, EPOLLOUT, EPOLLPRI};
+
+/// Epoll event bits that make a given select type ready. Hangup and error
+/// wake up readers and writers, same as ::select.
+static const uint32_t EPOLL_READY[3] = {
+    EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR, EPOLLOUT | EPOLLHUP | EPOLLERR,
+    EPOLLPRI};
+
+/// Maximum number of ready file descriptors collected in one wait.
+static const int MAX_EPOLL_EVENTS = 32;
+
+void ExecutorBase::select(Selectable *job)
+{
+    int fd = job->fd_;
+    if (fd >= (int)epollSlots_.size())
+    {
+        epollSlots_.resize(fd + 1);
+    }
+    Selectable *&slot = epollSlots_[fd].jobs[job->selectType_ - 1];
+    if (slot)
+    {
+        LOG(FATAL,
+            "Multiple Selectables are waiting for the same fd %d type %u", fd,
+            job->selectType_);
+    }
+    HASSERT(!job->next);
+    slot = job;
+    if (!epoll_update(fd))
+    {
+        // ::select reports files that epoll cannot watch (e.g. regular files)
+        // as always ready.
+        slot = nullptr;
+        add(job->wakeup_, job->priority_);
+    }
+}
+
+bool ExecutorBase::is_selected(Selectable *job)
+{
+    int fd = job->fd_;
+    return fd < (int)epollSlots_.size() &&
+        epollSlots_[fd].jobs[job->selectType_ - 1] != nullptr;
+}
+
+void ExecutorBase::unselect(Selectable *job)
+{
+    int fd = job->fd_;
+    if (!is_selected(job))
+    {
+        LOG(FATAL, "Tried to remove a non-active selectable: fd %d type %u", fd,
+            job->selectType_);
+    }
+    epollSlots_[fd].jobs[job->selectType_ - 1] = nullptr;
+    epoll_update(fd);
+}
+
+bool ExecutorBase::epoll_update(int fd)
+{
+    EpollSlot *s = &epollSlots_[fd];
+    uint32_t want = 0;
+    for (unsigned i = 0; i < 3; ++i)
+    {
+        if (s->jobs[i])
+        {
+            want |= EPOLL_MASKS[i];
+        }
+    }
+    if (want == s->armed)
+    {
+        return true;
+    }
+    // The fd stays in the set once added. EPOLLONESHOT disarms it when it
+    // reports ready, and we re-arm or disarm it with a single MOD.
+    struct epoll_event ev;
+    ev.events = want | EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (s->registered)
+    {
+        if (epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev) == 0)
+        {
+            s->armed = want;
+            return true;
+        }
+        // The fd was closed (and maybe reopened) since we registered it,
+        // which removed it from the set.
+        s->registered = false;
+        s->armed = 0;
+    }
+    if (!want)
+    {
+        return true;
+    }
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        if (errno == EPERM)
+        {
+            return false;
+        }
+        LOG(WARNING, "Failed to add fd %d to the executor epoll set: %s", fd,
+            strerror(errno));
+        return true;
+    }
+    s->registered = true;
+    s->armed = want;
+    return true;
+}
+
+void ExecutorBase::wait_with_select(long long wait_length)
+{
+    if (!empty()) {
+        wait_length = 0;
+    }
+    long long max_sleep = MSEC_TO_NSEC(config_executor_max_sleep_msec());
+    if (wait_length > max_sleep)
+    {
+        wait_length = max_sleep;
+    }
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int count = selectHelper_.epoll_wait(
+        epollFd_, events, MAX_EPOLL_EVENTS, wait_length);
+    for (int i = 0; i < count; ++i)
+    {
+        int fd = events[i].data.fd;
+        EpollSlot *s = &epollSlots_[fd];
+        // EPOLLONESHOT disarmed the fd in the kernel.
+        s->armed = 0;
+        for (unsigned t = 0; t < 3; ++t)
+        {
+            Selectable *job = s->jobs[t];
+            if (job && (events[i].events & EPOLL_READY[t]))
+            {
+                s->jobs[t] = nullptr;
+                add(job->wakeup_, job->priority_);
+            }
+        }
+        epoll_update(fd);
+    }
+}
+
+#else
+
 void ExecutorBase::select(Selectable *job)
 {
     fd_set *s = get_select_set(job->type());
@@ -417,6 +571,8 @@ void ExecutorBase::wait_with_select(long long wait_length)
     selectNFds_ = max_fd;
 }
 
+#endif // OPENMRN_FEATURE_EXECUTOR_EPOLL
+
 #endif
 
 #if defined(ARDUINO)
@@ -446,4 +602,7 @@ ExecutorBase::~ExecutorBase()
     {
         shutdown();
     }
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    ::close(epollFd_);
+#endif
 }
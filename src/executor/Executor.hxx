@@ -49,6 +49,10 @@
 #include "utils/macros.h"
 #include "os/OSSelectWakeup.hxx"
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+#include <vector>
+#endif
+
 #ifdef ESP_NONOS
 extern "C" {
 #include <ets_sys.h>
@@ -191,6 +195,28 @@ private:
      * @param next_timer_nsec is the maximum time to sleep in nanoseconds. */
     void wait_with_select(long long next_timer_nsec);
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    /// Brings the kernel's epoll registration of a file descriptor in sync
+    /// with the Selectables currently waiting on it.
+    ///
+    /// @param fd the file descriptor.
+    ///
+    /// @return false if the descriptor cannot be watched by epoll (for
+    /// example, a regular file).
+    bool epoll_update(int fd);
+
+    /// Selectables waiting on one file descriptor, indexed by select type
+    /// minus one.
+    struct EpollSlot
+    {
+        /// Waiting Selectables for READ, WRITE and EXCEPT.
+        Selectable *jobs[3] = {nullptr, nullptr, nullptr};
+        /// Event mask currently armed in the epoll set.
+        uint32_t armed = 0;
+        /// True if the fd was added to the epoll set.
+        bool registered = false;
+    };
+#else
     /// Helper function.
     ///
     /// @param type a select type: READ, WRITE or EXCEPT
@@ -208,6 +234,7 @@ private:
         LOG(FATAL, "Unexpected select type %d", type);
         return nullptr;
     }
+#endif
 
     /** name of this Executor */
     const char *name_;
@@ -218,6 +245,12 @@ private:
     /** List of active timers. */
     ActiveTimers activeTimers_;
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    /** The epoll set with all watched file descriptors. */
+    int epollFd_;
+    /** Waiting Selectables, indexed by file descriptor. */
+    std::vector<EpollSlot> epollSlots_;
+#else
     /** fd to select for read. */
     fd_set selectRead_;
     /** fd to select for write. */
@@ -228,6 +261,7 @@ private:
     int selectNFds_;
     /** Head of the linked list for the select calls. */
     TypedQueue<Selectable> selectables_;
+#endif
 
     /** Set to 1 when the executor thread has exited and it is safe to delete
      * *this. */
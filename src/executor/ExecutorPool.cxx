@@ -0,0 +1,304 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file ExecutorPool.cxx
+ *
+ * An executor that runs its executables on several threads.
+ *
+ * @author agent
+ * @date 17 October 2026
+ */
+
+#include "executor/ExecutorPool.hxx"
+
+ExecutorPool::ExecutorPool(
+    const char *name, int priority, size_t stack_size, unsigned num_workers)
+{
+    HASSERT(num_workers >= 1);
+    for (unsigned i = 0; i < num_workers; ++i)
+    {
+        workers_.emplace_back(new Worker(this, i));
+    }
+    OSThread::start(name, priority, stack_size);
+    for (auto &w : workers_)
+    {
+        w->start(name, priority, stack_size);
+    }
+}
+
+ExecutorPool::~ExecutorPool()
+{
+    // Stops the workers first; the executor's thread keeps running timers
+    // for them until they are done.
+    exitPending_ = true;
+    for (auto &w : workers_)
+    {
+        wake(w.get());
+    }
+    for (unsigned i = 0; i < workers_.size(); ++i)
+    {
+        exitSem_.wait();
+    }
+    shutdown();
+}
+
+void ExecutorPool::add(Executable *msg, unsigned priority)
+{
+    if (msg == this)
+    {
+        // The exit closure must run on the executor's own thread.
+        mainExitPending_ = true;
+        selectHelper_.wakeup();
+    }
+    else if (msg == active_timers())
+    {
+        // Timers are only scheduled by the executor's own thread.
+        timersPending_ = true;
+        selectHelper_.wakeup();
+    }
+    else
+    {
+        push(target_worker(), msg, priority == 0);
+    }
+}
+
+bool ExecutorPool::empty()
+{
+    if (timersPending_)
+    {
+        return false;
+    }
+    for (auto &w : workers_)
+    {
+        OSMutexLock l(&w->lock_);
+        if (!w->queue_.empty())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t ExecutorPool::sequence()
+{
+    uint32_t ret = 0;
+    for (auto &w : workers_)
+    {
+        ret += w->runCount_;
+    }
+    return ret;
+}
+
+uint32_t ExecutorPool::steal_count()
+{
+    uint32_t ret = 0;
+    for (auto &w : workers_)
+    {
+        ret += w->stealCount_;
+    }
+    return ret;
+}
+
+Executable *ExecutorPool::next(unsigned *priority)
+{
+    *priority = 0;
+    if (timersPending_.exchange(false))
+    {
+        return active_timers();
+    }
+    if (mainExitPending_)
+    {
+        return this;
+    }
+    return nullptr;
+}
+
+void ExecutorPool::worker_loop(Worker *w)
+{
+    w->handle_ = os_thread_self();
+    while (true)
+    {
+        Executable *msg = take(w);
+        if (!msg)
+        {
+            w->idle_ = true;
+            // Work added before idle_ was set would not wake us up.
+            msg = take(w);
+            if (!msg)
+            {
+                if (exitPending_)
+                {
+                    break;
+                }
+                w->sem_.wait();
+                continue;
+            }
+            w->idle_ = false;
+        }
+        ++w->runCount_;
+        msg->run();
+        w->running_ = nullptr;
+    }
+    // After this the destructor may delete *w.
+    exitSem_.post();
+}
+
+Executable *ExecutorPool::take(Worker *w)
+{
+    for (unsigned i = 0; i < workers_.size(); ++i)
+    {
+        Worker *owner = workers_[(w->index_ + i) % workers_.size()].get();
+        Executable *msg = claim(w, owner, i == 0);
+        if (msg)
+        {
+            if (i)
+            {
+                ++w->stealCount_;
+            }
+            return msg;
+        }
+    }
+    return nullptr;
+}
+
+Executable *ExecutorPool::claim(Worker *w, Worker *owner, bool from_front)
+{
+    while (true)
+    {
+        Executable *msg;
+        Worker *busy;
+        {
+            OSMutexLock l(&owner->lock_);
+            if (owner->queue_.empty())
+            {
+                return nullptr;
+            }
+            if (from_front)
+            {
+                msg = owner->queue_.front();
+                owner->queue_.pop_front();
+            }
+            else
+            {
+                msg = owner->queue_.back();
+                owner->queue_.pop_back();
+            }
+            // Claims msg before looking at the other workers, so that a
+            // worker taking msg after it is queued again will see it.
+            w->running_ = msg;
+            busy = running_elsewhere(w, msg);
+            if (!busy)
+            {
+                return msg;
+            }
+            w->running_ = nullptr;
+            if (busy == owner)
+            {
+                // The owner will run it when its current run is done.
+                if (from_front)
+                {
+                    owner->queue_.push_front(msg);
+                }
+                else
+                {
+                    owner->queue_.push_back(msg);
+                }
+                return nullptr;
+            }
+        }
+        // The previous run of msg is not done yet. Hands it over to the
+        // worker running it, which will pick it up next.
+        {
+            OSMutexLock l(&busy->lock_);
+            busy->queue_.push_front(msg);
+        }
+        wake(busy);
+    }
+}
+
+ExecutorPool::Worker *ExecutorPool::running_elsewhere(
+    Worker *w, Executable *msg)
+{
+    for (auto &o : workers_)
+    {
+        if (o.get() != w && o->running_ == msg)
+        {
+            return o.get();
+        }
+    }
+    return nullptr;
+}
+
+void ExecutorPool::push(Worker *w, Executable *msg, bool front)
+{
+    {
+        OSMutexLock l(&w->lock_);
+        if (front)
+        {
+            w->queue_.push_front(msg);
+        }
+        else
+        {
+            w->queue_.push_back(msg);
+        }
+    }
+    if (wake(w))
+    {
+        return;
+    }
+    // The owner is busy. Lets an idle worker steal the work.
+    for (auto &o : workers_)
+    {
+        if (wake(o.get()))
+        {
+            return;
+        }
+    }
+}
+
+bool ExecutorPool::wake(Worker *w)
+{
+    if (w->idle_ && w->idle_.exchange(false))
+    {
+        w->sem_.post();
+        return true;
+    }
+    return false;
+}
+
+ExecutorPool::Worker *ExecutorPool::target_worker()
+{
+    os_thread_t self = os_thread_self();
+    for (auto &w : workers_)
+    {
+        if (w->handle_ == self)
+        {
+            return w.get();
+        }
+    }
+    unsigned n = nextTarget_++;
+    return workers_[n % workers_.size()].get();
+}
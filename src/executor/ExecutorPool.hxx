@@ -0,0 +1,229 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file ExecutorPool.hxx
+ *
+ * An executor that runs its executables on several threads.
+ *
+ * @author agent
+ * @date 17 October 2026
+ */
+
+#ifndef _EXECUTOR_EXECUTORPOOL_HXX_
+#define _EXECUTOR_EXECUTORPOOL_HXX_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "executor/Executor.hxx"
+#include "os/OS.hxx"
+
+/// Executor that schedules its executables over a number of worker threads.
+///
+/// Each worker has its own deque of executables, protected by its own
+/// lock. Executables added from a worker thread go to the back of that
+/// worker's deque; executables added from other threads are distributed
+/// round-robin. A worker runs its own deque front to back, and when it is
+/// empty, it steals from the back of the other workers' deques, taking only
+/// the victim's lock.
+///
+/// An executable is never run on two workers at the same time: when a worker
+/// takes an executable that is still running on another worker, it hands the
+/// executable over to the deque of that worker instead. This keeps the
+/// guarantee of the single-threaded executor that an Executable (e.g. a
+/// StateFlow) does not run concurrently with itself.
+///
+/// That guarantee covers only the Executable object itself. The thread of
+/// the executor runs the timers (including StateFlowTimer and every other
+/// ::Timer) and the select loop; it does not run any executables from the
+/// deques. Timer callbacks therefore run in parallel with the flows, and
+/// different flows of the same Service run in parallel with each other.
+/// A service is safe on a pool only if
+///  - its flows share no state with each other, or protect it with a lock;
+///  - its timers only wake up flows (StateFlowBase::sleep_and_call,
+///    StateFlowTimer), and do not touch flow or service state from
+///    timeout();
+///  - it does no file descriptor I/O (select(), unselect() and
+///    is_selected() may only be called on the executor thread).
+///
+/// The OpenLCB stack services (If and its dispatchers, datagram, memory
+/// config, traction) do not meet these requirements and must stay on a
+/// single-threaded Executor. The pool is meant for independent, CPU-bound
+/// state flows written for it.
+///
+/// Priorities are coarsened into two bands: priority 0 is put to the front of
+/// the deque, everything else to the back.
+class ExecutorPool : public ExecutorBase
+{
+public:
+    /// Constructor. Starts all threads.
+    ///
+    /// @param name thread name (passed to OS) of the threads
+    /// @param priority thread priority (0 == default prio)
+    /// @param stack_size number of bytes to allocate for each thread stack
+    /// @param num_workers how many threads should run executables. This is
+    /// in addition to the executor's own thread, which runs the timers and
+    /// the select loop. Must be at least 1.
+    ExecutorPool(const char *name, int priority, size_t stack_size,
+        unsigned num_workers);
+
+    /// Destructor. Waits for the workers to run out of queued work, then
+    /// stops all threads. Executables added while the destructor is running
+    /// may be dropped.
+    ~ExecutorPool();
+
+    /// Send a message to this Executor's queue.
+    /// @param msg Executable instance to insert into the input queue
+    /// @param priority priority of message
+    void add(Executable *msg, unsigned priority = UINT_MAX) override;
+
+#if OPENMRN_FEATURE_RTOS_FROM_ISR
+    /// Not supported: the pool's queues are protected by a mutex.
+    void add_from_isr(Executable *msg, unsigned priority = UINT_MAX) override
+    {
+        DIE("ExecutorPool does not support adding from an ISR");
+    }
+#endif // OPENMRN_FEATURE_RTOS_FROM_ISR
+
+    /// @return true if there are no executables waiting on any of the
+    /// workers. There could still be executables running.
+    bool empty() override;
+
+    uint32_t sequence() override;
+
+    /// @return the number of threads running executables.
+    unsigned num_workers()
+    {
+        return workers_.size();
+    }
+
+    /// @return how many times a worker took an executable from another
+    /// worker's deque.
+    uint32_t steal_count();
+
+private:
+    /// A thread running executables.
+    class Worker : public OSThread
+    {
+    public:
+        /// Constructor. @param parent owning pool, @param index position in
+        /// the worker list.
+        Worker(ExecutorPool *parent, unsigned index)
+            : parent_(parent)
+            , index_(index)
+        {
+        }
+
+        /// Thread entry point.
+        void *entry() override
+        {
+            parent_->worker_loop(this);
+            return nullptr;
+        }
+
+        /// Owning pool.
+        ExecutorPool *parent_;
+        /// Protects queue_.
+        OSMutex lock_;
+        /// Executables waiting to be run, preferably on this worker.
+        std::deque<Executable *> queue_;
+        /// Executable this worker is running now, or nullptr.
+        std::atomic<Executable *> running_ {nullptr};
+        /// Thread handle; set by the worker thread itself.
+        std::atomic<os_thread_t> handle_ {0};
+        /// True if the worker is sleeping (or about to) on sem_.
+        std::atomic<bool> idle_ {false};
+        /// Number of executables run by this worker.
+        std::atomic<uint32_t> runCount_ {0};
+        /// Number of executables taken from another worker's deque.
+        std::atomic<uint32_t> stealCount_ {0};
+        /// Idle workers sleep on this.
+        OSSem sem_;
+        /// Position of this worker in workers_.
+        unsigned index_;
+    };
+
+    /// Called on the executor's thread to get the next executable. Returns
+    /// only the timers and the exit closure; everything else runs on the
+    /// workers.
+    Executable *next(unsigned *priority) override;
+
+    /// Body of the worker threads. @param w is the calling worker.
+    void worker_loop(Worker *w);
+
+    /// Takes the next executable for a worker, preferably from its own
+    /// deque, otherwise stealing from another worker.
+    /// @param w the worker asking for work.
+    /// @return executable to run (already marked as running on w), or
+    /// nullptr if there is nothing to run.
+    Executable *take(Worker *w);
+
+    /// Removes an executable from a deque and marks it as running on a
+    /// worker. If the executable is still running on a different worker, it
+    /// is moved to that worker's deque and the next entry is tried.
+    /// @param w the worker asking for work.
+    /// @param owner the worker whose deque to take from.
+    /// @param from_front true to take from the front, false from the back.
+    /// @return the executable, or nullptr if the deque is empty.
+    Executable *claim(Worker *w, Worker *owner, bool from_front);
+
+    /// @return the worker other than w that is running msg, or nullptr.
+    /// @param w worker to skip. @param msg executable to look for.
+    Worker *running_elsewhere(Worker *w, Executable *msg);
+
+    /// Queues an executable on a worker and wakes up a worker to run it.
+    /// @param w the worker whose deque gets the executable.
+    /// @param msg executable to queue.
+    /// @param front true to put it to the front of the deque.
+    void push(Worker *w, Executable *msg, bool front);
+
+    /// Wakes up a worker if it is idle. @param w the worker. @return true if
+    /// it was idle.
+    bool wake(Worker *w);
+
+    /// @return the worker on which a newly added executable should be
+    /// queued.
+    Worker *target_worker();
+
+    /// All the workers.
+    std::vector<std::unique_ptr<Worker>> workers_;
+    /// Next worker to get an executable added from outside the pool.
+    std::atomic<unsigned> nextTarget_ {0};
+    /// True if the ActiveTimers needs to run on the executor's thread.
+    std::atomic<bool> timersPending_ {false};
+    /// True if the exit closure was added.
+    std::atomic<bool> mainExitPending_ {false};
+    /// True if the workers should exit when they run out of work.
+    std::atomic<bool> exitPending_ {false};
+    /// Each worker posts this when it exits.
+    OSSem exitSem_;
+
+    DISALLOW_COPY_AND_ASSIGN(ExecutorPool);
+};
+
+#endif // _EXECUTOR_EXECUTORPOOL_HXX_
@@ -33,6 +33,9 @@
  */
 
 #include "executor/Timer.hxx"
+
+#include <algorithm>
+
 #include "executor/Executor.hxx"
 #include "os/os.h"
 
@@ -86,32 +89,28 @@ long long ActiveTimers::get_next_timeout()
 {
     OSMutexLock l(&lock_);
 
-    QMember **last = &activeTimers_.next;
-    Timer *current_timer = static_cast<Timer *>(*last);
     long long now = OSTime::get_monotonic();
     bool found_timer = false;
-    while (current_timer && current_timer->when_ <= now)
+    while (!heap_.empty() && heap_[0]->when_ <= now)
     {
         // Deques next timer.
         found_timer = true;
-        *last = current_timer->next;
-        current_timer->next = nullptr;
+        Timer *current_timer = heap_[0];
+        remove_at(0);
 
         current_timer->isActive_ = 0;
         current_timer->isExpired_ = 1;
         // Puts it on the executor.
         executor_->add(current_timer, current_timer->priority_);
-        // Takes the next timer.
-        current_timer = static_cast<Timer *>(*last);
     }
 
     if (found_timer)
     {
         return 0;
     }
-    else if (current_timer)
+    else if (!heap_.empty())
     {
-        long long ret = current_timer->when_ - now;
+        long long ret = heap_[0]->when_ - now;
         return ret;
     }
     else
@@ -124,10 +123,7 @@ long long ActiveTimers::get_next_timeout()
 
 bool ActiveTimers::empty() {
     OSMutexLock l(&lock_);
-
-    QMember **last = &activeTimers_.next;
-    Timer *current_timer = static_cast<Timer *>(*last);
-    return (current_timer == nullptr);
+    return heap_.empty();
 }
 
 void ActiveTimers::schedule_timer(Timer *timer)
@@ -136,21 +132,88 @@ void ActiveTimers::schedule_timer(Timer *timer)
     insert_locked(timer);
 }
 
+bool ActiveTimers::expires_before(Timer *a, Timer *b)
+{
+    if (a->when_ != b->when_)
+    {
+        return a->when_ < b->when_;
+    }
+    // Sequence numbers may wrap around.
+    return (int32_t)(a->seq_ - b->seq_) < 0;
+}
+
+void ActiveTimers::place(unsigned idx, Timer *timer)
+{
+    heap_[idx] = timer;
+    timer->heapIndex_ = idx;
+}
+
+void ActiveTimers::sift_up(unsigned idx)
+{
+    Timer *timer = heap_[idx];
+    while (idx > 0)
+    {
+        unsigned parent = (idx - 1) / ARITY;
+        if (!expires_before(timer, heap_[parent]))
+        {
+            break;
+        }
+        place(idx, heap_[parent]);
+        idx = parent;
+    }
+    place(idx, timer);
+}
+
+void ActiveTimers::sift_down(unsigned idx)
+{
+    Timer *timer = heap_[idx];
+    unsigned size = heap_.size();
+    while (true)
+    {
+        unsigned first = idx * ARITY + 1;
+        if (first >= size)
+        {
+            break;
+        }
+        unsigned last = std::min(first + ARITY, size);
+        unsigned best = first;
+        for (unsigned c = first + 1; c < last; ++c)
+        {
+            if (expires_before(heap_[c], heap_[best]))
+            {
+                best = c;
+            }
+        }
+        if (!expires_before(heap_[best], timer))
+        {
+            break;
+        }
+        place(idx, heap_[best]);
+        idx = best;
+    }
+    place(idx, timer);
+}
+
+void ActiveTimers::remove_at(unsigned idx)
+{
+    Timer *last = heap_.back();
+    heap_.pop_back();
+    if (idx < heap_.size())
+    {
+        place(idx, last);
+        sift_down(idx);
+        sift_up(last->heapIndex_);
+    }
+}
+
 void ActiveTimers::insert_locked(Timer *timer)
 {
     HASSERT(timer);
     HASSERT(timer->next == nullptr);
 
-    QMember **last = &activeTimers_.next;
-    Timer *current_timer = static_cast<Timer *>(*last);
-    while (current_timer && current_timer->when_ <= timer->when_)
-    {
-        last = &current_timer->next;
-        current_timer = static_cast<Timer *>(*last);
-    }
-    // Inserts into the queue.
-    timer->next = current_timer;
-    *last = timer;
+    timer->seq_ = nextSeq_++;
+    heap_.push_back(timer);
+    sift_up(heap_.size() - 1);
 
     // This will wake up the executor, which will schedule all expired timers
     // and recompute sleep length.
@@ -160,23 +223,24 @@ void ActiveTimers::insert_locked(Timer *timer)
 void ActiveTimers::remove_locked(Timer *timer)
 {
     HASSERT(timer);
-    // Removes the timer from the queue.
-    QMember **last = &activeTimers_.next;
-    while (*last && *last != timer)
-    {
-        last = &((*last)->next);
-    }
-    HASSERT(*last == timer);
-    *last = timer->next;
-    timer->next = nullptr;
+    // Removes the timer from the heap.
+    unsigned idx = timer->heapIndex_;
+    HASSERT(idx < heap_.size() && heap_[idx] == timer);
+    remove_at(idx);
 }
 
 void ActiveTimers::update_timer(Timer *timer)
 {
     HASSERT(timer);
     OSMutexLock l(&lock_);
-    remove_locked(timer);
-    insert_locked(timer);
+    unsigned idx = timer->heapIndex_;
+    HASSERT(idx < heap_.size() && heap_[idx] == timer);
+    // Same order as removing and inserting again: goes after the timers with
+    // the same expiration time.
+    timer->seq_ = nextSeq_++;
+    sift_down(idx);
+    sift_up(timer->heapIndex_);
+    notify();
 }
 
 void ActiveTimers::remove_timer(Timer *timer)
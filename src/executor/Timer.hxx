@@ -35,6 +35,8 @@
 #ifndef _EXECUTOR_TIMER_HXX_
 #define _EXECUTOR_TIMER_HXX_
 
+#include <vector>
+
 #include "executor/Notifiable.hxx"
 #include "utils/Buffer.hxx"
 #include "utils/QMember.hxx"
@@ -44,7 +46,12 @@ class Timer;
 class ExecutorBase;
 
 /** Class that manages the list of active timers. The Executor uses this class
- * tightly in its sleep-execute loop. */
+ * tightly in its sleep-execute loop.
+ *
+ * The active timers are kept in a 4-ary min-heap ordered by expiration time.
+ * Timers with the same expiration time expire in the order they were
+ * scheduled (or last updated). Scheduling, updating and removing a timer
+ * costs O(log n). */
 class ActiveTimers : public Executable
 {
 public:
@@ -53,6 +60,7 @@ public:
     /// @param executor parent that will use this instance.
     ActiveTimers(ExecutorBase *executor)
         : executor_(executor)
+        , nextSeq_(0)
         , isPending_(0)
     {
     }
@@ -75,17 +83,15 @@ public:
      * scheduled. */
     void schedule_timer(::Timer *timer);
 
-    /** Updates the expiration time of an already scheduled timer. This call is
-     * somewhat expensive, because it needs to walk the entire queue of active
-     * timers. May wake up the executor.
+    /** Updates the expiration time of an already scheduled timer. May wake up
+     * the executor.
      *
      * @param timer is the timer whose next execution time has been updated. It
      * must already be scheduled. */
     void update_timer(::Timer *timer);
 
-    /** Deletes an already scheduled but not yet expired timer. This call is
-     * somewhat expensive, because it needs to walk the entire queue of active
-     * timers. Asserts that the timer is in fact not yet expired.
+    /** Deletes an already scheduled but not yet expired timer. Asserts that
+     * the timer is in fact not yet expired.
      *
      * @param timer is the timer to delete. */
     void remove_timer(::Timer *timer);
@@ -113,12 +119,39 @@ private:
      * @param timer what to insert into the active list. */
     void insert_locked(::Timer *timer);
 
+    /** Removes the heap entry at a given index. Caller must hold the lock.
+     * @param idx index in heap_ of the timer to remove. */
+    void remove_at(unsigned idx);
+
+    /** Moves a heap entry up until its parent expires before it.
+     * @param idx index in heap_ of the entry to move. */
+    void sift_up(unsigned idx);
+
+    /** Moves a heap entry down until all its children expire after it.
+     * @param idx index in heap_ of the entry to move. */
+    void sift_down(unsigned idx);
+
+    /** Stores a timer in the heap and records its position in the timer.
+     * @param idx index in heap_ to write. @param timer is the timer to put
+     * there. */
+    void place(unsigned idx, ::Timer *timer);
+
+    /** @return true if timer a has to expire before timer b. @param a is the
+     * first timer. @param b is the second timer. */
+    static bool expires_before(::Timer *a, ::Timer *b);
+
+    /// Number of children of each heap node.
+    static constexpr unsigned ARITY = 4;
+
     /// Parent.
     ExecutorBase *executor_;
-    /// Protects the timer list.
+    /// Protects the timer heap.
     OSMutex lock_;
-    /// List of timers that are scheduled.
-    QMember activeTimers_;
+    /// Timers that are scheduled, as a 4-ary min-heap.
+    std::vector<::Timer *> heap_;
+    /// Sequence number given to the next timer that is scheduled or updated.
+    /// Orders timers with the same expiration time.
+    uint32_t nextSeq_;
     /// 1 if we in the executor's queue.
     unsigned isPending_ : 1;
 
@@ -141,6 +174,8 @@ public:
         , priority_(UINT_MAX)
         , when_(0)
         , period_(0)
+        , seq_(0)
+        , heapIndex_(0)
         , isActive_(0)
         , isExpired_(0)
         , isCancelled_(0)
@@ -293,6 +328,10 @@ private:
     long long when_;
     /** period in nanoseconds for timer */
     long long period_;
+    /** scheduling order among timers with the same expiration time */
+    uint32_t seq_;
+    /** position in the active timers' heap while isActive_ is set */
+    unsigned heapIndex_;
     /** true when the timer is in the active timers list */
     unsigned isActive_ : 1;
     /** True when the timer is in the pending executables list of the
@@ -115,6 +115,33 @@ void EEPROMEmulation::mount()
         /* turn on shadowing */
         shadowInRam_ = true;
     }
+    else if (INDEX_IN_RAM)
+    {
+        /* raw block numbers must not collide with the empty marker */
+        HASSERT(rawBlockCount_ < NO_SLOT);
+        index_ = new uint16_t[fblock_count()];
+        build_index();
+    }
+}
+
+/** Fills in index_ by scanning the journal of the active sector.
+ */
+void EEPROMEmulation::build_index()
+{
+    for (unsigned i = 0; i < fblock_count(); ++i)
+    {
+        index_[i] = NO_SLOT;
+    }
+    /* later slots override earlier ones */
+    for (unsigned raw_block = slot_first();
+         raw_block < rawBlockCount_ - availableSlots_; ++raw_block)
+    {
+        unsigned fblock = *block(activeSector_, raw_block) >> 16;
+        if (fblock < fblock_count())
+        {
+            index_[fblock] = raw_block;
+        }
+    }
 }
 
 /** Write to the EEPROM.  NOTE!!! This is not necessarily atomic across
@@ -213,6 +240,10 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
                            (data[(i * 2) + 0] << 0);
         }
         flash_program(activeSector_, rawBlockCount_ - availableSlots_, slot_data, BLOCK_SIZE);
+        if (index_)
+        {
+            index_[index] = rawBlockCount_ - availableSlots_;
+        }
         --availableSlots_;
     }
     else
@@ -229,7 +260,7 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
         unsigned available_slots = slot_count();
 
         /* move any existing data over */
-        for (unsigned int fblock = 0; fblock < (file_size() / BYTES_PER_BLOCK); ++fblock)
+        for (unsigned int fblock = 0; fblock < fblock_count(); ++fblock)
         {
             uint32_t slot_data[BLOCK_SIZE / sizeof(uint32_t)];
             if (fblock == index) // the new data to be written
@@ -248,6 +279,10 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
                 if (!read_fblock(fblock, read_data))
                 {
                     /* nothing to write, this is the default "erased" value */
+                    if (index_)
+                    {
+                        index_[fblock] = NO_SLOT;
+                    }
                     continue;
                 }
                 for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
@@ -259,6 +294,12 @@ void EEPROMEmulation::write_fblock(unsigned int index, const uint8_t data[])
             }
             /* commit the write */
             flash_program(new_sector, rawBlockCount_ - available_slots, slot_data, BLOCK_SIZE);
+            if (index_)
+            {
+                /* entries of the blocks not yet moved still refer to the
+                 * old sector, which is where read_fblock looks for them */
+                index_[fblock] = rawBlockCount_ - available_slots;
+            }
             --available_slots;
         }
         /* finalize the data move and write */
@@ -287,6 +328,27 @@ void EEPROMEmulation::read(unsigned int offset, void *buf, size_t len)
     }
 
     uint8_t *byte_data = (uint8_t *)buf;
+
+    if (index_)
+    {
+        while (len)
+        {
+            unsigned slotofs = offset % BYTES_PER_BLOCK;
+            size_t copylen = BYTES_PER_BLOCK - slotofs;
+            if (copylen > len)
+            {
+                copylen = len;
+            }
+            uint8_t data[BYTES_PER_BLOCK];
+            read_fblock(offset / BYTES_PER_BLOCK, data);
+            memcpy(byte_data, data + slotofs, copylen);
+            offset += copylen;
+            byte_data += copylen;
+            len -= copylen;
+        }
+        return;
+    }
+
     memset(byte_data, 0xff, len); // default if data not found
 
     for (unsigned block_index = slot_first();
@@ -306,11 +368,7 @@ void EEPROMEmulation::read(unsigned int offset, void *buf, size_t len)
         }
         // Reads the block
         uint8_t data[BYTES_PER_BLOCK];
-        for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
-        {
-            data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
-            data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
-        }
+        decode_slot(address, data);
         // Copies the right part into the output buffer.
         unsigned slotofs, bufofs;
         if (slot_offset < offset)
@@ -352,6 +410,17 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
         }
         return false;
     }
+    else if (index_)
+    {
+        unsigned raw_block = index_[index];
+        if (raw_block == NO_SLOT)
+        {
+            memset(data, 0xFF, BYTES_PER_BLOCK);
+            return false;
+        }
+        decode_slot(block(activeSector_, raw_block), data);
+        return true;
+    }
     else
     {
         /* default data value if not found */
@@ -366,11 +435,7 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
             if (index == (*address >> 16))
             {
                 /* found the data */
-                for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
-                {
-                    data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
-                    data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
-                }
+                decode_slot(address, data);
                 return true;
             }
         }
@@ -378,3 +443,17 @@ bool EEPROMEmulation::read_fblock(unsigned int index, uint8_t data[])
 
     return false;
 }
+
+/** Decodes the data payload of a slot.
+ * @param address pointer to the slot in flash
+ * @param data location to place the data, array size must be @ref
+ *           BYTES_PER_BLOCK large
+ */
+void EEPROMEmulation::decode_slot(const uint32_t *address, uint8_t data[])
+{
+    for (unsigned int i = 0; i < BLOCK_SIZE / sizeof(uint32_t); ++i)
+    {
+        data[(i * 2) + 0] = (address[i] >> 0) & 0xFF;
+        data[(i * 2) + 1] = (address[i] >> 8) & 0xFF;
+    }
+}
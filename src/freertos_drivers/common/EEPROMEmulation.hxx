@@ -101,6 +101,13 @@ extern const char __eeprom_end;
  *  be allocated in RAM that will be pre-filled with the entire eeprom
  *  data. Dramatically speeds up reads, because reads will not have to go
  *  through the log anymore.
+ *  @param INDEX_IN_RAM: a boolean, if set to true (and SHADOW_IN_RAM is
+ *  false), an index is allocated in RAM that stores for every BYTES_PER_BLOCK
+ *  chunk of the file which slot of the journal holds its latest data. The
+ *  index is built once at mount by scanning the journal, and makes reads
+ *  constant time independently of how full the journal is. It costs two
+ *  bytes of RAM per BYTES_PER_BLOCK bytes of file, compared to the full file
+ *  size for SHADOW_IN_RAM.
  *  @param file_size: The total number of bytes held by the emulated eeprom
  *  file. Reads from address 0 .. file_size - 1 will be valid. Must be smaller
  *  than half of one sector, but should be realistically about 35% of the
@@ -142,6 +149,7 @@ protected:
      */
     ~EEPROMEmulation()
     {
+        delete[] index_;
     }
 
     /** Mount the EEPROM file.  Should be called during construction of the
@@ -196,6 +204,17 @@ private:
      */
     static const bool SHADOW_IN_RAM;
 
+    /** Keep an index of the latest journal slot for each block of data in
+     * RAM. This makes reads independent of the journal fill at the expense of
+     * two bytes of RAM per BYTES_PER_BLOCK bytes of data. Ignored when
+     * SHADOW_IN_RAM is set.
+     */
+    static const bool INDEX_IN_RAM;
+
+    /** Entry in index_ for a block of data that has no slot in the active
+     * sector. */
+    static const uint16_t NO_SLOT = 0xFFFF;
+
 protected:
     /** magic marker for an intact block */
     static const uint32_t MAGIC_INTACT;
@@ -237,6 +256,22 @@ private:
      */
     bool read_fblock(unsigned int index, uint8_t data[]);
 
+    /** Decodes the data payload of a slot.
+     * @param address pointer to the slot in flash
+     * @param data location to place the data, array size must be @ref
+     *           BYTES_PER_BLOCK large
+     */
+    void decode_slot(const uint32_t *address, uint8_t data[]);
+
+    /** Fills in index_ by scanning the journal of the active sector. */
+    void build_index();
+
+    /** @return how many BYTES_PER_BLOCK sized blocks the file has. */
+    unsigned fblock_count()
+    {
+        return (file_size() + BYTES_PER_BLOCK - 1) / BYTES_PER_BLOCK;
+    }
+
     /** Get the next active sector pointer.
      * @return sector index for the next sector to use.
      */
@@ -324,6 +359,11 @@ protected:
     /** pointer to RAM for shadowing EEPROM. */
     uint8_t *shadow_{nullptr};
 
+    /** For each block of data (index / BYTES_PER_BLOCK), the raw block index
+     * of the slot in the active sector with the latest data, or NO_SLOT. Null
+     * if the index is not used. */
+    uint16_t *index_{nullptr};
+
 
     /** Default constructor.
      */
@@ -33,6 +33,8 @@
 
 #include "openlcb/AliasCache.hxx"
 
+#include <string.h>
+
 #include "os/OS.hxx"
 
 namespace openlcb
@@ -42,16 +44,39 @@ namespace openlcb
 
 const NodeID AliasCache::RESERVED_ALIAS_NODE_ID = 1;
 
+/** Scrambles the bits of a hash key.
+ * @param key the value to hash
+ * @return hash value; the low bits depend on all bits of key.
+ */
+static inline unsigned hash_mix(uint32_t key)
+{
+    key *= 0x9E3779B1U;
+    return key ^ (key >> 15);
+}
+
+/** Computes the hash of a Node ID. @param id Node ID @return hash value */
+static inline unsigned hash_id(NodeID id)
+{
+    return hash_mix((uint32_t)id ^ (uint32_t)(id >> 24));
+}
+
 void AliasCache::clear()
 {
     idMap.clear();
     aliasMap.clear();
+    if (aliasTable)
+    {
+        memset(aliasTable, 0, (tableMask + 1) * sizeof(aliasTable[0]));
+        memset(idTable, 0, (tableMask + 1) * sizeof(idTable[0]));
+    }
     oldest = nullptr;
     newest = nullptr;
     freeList = nullptr;
     /* initialize the freeList */
     for (size_t i = 0; i < entries; ++i)
     {
+        pool[i].id = 0;
+        pool[i].alias = 0;
         pool[i].prev = NULL;
         pool[i].next = freeList;
         freeList = pool + i;
@@ -67,19 +92,18 @@ void AliasCache::add(NodeID id, NodeAlias alias)
     HASSERT(id != 0);
     HASSERT(alias != 0);
     
-    Metadata *insert;
+    Metadata *insert = find_alias(alias);
 
-    AliasMap::Iterator it = aliasMap.find(alias);
-    if (it != aliasMap.end())
+    if (insert)
     {
         /* we already have a mapping for this alias, so lets remove it */
-        insert = (*it).second;
+        NodeID old_id = insert->id;
         remove(alias);
         
         if (removeCallback)
         {
             /* tell the interface layer that we removed this mapping */
-            (*removeCallback)(insert->id, insert->alias, context);
+            (*removeCallback)(old_id, alias, context);
         }
     }
 
@@ -105,8 +129,7 @@ void AliasCache::add(NodeID id, NodeAlias alias)
         }
         oldest = oldest->newer;
 
-        aliasMap.erase(insert->alias);
-        idMap.erase(insert->id);
+        index_remove(insert);
 
         if (removeCallback)
         {
@@ -118,9 +141,9 @@ void AliasCache::add(NodeID id, NodeAlias alias)
     insert->timestamp = OSTime::get_monotonic();
     insert->id = id;
     insert->alias = alias;
+    insert->verified = true;
 
-    aliasMap[alias] = insert;
-    idMap[id] = insert;
+    index_add(insert);
 
     /* update the time based list */
     insert->newer = NULL;
@@ -150,14 +173,12 @@ void AliasCache::add(NodeID id, NodeAlias alias)
  */
 void AliasCache::remove(NodeAlias alias)
 {
-    AliasMap::Iterator it = aliasMap.find(alias);
+    Metadata *metadata = find_alias(alias);
 
-    if (it != aliasMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        aliasMap.erase(it);
-        idMap.erase(metadata->id);
-        
+        index_remove(metadata);
+
         if (metadata->newer)
         {
             metadata->newer->older = metadata->older;
@@ -175,19 +196,47 @@ void AliasCache::remove(NodeAlias alias)
             oldest = metadata->newer;
         }
     
+        metadata->id = 0;
+        metadata->alias = 0;
         metadata->next = freeList;
         freeList = metadata;
     }
     
 }
 
-bool AliasCache::retrieve(unsigned entry, NodeID* node, NodeAlias* alias)
+void AliasCache::add_unverified(NodeID id, NodeAlias alias, long long timestamp)
+{
+    add(id, alias);
+    newest->verified = false;
+    newest->timestamp = timestamp;
+}
+
+void AliasCache::confirm(NodeAlias alias)
+{
+    Metadata *metadata = find_alias(alias);
+    if (metadata)
+    {
+        metadata->verified = true;
+        touch(metadata);
+    }
+}
+
+bool AliasCache::is_verified(NodeAlias alias)
+{
+    Metadata *metadata = find_alias(alias);
+    return metadata && metadata->verified;
+}
+
+bool AliasCache::retrieve(unsigned entry, NodeID* node, NodeAlias* alias,
+                          long long *timestamp, bool *verified)
 {
     HASSERT(entry < size());
     Metadata* md = pool + entry;
     if (!md->alias) return false;
     if (node) *node = md->id;
     if (alias) *alias = md->alias;
+    if (timestamp) *timestamp = md->timestamp;
+    if (verified) *verified = md->verified;
     return true;
 }
 
@@ -199,12 +248,11 @@ NodeAlias AliasCache::lookup(NodeID id)
 {
     HASSERT(id != 0);
 
-    IdMap::Iterator it = idMap.find(id);
+    Metadata *metadata = find_id(id);
 
-    if (it != idMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        
+
         /* update timestamp */
         touch(metadata);
         return metadata->alias;
@@ -222,12 +270,11 @@ NodeID AliasCache::lookup(NodeAlias alias)
 {
     HASSERT(alias != 0);
 
-    AliasMap::Iterator it = aliasMap.find(alias);
+    Metadata *metadata = find_alias(alias);
 
-    if (it != aliasMap.end())
+    if (metadata)
     {
-        Metadata *metadata = (*it).second;
-        
+
         /* update timestamp */
         touch(metadata);
         return metadata->id;
@@ -277,7 +324,11 @@ NodeAlias AliasCache::generate()
  */
 void AliasCache::touch(Metadata* metadata)
 {
-    metadata->timestamp = OSTime::get_monotonic();
+    if (metadata->verified)
+    {
+        /* unverified entries keep the time they were last seen on the bus */
+        metadata->timestamp = OSTime::get_monotonic();
+    }
 
     if (metadata != newest)
     {
@@ -299,4 +350,148 @@ void AliasCache::touch(Metadata* metadata)
     }
 }
 
+void AliasCache::init_hash_tables()
+{
+    /* slot values are pool index + 1 */
+    HASSERT(entries < 0xFFFF);
+    /* keep the load factor at or below 1/2 */
+    unsigned size = 4;
+    while (size < entries * 2)
+    {
+        size <<= 1;
+    }
+    tableMask = size - 1;
+    aliasTable = new uint16_t[size];
+    idTable = new uint16_t[size];
+}
+
+AliasCache::Metadata *AliasCache::find_alias(NodeAlias alias)
+{
+    if (!aliasTable)
+    {
+        AliasMap::Iterator it = aliasMap.find(alias);
+        return it == aliasMap.end() ? NULL : (*it).second;
+    }
+    for (unsigned i = hash_mix(alias) & tableMask;; i = (i + 1) & tableMask)
+    {
+        uint16_t slot = aliasTable[i];
+        if (slot == EMPTY_SLOT)
+        {
+            return NULL;
+        }
+        if (pool[slot - 1].alias == alias)
+        {
+            return pool + slot - 1;
+        }
+    }
+}
+
+AliasCache::Metadata *AliasCache::find_id(NodeID id)
+{
+    if (!idTable)
+    {
+        IdMap::Iterator it = idMap.find(id);
+        return it == idMap.end() ? NULL : (*it).second;
+    }
+    for (unsigned i = hash_id(id) & tableMask;; i = (i + 1) & tableMask)
+    {
+        uint16_t slot = idTable[i];
+        if (slot == EMPTY_SLOT)
+        {
+            return NULL;
+        }
+        if (pool[slot - 1].id == id)
+        {
+            return pool + slot - 1;
+        }
+    }
+}
+
+void AliasCache::index_add(Metadata *metadata)
+{
+    if (!aliasTable)
+    {
+        aliasMap[metadata->alias] = metadata;
+        idMap[metadata->id] = metadata;
+        return;
+    }
+    uint16_t value = metadata - pool + 1;
+    /* The alias is never in the table at this point. The Node ID might be, in
+     * which case the new entry replaces the old one, like with the Map. */
+    unsigned i = hash_mix(metadata->alias) & tableMask;
+    while (aliasTable[i] != EMPTY_SLOT)
+    {
+        i = (i + 1) & tableMask;
+    }
+    aliasTable[i] = value;
+    for (i = hash_id(metadata->id) & tableMask; idTable[i] != EMPTY_SLOT;
+         i = (i + 1) & tableMask)
+    {
+        if (pool[idTable[i] - 1].id == metadata->id)
+        {
+            break;
+        }
+    }
+    idTable[i] = value;
+}
+
+void AliasCache::index_remove(Metadata *metadata)
+{
+    if (!aliasTable)
+    {
+        aliasMap.erase(metadata->alias);
+        idMap.erase(metadata->id);
+        return;
+    }
+    uint16_t value = metadata - pool + 1;
+    for (unsigned i = hash_mix(metadata->alias) & tableMask;
+         aliasTable[i] != EMPTY_SLOT; i = (i + 1) & tableMask)
+    {
+        if (aliasTable[i] == value)
+        {
+            erase_slot(aliasTable, i);
+            break;
+        }
+    }
+    /* If the Node ID was taken over by a newer entry, the slot points to that
+     * entry and we leave it alone. */
+    for (unsigned i = hash_id(metadata->id) & tableMask;
+         idTable[i] != EMPTY_SLOT; i = (i + 1) & tableMask)
+    {
+        if (idTable[i] == value)
+        {
+            erase_slot(idTable, i);
+            break;
+        }
+    }
+}
+
+unsigned AliasCache::home_slot(const uint16_t *table, uint16_t slot)
+{
+    const Metadata *metadata = pool + slot - 1;
+    if (table == aliasTable)
+    {
+        return hash_mix(metadata->alias) & tableMask;
+    }
+    return hash_id(metadata->id) & tableMask;
+}
+
+void AliasCache::erase_slot(uint16_t *table, unsigned i)
+{
+    /* Backward shift deletion: walk the rest of the cluster and move back
+     * every entry whose probe sequence passes through the hole. */
+    for (unsigned j = (i + 1) & tableMask; table[j] != EMPTY_SLOT;
+         j = (j + 1) & tableMask)
+    {
+        unsigned home = home_slot(table, table[j]);
+        /* distance from the home slot to the hole and to the entry */
+        if (((i - home) & tableMask) < ((j - home) & tableMask))
+        {
+            table[i] = table[j];
+            i = j;
+        }
+    }
+    table[i] = EMPTY_SLOT;
+}
+
 }
@@ -48,6 +48,12 @@ namespace openlcb
  * is no mutual exclusion locking mechanism built into this class.  Mutual
  * exclusion must be handled by the user as needed.
  *
+ * The lookups are served either from a pair of Map instances (the default),
+ * or, if requested at construction, from a pair of open-addressing hash tables
+ * that hold indexes into the metadata pool. The hash tables make lookups O(1)
+ * and are the better choice for caches with hundreds or thousands of entries;
+ * they cost about 8 bytes of RAM per entry.
+ *
  * @todo the class uses RBTree, consider a version that is a linear search for
  * a small number of entries.
  */
@@ -60,14 +66,19 @@ public:
      * @param remove_callback callback to call when we remove a mapping from
      *        the cache however it will not be called in the remove() method
      * @param context context pointer to pass to remove_callback
+     * @param hash_index if true, lookups will use open-addressing hash tables
+     *        instead of the Map instances
      */
     AliasCache(NodeID seed, size_t _entries,
                void (*remove_callback)(NodeID id, NodeAlias alias, void *) = NULL,
-               void *context = NULL)
+               void *context = NULL, bool hash_index = false)
         : pool(new Metadata[_entries]),
           freeList(NULL),
-          aliasMap(_entries),
-          idMap(_entries),
+          aliasMap(hash_index ? 0 : _entries),
+          idMap(hash_index ? 0 : _entries),
+          aliasTable(NULL),
+          idTable(NULL),
+          tableMask(0),
           oldest(NULL),
           newest(NULL),
           seed(seed),
@@ -75,6 +86,10 @@ public:
           removeCallback(remove_callback),
           context(context)
     {
+        if (hash_index)
+        {
+            init_hash_tables();
+        }
         clear();
     }
 
@@ -89,6 +104,29 @@ public:
      * @param alias 12-bit alias associated with Node ID
      */
     void add(NodeID id, NodeAlias alias);
+
+    /** Add a mapping that was not observed on the bus, for example one
+     * restored from a saved snapshot. The entry is used for lookups like any
+     * other, but is_verified() returns false for it until confirm() is
+     * called. Lookups do not update the timestamp of an unverified entry.
+     * @param id 48-bit NMRAnet Node ID to associate alias with
+     * @param alias 12-bit alias associated with Node ID
+     * @param timestamp when the mapping was last seen, in
+     *        OSTime::get_monotonic() units
+     */
+    void add_unverified(NodeID id, NodeAlias alias, long long timestamp);
+
+    /** Marks the mapping of an alias as verified by traffic on the bus.
+     * Does nothing if the alias is not in the cache.
+     * @param alias 12-bit alias to confirm
+     */
+    void confirm(NodeAlias alias);
+
+    /** @param alias 12-bit alias to look for
+     * @return true if the alias is in the cache and its mapping was observed
+     * on the bus (as opposed to being added with add_unverified()). Does not
+     * count as a use of the entry. */
+    bool is_verified(NodeAlias alias);
     
     /** Remove an alias from an alias cache.  This method does not call the
      * remove_callback method passed in at construction since it is a
@@ -127,9 +165,14 @@ public:
      * @param entry is between 0 and size() - 1.
      * @param node will be filled with the node ID. May be null.
      * @param aliad will be filles with the alias. May be null.
+     * @param timestamp will be filled with the time of last usage. May be
+     * null.
+     * @param verified will be filled with whether the mapping was observed on
+     * the bus. May be null.
      * @return true if the entry is valid, and node and alias were filled, otherwise false if the entry is not allocated.
      */
-    bool retrieve(unsigned entry, NodeID* node, NodeAlias* alias);
+    bool retrieve(unsigned entry, NodeID* node, NodeAlias* alias,
+                  long long *timestamp = NULL, bool *verified = NULL);
 
     /** Generate a 12-bit pseudo-random alias for a givin alias cache.
      * @return pseudo-random 12-bit alias, an alias of zero is invalid
@@ -140,6 +183,8 @@ public:
     ~AliasCache()
     {
         delete [] pool;
+        delete [] aliasTable;
+        delete [] idTable;
     }
 
     /** Visible for testing. Check internal consistency. */
@@ -149,7 +194,9 @@ private:
     enum
     {
         /** marks an unused mapping */
-        UNUSED_MASK = 0x10000000
+        UNUSED_MASK = 0x10000000,
+        /** marks an empty slot in the hash tables */
+        EMPTY_SLOT = 0
     };
 
     /** Interesting information about a given cache entry. */
@@ -157,6 +204,7 @@ private:
     {
         NodeID id = 0; /**< 48-bit NMRAnet Node ID */
         NodeAlias alias = 0; /**< NMRAnet alias */
+        bool verified = false; /**< false if added by add_unverified */
         long long timestamp; /**< time stamp of last usage */
         union
         {
@@ -187,6 +235,18 @@ private:
     
     /** Map of Node ID to corresponding Metadata */
     IdMap idMap;
+
+    /** Open-addressing hash table from alias to metadata. Each slot holds
+     * the index of the entry in pool plus one, or EMPTY_SLOT. NULL if the
+     * Map instances are used. */
+    uint16_t *aliasTable;
+
+    /** Open-addressing hash table from Node ID to metadata. Same layout as
+     * aliasTable. */
+    uint16_t *idTable;
+
+    /** Number of slots in the hash tables minus one. */
+    unsigned tableMask;
     
     /** oldest untouched entry */
     Metadata *oldest;
@@ -211,6 +271,45 @@ private:
      */
     void touch(Metadata* metadata);
 
+    /** Allocates the hash tables. */
+    void init_hash_tables();
+
+    /** Looks up the metadata for an alias in the index.
+     * @param alias alias to look for
+     * @return metadata entry, or NULL if not found
+     */
+    Metadata *find_alias(NodeAlias alias);
+
+    /** Looks up the metadata for a Node ID in the index.
+     * @param id Node ID to look for
+     * @return metadata entry, or NULL if not found
+     */
+    Metadata *find_id(NodeID id);
+
+    /** Adds an entry to the index under its alias and Node ID.
+     * @param metadata entry to add
+     */
+    void index_add(Metadata *metadata);
+
+    /** Removes an entry from the index.
+     * @param metadata entry to remove
+     */
+    void index_remove(Metadata *metadata);
+
+    /** Computes the home slot of a hash table entry.
+     * @param table aliasTable or idTable
+     * @param slot value stored in the table
+     * @return index of the slot where the probe sequence starts
+     */
+    unsigned home_slot(const uint16_t *table, uint16_t slot);
+
+    /** Removes a slot from a hash table, moving back the entries of the probe
+     * sequence as needed.
+     * @param table aliasTable or idTable
+     * @param i index of the slot to clear
+     */
+    void erase_slot(uint16_t *table, unsigned i);
+
     DISALLOW_COPY_AND_ASSIGN(AliasCache);
 };
 
@@ -0,0 +1,283 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AliasCacheSnapshot.cxx
+ *
+ * Saves the remote alias cache of a CAN interface to a file and restores it
+ * at startup.
+ *
+ * @author agent
+ * @date 17 Oct 2026
+ */
+
+#include "openlcb/AliasCacheSnapshot.hxx"
+
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "openlcb/IfCan.hxx"
+#include "os/OS.hxx"
+#include "utils/logging.h"
+
+namespace openlcb
+{
+
+/// Identifies a snapshot file. Also catches files from hosts with different
+/// endianness.
+static const uint32_t SNAPSHOT_MAGIC = 0x4f4c4143;
+
+/// Header of the snapshot file.
+struct SnapshotHeader
+{
+    /// SNAPSHOT_MAGIC
+    uint32_t magic;
+    /// Number of SnapshotEntry structures following the header.
+    uint32_t count;
+};
+
+/// One mapping in the snapshot file.
+struct SnapshotEntry
+{
+    /// Node ID of the mapping.
+    uint64_t id;
+    /// Wall clock time (seconds since the epoch) when the mapping was last
+    /// seen.
+    int64_t lastSeen;
+    /// Alias of the mapping.
+    uint16_t alias;
+    /// 1 if the mapping was verified on the bus when it was saved.
+    uint16_t verified;
+    /// Padding, always zero.
+    uint32_t reserved;
+};
+
+AliasCacheSnapshot::AliasCacheSnapshot(IfCan *iface, const char *path,
+    long long period_nsec, unsigned max_age_sec, ExecutorBase *io_executor)
+    : StateFlowBase(iface)
+    , iface_(iface)
+    , path_(path)
+    , period_(period_nsec)
+    , maxAge_(max_age_sec)
+    , ioExecutor_(io_executor)
+{
+    if (!ioExecutor_)
+    {
+        ownExecutor_.reset(new Executor<1>("alias_snapshot", 0, 2048));
+        ioExecutor_ = ownExecutor_.get();
+    }
+    start_flow(STATE(wait_for_timer));
+}
+
+AliasCacheSnapshot::~AliasCacheSnapshot()
+{
+    // The queued writes do not reference *this. If we own the IO executor,
+    // destroying it waits for them to finish.
+    timer_.cancel();
+}
+
+int AliasCacheSnapshot::load()
+{
+    return load(iface_->remote_aliases(), path_.c_str(), maxAge_);
+}
+
+int AliasCacheSnapshot::save()
+{
+    std::vector<SnapshotEntry> entries;
+    collect(iface_->remote_aliases(), &entries);
+    int count = entries.size();
+    std::string path = path_;
+    ioExecutor_->add(new CallbackExecutable(
+        [entries, path]() { write_file(entries, path.c_str()); }));
+    return count;
+}
+
+void AliasCacheSnapshot::flush()
+{
+    ioExecutor_->sync_run([]() {});
+}
+
+void AliasCacheSnapshot::shutdown()
+{
+    shutdown_ = true;
+    timer_.ensure_triggered();
+}
+
+StateFlowBase::Action AliasCacheSnapshot::wait_for_timer()
+{
+    if (shutdown_)
+    {
+        return call_immediately(STATE(timer_done));
+    }
+    // With no period we only wake up for shutdown.
+    return sleep_and_call(&timer_, period_ ? period_ : SEC_TO_NSEC(3600),
+        period_ ? STATE(timer_done) : STATE(wait_for_timer));
+}
+
+StateFlowBase::Action AliasCacheSnapshot::timer_done()
+{
+    save();
+    if (shutdown_)
+    {
+        return exit();
+    }
+    return call_immediately(STATE(wait_for_timer));
+}
+
+int AliasCacheSnapshot::save(AliasCache *cache, const char *path)
+{
+    std::vector<SnapshotEntry> entries;
+    collect(cache, &entries);
+    return write_file(entries, path);
+}
+
+void AliasCacheSnapshot::collect(
+    AliasCache *cache, std::vector<SnapshotEntry> *entries)
+{
+    long long now = OSTime::get_monotonic();
+    int64_t wall = time(nullptr);
+    for (unsigned i = 0; i < cache->size(); ++i)
+    {
+        SnapshotEntry e;
+        NodeAlias alias;
+        long long timestamp;
+        bool verified;
+        if (!cache->retrieve(i, &e.id, &alias, &timestamp, &verified) ||
+            alias == NOT_RESPONDING ||
+            e.id == AliasCache::RESERVED_ALIAS_NODE_ID)
+        {
+            continue;
+        }
+        e.alias = alias;
+        e.verified = verified ? 1 : 0;
+        e.reserved = 0;
+        e.lastSeen = wall - (now - timestamp) / 1000000000LL;
+        entries->push_back(e);
+    }
+}
+
+int AliasCacheSnapshot::write_file(
+    const std::vector<SnapshotEntry> &entries, const char *path)
+{
+    std::string tmp(path);
+    tmp += ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f)
+    {
+        LOG(WARNING, "Could not open alias cache snapshot %s: %s",
+            tmp.c_str(), strerror(errno));
+        return -1;
+    }
+    SnapshotHeader hdr;
+    hdr.magic = SNAPSHOT_MAGIC;
+    hdr.count = entries.size();
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    if (ok && !entries.empty())
+    {
+        ok = fwrite(entries.data(), sizeof(entries[0]), entries.size(), f) ==
+            entries.size();
+    }
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp.c_str(), path) != 0)
+    {
+        LOG(WARNING, "Could not write alias cache snapshot %s: %s", path,
+            strerror(errno));
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return entries.size();
+}
+
+int AliasCacheSnapshot::load(
+    AliasCache *cache, const char *path, unsigned max_age_sec)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        return -1;
+    }
+    SnapshotHeader hdr;
+    std::vector<SnapshotEntry> entries;
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+        hdr.magic == SNAPSHOT_MAGIC && hdr.count <= 0x10000;
+    if (ok)
+    {
+        entries.resize(hdr.count);
+        ok = fread(entries.data(), sizeof(entries[0]), entries.size(), f) ==
+            entries.size();
+        char c;
+        // There should be nothing after the last entry.
+        ok = ok && fread(&c, 1, 1, f) == 0;
+    }
+    fclose(f);
+    if (!ok)
+    {
+        LOG(WARNING, "Invalid alias cache snapshot %s", path);
+        return -1;
+    }
+
+    long long now = OSTime::get_monotonic();
+    int64_t wall = time(nullptr);
+    // Drops invalid and expired entries.
+    auto it = std::remove_if(entries.begin(), entries.end(),
+        [wall, max_age_sec](const SnapshotEntry &e) {
+            return e.id == 0 || e.id > 0xFFFFFFFFFFFFULL || e.alias == 0 ||
+                e.alias > 0xFFF || wall - e.lastSeen > (int64_t)max_age_sec;
+        });
+    entries.erase(it, entries.end());
+    // Adding the entries from the oldest to the newest recreates the LRU
+    // order. If there are more entries than the cache can hold, the oldest
+    // ones are skipped.
+    std::sort(entries.begin(), entries.end(),
+        [](const SnapshotEntry &a, const SnapshotEntry &b) {
+            return a.lastSeen < b.lastSeen;
+        });
+    size_t first = 0;
+    if (entries.size() > cache->size())
+    {
+        first = entries.size() - cache->size();
+    }
+    int count = 0;
+    for (size_t i = first; i < entries.size(); ++i)
+    {
+        const SnapshotEntry &e = entries[i];
+        if (cache->lookup((NodeAlias)e.alias) || cache->lookup((NodeID)e.id))
+        {
+            // Never override something we already learned from the bus.
+            continue;
+        }
+        int64_t age = std::max(wall - e.lastSeen, (int64_t)0);
+        cache->add_unverified(e.id, e.alias, now - SEC_TO_NSEC(age));
+        ++count;
+    }
+    return count;
+}
+
+} // namespace openlcb
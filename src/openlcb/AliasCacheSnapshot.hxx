@@ -0,0 +1,161 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file AliasCacheSnapshot.hxx
+ *
+ * Saves the remote alias cache of a CAN interface to a file and restores it
+ * at startup.
+ *
+ * @author agent
+ * @date 17 Oct 2026
+ */
+
+#ifndef _OPENLCB_ALIASCACHESNAPSHOT_HXX_
+#define _OPENLCB_ALIASCACHESNAPSHOT_HXX_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "executor/StateFlow.hxx"
+#include "openlcb/AliasCache.hxx"
+
+namespace openlcb
+{
+
+class IfCan;
+struct SnapshotEntry;
+
+/// Keeps a file copy of the remote alias cache of an IfCan, so that a node
+/// with many remote nodes to talk to (e.g. a gateway) does not need to look
+/// up every alias again on the bus after a restart.
+///
+/// The snapshot is written periodically and at shutdown. The file stores the
+/// node ID, the alias and the (wall clock) time the mapping was last used.
+/// Upon load, the mappings are added to the cache as unverified (see
+/// AliasCache::add_unverified()); they become verified when an alias mapping
+/// definition or a verified node ID message from the bus confirms them, and
+/// are replaced when the bus contradicts them. Entries that were not
+/// confirmed or used for longer than the maximum age are dropped at load.
+///
+/// The cache is copied on the interface's executor, but the file is written
+/// on a separate executor, so that the interface is not blocked by the disk.
+class AliasCacheSnapshot : public StateFlowBase
+{
+public:
+    /// Constructor. Does not load the snapshot; call load() for that.
+    ///
+    /// @param iface is the interface whose remote alias cache to save.
+    /// @param path is the file name to save the snapshot to.
+    /// @param period_nsec how often to save the snapshot. 0 to save only
+    /// upon explicit calls to save() or shutdown().
+    /// @param max_age_sec entries that were not seen for this long will not
+    /// be restored.
+    /// @param io_executor is where the file is written. If nullptr, a
+    /// dedicated thread is started for that.
+    AliasCacheSnapshot(IfCan *iface, const char *path,
+        long long period_nsec = SEC_TO_NSEC(60),
+        unsigned max_age_sec = 24 * 3600, ExecutorBase *io_executor = nullptr);
+
+    /// Destructor. Must be called on the interface's executor. Stops the
+    /// periodic saving; snapshots already queued will still be written.
+    ~AliasCacheSnapshot();
+
+    /// Restores the snapshot file into the remote alias cache. Must be called
+    /// on the interface's executor, preferably before the interface starts
+    /// processing traffic.
+    /// @return the number of entries restored, or -1 if the file could not be
+    /// read or is invalid.
+    int load();
+
+    /// Copies the cache and queues writing the snapshot file. Must be called
+    /// on the interface's executor.
+    /// @return the number of entries queued for saving.
+    int save();
+
+    /// Blocks until all queued snapshots are written to the file. Must not be
+    /// called on the IO executor.
+    void flush();
+
+    /// Stops the periodic saving after writing the snapshot one last time.
+    /// Must be called on the interface's executor.
+    void shutdown();
+
+    /// Writes the contents of an alias cache to a file. The file is replaced
+    /// atomically.
+    /// @param cache is the alias cache to save.
+    /// @param path is the file to write.
+    /// @return the number of entries saved, or -1 on error.
+    static int save(AliasCache *cache, const char *path);
+
+    /// Adds the entries from a snapshot file to an alias cache as unverified
+    /// entries.
+    /// @param cache is the alias cache to fill.
+    /// @param path is the file to read.
+    /// @param max_age_sec entries that were last seen longer ago will be
+    /// skipped.
+    /// @return the number of entries restored, or -1 on error.
+    static int load(AliasCache *cache, const char *path, unsigned max_age_sec);
+
+private:
+    /// Copies the entries of an alias cache that are worth saving.
+    /// @param cache is the alias cache to save.
+    /// @param entries will be filled in.
+    static void collect(AliasCache *cache, std::vector<SnapshotEntry> *entries);
+
+    /// Writes a snapshot file. The file is replaced atomically.
+    /// @param entries is what to write.
+    /// @param path is the file to write.
+    /// @return the number of entries saved, or -1 on error.
+    static int write_file(
+        const std::vector<SnapshotEntry> &entries, const char *path);
+
+    /// Waits for the next time to save. @return next state.
+    Action wait_for_timer();
+    /// Saves the snapshot after the timer expired. @return next state.
+    Action timer_done();
+
+    /// Interface whose remote cache we are saving.
+    IfCan *iface_;
+    /// Snapshot file name.
+    std::string path_;
+    /// How often to save.
+    long long period_;
+    /// Maximum age of entries to restore in seconds.
+    unsigned maxAge_;
+    /// true when shutdown() was called.
+    bool shutdown_{false};
+    /// Executor created for writing the file if the caller did not give one.
+    std::unique_ptr<ExecutorBase> ownExecutor_;
+    /// Where the file is written.
+    ExecutorBase *ioExecutor_;
+    /// Helper for periodic saving.
+    StateFlowTimer timer_{this};
+};
+
+} // namespace openlcb
+
+#endif // _OPENLCB_ALIASCACHESNAPSHOT_HXX_
@@ -37,12 +37,12 @@
 
 #include "openlcb/DatagramDefs.hxx"
 #include "openlcb/FirmwareUpgradeDefs.hxx"
-#include "openlcb/StreamDefs.hxx"
 #include "openlcb/PIPClient.hxx"
-#include "openlcb/CanDefs.hxx"
 #include "openlcb/MemoryConfig.hxx"
 #include "openlcb/IfCan.hxx"
+#include "openlcb/StreamCan.hxx"
 #include "utils/Ewma.hxx"
+#include "utils/StringPrintf.hxx"
 
 namespace openlcb
 {
@@ -93,8 +93,8 @@ int g_bootloader_timeout_sec = 3;
 /// 1) allocates a datagram handler
 /// 2) sends a stream write request datagram to the target node
 /// 3) waits for the write stream response
-/// 4) sends the data using a manual implementaiton of the stream protocol
-/// (stream initiate; data send; wait for proceeds; stream close)
+/// 4) sends the data using a StreamSender (stream initiate; data send; wait
+/// for proceeds; stream close)
 /// 5) reboots the target node.
 ///
 /// This stateflow needs to get one message of type BootloaderRequest to
@@ -102,13 +102,30 @@ int g_bootloader_timeout_sec = 3;
 class BootloaderClient : public StateFlow<Buffer<BootloaderRequest>, QList<1>>
 {
 public:
-    BootloaderClient(
-        Node *node, DatagramService *if_datagram_service, IfCan *if_can)
+    /// Constructor.
+    /// @param node is the local node to send the firmware from.
+    /// @param if_datagram_service is the datagram service of the interface.
+    /// @param if_can is the CAN interface.
+    /// @param stream_service is the stream service to send the firmware data
+    /// with. Applications that already have a StreamService on if_can must
+    /// pass it here. If null, a private stream service with a single sender
+    /// is created on if_can, using the highest valid stream ID so that it
+    /// does not collide with the IDs of a StreamService created with the
+    /// default ID range.
+    BootloaderClient(Node *node, DatagramService *if_datagram_service,
+        IfCan *if_can, StreamService *stream_service = nullptr)
         : StateFlow<Buffer<BootloaderRequest>, QList<1>>(node->iface())
         , node_(node)
         , datagramService_(if_datagram_service)
         , ifCan_(if_can)
+        , streamService_(stream_service)
     {
+        if (!streamService_)
+        {
+            ownedStreamService_.reset(new CanStreamService(
+                if_can, 1, 0, StreamDefs::INVALID_STREAM_ID - 1));
+            streamService_ = ownedStreamService_.get();
+        }
     }
 
     Action entry() override
@@ -213,6 +230,14 @@ private:
 
     Action bootload_using_stream()
     {
+        return allocate_and_call(
+            STATE(got_stream_sender), streamService_->sender_allocator());
+    }
+
+    Action got_stream_sender()
+    {
+        streamSender_ =
+            full_allocation_result(streamService_->sender_allocator());
         Buffer<GenMessage> *b;
         mainBufferPool->alloc(&b);
         DatagramPayload payload;
@@ -223,8 +248,7 @@ private:
         payload.push_back(message()->data()->offset >> 8);
         payload.push_back(message()->data()->offset);
         payload.push_back(message()->data()->memory_space);
-        localStreamId_ = allocate_local_stream_id();
-        payload.push_back(localStreamId_);
+        payload.push_back(streamSender_->local_stream_id());
         b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(),
             message()->data()->dst, payload);
         b->set_done(n_.reset(this));
@@ -344,8 +368,8 @@ private:
             error_code =
                 (payload[error_ofs] << 8) | ((uint8_t)payload[error_ofs + 1]);
             error_ofs += 2;
-            return return_error(
-                error_code, "Write rejected " + payload.substr(error_ofs));
+            return return_error(error_code,
+                "Write rejected " + string(payload.substr(error_ofs)));
         }
         else if ((payload[1] & 0xFC) ==
             MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY)
@@ -363,11 +387,6 @@ private:
         }
     }
 
-    uint8_t allocate_local_stream_id()
-    {
-        return 0x55;
-    }
-
     Action return_error(uint16_t error_code, const string &error_details)
     {
         unregister_write_response_handler();
@@ -378,9 +397,19 @@ private:
             responseDatagram_->unref();
             responseDatagram_ = nullptr;
         }
+        release_stream_sender();
         return release_and_exit();
     }
 
+    void release_stream_sender()
+    {
+        if (streamSender_)
+        {
+            streamService_->sender_allocator()->typed_insert(streamSender_);
+            streamSender_ = nullptr;
+        }
+    }
+
     void register_write_response_handler()
     {
         datagramService_->registry()->insert(
@@ -400,233 +429,74 @@ private:
 
     Action initiate_stream()
     {
-        return allocate_and_call(
-            node_->iface()->addressed_message_write_flow(),
-            STATE(send_init_stream));
-    }
-
-    Action send_init_stream()
-    {
-        auto *b = get_allocation_result(
-            node_->iface()->addressed_message_write_flow());
-        b->data()->reset(Defs::MTI_STREAM_INITIATE_REQUEST, node_->node_id(),
-            message()->data()->dst,
-            StreamDefs::create_initiate_request(
-                             StreamDefs::MAX_PAYLOAD, false, localStreamId_));
-        node_->iface()->addressed_message_write_flow()->send(b);
-        sleeping_ = true;
-        node_->iface()->dispatcher()->register_handler(
-            &streamInitiateReplyHandler_, Defs::MTI_STREAM_INITIATE_REPLY,
-            Defs::MTI_EXACT);
-        return sleep_and_call(&timer_, SEC_TO_NSEC(g_bootloader_timeout_sec),
-            STATE(received_init_stream));
-    }
-
-    void stream_initiate_replied(Buffer<GenMessage> *message)
-    {
-        if (message->data()->dstNode != node_ ||
-            !node_->iface()->matching_node(dst(), message->data()->src))
-        {
-            // Not for me.
-            return message->unref();
-        }
-        const auto &payload = message->data()->payload;
-        if (payload.size() < 6 || payload[4] != localStreamId_)
-        {
-            // Talking about another stream or incorrect data.
-            return message->unref();
-        }
-        remoteStreamId_ = payload[5];
-        streamFlags_ = payload[2];
-        streamAdditionalFlags_ = payload[3];
-        maxBufferSize_ = (payload[0] << 8) | payload[1];
-        // We save the remote alias here if we haven't got any yet.
-        if (message->data()->src.alias)
-        {
-            this->message()->data()->dst.alias = message->data()->src.alias;
-        }
-        message->unref();
-        timer_.trigger();
-    }
-
-    Action received_init_stream()
-    {
-        sleeping_ = false;
-        node_->iface()->dispatcher()->unregister_handler(
-            &streamInitiateReplyHandler_, Defs::MTI_STREAM_INITIATE_REPLY,
-            Defs::MTI_EXACT);
-        if (!(streamFlags_ & StreamDefs::FLAG_ACCEPT))
-        {
-            if (streamFlags_ & StreamDefs::FLAG_PERMANENT_ERROR)
-            {
-                return return_error(
-                    DatagramDefs::PERMANENT_ERROR | streamAdditionalFlags_,
-                    "Stream initiate request was denied (permanent error).");
-            }
-            else
-            {
-                return return_error(
-                    Defs::ERROR_TEMPORARY | streamAdditionalFlags_,
-                    "Stream initiate request was denied (temporary error).");
-            }
-        }
-        if (!maxBufferSize_)
-        {
-            return return_error(DatagramDefs::PERMANENT_ERROR,
-                "Inconsistency: zero buffer length but "
-                "accepted stream request.");
-        }
-        availableBufferSize_ = maxBufferSize_;
-        bufferOffset_ = 0;
-        speed_ = 0;
-        lastMeasurementOffset_ = 0;
-        lastMeasurementTimeNsec_ = os_get_time_monotonic();
-        node_->iface()->dispatcher()->register_handler(
-            &streamProceedHandler_, Defs::MTI_STREAM_PROCEED, Defs::MTI_EXACT);
-        return call_immediately(STATE(send_stream_data));
+        return invoke_subflow_and_wait(streamSender_, STATE(stream_opened),
+            StreamSendRequest::OPEN, node_, message()->data()->dst,
+            uint16_t(StreamDefs::MAX_PAYLOAD),
+            SEC_TO_NSEC(g_bootloader_timeout_sec));
     }
 
-    Action send_stream_data()
+    Action stream_opened()
     {
-        if (bufferOffset_ >= message()->data()->data.size())
-        {
-            return call_immediately(STATE(close_stream));
-        }
-        return allocate_and_call(
-            ifCan_->frame_write_flow(), STATE(fill_outgoing_stream_frame));
-    }
-
-    Action fill_outgoing_stream_frame()
-    {
-        auto *b = get_allocation_result(ifCan_->frame_write_flow());
-        uint32_t can_id;
-        NodeAlias local_alias =
-            ifCan_->local_aliases()->lookup(node()->node_id());
-        NodeAlias remote_alias = dst().alias;
-        CanDefs::set_datagram_fields(
-            &can_id, local_alias, remote_alias, CanDefs::STREAM_DATA);
-        auto *frame = b->data()->mutable_frame();
-        SET_CAN_FRAME_ID_EFF(*frame, can_id);
-        size_t len =
-            std::min(size_t(7), message()->data()->data.size() - bufferOffset_);
-        if (availableBufferSize_ < len)
-        {
-            len = availableBufferSize_;
-        }
-        frame->can_dlc = len + 1;
-        frame->data[0] = remoteStreamId_;
-        memcpy(&frame->data[1], &message()->data()->data[bufferOffset_], len);
-        bufferOffset_ += len;
-        availableBufferSize_ -= len;
-        // LOG(INFO, "available buffer: %d", availableBufferSize_);
-        b->set_done(n_.reset(this));
-        ifCan_->frame_write_flow()->send(b);
-
-        if (availableBufferSize_)
+        auto b = get_buffer_deleter(full_allocation_result(streamSender_));
+        int error = b->data()->resultCode;
+        if (error == Defs::OPENMRN_TIMEOUT)
         {
-            return wait_and_call(STATE(send_stream_data));
+            return return_error(Defs::ERROR_TEMPORARY,
+                "Timed out waiting for stream initiate reply.");
         }
-        else
+        if (error & Defs::ERROR_PERMANENT)
         {
-            return wait_and_call(STATE(wait_for_stream_proceed));
+            return return_error(error,
+                "Stream initiate request was denied (permanent error).");
         }
-    }
-
-    Action wait_for_stream_proceed()
-    {
-        if (availableBufferSize_)
+        if (error)
         {
-            // received early stream_proceed response
-            return call_immediately(STATE(stream_proceed_timeout));
+            return return_error(error,
+                "Stream initiate request was denied (temporary error).");
         }
-        sleeping_ = true;
-        sleepStartTimeNsec_ = os_get_time_monotonic();
-        return sleep_and_call(&timer_, SEC_TO_NSEC(g_bootloader_timeout_sec),
-            STATE(stream_proceed_timeout));
+        speedAvg_ = Ewma();
+        return invoke_subflow_and_wait(streamSender_, STATE(stream_written),
+            StreamSendRequest::WRITE, message()->data()->data,
+            [this](size_t ofs) { stream_progress(ofs); });
     }
 
-    void stream_proceed_received(Buffer<GenMessage> *message)
+    /// Called by the stream sender upon every stream proceed message.
+    /// @param ofs is the number of bytes sent so far.
+    void stream_progress(size_t ofs)
     {
-        if (message->data()->dstNode != node_ ||
-            !node_->iface()->matching_node(dst(), message->data()->src))
-        {
-            // Not for me.
-            return message->unref();
-        }
-        size_t bytes_sent = bufferOffset_ - lastMeasurementOffset_;
-        long long next_time = os_get_time_monotonic();
-        float new_speed = next_time - lastMeasurementTimeNsec_;
-        new_speed = float(bytes_sent) * 1e9 / new_speed;
-        if (!lastMeasurementOffset_)
-        {
-            speed_ = new_speed;
-        }
-        else
-        {
-            speed_ = speed_ * 0.8 + new_speed * 0.2;
-        }
-        struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
+        speedAvg_.add_absolute(ofs);
+        LOG(INFO, "stream offset: %" PRIdPTR "; speed=%.0f bytes/sec", ofs,
+            speedAvg_.avg());
         if (request()->progress_callback)
         {
-            float ofs = bufferOffset_;
-            ofs /= request()->data.size();
-            request()->progress_callback(ofs);
-        }
-        LOG(INFO,
-            "%02ld.%06ld stream offset: %" PRIdPTR "; wrote %.0lld usec slept "
-            "%.0lld usec, speed=%.0f bytes/sec",
-            ts.tv_sec % 60, ts.tv_nsec / 1000, bufferOffset_,
-            (sleepStartTimeNsec_ - lastMeasurementTimeNsec_) / 1000,
-            (next_time - sleepStartTimeNsec_) / 1000, speed_);
-        lastMeasurementOffset_ = bufferOffset_;
-        lastMeasurementTimeNsec_ = next_time;
-
-        const auto &payload = message->data()->payload;
-        if (payload.size() < 2 || payload[0] != localStreamId_)
-        {
-            // Talking about another stream or incorrect data.
-            return message->unref();
-        }
-        availableBufferSize_ += maxBufferSize_;
-        message->unref();
-        if (sleeping_)
-        {
-            timer_.trigger();
+            float f = ofs;
+            f /= request()->data.size();
+            request()->progress_callback(f);
         }
     }
 
-    Action stream_proceed_timeout()
+    Action stream_written()
     {
-        sleeping_ = false;
-        if (!availableBufferSize_) // no proceed arrived
+        auto b = get_buffer_deleter(full_allocation_result(streamSender_));
+        int error = b->data()->resultCode;
+        if (error == Defs::OPENMRN_TIMEOUT)
         {
-            ///@TODO(balazs.racz) somehow merge these two actions: remember
-            /// that we timed out and close the stream.
             return return_error(Defs::ERROR_TEMPORARY,
-                "Times out waiting for stream proceed message.");
-            return call_immediately(STATE(close_stream));
+                "Timed out waiting for stream proceed message.");
         }
-        return call_immediately(STATE(send_stream_data));
-    }
-
-    Action close_stream()
-    {
-        node_->iface()->dispatcher()->unregister_handler(
-            &streamProceedHandler_, Defs::MTI_STREAM_PROCEED, Defs::MTI_EXACT);
-        return allocate_and_call(
-            node_->iface()->addressed_message_write_flow(),
-            STATE(send_close_stream));
+        if (error)
+        {
+            return return_error(error & 0xffff,
+                StringPrintf("Stream write failed with error 0x%x.", error));
+        }
+        return invoke_subflow_and_wait(
+            streamSender_, STATE(stream_closed), StreamSendRequest::CLOSE);
     }
 
-    Action send_close_stream()
+    Action stream_closed()
     {
-        auto *b = get_allocation_result(
-            node_->iface()->addressed_message_write_flow());
-        b->data()->reset(Defs::MTI_STREAM_COMPLETE, node_->node_id(),
-            message()->data()->dst,
-            StreamDefs::create_close_request(localStreamId_, remoteStreamId_));
-        node_->iface()->addressed_message_write_flow()->send(b);
+        full_allocation_result(streamSender_)->unref();
+        release_stream_sender();
         // wait some time before sending the reset command.
         return sleep_and_call(
             &timer_, MSEC_TO_NSEC(200), STATE(send_reboot_request));
@@ -771,38 +641,19 @@ private:
     IfCan *ifCan_;
     DatagramClient *dgClient_ = nullptr;
     Buffer<IncomingDatagram> *responseDatagram_ = nullptr;
-    uint8_t localStreamId_;
-    uint8_t remoteStreamId_;
-    // maximum size of pending stream data.
-    uint16_t maxBufferSize_;
-    // Flags from the stream initiate response.
-    uint8_t streamFlags_;
-    // Additional flags from the initiate response.
-    uint8_t streamAdditionalFlags_;
-
-    // How many bytes can we send before needing to wait for stream data
-    // proceed message.
-    uint32_t availableBufferSize_;
+    // Sends the firmware data.
+    StreamService *streamService_;
+    // Owns the stream service if the caller did not supply one.
+    std::unique_ptr<CanStreamService> ownedStreamService_;
+    // Stream sender allocated while a stream write is in progress.
+    StreamSender *streamSender_ = nullptr;
     // The next byte we need to send from the input data.
     size_t bufferOffset_;
 
     Ewma speedAvg_;
-    // The Average speed (ewma) in bytes/second.
-    float speed_;
-    // The offset at which the last speed measurement took place.
-    size_t lastMeasurementOffset_;
-    // The time in nsec at which the last speed measurement took place.
-    long long lastMeasurementTimeNsec_;
-    // Snapshots the time at which we start to sleep to wait for a stream
-    // proceed flag.
-    long long sleepStartTimeNsec_;
 
     WriteResponseHandler writeResponseHandler_{this};
     bool writeResponseRegistered_ = false;
-    MessageHandler::GenericHandler streamInitiateReplyHandler_{
-        this, &BootloaderClient::stream_initiate_replied};
-    MessageHandler::GenericHandler streamProceedHandler_{
-        this, &BootloaderClient::stream_proceed_received};
     StateFlowTimer timer_{this};
     // true if we are waiting for a timeout, false if we haven't started
     // sleeping yet.
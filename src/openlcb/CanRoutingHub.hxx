@@ -36,6 +36,9 @@
 #ifndef _OPENLCB_CANROUTNGHUB_HXX_
 #define _OPENLCB_CANROUTNGHUB_HXX_
 
+#include <memory>
+#include <vector>
+
 #include "openlcb/RoutingLogic.hxx"
 #include "openlcb/CanDefs.hxx"
 #include "openlcb/Defs.hxx"
@@ -52,6 +55,11 @@ namespace openlcb
    GridConnect protocol, performs routing decisions on the frames and sends out
    to the appropriate ports.
 
+   By default the outgoing frames are handed to the ports one by one from the
+   routing flow. After enable_sharded_delivery() each port gets a bounded
+   queue serviced by one of a set of executors (threads), so a slow port only
+   delays the ports that share its executor.
+
    TODO: need to process consumer and producer identified messages.
    TODO: need to exclude CHECK ID frames from the source address learning.
  */
@@ -67,6 +75,72 @@ public:
     {
     }
 
+    /// What to do with an outgoing frame when the port's delivery queue is
+    /// full (sharded delivery mode only). Set for each port in
+    /// register_port().
+    enum QueueFullPolicy
+    {
+        /// Drops the frame for this port and continues with the next port.
+        DROP_FRAME,
+        /// Stops routing until the port's queue has space. This applies
+        /// backpressure to all ports.
+        WAIT_FOR_SPACE
+    };
+
+    /// Statistics about the delivery queue of a port.
+    struct PortQueueStats
+    {
+        /// Number of frames currently queued or being delivered.
+        unsigned depth;
+        /// Highest value of depth seen.
+        unsigned maxDepth;
+        /// Number of frames handed to the port.
+        unsigned delivered;
+        /// Number of frames dropped due to the queue being full.
+        unsigned dropped;
+    };
+
+    /** Switches the hub to sharded delivery mode. Frames are classified and
+     * routed once, then put into a per-port queue; each queue is serviced by
+     * one of the given executors, which sends the frames to the port. Ports
+     * are assigned to the executors round-robin. Must be called before any
+     * port is registered.
+     *
+     * @param executors are the threads that deliver the frames to the ports.
+     * @param queue_limit is the maximum number of frames queued for a
+     * port. */
+    void enable_sharded_delivery(
+        std::vector<ExecutorBase *> executors, unsigned queue_limit = 32)
+    {
+        OSMutexLock l(&lock_);
+        HASSERT(ports_.empty());
+        HASSERT(!executors.empty());
+        HASSERT(queue_limit > 0);
+        for (ExecutorBase *e : executors)
+        {
+            shardServices_.emplace_back(new Service(e));
+        }
+        queueLimit_ = queue_limit;
+    }
+
+    /** Retrieves the delivery queue statistics of a port. Works only in
+     * sharded delivery mode.
+     *
+     * @param port is the port to query.
+     * @param stats will be filled with the statistics.
+     * @return false if the port is not known or not in sharded mode. */
+    bool get_port_stats(HubPortInterface *port, PortQueueStats *stats)
+    {
+        OSMutexLock l(&lock_);
+        auto it = ports_.find(port);
+        if (it == ports_.end() || !it->second.sender_)
+        {
+            return false;
+        }
+        it->second.sender_->get_stats(stats);
+        return true;
+    }
+
     void send(Buffer<HubData> *b, unsigned priority = UINT_MAX) override
     {
         OSMutexLock l(&lock_);
@@ -81,17 +155,24 @@ public:
             return;
         }
         const string &p = *b->data();
-        for (unsigned i = 0; i < p.size(); ++i)
+        const char *data = p.data();
+        size_t len = p.size();
+        static constexpr unsigned BATCH = 16;
+        struct can_frame frames[BATCH];
+        while (len)
         {
-            if (it->second.segmenter_.consume_byte(p[i]))
+            size_t consumed;
+            unsigned n = it->second.segmenter_.consume_buffer(
+                data, len, frames, BATCH, &consumed);
+            data += consumed;
+            len -= consumed;
+            for (unsigned i = 0; i < n; ++i)
             {
                 // We have a frame.
-                string ret;
-                it->second.segmenter_.frame_buffer(&ret);
-                LOG(VERBOSE, "sending frame: %s", ret.c_str());
+                LOG(VERBOSE, "sending frame: %08" PRIx32,
+                    GET_CAN_FRAME_ID_EFF(frames[i]));
                 auto *cb = deliveryFlow_.alloc();
-                HASSERT(it->second.segmenter_.parse_frame_to_output(
-                    cb->data()->mutable_frame()));
+                *cb->data()->mutable_frame() = frames[i];
                 cb->data()->skipMember_ = reinterpret_cast<
                     FlowInterface<Buffer<HubContainer<CanFrameContainer>>> *>(
                     b->data()->skipMember_);
@@ -109,29 +190,299 @@ public:
         return &deliveryFlow_;
     }
 
-    void register_port(HubPortInterface *port)
+    /** Adds a port to the hub.
+     *
+     * @param port is the port to send the outgoing frames to.
+     * @param policy tells what to do with a frame when the port's delivery
+     * queue is full. Used only in sharded delivery mode. */
+    void register_port(
+        HubPortInterface *port, QueueFullPolicy policy = DROP_FRAME)
     {
         OSMutexLock l(&lock_);
         HASSERT(port);
-        ports_[port].hubPort_ = port;
+        PortParser &pp = ports_[port];
+        pp.hubPort_ = port;
+        pp.policy_ = policy;
+        if (!shardServices_.empty() && !pp.sender_)
+        {
+            pp.sender_ = alloc_sender(port);
+        }
     }
 
     void unregister_port(HubPortInterface *port)
     {
-        OSMutexLock l(&lock_);
-        auto it = ports_.find(port);
-        if (it == ports_.end())
+        PortSender *sender;
         {
-            LOG(INFO, "Trying to remove a nonexistant port: %p", port);
-            return;
+            OSMutexLock l(&lock_);
+            auto it = ports_.find(port);
+            if (it == ports_.end())
+            {
+                LOG(INFO, "Trying to remove a nonexistant port: %p", port);
+                return;
+            }
+            it->second.inactive_ = true;
+            sender = it->second.sender_;
+            pendingRemove_.push_back(port);
+        }
+        if (sender)
+        {
+            // After this returns the sender will not touch the port anymore.
+            // Senders are never deleted while the hub is alive.
+            sender->set_port(nullptr);
         }
-        it->second.inactive_ = true;
-        pendingRemove_.push_back(port);
     }
 
 private:
     class PortParser;
     typedef std::map<void *, PortParser> PortsMap;
+
+    /// Delivery queue of a single port in sharded mode. Runs on one of the
+    /// shard executors and hands the queued frames to the port.
+    ///
+    /// The same rendered frame is queued for many ports, and a Buffer can
+    /// only be linked into one queue at a time, so the frames are kept in a
+    /// fixed-size ring here. At delivery a port gets its own copy, except the
+    /// last port holding the frame, which gets the buffer itself.
+    class PortSender : public StateFlowBase, private Atomic
+    {
+    public:
+        /// Constructor.
+        /// @param s is the service (executor) to deliver on.
+        /// @param port is the destination of the frames.
+        /// @param limit is the maximum number of frames queued.
+        PortSender(Service *s, HubPortInterface *port, unsigned limit)
+            : StateFlowBase(s)
+            , port_(port)
+            , ring_(limit, nullptr)
+        {
+            reset_flow(STATE(deliver));
+        }
+
+        ~PortSender()
+        {
+            for (auto *b : ring_)
+            {
+                if (b)
+                {
+                    b->unref();
+                }
+            }
+        }
+
+        /** Adds a frame to the queue.
+         *
+         * @param b is the frame to send. A new reference is taken when the
+         * frame is queued.
+         * @param waiter if the queue is full and this is not null, it will be
+         * notified when there is space in the queue.
+         * @return true if the frame was queued, false if the queue was
+         * full. */
+        bool try_enqueue(Buffer<HubData> *b, Notifiable *waiter)
+        {
+            bool start;
+            {
+                AtomicHolder h(this);
+                if (depth_ >= ring_.size())
+                {
+                    waiter_ = waiter;
+                    if (!waiter)
+                    {
+                        ++dropped_;
+                    }
+                    return false;
+                }
+                ring_[(head_ + depth_) % ring_.size()] = b->ref();
+                if (++depth_ > maxDepth_)
+                {
+                    maxDepth_ = depth_;
+                }
+                start = !running_;
+                running_ = true;
+            }
+            if (start)
+            {
+                notify();
+            }
+            return true;
+        }
+
+        /// Changes the destination port. Blocks while a frame is being
+        /// delivered to the old port by another thread. Must not be called
+        /// with the hub's lock held, because the port's send() may call back
+        /// into the hub.
+        /// @param port is the new destination, or nullptr to drop the frames.
+        void set_port(HubPortInterface *port)
+        {
+            SyncNotifiable n;
+            {
+                OSMutexLock l(&portLock_);
+                // A port may unregister itself from within its send().
+                if (!sending_ || sendingThread_ == os_thread_self())
+                {
+                    port_ = port;
+                    return;
+                }
+                // The delivery flow applies the change when send() returns.
+                HASSERT(!portChanged_);
+                nextPort_ = port;
+                portChanged_ = &n;
+            }
+            n.wait_for_notification();
+        }
+
+        /// @return true if the sender has no port and no queued frames.
+        bool is_idle()
+        {
+            OSMutexLock l(&portLock_);
+            AtomicHolder h(this);
+            return port_ == nullptr && !sending_ && depth_ == 0 && !running_;
+        }
+
+        /// @return the executor this sender runs on.
+        ExecutorBase *executor()
+        {
+            return service()->executor();
+        }
+
+        /// Copies the queue statistics.
+        /// @param stats is the output.
+        void get_stats(PortQueueStats *stats)
+        {
+            AtomicHolder h(this);
+            stats->depth = depth_;
+            stats->maxDepth = maxDepth_;
+            stats->delivered = delivered_;
+            stats->dropped = dropped_;
+        }
+
+    private:
+        /// Sends the frame at the head of the ring to the port.
+        Action deliver()
+        {
+            Buffer<HubData> *b;
+            {
+                AtomicHolder h(this);
+                if (!depth_)
+                {
+                    running_ = false;
+                    return wait();
+                }
+                b = ring_[head_];
+            }
+            HubPortInterface *port;
+            {
+                OSMutexLock l(&portLock_);
+                port = port_;
+                if (port)
+                {
+                    sending_ = true;
+                    sendingThread_ = os_thread_self();
+                }
+            }
+            if (port)
+            {
+                Buffer<HubData> *out;
+                if (b->references() == 1)
+                {
+                    // All other ports are done with this frame, so the buffer
+                    // can be handed over without copying.
+                    out = b;
+                    b = nullptr;
+                }
+                else
+                {
+                    // The port will link the buffer into its queue, which
+                    // another port might be doing at the same time.
+                    mainBufferPool->alloc(&out);
+                    *out->data() = *b->data();
+                }
+                // The lock is not held here, because the port might call back
+                // into the hub. set_port() waits for sending_ to clear.
+                port->send(out);
+                OSMutexLock l(&portLock_);
+                sending_ = false;
+                if (portChanged_)
+                {
+                    port_ = nextPort_;
+                    portChanged_->notify();
+                    portChanged_ = nullptr;
+                }
+            }
+            if (b)
+            {
+                b->unref();
+            }
+            Notifiable *w;
+            {
+                AtomicHolder h(this);
+                ring_[head_] = nullptr;
+                head_ = (head_ + 1) % ring_.size();
+                --depth_;
+                ++delivered_;
+                w = waiter_;
+                waiter_ = nullptr;
+            }
+            if (w)
+            {
+                w->notify();
+            }
+            // Lets the other ports on this executor have their turn.
+            return yield();
+        }
+
+        /// Protects port_, sending_, sendingThread_, nextPort_ and
+        /// portChanged_.
+        OSMutex portLock_;
+        /// Destination of the frames. nullptr if the port was unregistered.
+        HubPortInterface *port_;
+        /// true while a frame is being handed to port_.
+        bool sending_{false};
+        /// Thread that is calling port_->send(), if sending_ is true.
+        os_thread_t sendingThread_{0};
+        /// Destination to switch to when the current send() returns.
+        HubPortInterface *nextPort_{nullptr};
+        /// set_port() call waiting for the current send() to return, or
+        /// nullptr.
+        Notifiable *portChanged_{nullptr};
+        /// Queued frames, each holding a reference.
+        std::vector<Buffer<HubData> *> ring_;
+        /// Index of the oldest frame in ring_.
+        unsigned head_{0};
+        /// Frames queued or being delivered.
+        unsigned depth_{0};
+        /// true if the flow is scheduled or running.
+        bool running_{false};
+        /// Who to notify when a frame leaves the queue.
+        Notifiable *waiter_{nullptr};
+        /// Highest depth_ seen.
+        unsigned maxDepth_{0};
+        /// Frames delivered (or released after unregistration).
+        unsigned delivered_{0};
+        /// Frames dropped due to full queue.
+        unsigned dropped_{0};
+    };
+
+    /// Creates (or reuses) a sender for a newly registered port. Must be
+    /// called with lock_ held.
+    /// @param port is the destination port.
+    /// @return the sender, owned by senders_.
+    PortSender *alloc_sender(HubPortInterface *port)
+    {
+        Service *s = shardServices_[nextShard_].get();
+        nextShard_ = (nextShard_ + 1) % shardServices_.size();
+        // Senders of unregistered ports are kept around, because frames might
+        // still be in flight. We reuse them once they are drained.
+        for (auto &sender : senders_)
+        {
+            if (sender->executor() == s->executor() && sender->is_idle())
+            {
+                sender->set_port(port);
+                return sender.get();
+            }
+        }
+        senders_.emplace_back(new PortSender(s, port, queueLimit_));
+        return senders_.back().get();
+    }
     /**
        Computes the desired priority of a CAN frame.
 
@@ -320,20 +671,17 @@ private:
                 return done_processing();
             }
 
-            if (forwardType_ == EVENT)
+            if (forwardType_ != EVENT ||
+                parent_->routingTable_.check_pcer(
+                    static_cast<CanHubPortInterface *>(nextIt_->first),
+                    event_))
             {
-                if (parent_->routingTable_.check_pcer(
-                        static_cast<CanHubPortInterface *>(nextIt_->first),
-                        event_))
+                if (!forward_to_port())
                 {
-                    forward_to_port();
+                    // Port queue full; we will be woken up when it drains.
+                    return wait_and_call(STATE(try_next_entry));
                 }
             }
-            else
-            {
-                // forward all
-                forward_to_port();
-            }
 
             nextIt_++;
             return again();
@@ -342,7 +690,10 @@ private:
         Action forward_addressed()
         {
             OSMutexLock l(&parent_->lock_);
-            forward_to_port();
+            if (!forward_to_port())
+            {
+                return wait_and_call(STATE(forward_addressed));
+            }
             return done_processing();
         }
 
@@ -356,14 +707,17 @@ private:
             return release_and_exit();
         }
 
-        void forward_to_port()
+        /// Sends the current frame to the port at nextIt_.
+        /// @return false if the frame could not be queued for the port and we
+        /// need to wait for the port's queue to drain.
+        bool forward_to_port()
         {
             if (nextIt_->second.inactive_)
-                return;
+                return true;
             if (nextIt_->second.canPort_)
             {
                 if (nextIt_->second.canPort_ == message()->data()->skipMember_)
-                    return;
+                    return true;
                 nextIt_->second.canPort_->send(message()->ref(), priority());
             }
             else
@@ -373,10 +727,18 @@ private:
                     reinterpret_cast<CanHubPortInterface *>(
                         nextIt_->second.hubPort_);
                 if (hpi == message()->data()->skipMember_)
-                    return;
+                    return true;
                 ensure_gc_buf_available();
+                if (nextIt_->second.sender_)
+                {
+                    bool wait = nextIt_->second.policy_ == WAIT_FOR_SPACE;
+                    return nextIt_->second.sender_->try_enqueue(
+                               gcBuf_, wait ? this : nullptr) ||
+                        !wait;
+                }
                 nextIt_->second.hubPort_->send(gcBuf_->ref());
             }
+            return true;
         }
 
         void ensure_gc_buf_available()
@@ -425,6 +787,11 @@ private:
         GcStreamParser segmenter_;
         CanHubPortInterface *canPort_{nullptr};
         HubPortInterface *hubPort_{nullptr};
+        /// Delivery queue in sharded mode, otherwise nullptr. Owned by
+        /// senders_.
+        PortSender *sender_{nullptr};
+        /// What to do with frames when the sender_'s queue is full.
+        QueueFullPolicy policy_{DROP_FRAME};
     };
     /// Keyed by the skipMember_ value of the incoming data from a given port.
     std::map<void *, PortParser> ports_;
@@ -435,6 +802,16 @@ private:
     std::vector<void *> pendingRemove_;
 
     RoutingLogic<CanHubPortInterface, NodeAlias> routingTable_;
+
+    /// Services for the executors of sharded delivery mode. Empty if the
+    /// frames are delivered directly from the routing flow.
+    std::vector<std::unique_ptr<Service>> shardServices_;
+    /// All per-port senders ever created in sharded mode.
+    std::vector<std::unique_ptr<PortSender>> senders_;
+    /// Which shard the next registered port goes to.
+    unsigned nextShard_{0};
+    /// Maximum number of frames queued per port in sharded mode.
+    unsigned queueLimit_{0};
 };
 
 } // namespace openlcb
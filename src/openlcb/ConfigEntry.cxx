@@ -36,14 +36,131 @@
 
 #include <sys/types.h>
 #include <unistd.h>
+#include <string.h>
+#include "os/os.h"
+#include "utils/Atomic.hxx"
 #include "utils/logging.h"
 #include "utils/FdUtils.hxx"
 
 namespace openlcb
 {
 
+/// The currently active snapshot, or nullptr. Accessed with atomic loads
+/// and stores, because current() is called from any thread without locking.
+static ConfigSnapshot *activeSnapshot = nullptr;
+/// The thread on which activeSnapshot is active. Written before
+/// activeSnapshot is published.
+static os_thread_t activeSnapshotThread;
+/// Serializes the installation and removal of the active snapshot.
+static Atomic activeSnapshotLock;
+/// Incremented by every ConfigEntry write. Accessed with atomic operations.
+static unsigned configWriteGeneration = 0;
+
+bool ConfigSnapshot::load(int fd, size_t size)
+{
+    clear();
+    if (lseek(fd, 0, SEEK_SET) != 0)
+    {
+        return false;
+    }
+    data_.resize(size);
+    size_t ofs = 0;
+    while (ofs < size)
+    {
+        ssize_t ret = ::read(fd, &data_[ofs], size - ofs);
+        if (ret <= 0)
+        {
+            break;
+        }
+        ofs += ret;
+    }
+    if (ofs == 0)
+    {
+        clear();
+        return false;
+    }
+    data_.resize(ofs);
+    fd_ = fd;
+    return true;
+}
+
+void ConfigSnapshot::clear()
+{
+    fd_ = -1;
+    string().swap(data_);
+}
+
+bool ConfigSnapshot::read(int fd, unsigned offset, void *buf, size_t size) const
+{
+    if (fd != fd_ || offset + size > data_.size())
+    {
+        return false;
+    }
+    memcpy(buf, data_.data() + offset, size);
+    return true;
+}
+
+void ConfigSnapshot::write(int fd, unsigned offset, const void *buf, size_t size)
+{
+    if (fd != fd_ || offset >= data_.size())
+    {
+        return;
+    }
+    if (offset + size > data_.size())
+    {
+        size = data_.size() - offset;
+    }
+    memcpy(&data_[offset], buf, size);
+}
+
+ConfigSnapshot *ConfigSnapshot::current()
+{
+    ConfigSnapshot *s = __atomic_load_n(&activeSnapshot, __ATOMIC_ACQUIRE);
+    // The thread can only match if the calling thread installed the snapshot
+    // itself, in which case s is that snapshot.
+    if (s &&
+        __atomic_load_n(&activeSnapshotThread, __ATOMIC_RELAXED) ==
+            os_thread_self())
+    {
+        return s;
+    }
+    return nullptr;
+}
+
+ConfigSnapshot::Scope::Scope(ConfigSnapshot *snapshot)
+    : snapshot_(nullptr)
+{
+    if (!snapshot)
+    {
+        return;
+    }
+    AtomicHolder h(&activeSnapshotLock);
+    if (!activeSnapshot)
+    {
+        snapshot_ = snapshot;
+        __atomic_store_n(
+            &activeSnapshotThread, os_thread_self(), __ATOMIC_RELAXED);
+        __atomic_store_n(&activeSnapshot, snapshot, __ATOMIC_RELEASE);
+    }
+}
+
+ConfigSnapshot::Scope::~Scope()
+{
+    if (snapshot_)
+    {
+        AtomicHolder h(&activeSnapshotLock);
+        __atomic_store_n(&activeSnapshot, (ConfigSnapshot *)nullptr,
+            __ATOMIC_RELEASE);
+    }
+}
+
 void ConfigEntryBase::repeated_read(int fd, void *buf, size_t size) const
 {
+    ConfigSnapshot *s = ConfigSnapshot::current();
+    if (s && s->read(fd, offset_, buf, size))
+    {
+        return;
+    }
     int ret = lseek(fd, offset_, SEEK_SET);
     ERRNOCHECK("seek_config", ret);
     FdUtils::repeated_read(fd, buf, size);
@@ -54,6 +171,17 @@ void ConfigEntryBase::repeated_write(int fd, const void *buf, size_t size) const
     int ret = lseek(fd, offset_, SEEK_SET);
     ERRNOCHECK("seek_config", ret);
     FdUtils::repeated_write(fd, buf, size);
+    __atomic_fetch_add(&configWriteGeneration, 1, __ATOMIC_RELEASE);
+    ConfigSnapshot *s = ConfigSnapshot::current();
+    if (s)
+    {
+        s->write(fd, offset_, buf, size);
+    }
+}
+
+unsigned ConfigEntryBase::write_generation()
+{
+    return __atomic_load_n(&configWriteGeneration, __ATOMIC_ACQUIRE);
 }
 
 } // namespace openlcb
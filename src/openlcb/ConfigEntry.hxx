@@ -79,6 +79,80 @@ protected:
     unsigned offset_;
 };
 
+/// RAM copy of the configuration file. While a snapshot is active on a thread
+/// (see ConfigSnapshot::Scope), the ConfigEntry reads issued by that thread
+/// for the same fd are served from RAM instead of doing a seek and a read
+/// syscall each, and the ConfigEntry writes update the RAM copy as well as
+/// the file. Data written to the fd bypassing ConfigEntry is not visible in
+/// the snapshot.
+class ConfigSnapshot
+{
+public:
+    /// Reads the configuration file into RAM.
+    ///
+    /// @param fd the config file.
+    /// @param size how many bytes to load from the beginning of the file.
+    ///
+    /// @return true if the snapshot was loaded.
+    ///
+    bool load(int fd, size_t size);
+
+    /// Releases the RAM copy.
+    void clear();
+
+    /// @return true if there is no data loaded.
+    bool empty() const
+    {
+        return fd_ < 0;
+    }
+
+    /// Copies data from the snapshot.
+    ///
+    /// @param fd config file the data is requested from.
+    /// @param offset offset in the config file.
+    /// @param buf where to copy the data.
+    /// @param size how many bytes to copy.
+    ///
+    /// @return false if the snapshot does not cover the requested range; in
+    /// this case the data has to be read from the file.
+    ///
+    bool read(int fd, unsigned offset, void *buf, size_t size) const;
+
+    /// Updates the snapshot with data that was written to the file.
+    ///
+    /// @param fd config file the data was written to.
+    /// @param offset offset in the config file.
+    /// @param buf the data written.
+    /// @param size how many bytes were written.
+    ///
+    void write(int fd, unsigned offset, const void *buf, size_t size);
+
+    /// @return the snapshot that is active on the calling thread, or nullptr.
+    static ConfigSnapshot *current();
+
+    /// Activates a snapshot for the calling thread while this object is
+    /// alive. Only one snapshot can be active at a time; if another one is
+    /// already active, this object does nothing.
+    class Scope
+    {
+    public:
+        /// Constructor. @param snapshot will be active on the current
+        /// thread. If nullptr, nothing happens.
+        Scope(ConfigSnapshot *snapshot);
+        ~Scope();
+
+    private:
+        /// The snapshot we activated, or nullptr.
+        ConfigSnapshot *snapshot_;
+    };
+
+private:
+    /// File descriptor the data was loaded from, -1 if empty.
+    int fd_{-1};
+    /// Contents of the file.
+    string data_;
+};
+
 /// Function declaration that will be called with all event offsets that exist
 /// in the configuration space.
 typedef std::function<void(unsigned)> EventOffsetCallback;
@@ -100,6 +174,12 @@ public:
 
     static void handle_events(const EventOffsetCallback& fn) {}
 
+    /// @return a counter that is incremented by every write made through a
+    /// configuration entry. Caches of the configuration file (such as the
+    /// readahead of FileMemorySpace) compare it to find out that the file
+    /// was changed behind their back.
+    static unsigned write_generation();
+
 protected:
     /// Reads a given typed variable from the configuration file. DOes not do
     /// any binary conversion (only reads raw data).
@@ -36,10 +36,17 @@
 
 #include "openlcb/ConfigUpdateFlow.hxx"
 #include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "nmranet_config.h"
 
 namespace openlcb
 {
 
+extern const char *const CONFIG_FILENAME __attribute__((weak)) = nullptr;
+extern const size_t CONFIG_FILE_SIZE __attribute__((weak)) = 0;
+
 int ConfigUpdateFlow::open_file(const char *path)
 {
     if (fd_ >= 0) return fd_;
@@ -51,10 +58,30 @@ int ConfigUpdateFlow::open_file(const char *path)
     {
         fd_ = ::open(path, O_RDWR);
         HASSERT(fd_ >= 0);
+        useSnapshot_ = 1;
     }
     return fd_;
 }
 
+void ConfigUpdateFlow::load_snapshot()
+{
+    size_t size = CONFIG_FILE_SIZE;
+    if (!size)
+    {
+        struct stat buf;
+        if (fstat(fd_, &buf) < 0)
+        {
+            return;
+        }
+        size = buf.st_size;
+    }
+    if (!size || size > (size_t)config_update_snapshot_max_size())
+    {
+        return;
+    }
+    snapshot_.load(fd_, size);
+}
+
 void ConfigUpdateFlow::init_flow()
 {
     trigger_update();
@@ -72,6 +99,90 @@ void ConfigUpdateFlow::factory_reset()
     }
 }
 
+void ConfigUpdateFlow::config_written(unsigned offset, unsigned len)
+{
+    unsigned end = offset + len;
+    if (end < offset)
+    {
+        end = UINT_MAX;
+    }
+    AtomicHolder h(this);
+    add_range(pendingDirty_, &numPendingDirty_, offset, end);
+}
+
+void ConfigUpdateFlow::trigger_partial_update()
+{
+    AtomicHolder h(this);
+    if (!numPendingDirty_)
+    {
+        // We do not know what changed.
+        updateAll_ = 1;
+    }
+    else if (is_terminated())
+    {
+        updateAll_ = 0;
+        numActiveDirty_ = 0;
+    }
+    // else: a refresh cycle is running; it will be restarted with the union
+    // of what it was doing and the new writes.
+    for (unsigned i = 0; i < numPendingDirty_; ++i)
+    {
+        add_range(activeDirty_, &numActiveDirty_, pendingDirty_[i].begin,
+            pendingDirty_[i].end);
+    }
+    numPendingDirty_ = 0;
+    restart_refresh();
+}
+
+void ConfigUpdateFlow::add_range(
+    DirtyRange *ranges, uint8_t *count, unsigned begin, unsigned end)
+{
+    // Merges every existing range that overlaps or touches the new one.
+    unsigned i = 0;
+    while (i < *count)
+    {
+        if (ranges[i].begin <= end && begin <= ranges[i].end)
+        {
+            begin = std::min(begin, ranges[i].begin);
+            end = std::max(end, ranges[i].end);
+            ranges[i] = ranges[--*count];
+            continue;
+        }
+        ++i;
+    }
+    if (*count >= MAX_DIRTY_RANGES)
+    {
+        // Out of space: collapses everything into one covering range.
+        for (i = 0; i < *count; ++i)
+        {
+            begin = std::min(begin, ranges[i].begin);
+            end = std::max(end, ranges[i].end);
+        }
+        *count = 0;
+    }
+    ranges[*count].begin = begin;
+    ranges[*count].end = end;
+    ++*count;
+}
+
+bool ConfigUpdateFlow::is_affected(ConfigUpdateListener *l)
+{
+    unsigned offset, size;
+    if (!l->config_range(&offset, &size))
+    {
+        return true;
+    }
+    for (unsigned i = 0; i < numActiveDirty_; ++i)
+    {
+        if (activeDirty_[i].begin < offset + size &&
+            offset < activeDirty_[i].end)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void ConfigUpdateFlow::register_update_listener(ConfigUpdateListener *listener)
 {
     AtomicHolder h(this);
@@ -108,7 +219,4 @@ void ConfigUpdateFlow::unregister_update_listener(
     nextRefresh_ = listeners_.begin();
 }
 
-extern const char *const CONFIG_FILENAME __attribute__((weak)) = nullptr;
-extern const size_t CONFIG_FILE_SIZE __attribute__((weak)) = 0;
-
 } // namespace openlcb
@@ -38,6 +38,7 @@
 #define _OPENLCB_CONFIGUPDATEFLOW_HXX_
 
 #include "openmrn_features.h"
+#include "openlcb/ConfigEntry.hxx"
 #include "utils/ConfigUpdateListener.hxx"
 #include "utils/ConfigUpdateService.hxx"
 #include "openlcb/NodeInitializeFlow.hxx"
@@ -57,6 +58,15 @@ namespace openlcb
 /// to the registered ConfigUpdateListener descendants. This flow also handles
 /// any necessary action such as reboot or factory reset. This flow keeps the
 /// file descriptor for the config file that's currently open.
+///
+/// When the config file was opened by open_file(), the listeners are called
+/// with a ConfigSnapshot active: the file is read into RAM once per refresh
+/// cycle, and the ConfigEntry reads in the listeners are served from there.
+///
+/// Writes reported via config_written() are collected as dirty ranges. A
+/// trigger_partial_update() then only calls the listeners whose declared
+/// config_range() overlaps with a dirty range (and the listeners that do not
+/// declare a range).
 class ConfigUpdateFlow : public StateFlowBase,
                          public ConfigUpdateService,
                          private Atomic
@@ -67,6 +77,8 @@ public:
         , nextRefresh_(listeners_.begin())
         , needsReboot_(0)
         , needsReInit_(0)
+        , useSnapshot_(0)
+        , updateAll_(1)
         , fd_(-1)
     {
     }
@@ -90,6 +102,45 @@ public:
     void trigger_update() override
     {
         AtomicHolder h(this);
+        updateAll_ = 1;
+        numPendingDirty_ = 0;
+        numActiveDirty_ = 0;
+        restart_refresh();
+    }
+
+    void config_written(unsigned offset, unsigned len) override;
+    void trigger_partial_update() override;
+
+    void register_update_listener(ConfigUpdateListener *listener) override;
+    void unregister_update_listener(ConfigUpdateListener *listener) override;
+private:
+    /// A range of the config file, [begin, end).
+    struct DirtyRange
+    {
+        unsigned begin;
+        unsigned end;
+    };
+
+    /// How many distinct dirty ranges we keep track of. Further ranges are
+    /// merged.
+    static constexpr unsigned MAX_DIRTY_RANGES = 4;
+
+    /// Adds a range to a list of dirty ranges, merging as necessary.
+    /// @param ranges the list of ranges (MAX_DIRTY_RANGES entries).
+    /// @param count number of valid entries in ranges; will be updated.
+    /// @param begin first byte of the range to add.
+    /// @param end one past the last byte of the range to add.
+    static void add_range(
+        DirtyRange *ranges, uint8_t *count, unsigned begin, unsigned end);
+
+    /// @return true if the listener has to be called in the current partial
+    /// refresh cycle. Must be called with the Atomic held.
+    bool is_affected(ConfigUpdateListener *l);
+
+    /// Restarts the refresh cycle from the first listener. Must be called with
+    /// the Atomic held.
+    void restart_refresh()
+    {
         nextRefresh_ = listeners_.begin();
         needsReboot_ = 0;
         needsReInit_ = 0;
@@ -99,21 +150,27 @@ public:
         }
     }
 
-    void register_update_listener(ConfigUpdateListener *listener) override;
-    void unregister_update_listener(ConfigUpdateListener *listener) override;
-private:
     Action call_next_listener()
     {
         ConfigUpdateListener *l = nullptr;
         {
             AtomicHolder h(this);
-            if (nextRefresh_ == listeners_.end())
+            do
             {
-                return call_immediately(STATE(do_initial_load));
-            }
-            l = nextRefresh_.operator->();
+                if (nextRefresh_ == listeners_.end())
+                {
+                    return call_immediately(STATE(do_initial_load));
+                }
+                l = nextRefresh_.operator->();
+                if (nextRefresh_ == listeners_.begin())
+                {
+                    // New refresh cycle: the file might have changed since
+                    // the snapshot was taken.
+                    snapshot_.clear();
+                }
+                ++nextRefresh_;
+            } while (!updateAll_ && !is_affected(l));
         }
-        ++nextRefresh_;
         return call_listener(l, false);
     }
 
@@ -124,8 +181,15 @@ private:
             DIE("CONFIG_FILENAME not specified, or init() was not called, but "
                 "there are configuration listeners.");
         }
-        ConfigUpdateListener::UpdateAction action =
-            l->apply_configuration(fd_, is_initial, n_.reset(this));
+        if (useSnapshot_ && snapshot_.empty())
+        {
+            load_snapshot();
+        }
+        ConfigUpdateListener::UpdateAction action;
+        {
+            ConfigSnapshot::Scope s(snapshot_.empty() ? nullptr : &snapshot_);
+            action = l->apply_configuration(fd_, is_initial, n_.reset(this));
+        }
         switch (action)
         {
             case ConfigUpdateListener::UPDATED:
@@ -166,6 +230,12 @@ private:
 
     Action apply_action()
     {
+        snapshot_.clear();
+        {
+            AtomicHolder h(this);
+            updateAll_ = 1;
+            numActiveDirty_ = 0;
+        }
         /// TODO(balazs.racz) apply the changes reported.
         if (needsReboot_)
         {
@@ -181,6 +251,9 @@ private:
         return exit();
     }
 
+    /// Reads the config file into snapshot_ if it is small enough.
+    void load_snapshot();
+
     typedef TypedQueue<ConfigUpdateListener> queue_type;
     /// All registered update listeners. Protected by Atomic *this.
     queue_type listeners_;
@@ -193,7 +266,24 @@ private:
     unsigned needsReboot_ : 1;
     /// did anybody request a node reinit to happen?
     unsigned needsReInit_ : 1;
+    /// true if fd_ was opened by us, so it is safe to snapshot.
+    unsigned useSnapshot_ : 1;
+    /// true if the current refresh cycle has to call every listener; false if
+    /// only the ones affected by activeDirty_.
+    unsigned updateAll_ : 1;
+    /// Number of valid entries in pendingDirty_.
+    uint8_t numPendingDirty_ {0};
+    /// Number of valid entries in activeDirty_.
+    uint8_t numActiveDirty_ {0};
+    /// Writes reported since the last update was triggered. Protected by
+    /// Atomic *this.
+    DirtyRange pendingDirty_[MAX_DIRTY_RANGES];
+    /// Writes that the current refresh cycle is applying. Protected by Atomic
+    /// *this.
+    DirtyRange activeDirty_[MAX_DIRTY_RANGES];
     int fd_;
+    /// RAM copy of the config file for the current refresh cycle.
+    ConfigSnapshot snapshot_;
     BarrierNotifiable n_;
 };
 
@@ -134,6 +134,13 @@ public:
         cfg_.description().write(fd, "");
     }
 
+    bool config_range(unsigned *offset, unsigned *size) OVERRIDE
+    {
+        *offset = cfg_.offset();
+        *size = cfg_.size();
+        return true;
+    }
+
 private:
     Impl impl_;
     BitEventConsumer consumer_;
@@ -197,6 +204,13 @@ public:
         CDI_FACTORY_RESET(cfg_.duration);
     }
 
+    bool config_range(unsigned *offset, unsigned *size) OVERRIDE
+    {
+        *offset = cfg_.offset();
+        *size = cfg_.size();
+        return true;
+    }
+
 private:
     /// Registers the event handler with the global event registry.
     void do_register()
@@ -143,6 +143,13 @@ public:
         CDI_FACTORY_RESET(cfg_.debounce);
     }
 
+    bool config_range(unsigned *offset, unsigned *size) OVERRIDE
+    {
+        *offset = cfg_.offset();
+        *size = cfg_.size();
+        return true;
+    }
+
     Polling *polling()
     {
         return &producer_;
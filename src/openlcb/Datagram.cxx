@@ -34,6 +34,8 @@
 
 #include "openlcb/Datagram.hxx"
 
+#include "openlcb/DatagramImpl.hxx"
+
 namespace openlcb
 {
 
@@ -55,6 +57,193 @@ DatagramService::~DatagramService()
                                                 );
 }
 
+DatagramSender *DatagramService::pipeline()
+{
+    return pipeline_.get();
+}
+
+void DatagramService::enable_pipeline(
+    MessageHandler *send_flow, unsigned num_slots)
+{
+    HASSERT(!pipeline_);
+    if (num_slots)
+    {
+        pipeline_.reset(new DatagramPipeline(iface_, send_flow, num_slots));
+    }
+}
+
+DatagramReplyTable::DatagramReplyTable(If *iface)
+    : iface_(iface)
+{
+    iface_->dispatcher()->register_handler(
+        this, DatagramClientImpl::MTI_1, DatagramClientImpl::MASK_1);
+    iface_->dispatcher()->register_handler(
+        this, DatagramClientImpl::MTI_2, DatagramClientImpl::MASK_2);
+    iface_->dispatcher()->register_handler(
+        this, DatagramClientImpl::MTI_3, DatagramClientImpl::MASK_3);
+}
+
+DatagramReplyTable::~DatagramReplyTable()
+{
+    iface_->dispatcher()->unregister_handler_all(this);
+}
+
+void DatagramReplyTable::add(DatagramClientImpl *c)
+{
+    DatagramClientImpl *&entry = clients_[key(c->dst_)];
+    HASSERT(!entry);
+    entry = c;
+}
+
+void DatagramReplyTable::remove(DatagramClientImpl *c)
+{
+    auto it = clients_.find(key(c->dst_));
+    if (it != clients_.end() && it->second == c)
+    {
+        clients_.erase(it);
+    }
+}
+
+DatagramClientImpl *DatagramReplyTable::lookup(NodeHandle h)
+{
+    if (h.id)
+    {
+        auto it = clients_.find(h.id);
+        if (it != clients_.end())
+        {
+            return it->second;
+        }
+    }
+    if (h.alias)
+    {
+        // The destination was given by alias only.
+        auto it = clients_.find(ALIAS_KEY | h.alias);
+        if (it != clients_.end())
+        {
+            return it->second;
+        }
+    }
+    return nullptr;
+}
+
+void DatagramReplyTable::send(Buffer<GenMessage> *b, unsigned priority)
+{
+    GenMessage *m = b->data();
+    NodeHandle from = m->src;
+    if (m->mti == Defs::MTI_INITIALIZATION_COMPLETE)
+    {
+        if (m->payload.size() != 6)
+        {
+            b->unref();
+            return;
+        }
+        from.id = buffer_to_node_id(m->payload);
+    }
+    DatagramClientImpl *c = lookup(from);
+    if (c)
+    {
+        c->handle_response(m);
+    }
+    b->unref();
+}
+
+DatagramPipeline::DatagramPipeline(
+    If *iface, MessageHandler *send_flow, unsigned num_slots)
+    : StateFlow<Buffer<DatagramSendRequest>, QList<1>>(iface)
+    , iface_(iface)
+    , replyTable_(iface)
+{
+    for (unsigned i = 0; i < num_slots; ++i)
+    {
+        slots_.emplace_back(new Slot(this, send_flow));
+    }
+}
+
+DatagramPipeline::~DatagramPipeline()
+{
+}
+
+StateFlowBase::Action DatagramPipeline::entry()
+{
+    DatagramSendRequest *r = message()->data();
+    iface_->canonicalize_handle(&r->dst);
+    if (dst_busy(r->dst))
+    {
+        parked_.push_back(transfer_message());
+        return exit();
+    }
+    for (auto &s : slots_)
+    {
+        if (!s->request_)
+        {
+            start(s.get(), transfer_message());
+            return exit();
+        }
+    }
+    waitingForSlot_ = true;
+    return wait_and_call(STATE(entry));
+}
+
+void DatagramPipeline::start(Slot *s, Buffer<DatagramSendRequest> *b)
+{
+    s->request_ = b;
+    DatagramSendRequest *r = b->data();
+    auto *m = iface_->addressed_message_write_flow()->alloc();
+    m->data()->reset(
+        Defs::MTI_DATAGRAM, r->src, r->dst, std::move(r->payload));
+    m->set_done(s->done_.reset(s));
+    s->client_.write_datagram(m, UINT_MAX);
+}
+
+void DatagramPipeline::slot_done(Slot *s)
+{
+    Buffer<DatagramSendRequest> *b = s->request_;
+    s->request_ = nullptr;
+    DatagramSendRequest *r = b->data();
+    uint32_t result = s->client_.result();
+    r->result = result;
+    if (result & DatagramClient::OPERATION_SUCCESS)
+    {
+        r->resultCode = 0;
+    }
+    else
+    {
+        r->resultCode = result & DatagramClient::RESPONSE_CODE_MASK;
+    }
+    NodeHandle dst = r->dst;
+    r->done.notify();
+    b->unref();
+
+    // The next datagram to the same destination can use this slot.
+    for (auto it = parked_.begin(); it != parked_.end(); ++it)
+    {
+        if (iface_->matching_node(dst, (*it)->data()->dst))
+        {
+            b = *it;
+            parked_.erase(it);
+            start(s, b);
+            return;
+        }
+    }
+    if (waitingForSlot_)
+    {
+        waitingForSlot_ = false;
+        notify();
+    }
+}
+
+bool DatagramPipeline::dst_busy(NodeHandle dst)
+{
+    for (auto &s : slots_)
+    {
+        if (s->request_ && iface_->matching_node(s->request_->data()->dst, dst))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 StateFlowBase::Action DatagramService::DatagramDispatcher::entry()
 {
     if (!nmsg()->dstNode)
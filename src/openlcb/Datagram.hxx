@@ -35,6 +35,9 @@
 #ifndef _OPENLCB_DATAGRAM_HXX_
 #define _OPENLCB_DATAGRAM_HXX_
 
+#include <memory>
+
+#include "executor/CallableFlow.hxx"
 #include "utils/NodeHandlerMap.hxx"
 #include "utils/Queue.hxx"
 #include "openlcb/If.hxx"
@@ -43,6 +46,7 @@ namespace openlcb
 {
 
 struct IncomingDatagram;
+class DatagramPipeline;
 
 /// Defines how long to wait for a Datagram_OK / Datagram_Rejected message.
 extern long long DATAGRAM_RESPONSE_TIMEOUT_NSEC;
@@ -148,6 +152,38 @@ protected:
     uint32_t result_;
 };
 
+/// Request structure for sending a datagram via the DatagramPipeline. The
+/// caller does not need to allocate a DatagramClient for these.
+struct DatagramSendRequest : public CallableFlowRequestBase
+{
+    /// Sets up the request.
+    /// @param src local node to send the datagram from.
+    /// @param dst destination node.
+    /// @param payload datagram contents, including the datagram ID.
+    void reset(NodeID src, NodeHandle dst, DatagramPayload payload)
+    {
+        reset_base();
+        this->src = src;
+        this->dst = dst;
+        this->payload = std::move(payload);
+        result = 0;
+    }
+
+    /// Local node sending the datagram.
+    NodeID src;
+    /// Destination of the datagram.
+    NodeHandle dst;
+    /// Datagram contents. Consumed when the datagram is sent.
+    DatagramPayload payload;
+    /// Bitmask of DatagramClient::ResultCodes when the request is done. The
+    /// resultCode field is zero if the datagram was accepted, otherwise it
+    /// holds the error bits from this field.
+    uint32_t result;
+};
+
+/// Flow interface of the DatagramPipeline.
+typedef FlowInterface<Buffer<DatagramSendRequest>> DatagramSender;
+
 /** Transport-agnostic dispatcher of datagrams.
  *
  * There will be typically one instance of this for each interface with virtual
@@ -193,6 +229,25 @@ public:
         return iface_;
     }
 
+    /** Pipelined datagram sender.
+     *
+     * Send DatagramSendRequest buffers here to keep multiple datagrams in
+     * flight at the same time, to different destinations. Datagrams to the
+     * same destination are sent one after the other, in the order they
+     * arrived. The request's done notifiable is called when the datagram
+     * send completed.
+     *
+     * @return nullptr if the pipeline was not enabled for this service. */
+    DatagramSender *pipeline();
+
+protected:
+    /// Creates the pipelined datagram sender. Called by the transport
+    /// specific subclasses.
+    /// @param send_flow is the addressed datagram send flow of the
+    /// transport.
+    /// @param num_slots how many datagrams can be in flight at the same time.
+    void enable_pipeline(MessageHandler *send_flow, unsigned num_slots);
+
 private:
     /** Class for routing incoming datagram messages to the datagram handlers.
      *
@@ -244,6 +299,9 @@ private:
 
     /// Datagram dispatch handler.
     DatagramDispatcher dispatcher_;
+
+    /// Pipelined datagram sender, if enabled.
+    std::unique_ptr<DatagramPipeline> pipeline_;
 };
 
 } // namespace openlcb
@@ -343,7 +343,8 @@ private:
 };
 CanDatagramService::CanDatagramService(IfCan *iface,
                                        int num_registry_entries,
-                                       int num_clients)
+                                       int num_clients,
+                                       int num_pipeline_slots)
     : DatagramService(iface, num_registry_entries)
 {
     if_can()->add_owned_flow(new CanDatagramParser(if_can()));
@@ -355,6 +356,7 @@ CanDatagramService::CanDatagramService(IfCan *iface,
         if_can()->add_owned_flow(client_flow);
         client_allocator()->insert(static_cast<DatagramClient *>(client_flow));
     }
+    enable_pipeline(dg_send, num_pipeline_slots);
 }
 
 Executable *TEST_CreateCanDatagramParser(IfCan *if_can)
@@ -51,9 +51,12 @@ class CanDatagramService : public DatagramService
 public:
     /*
      * @param num_registry_entries is the size of the registry map (how
-     * many datagram handlers can be registered)*/
+     * many datagram handlers can be registered)
+     * @param num_clients how many datagram clients to create.
+     * @param num_pipeline_slots if non-zero, enables pipeline() with this
+     * many datagrams in flight at the same time. */
     CanDatagramService(IfCan *iface, int num_registry_entries,
-                       int num_clients);
+                       int num_clients, int num_pipeline_slots = 0);
 
     ~CanDatagramService();
 
@@ -32,8 +32,11 @@
  * @date 27 Jan 2013
  */
 
+#include <deque>
+
 #include "openlcb/Datagram.hxx"
 #include "openlcb/DatagramDefs.hxx"
+#include "utils/StlMap.hxx"
 
 namespace openlcb
 {
@@ -42,6 +45,55 @@ namespace openlcb
 /// ack/nack response message.
 extern long long DATAGRAM_RESPONSE_TIMEOUT_NSEC;
 
+class DatagramClientImpl;
+
+/// Routes datagram response messages to the datagram client that is waiting
+/// for them, by looking up the source of the response in a map keyed by the
+/// destination of the pending datagrams. Clients using a reply table do not
+/// register their own response handlers with the interface, so an incoming
+/// response costs one map lookup instead of one call per pending client.
+class DatagramReplyTable : public MessageHandler
+{
+public:
+    /// Constructor. Registers the table with the interface's dispatcher.
+    /// @param iface is the interface to listen on.
+    DatagramReplyTable(If *iface);
+    ~DatagramReplyTable();
+
+    /// Adds a client that is waiting for a response. There can be only one
+    /// such client per destination node.
+    void add(DatagramClientImpl *c);
+    /// Removes a client that was added before.
+    void remove(DatagramClientImpl *c);
+
+    /// @return how many clients are waiting for a response.
+    size_t size()
+    {
+        return clients_.size();
+    }
+
+    /// Handler callback for incoming response messages.
+    void send(Buffer<GenMessage> *b, unsigned priority = UINT_MAX) override;
+
+private:
+    /// Marks a map key as an alias. Node IDs are only 48 bits wide.
+    static constexpr uint64_t ALIAS_KEY = 1ULL << 63;
+
+    /// @return map key for a given destination node.
+    static uint64_t key(NodeHandle h)
+    {
+        return h.id ? h.id : (ALIAS_KEY | h.alias);
+    }
+
+    /// @return the client waiting for a response from node h, or nullptr.
+    DatagramClientImpl *lookup(NodeHandle h);
+
+    /// Interface we are registered on.
+    If *iface_;
+    /// Pending clients keyed by their destination.
+    StlMap<uint64_t, DatagramClientImpl *> clients_;
+};
+
 /// Datagram client implementation for CANbus-based datagram protocol.
 ///
 /// This flow is responsible for the outgoing CAN datagram framing, and listens
@@ -86,7 +138,18 @@ public:
         DIE("Canceling datagram send operation is not yet implemented.");
     }
 
+    /// Makes this client receive the datagram responses via a reply table
+    /// instead of registering its own handlers. Must be called before the
+    /// first datagram is sent.
+    /// @param table the reply table to use; externally owned.
+    void set_reply_table(DatagramReplyTable *table)
+    {
+        replyTable_ = table;
+    }
+
 private:
+    friend class DatagramReplyTable;
+
     /// Equivalent to enqueuing a new datagram to send.
     /// @param b datagram to send.
     /// @param priority executor priority.
@@ -175,6 +238,11 @@ private:
         hasResponse_ = 0;
         isSleeping_ = 0;
         sendPending_ = 1;
+        if (replyTable_)
+        {
+            replyTable_->add(this);
+            return;
+        }
         iface()->dispatcher()->register_handler(&listener_, MTI_1, MASK_1);
         iface()->dispatcher()->register_handler(&listener_, MTI_2, MASK_2);
         iface()->dispatcher()->register_handler(&listener_, MTI_3, MASK_3);
@@ -205,9 +273,19 @@ private:
 
     void unregister_response_handler()
     {
-        iface()->dispatcher()->unregister_handler(&listener_, MTI_1, MASK_1);
-        iface()->dispatcher()->unregister_handler(&listener_, MTI_2, MASK_2);
-        iface()->dispatcher()->unregister_handler(&listener_, MTI_3, MASK_3);
+        if (replyTable_)
+        {
+            replyTable_->remove(this);
+        }
+        else
+        {
+            iface()->dispatcher()->unregister_handler(
+                &listener_, MTI_1, MASK_1);
+            iface()->dispatcher()->unregister_handler(
+                &listener_, MTI_2, MASK_2);
+            iface()->dispatcher()->unregister_handler(
+                &listener_, MTI_3, MASK_3);
+        }
         sendPending_ = 0;
         if (!waitingClients_.empty())
         {
@@ -406,6 +484,8 @@ private:
     NodeHandle dst_;
     /// Addressed datagram send flow from the interface. Externally owned.
     MessageHandler *sendFlow_;
+    /// If not null, responses are routed to us by this table.
+    DatagramReplyTable *replyTable_ {nullptr};
     /// Instance of the listener object.
     ReplyListener listener_;
     /// Helper object for sleep.
@@ -428,4 +508,83 @@ private:
     static constexpr unsigned MAX_PRIORITY = (1 << 24) - 1;
 }; // class DatagramClientImpl
 
+/// Sends datagrams from a queue, keeping several of them in flight at the
+/// same time. Each in-flight datagram occupies a slot with its own
+/// DatagramClientImpl; the slots share a DatagramReplyTable for the
+/// responses. A datagram to a destination that already has one in flight is
+/// parked until the earlier one completes, as the protocol allows only one
+/// outstanding datagram per source and destination pair.
+class DatagramPipeline : public StateFlow<Buffer<DatagramSendRequest>, QList<1>>
+{
+public:
+    /// Constructor.
+    /// @param iface is the interface to send datagrams on.
+    /// @param send_flow is the addressed datagram send flow of the transport.
+    /// @param num_slots how many datagrams can be in flight at the same time.
+    DatagramPipeline(If *iface, MessageHandler *send_flow, unsigned num_slots);
+    ~DatagramPipeline();
+
+private:
+    /// One in-flight datagram.
+    class Slot : public Executable
+    {
+    public:
+        /// Constructor.
+        /// @param parent owning pipeline.
+        /// @param send_flow transport's datagram send flow.
+        Slot(DatagramPipeline *parent, MessageHandler *send_flow)
+            : parent_(parent)
+            , client_(parent->iface_, send_flow)
+        {
+            client_.set_reply_table(&parent->replyTable_);
+        }
+
+        /// Called when the datagram client is done.
+        void notify() override
+        {
+            parent_->service()->executor()->add(this);
+        }
+
+        /// Called on the executor after the datagram client is done.
+        void run() override
+        {
+            parent_->slot_done(this);
+        }
+
+        /// Owning pipeline.
+        DatagramPipeline *parent_;
+        /// Sends the datagram and waits for the response.
+        DatagramClientImpl client_;
+        /// Request being sent now, or nullptr if the slot is free.
+        Buffer<DatagramSendRequest> *request_ {nullptr};
+        /// Notifies us when the client is done.
+        BarrierNotifiable done_;
+    };
+
+    Action entry() override;
+
+    /// Hands off a request to a slot.
+    /// @param s a free slot.
+    /// @param b the request; ownership is transferred.
+    void start(Slot *s, Buffer<DatagramSendRequest> *b);
+
+    /// Called when the datagram in a slot completed.
+    /// @param s the slot.
+    void slot_done(Slot *s);
+
+    /// @return true if there is a datagram in flight to dst.
+    bool dst_busy(NodeHandle dst);
+
+    /// Interface we are sending on.
+    If *iface_;
+    /// Dispatches the responses to the slots.
+    DatagramReplyTable replyTable_;
+    /// All slots.
+    std::vector<std::unique_ptr<Slot>> slots_;
+    /// Requests waiting for an earlier datagram to the same destination.
+    std::deque<Buffer<DatagramSendRequest> *> parked_;
+    /// True if the flow is waiting for a slot to become free.
+    bool waitingForSlot_ {false};
+};
+
 } // namespace openlcb
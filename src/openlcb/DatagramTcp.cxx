@@ -40,7 +40,8 @@ namespace openlcb
 {
 
 TcpDatagramService::TcpDatagramService(
-    IfTcp *iface, int num_registry_entries, int num_clients)
+    IfTcp *iface, int num_registry_entries, int num_clients,
+    int num_pipeline_slots)
     : DatagramService(iface, num_registry_entries)
 {
     auto *dg_send = if_tcp()->addressed_message_write_flow();
@@ -50,6 +51,7 @@ TcpDatagramService::TcpDatagramService(
         if_tcp()->add_owned_flow(client_flow);
         client_allocator()->insert(static_cast<DatagramClient *>(client_flow));
     }
+    enable_pipeline(dg_send, num_pipeline_slots);
 }
 
 TcpDatagramService::~TcpDatagramService()
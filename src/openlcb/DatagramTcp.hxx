@@ -51,7 +51,10 @@ public:
     /// datagram handlers can be registered)
     /// @param num_clients how many datagram clients to create. These are
     /// allocated and freed on demand by flows sending datagrams.
-    TcpDatagramService(IfTcp *iface, int num_registry_entries, int num_clients);
+    /// @param num_pipeline_slots if non-zero, enables pipeline() with this
+    /// many datagrams in flight at the same time.
+    TcpDatagramService(IfTcp *iface, int num_registry_entries, int num_clients,
+        int num_pipeline_slots = 0);
 
     ~TcpDatagramService();
 
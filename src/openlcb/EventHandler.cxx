@@ -32,6 +32,10 @@
  */
 
 #include "openlcb/EventHandler.hxx"
+
+#include <string.h>
+
+#include "nmranet_config.h"
 #include "openlcb/WriteHelper.hxx"
 
 namespace openlcb
@@ -45,6 +49,86 @@ EventRegistry::~EventRegistry()
 {
 }
 
+void EventRegistry::create_filter()
+{
+    if (config_event_registry_filter_size() > 0)
+    {
+        filter_.reset(new EventFilter(config_event_registry_filter_size()));
+    }
+}
+
+EventFilter::EventFilter(unsigned size)
+{
+    size_ = 1;
+    while (size_ < size)
+    {
+        size_ <<= 1;
+    }
+    counters_.reset(new uint8_t[size_]);
+    memset(counters_.get(), 0, size_);
+    memset(maskCount_, 0, sizeof(maskCount_));
+}
+
+void EventFilter::add(EventId event, unsigned mask)
+{
+    if (mask >= 64)
+    {
+        ++numMatchAll_;
+        return;
+    }
+    if (maskCount_[mask]++ == 0)
+    {
+        usedMasks_ |= (1ULL << mask);
+    }
+    uint8_t &c = counters_[slot(event & ~((1ULL << mask) - 1), mask)];
+    if (c < 255)
+    {
+        ++c;
+    }
+}
+
+void EventFilter::remove(EventId event, unsigned mask)
+{
+    if (mask >= 64)
+    {
+        HASSERT(numMatchAll_ > 0);
+        --numMatchAll_;
+        return;
+    }
+    HASSERT(maskCount_[mask] > 0);
+    if (--maskCount_[mask] == 0)
+    {
+        usedMasks_ &= ~(1ULL << mask);
+    }
+    uint8_t &c = counters_[slot(event & ~((1ULL << mask) - 1), mask)];
+    // Saturated counters do not know their real count anymore.
+    if (c > 0 && c < 255)
+    {
+        --c;
+    }
+}
+
+bool EventFilter::may_match(EventId event)
+{
+    ++stats_.queries;
+    if (numMatchAll_)
+    {
+        return true;
+    }
+    uint64_t masks = usedMasks_;
+    while (masks)
+    {
+        unsigned mask = __builtin_ctzll(masks);
+        masks &= masks - 1;
+        if (counters_[slot(event & ~((1ULL << mask) - 1), mask)])
+        {
+            return true;
+        }
+    }
+    ++stats_.rejected;
+    return false;
+}
+
 // static
 unsigned EventRegistry::align_mask(EventId *event, unsigned size)
 {
@@ -35,6 +35,7 @@
 #define _OPENLCB_EVENTHANDLER_HXX_
 
 #include <stdint.h>
+#include <memory>
 
 #include "executor/Notifiable.hxx"
 #include "utils/AsyncMutex.hxx"
@@ -150,6 +151,19 @@ public:
     {
     }
 
+    /// Declares whether this handler may be called concurrently with other
+    /// event handlers for the same incoming message. A reentrant handler must
+    /// not use the shared write helpers in the EventReport (use its own
+    /// buffers instead) and must not modify the EventReport. Such handlers
+    /// are invoked in a batch without waiting for each other, if the event
+    /// service has batch calls enabled (see @ref
+    /// EventService::enable_batch_calls).
+    /// @return true if the handler is reentrant. Default is false.
+    virtual bool is_reentrant()
+    {
+        return false;
+    }
+
     /// Called on incoming EventReport messages. @param event stores
     /// information about the incoming message. Filled: src_node, event. Mask
     /// is always 1 (filled in). state is not filled in. @param registry_entry
@@ -244,6 +258,91 @@ typedef void (EventHandler::*EventHandlerFunction)(
 
 class EventIterator;
 
+/// Compact pre-filter for incoming single-event messages. Keeps a table of
+/// 8-bit counters indexed by a hash of the registered (event, mask)
+/// pairs. Answers "can there be any registered handler for this event" with a
+/// few instructions and no false negatives, so that irrelevant event reports
+/// can be dropped before any iteration of the event registry starts.
+///
+/// Range registrations are supported by hashing the event aligned to every
+/// registration mask width that is currently in use. Counters that saturate
+/// stay saturated (the slot will always report a potential match).
+class EventFilter
+{
+public:
+    /// @param size is the number of counters in the table. Will be rounded up
+    /// to a power of two.
+    EventFilter(unsigned size);
+
+    /// Adds a registration to the filter.
+    /// @param event is the registered event ID.
+    /// @param mask is the registration mask (see @ref
+    /// EventRegistry::register_handler).
+    void add(EventId event, unsigned mask);
+
+    /// Removes a registration from the filter. Must be called with the same
+    /// arguments as a previous add() call.
+    /// @param event is the registered event ID.
+    /// @param mask is the registration mask.
+    void remove(EventId event, unsigned mask);
+
+    /// @param event is an event ID of an incoming message.
+    /// @return false if there is definitely no registration matching event.
+    bool may_match(EventId event);
+
+    /// Statistics about the filter's performance.
+    struct Stats
+    {
+        /// How many events were checked against the filter.
+        uint32_t queries;
+        /// How many events were dropped by the filter.
+        uint32_t rejected;
+        /// How many events passed the filter but had no matching handler.
+        uint32_t false_positives;
+    };
+
+    /// @return the statistics counters.
+    const Stats &stats()
+    {
+        return stats_;
+    }
+
+    /// Called by the event iteration when an event passed the filter, but no
+    /// handler was found for it.
+    void count_false_positive()
+    {
+        ++stats_.false_positives;
+    }
+
+    /// Resets the statistics counters.
+    void clear_stats()
+    {
+        stats_ = {0, 0, 0};
+    }
+
+private:
+    /// @return the counter index for a given aligned event ID and mask.
+    unsigned slot(EventId aligned_event, unsigned mask)
+    {
+        uint64_t h = (aligned_event ^ (aligned_event >> 31) ^ mask) *
+            0x9E3779B97F4A7C15ULL;
+        return (h >> 32) & (size_ - 1);
+    }
+
+    /// Hashed counters.
+    std::unique_ptr<uint8_t[]> counters_;
+    /// Number of counters. Power of two.
+    unsigned size_;
+    /// Bit N is set if there is a registration with mask N.
+    uint64_t usedMasks_{0};
+    /// Number of registrations for each mask value.
+    uint16_t maskCount_[64];
+    /// Number of registrations with mask 64 (matching all events).
+    unsigned numMatchAll_{0};
+    /// Performance counters.
+    Stats stats_{0, 0, 0};
+};
+
 /// Global static object for registering event handlers.
 ///
 /// Usage: create one of the implementation classes depending on the resource
@@ -285,6 +384,22 @@ public:
         return dirtyCounter_;
     }
 
+    /// Checks the pre-filter for an incoming single event.
+    /// @param event is the event ID from the incoming message.
+    /// @return false if it is certain that no registered handler matches this
+    /// event; true if there may be a match (or the filter is not in use).
+    bool may_match(EventId event)
+    {
+        return !filter_ || filter_->may_match(event);
+    }
+
+    /// @return the pre-filter, or nullptr if this registry is not using
+    /// one. Useful for reading the filter statistics.
+    EventFilter *filter()
+    {
+        return filter_.get();
+    }
+
 protected:
     EventRegistry();
 
@@ -295,9 +410,41 @@ protected:
         ++dirtyCounter_;
     }
 
+    /// Implementations that match the registrations exactly (by event ID and
+    /// mask) may call this function from their constructor to set up a
+    /// pre-filter, sized according to config_event_registry_filter_size(). If
+    /// a filter is created, the implementation must call filter_add and
+    /// filter_remove for every registration.
+    void create_filter();
+
+    /// Adds a registration to the pre-filter, if any.
+    /// @param event is the registered event ID.
+    /// @param mask is the registration mask.
+    void filter_add(EventId event, unsigned mask)
+    {
+        if (filter_)
+        {
+            filter_->add(event, mask);
+        }
+    }
+
+    /// Removes a registration from the pre-filter, if any.
+    /// @param event is the registered event ID.
+    /// @param mask is the registration mask.
+    void filter_remove(EventId event, unsigned mask)
+    {
+        if (filter_)
+        {
+            filter_->remove(event, mask);
+        }
+    }
+
 private:
     static EventRegistry *instance_;
 
+    /// Pre-filter for incoming events. nullptr if not used.
+    std::unique_ptr<EventFilter> filter_;
+
     /// This counter will be incremented every time the set of event handlers
     /// change (and thus the event iterators are invalidated).
     unsigned dirtyCounter_ = 0;
@@ -46,6 +46,7 @@ void TreeEventHandlers::register_handler(const EventRegistryEntry &entry,
     LOG(VERBOSE, "%p: register %p", this, entry.handler);
     set_dirty();
     handlers_[mask].insert(EventRegistryEntry(entry));
+    filter_add(entry.event, mask);
 }
 
 void TreeEventHandlers::unregister_handler(EventHandler *handler)
@@ -58,6 +59,13 @@ void TreeEventHandlers::unregister_handler(EventHandler *handler)
     {
         auto begin_it = r->second.begin();
         auto end_it = r->second.end();
+        for (auto it = begin_it; it != end_it; ++it)
+        {
+            if (it->handler == handler)
+            {
+                filter_remove(it->event, r->first);
+            }
+        }
         auto erase_it = std::remove_if(
             begin_it, end_it, [handler](const EventRegistryEntry &reg) {
                 return reg.handler == handler;
@@ -156,6 +164,292 @@ EventIterator *TreeEventHandlers::create_iterator()
 
 TreeEventHandlers::TreeEventHandlers()
 {
+    create_filter();
+}
+
+FlatEventHandlers::FlatEventHandlers()
+{
+    create_filter();
+}
+
+void FlatEventHandlers::register_handler(const EventRegistryEntry &entry,
+                                         unsigned mask)
+{
+    AtomicHolder h(this);
+    LOG(VERBOSE, "%p: register %p", this, entry.handler);
+    set_dirty();
+    entries_.push_back(entry);
+    masks_.push_back(mask >= 64 ? 64 : mask);
+    filter_add(entry.event, mask);
+}
+
+void FlatEventHandlers::unregister_handler(EventHandler *handler)
+{
+    AtomicHolder h(this);
+    set_dirty();
+    LOG(VERBOSE, "%p: unregister %p", this, handler);
+    unsigned dst = 0;
+    for (unsigned i = 0; i < entries_.size(); ++i)
+    {
+        if (entries_[i].handler == handler)
+        {
+            filter_remove(entries_[i].event, masks_[i]);
+            continue;
+        }
+        if (dst != i)
+        {
+            entries_[dst] = entries_[i];
+            masks_[dst] = masks_[i];
+        }
+        ++dst;
+    }
+    if (dst == entries_.size())
+    {
+        DIE("tried to unregister a handler that was not registered");
+    }
+    entries_.erase(entries_.begin() + dst, entries_.end());
+    masks_.erase(masks_.begin() + dst, masks_.end());
+}
+
+/// @param event is the registered event ID.
+/// @param mask is the registration mask (0..64).
+/// @return the first event ID of the aligned range covered by a registration.
+static inline uint64_t flat_range_first(uint64_t event, unsigned mask)
+{
+    return event & ~((1ULL << mask) - 1);
+}
+
+/// @param event is the registered event ID.
+/// @param mask is the registration mask (0..64).
+/// @return the last event ID (inclusive) of the aligned range covered by a
+/// registration.
+static inline uint64_t flat_range_last(uint64_t event, unsigned mask)
+{
+    return event | ((1ULL << mask) - 1);
+}
+
+void FlatEventHandlers::freeze()
+{
+    if (frozenEpoch_ == get_epoch())
+    {
+        return;
+    }
+    frozenEpoch_ = get_epoch();
+    unsigned n = entries_.size();
+
+    // Sorts the registrations: match-all entries first, then the others by
+    // the beginning of their range.
+    std::vector<unsigned> order(n);
+    for (unsigned i = 0; i < n; ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](unsigned a, unsigned b) {
+        bool wa = masks_[a] >= 64;
+        bool wb = masks_[b] >= 64;
+        if (wa != wb)
+        {
+            return wa;
+        }
+        if (wa)
+        {
+            return false;
+        }
+        return flat_range_first(entries_[a].event, masks_[a]) <
+            flat_range_first(entries_[b].event, masks_[b]);
+    });
+    std::vector<EventRegistryEntry> sorted_entries;
+    std::vector<uint8_t> sorted_masks;
+    sorted_entries.reserve(n);
+    sorted_masks.reserve(n);
+    numWildcard_ = 0;
+    for (unsigned i : order)
+    {
+        sorted_entries.push_back(entries_[i]);
+        sorted_masks.push_back(masks_[i]);
+        if (masks_[i] >= 64)
+        {
+            ++numWildcard_;
+        }
+    }
+    entries_.swap(sorted_entries);
+    masks_.swap(sorted_masks);
+
+    // Collects the boundaries of the elementary intervals.
+    unsigned num_ranged = n - numWildcard_;
+    firsts_.resize(num_ranged);
+    bounds_.clear();
+    for (unsigned i = 0; i < num_ranged; ++i)
+    {
+        const EventRegistryEntry &e = entries_[numWildcard_ + i];
+        unsigned mask = masks_[numWildcard_ + i];
+        firsts_[i] = flat_range_first(e.event, mask);
+        bounds_.push_back(firsts_[i]);
+        uint64_t last = flat_range_last(e.event, mask);
+        if (last != UINT64_MAX)
+        {
+            bounds_.push_back(last + 1);
+        }
+    }
+    std::sort(bounds_.begin(), bounds_.end());
+    bounds_.erase(std::unique(bounds_.begin(), bounds_.end()), bounds_.end());
+
+    // Computes which elementary intervals each registration covers. First
+    // pass counts the hits per interval, second pass fills them in.
+    std::vector<unsigned> range_begin(num_ranged);
+    std::vector<unsigned> range_end(num_ranged);
+    offsets_.assign(bounds_.size() + 1, 0);
+    for (unsigned i = 0; i < num_ranged; ++i)
+    {
+        uint64_t last = flat_range_last(
+            entries_[numWildcard_ + i].event, masks_[numWildcard_ + i]);
+        range_begin[i] =
+            std::lower_bound(bounds_.begin(), bounds_.end(), firsts_[i]) -
+            bounds_.begin();
+        if (last == UINT64_MAX)
+        {
+            range_end[i] = bounds_.size();
+        }
+        else
+        {
+            range_end[i] =
+                std::lower_bound(bounds_.begin(), bounds_.end(), last + 1) -
+                bounds_.begin();
+        }
+        for (unsigned j = range_begin[i]; j < range_end[i]; ++j)
+        {
+            ++offsets_[j + 1];
+        }
+    }
+    for (unsigned j = 1; j < offsets_.size(); ++j)
+    {
+        offsets_[j] += offsets_[j - 1];
+    }
+    hits_.resize(offsets_.back());
+    std::vector<unsigned> fill(offsets_.begin(), offsets_.end() - 1);
+    for (unsigned i = 0; i < num_ranged; ++i)
+    {
+        for (unsigned j = range_begin[i]; j < range_end[i]; ++j)
+        {
+            hits_[fill[j]++] = i;
+        }
+    }
+}
+
+void FlatEventHandlers::probe(uint64_t event, unsigned *begin, unsigned *end)
+{
+    auto it = std::upper_bound(bounds_.begin(), bounds_.end(), event);
+    if (it == bounds_.begin())
+    {
+        *begin = *end = 0;
+        return;
+    }
+    unsigned idx = (it - bounds_.begin()) - 1;
+    *begin = offsets_[idx];
+    *end = offsets_[idx + 1];
+}
+
+/// Class representing the iteration state on the flat array-based event
+/// handler registry.
+class FlatEventHandlers::Iterator : public EventIterator
+{
+public:
+    Iterator(FlatEventHandlers *parent)
+        : parent_(parent)
+    {
+        clear_iteration();
+    }
+
+    EventRegistryEntry *next_entry() OVERRIDE
+    {
+        AtomicHolder h(parent_);
+        if (wildcardIt_ < parent_->numWildcard_)
+        {
+            return &parent_->entries_[wildcardIt_++];
+        }
+        // Registrations that cover the first event of the query.
+        while (hitIt_ < hitEnd_)
+        {
+            unsigned idx = parent_->hits_[hitIt_++];
+            if (parent_->firsts_[idx] > hitLimit_)
+            {
+                // The hits are sorted by first event; all remaining entries
+                // will be produced by the slice below.
+                hitIt_ = hitEnd_;
+                break;
+            }
+            return &parent_->entries_[parent_->numWildcard_ + idx];
+        }
+        // Registrations that begin inside the query range.
+        if (sliceIt_ < sliceEnd_)
+        {
+            return &parent_->entries_[parent_->numWildcard_ + sliceIt_++];
+        }
+        return nullptr;
+    }
+
+    void clear_iteration() OVERRIDE
+    {
+        wildcardIt_ = UINT_MAX;
+        hitIt_ = hitEnd_ = 0;
+        sliceIt_ = sliceEnd_ = 0;
+    }
+
+    void init_iteration(EventReport *r) OVERRIDE
+    {
+        AtomicHolder h(parent_);
+        parent_->freeze();
+        wildcardIt_ = 0;
+        uint64_t first = r->event;
+        if (r->mask == 0)
+        {
+            // Single event: one probe tells all matching registrations.
+            parent_->probe(first, &hitIt_, &hitEnd_);
+            hitLimit_ = first;
+            sliceIt_ = sliceEnd_ = 0;
+            return;
+        }
+        uint64_t last = r->event + r->mask;
+        if (last < first)
+        {
+            last = UINT64_MAX;
+        }
+        // Range query. Registrations that begin before the range are found
+        // via the probe of the first event; registrations that begin inside
+        // the range are a contiguous slice of the sorted array.
+        if (first > 0)
+        {
+            parent_->probe(first, &hitIt_, &hitEnd_);
+            hitLimit_ = first - 1;
+        }
+        else
+        {
+            hitIt_ = hitEnd_ = 0;
+        }
+        auto &f = parent_->firsts_;
+        sliceIt_ = std::lower_bound(f.begin(), f.end(), first) - f.begin();
+        sliceEnd_ = std::upper_bound(f.begin(), f.end(), last) - f.begin();
+    }
+
+private:
+    FlatEventHandlers *parent_;
+    /// Next match-all entry to return.
+    unsigned wildcardIt_;
+    /// Next index into parent_->hits_.
+    unsigned hitIt_;
+    /// End index into parent_->hits_.
+    unsigned hitEnd_;
+    /// Entries coming from the hits list must start at or before this event.
+    uint64_t hitLimit_;
+    /// Next ranged entry to return from the sorted slice.
+    unsigned sliceIt_;
+    /// End of the sorted slice.
+    unsigned sliceEnd_;
+};
+
+EventIterator *FlatEventHandlers::create_iterator()
+{
+    return new Iterator(this);
 }
 
 } // namespace openlcb
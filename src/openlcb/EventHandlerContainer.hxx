@@ -189,6 +189,72 @@ private:
     MaskLookupMap handlers_;
 };
 
+/// EventRegistry implementation that keeps the event handlers in flat sorted
+/// arrays and answers the "which handlers match this event" question with a
+/// single binary search.
+///
+/// Registrations are accumulated in a vector. When an iteration is started
+/// after the set of registrations changed, the registry is frozen into an
+/// index: every registration covers an aligned range of event IDs; the
+/// boundaries of these ranges cut the event ID space into elementary
+/// intervals, and for each elementary interval we precompute the list of
+/// registrations that cover it. An event report then costs one lookup in the
+/// sorted boundary array, after which the matching handlers are a contiguous
+/// slice of the precomputed list. Registrations with mask 64 (match all
+/// events) are kept separately and not copied into every interval.
+///
+/// The index costs more memory than @ref TreeEventHandlers when many narrow
+/// registrations are nested inside wide ones, and rebuilding it costs O(n log
+/// n), so this implementation is best for nodes where the registrations are
+/// mostly static after startup.
+class FlatEventHandlers : public EventRegistry, private Atomic
+{
+public:
+    FlatEventHandlers();
+
+    EventIterator *create_iterator() OVERRIDE;
+    void register_handler(const EventRegistryEntry &entry,
+                          unsigned mask) OVERRIDE;
+    void unregister_handler(EventHandler *handler) OVERRIDE;
+
+private:
+    class Iterator;
+    friend class Iterator;
+
+    /// Rebuilds the lookup index if the registrations changed since the last
+    /// build. Must be called with the lock held.
+    void freeze();
+
+    /// Finds the elementary interval containing a given event.
+    /// @param event is the event ID to look up.
+    /// @param begin will be filled with the first index into hits_.
+    /// @param end will be filled with the past-the-end index into hits_.
+    void probe(uint64_t event, unsigned *begin, unsigned *end);
+
+    /// All registrations. After freeze() the registrations with mask 64 are
+    /// at the beginning, followed by the others sorted by first event ID.
+    std::vector<EventRegistryEntry> entries_;
+    /// Mask (log2 of the range size) for each entry in entries_.
+    std::vector<uint8_t> masks_;
+    /// Number of match-all (mask 64) entries at the beginning of entries_.
+    unsigned numWildcard_{0};
+    /// The registry epoch at which the index was last built.
+    unsigned frozenEpoch_{0};
+    /// First event ID of the registration range for entries_[numWildcard_ +
+    /// i]. Sorted.
+    std::vector<uint64_t> firsts_;
+    /// Sorted start points of the elementary intervals. The interval i
+    /// extends from bounds_[i] to bounds_[i + 1] - 1 (inclusive).
+    std::vector<uint64_t> bounds_;
+    /// hits_[offsets_[i]] .. hits_[offsets_[i + 1] - 1] are the registrations
+    /// that cover the elementary interval i. Has one more element than
+    /// bounds_.
+    std::vector<unsigned> offsets_;
+    /// Indexes into entries_ (offset by numWildcard_) of the registrations
+    /// covering each elementary interval.
+    std::vector<unsigned> hits_;
+};
+
 }; /* namespace openlcb */
 
 #endif  // _OPENLCB_EVENTHANDLERCONTAINER_HXX_
@@ -20,18 +20,20 @@ namespace openlcb
 /*static*/
 EventService *EventService::instance = nullptr;
 
-EventService::EventService(ExecutorBase *e) : Service(e)
+EventService::EventService(ExecutorBase *e, EventRegistry *registry)
+    : Service(e)
 {
     HASSERT(instance == nullptr);
     instance = this;
-    impl_.reset(new Impl(this));
+    impl_.reset(new Impl(this, registry));
 }
 
-EventService::EventService(If *iface) : Service(iface->executor())
+EventService::EventService(If *iface, EventRegistry *registry)
+    : Service(iface->executor())
 {
     HASSERT(instance == nullptr);
     instance = this;
-    impl_.reset(new Impl(this));
+    impl_.reset(new Impl(this, registry));
     register_interface(iface);
 }
 
@@ -54,8 +56,14 @@ void EventService::register_interface(If *iface)
         EventService::Impl::MTI_MASK_ADDRESSED_ALL));
 }
 
-EventService::Impl::Impl(EventService *service) : callerFlow_(service)
+EventService::Impl::Impl(EventService *service, EventRegistry *custom_registry)
+    : callerFlow_(service)
 {
+    if (custom_registry)
+    {
+        registry.reset(custom_registry);
+        return;
+    }
 #ifdef TARGET_LPC11Cxx
     registry.reset(new VectorEventHandlers());
 #else
@@ -103,6 +111,11 @@ EventIteratorFlow::~EventIteratorFlow()
     delete iterator_;
 }
 
+void EventService::enable_batch_calls()
+{
+    impl()->batchCalls_ = true;
+}
+
 /// Returns true if there are outstanding events that are not yet handled.
 bool EventService::event_processing_pending()
 {
@@ -226,6 +239,19 @@ StateFlowBase::Action EventIteratorFlow::entry()
         default:
             DIE("Unexpected message arrived at the global event handler.");
     } //    case
+
+    pendingFalsePositive_ = false;
+    if (rep->mask == 0)
+    {
+        EventRegistry *registry = eventService_->impl()->registry.get();
+        if (!registry->may_match(rep->event))
+        {
+            // No local handler can be interested in this event.
+            return release_and_exit();
+        }
+        pendingFalsePositive_ = registry->filter() != nullptr;
+    }
+
     // The incoming message is not needed anymore.
     incomingDone_ = message()->new_child();
     release();
@@ -249,30 +275,66 @@ StateFlowBase::Action EventIteratorFlow::iterate_next()
     EventRegistryEntry *entry = iterator_->next_entry();
     if (!entry)
     {
-        if (incomingDone_)
+        if (pendingFalsePositive_)
         {
-            incomingDone_->notify();
-            incomingDone_ = nullptr;
+            eventService_->impl()->registry->filter()->count_false_positive();
+            pendingFalsePositive_ = false;
         }
-
-#ifdef DEBUG_EVENT_PERFORMANCE
-        long long len = os_get_time_monotonic() - currentProcessStart_;
-        numProcessNsec_ += len;
-        countEvents_++;
-        if (countEvents_ >= REPORT_COUNT)
+        if (batchActive_)
         {
-            //long msec = numProcessNsec_ / 1000000;
-            //printf("event perf for mti %04x: %ld msec for %d events\n",
-            //       mtiValue_, msec, REPORT_COUNT);
-            countEvents_ = 0;
-            numProcessNsec_ = 0;
+            batchActive_ = false;
+            if (!batchN_.abort_if_almost_done())
+            {
+                // Some reentrant handlers are still running.
+                batchN_.notify();
+                return wait_and_call(STATE(iteration_done));
+            }
         }
+        return call_immediately(STATE(iteration_done));
+    }
+    pendingFalsePositive_ = false;
+    if (eventService_->impl()->batchCalls_ && entry->handler->is_reentrant())
+    {
+        batch_call(entry);
+        return call_immediately(STATE(iterate_next));
+    }
+    return dispatch_event(entry);
+}
 
-#endif
+void EventIteratorFlow::batch_call(const EventRegistryEntry *entry)
+{
+    if (!batchActive_)
+    {
+        batchN_.reset(this);
+        batchActive_ = true;
+    }
+    (entry->handler->*(fn_))(*entry, &eventReport_, batchN_.new_child());
+}
+
+StateFlowBase::Action EventIteratorFlow::iteration_done()
+{
+    if (incomingDone_)
+    {
+        incomingDone_->notify();
+        incomingDone_ = nullptr;
+    }
 
-        return exit();
+#ifdef DEBUG_EVENT_PERFORMANCE
+    long long len = os_get_time_monotonic() - currentProcessStart_;
+    numProcessNsec_ += len;
+    countEvents_++;
+    if (countEvents_ >= REPORT_COUNT)
+    {
+        //long msec = numProcessNsec_ / 1000000;
+        //printf("event perf for mti %04x: %ld msec for %d events\n",
+        //       mtiValue_, msec, REPORT_COUNT);
+        countEvents_ = 0;
+        numProcessNsec_ = 0;
     }
-    return dispatch_event(entry);
+
+#endif
+
+    return exit();
 }
 
 StateFlowBase::Action EventIteratorFlow::dispatch_event(const EventRegistryEntry *entry)
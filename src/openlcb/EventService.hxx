@@ -59,6 +59,7 @@ namespace openlcb
 class Node;
 
 class EventIteratorFlow;
+class EventRegistry;
 
 /// Global Event Service. Registers itself with a specific interface to receive
 /// all incoming messages related to the OpenLCB Event Protocol, maintains the
@@ -67,11 +68,19 @@ class EventIteratorFlow;
 class EventService : public Service
 {
 public:
-    /** Creates a global event service with no interfaces registered. */
-    EventService(ExecutorBase *e);
+    /** Creates a global event service with no interfaces registered.
+     * @param e is the executor to run the event service on.
+     * @param registry is the event registry implementation to use. The event
+     * service takes ownership. If nullptr, a default implementation is
+     * created. */
+    EventService(ExecutorBase *e, EventRegistry *registry = nullptr);
     /** Creates a global event service that runs on an interface's thread and
-     * registers the interface. */
-    EventService(If *iface);
+     * registers the interface.
+     * @param iface is the interface to register.
+     * @param registry is the event registry implementation to use. The event
+     * service takes ownership. If nullptr, a default implementation is
+     * created. */
+    EventService(If *iface, EventRegistry *registry = nullptr);
     ~EventService();
 
     /** Registers this global event handler with an interface. This operation
@@ -88,6 +97,19 @@ public:
      * handled. */
     bool event_processing_pending();
 
+    /** Enables batched invocation of reentrant event handlers (those
+     * returning true from EventHandler::is_reentrant()). For each incoming
+     * message all matching reentrant handlers are called in one executor
+     * pass without waiting for each other to complete, and the message is
+     * considered processed when all of them have notified their done
+     * callback. Non-reentrant handlers are still called one at a time.
+     *
+     * The calls are made inline on the event service's executor, so handler
+     * lifetime follows the same rules as for the regular calls.
+     *
+     * Must be called before any events arrive. */
+    void enable_batch_calls();
+
     static EventService *instance;
 
 private:
@@ -93,7 +93,10 @@ private:
 class EventService::Impl
 {
 public:
-    Impl(EventService *service);
+    /// @param service is the owning event service.
+    /// @param custom_registry is the event registry to use (ownership is
+    /// transferred), or nullptr to instantiate the default one.
+    Impl(EventService *service, EventRegistry *custom_registry);
     ~Impl();
 
     /// The implementation of the event registry.
@@ -107,6 +110,9 @@ public:
     /// calls need to be sent to this flow.
     EventCallerFlow callerFlow_;
 
+    /// True if reentrant event handlers should be called in batches.
+    bool batchCalls_{false};
+
     enum
     {
         // These address/mask should match all the messages carrying an event
@@ -134,10 +140,17 @@ public:
 protected:
     Action entry() OVERRIDE;
     Action iterate_next();
+    /// Called when all handlers for the current message are done.
+    Action iteration_done();
 
 private:
     virtual Action dispatch_event(const EventRegistryEntry *entry);
 
+    /// Calls a reentrant event handler as part of the current batch, without
+    /// waiting for it to complete.
+    /// @param entry is the registry entry to call.
+    void batch_call(const EventRegistryEntry *entry);
+
 protected:
     EventService *eventService_;
 
@@ -158,6 +171,15 @@ protected:
     BarrierNotifiable n_;
     EventHandlerFunction fn_;
 
+    /// True if the current event passed the registry pre-filter, but no
+    /// matching handler was found yet.
+    bool pendingFalsePositive_{false};
+    /// True if batchN_ is live for the current message.
+    bool batchActive_{false};
+    /// Barrier collecting the completion of the batch-called reentrant
+    /// handlers of the current message.
+    BarrierNotifiable batchN_;
+
 #ifdef DEBUG_EVENT_PERFORMANCE
     static const int REPORT_COUNT = 100;
     /// How many events' cost are accumulated so far.
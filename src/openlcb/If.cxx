@@ -34,18 +34,25 @@
 
 #include "openlcb/If.hxx"
 
-/// Ensures that the largest bucket in the main buffer pool is exactly the size
-/// of a GenMessage.
-const unsigned LARGEST_BUFFERPOOL_BUCKET = sizeof(Buffer<openlcb::GenMessage>);
+/// Size of a pool buffer holding a datagram-sized Payload spill chunk.
+static constexpr unsigned PAYLOAD_SPILL_BUFFER =
+    sizeof(Buffer<openlcb::PayloadChunk>) + openlcb::Payload::SPILL_CAPACITY + 1;
+
+/// Ensures that the largest bucket in the main buffer pool fits a GenMessage
+/// and a datagram-sized payload spill chunk.
+const unsigned LARGEST_BUFFERPOOL_BUCKET =
+    sizeof(Buffer<openlcb::GenMessage>) > PAYLOAD_SPILL_BUFFER
+    ? sizeof(Buffer<openlcb::GenMessage>)
+    : PAYLOAD_SPILL_BUFFER;
 
 namespace openlcb
 {
 
-string node_id_to_buffer(NodeID id)
+Payload node_id_to_buffer(NodeID id)
 {
     id = htobe64(id);
     const char *src = reinterpret_cast<const char *>(&id);
-    return string(src + 2, 6);
+    return Payload(src + 2, 6);
 }
 
 void node_id_to_data(NodeID id, void* buf)
@@ -62,7 +69,7 @@ NodeID data_to_node_id(const void* buf)
     return be64toh(d);
 }
 
-NodeID buffer_to_node_id(const string &buf)
+NodeID buffer_to_node_id(const Payload &buf)
 {
     HASSERT(buf.size() == 6);
     return data_to_node_id(buf.data());
@@ -71,7 +78,7 @@ NodeID buffer_to_node_id(const string &buf)
 Payload eventid_to_buffer(uint64_t eventid)
 {
     eventid = htobe64(eventid);
-    return string(reinterpret_cast<char*>(&eventid), 8);
+    return Payload(reinterpret_cast<char*>(&eventid), 8);
 }
 
 void error_to_data(uint16_t error_code, void* data) {
@@ -86,18 +93,18 @@ uint16_t data_to_error(const void *data)
     return (((uint16_t)p[0]) << 8) | p[1];
 }
 
-string error_to_buffer(uint16_t error_code, uint16_t mti)
+Payload error_to_buffer(uint16_t error_code, uint16_t mti)
 {
-    string ret(4, '\0');
+    Payload ret(4, '\0');
     error_to_data(error_code, &ret[0]);
     ret[2] = mti >> 8;
     ret[3] = mti & 0xff;
     return ret;
 }
 
-string error_to_buffer(uint16_t error_code)
+Payload error_to_buffer(uint16_t error_code)
 {
-    string ret(2, '\0');
+    Payload ret(2, '\0');
     error_to_data(error_code, &ret[0]);
     return ret;
 }
@@ -140,7 +147,7 @@ void send_event(Node* src_node, uint64_t event_id)
 }
 
 
-string EMPTY_PAYLOAD;
+Payload EMPTY_PAYLOAD;
 
 /*Buffer *node_id_to_buffer(NodeID id)
 {
@@ -40,6 +40,7 @@
 
 #include "openlcb/Node.hxx"
 #include "openlcb/Defs.hxx"
+#include "openlcb/Payload.hxx"
 #include "executor/Dispatcher.hxx"
 #include "executor/Service.hxx"
 #include "executor/Executor.hxx"
@@ -52,16 +53,13 @@ namespace openlcb
 
 class Node;
 
-/// Container that carries the data bytes in an NMRAnet message.
-typedef string Payload;
-
 /** Convenience function to render a 48-bit NMRAnet node ID into a new buffer.
  *
  * @param id is the 48-bit ID to render.
  * @returns a new buffer (from the main pool) with 6 bytes of used space, a
  * big-endian representation of the node ID.
  */
-extern string node_id_to_buffer(NodeID id);
+extern Payload node_id_to_buffer(NodeID id);
 /** Convenience function to render a 48-bit NMRAnet node ID into an existing
  * buffer.
  *
@@ -77,7 +75,7 @@ extern void node_id_to_data(NodeID id, void* data);
  * big-endian node id.
  * @returns the node id (in host endian).
  */
-extern NodeID buffer_to_node_id(const string& buf);
+extern NodeID buffer_to_node_id(const Payload& buf);
 /** Converts 6 bytes of big-endian data to a node ID.
  *
  * @param d is a pointer to at least 6 valid bytes.
@@ -98,11 +96,11 @@ inline uint64_t data_to_eventid(const void* data) {
 
 /** Formats a payload for response of error response messages such as OPtioanl
  * Interaction Rejected or Terminate Due To Error. */
-extern string error_to_buffer(uint16_t error_code, uint16_t mti);
+extern Payload error_to_buffer(uint16_t error_code, uint16_t mti);
 
 /** Formats a payload for response of error response messages such as Datagram
  * Rejected. */
-extern string error_to_buffer(uint16_t error_code);
+extern Payload error_to_buffer(uint16_t error_code);
 
 /** Writes an error code into a payload object at a given pointer. */
 extern void error_to_data(uint16_t error_code, void* data);
@@ -125,7 +123,7 @@ extern void append_error_to_buffer(uint16_t error_code, Payload* p);
 extern void buffer_to_error(const Payload& payload, uint16_t* error_code, uint16_t* mti, string* error_message);
 
 /** A global class / variable for empty or not-yet-initialized payloads. */
-extern string EMPTY_PAYLOAD;
+extern Payload EMPTY_PAYLOAD;
 
 /// @return the high 4 bytes of a node ID. @param id is the node ID.
 inline unsigned node_high(NodeID id) {
@@ -146,10 +144,10 @@ extern void send_event(Node* src_node, uint64_t event_id);
  * messages to the message handlers at the protocol-agnostic level (i.e. not
  * CAN or TCP-specific).
  *
- * TODO(balazs.racz) There shall be one instance of this class that will be
- * sent to all handlers that expressed interest in that MTI. When all those
- * handlers are done, the instance should be freed. Currently the instance is
- * copied by the dispatcher separately for each handler. */
+ * The dispatcher copies the instance for each handler, but the copies share
+ * the payload bytes through the reference count of Payload. Handlers that
+ * need a payload of their own are registered with private_copy = true; see
+ * dispatch_unshare(). */
 struct GenMessage
 {
     GenMessage()
@@ -160,7 +158,7 @@ struct GenMessage
         reset((Defs::MTI)0, 0, EMPTY_PAYLOAD);
     }
 
-    void reset(Defs::MTI mti, NodeID src, NodeHandle dst, string payload)
+    void reset(Defs::MTI mti, NodeID src, NodeHandle dst, Payload payload)
     {
         this->mti = mti;
         this->src = {src, 0};
@@ -171,7 +169,7 @@ struct GenMessage
         this->flagsDst = 0;
     }
 
-    void reset(Defs::MTI mti, NodeID src, string payload)
+    void reset(Defs::MTI mti, NodeID src, Payload payload)
     {
         this->mti = mti;
         this->src = {src, 0};
@@ -191,8 +189,7 @@ struct GenMessage
     /// If the destination node is local, this value is non-NULL.
     Node *dstNode;
     /// Data content in the message body. Owned by the dispatcher.
-    /// @todo(balazs.racz) figure out a better container.
-    string payload;
+    Payload payload;
 
     unsigned flagsSrc : 4;
     unsigned flagsDst : 4;
@@ -254,6 +251,14 @@ struct GenMessage
     };
 };
 
+/// Gives a dispatched message copy a payload that is not shared with the
+/// other copies. Used by the dispatcher for handlers registered with
+/// private_copy. @param m is the message copy.
+inline void dispatch_unshare(GenMessage *m)
+{
+    m->payload.unshare();
+}
+
 /// Interface class for all handlers that can be registered in the dispatcher
 /// to receive incoming NMRAnet messages.
 typedef FlowInterface<Buffer<GenMessage>> MessageHandler;
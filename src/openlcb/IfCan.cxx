@@ -40,6 +40,7 @@
 #include "openlcb/IfCanImpl.hxx"
 #include "openlcb/CanDefs.hxx"
 #include "can_frame.h"
+#include "nmranet_config.h"
 
 namespace openlcb
 {
@@ -219,7 +220,9 @@ public:
                     if_can()->remote_aliases()->lookup(node_id);
                 if (old_alias == alias)
                 {
-                    // No change.
+                    // No change. This confirms a mapping restored from a
+                    // snapshot.
+                    if_can()->remote_aliases()->confirm(alias);
                     return release_and_exit();
                 }
                 if (old_alias)
@@ -494,6 +497,14 @@ public:
         // This will be zero if the alias is not known.
         m->src.id =
             m->src.alias ? if_can()->remote_aliases()->lookup(m->src.alias) : 0;
+        // The lowest bit of these MTIs is the simple protocol flag.
+        unsigned mti = m->mti & ~1;
+        if (m->src.id && m->payload.size() == 6 &&
+            (mti == Defs::MTI_VERIFIED_NODE_ID_NUMBER ||
+                mti == Defs::MTI_INITIALIZATION_COMPLETE))
+        {
+            check_remote_mapping(m);
+        }
         if (!m->src.id && m->src.alias)
         {
             m->src.id = if_can()->local_aliases()->lookup(m->src.alias);
@@ -502,11 +513,34 @@ public:
         return exit();
     }
 
+    /// Compares a verified node ID message to the remote alias cache. Confirms
+    /// or replaces the cached mapping of the source alias.
+    /// @param m the incoming message, with src filled in from the cache.
+    void check_remote_mapping(GenMessage *m)
+    {
+        NodeID id = buffer_to_node_id(m->payload);
+        AliasCache *cache = if_can()->remote_aliases();
+        if (id == m->src.id)
+        {
+            cache->confirm(m->src.alias);
+            return;
+        }
+        // The cached mapping is stale (e.g. restored from a snapshot).
+        cache->remove(m->src.alias);
+        NodeAlias old_alias = cache->lookup(id);
+        if (old_alias)
+        {
+            cache->remove(old_alias);
+        }
+        cache->add(id, m->src.alias);
+        m->src.id = id;
+    }
+
 private:
     /// CAN frame ID, saved from the incoming frame.
     uint32_t id_;
     /// Payload for the MTI message.
-    string buf_;
+    Payload buf_;
 };
 
 /** This class listens for incoming CAN frames of regular addressed OpenLCB
@@ -649,7 +683,7 @@ public:
 
 private:
     uint32_t id_;
-    string buf_;
+    Payload buf_;
     NodeHandle dstHandle_;
     /// Reassembly buffers for multi-frame messages.
     StlMap<uint32_t, Payload> pendingBuffers_;
@@ -661,7 +695,8 @@ IfCan::IfCan(ExecutorBase *executor, CanHubFlow *device,
     : If(executor, local_nodes_count)
     , CanIf(this, device)
     , localAliases_(0, local_alias_cache_size)
-    , remoteAliases_(0, remote_alias_cache_size)
+    , remoteAliases_(0, remote_alias_cache_size, NULL, NULL,
+          config_remote_alias_cache_hash_index() == CONSTANT_TRUE)
 {
     auto *gflow = new GlobalCanMessageWriteFlow(this);
     globalWriteFlow_ = gflow;
@@ -167,12 +167,13 @@ private:
         return src_alias_lookup_done();
     }
 
-    Action src_alias_lookup_done()
+protected:
+    /// Called when the source alias is known. @return next state.
+    virtual Action src_alias_lookup_done()
     {
         return call_immediately(STATE(get_can_frame_buffer));
     }
 
-protected:
     Action get_can_frame_buffer()
     {
         return allocate_and_call(if_can()->frame_write_flow(),
@@ -202,7 +203,7 @@ private:
                           CanDefs::NORMAL_PRIORITY);
         SET_CAN_FRAME_ID_EFF(*f, can_id);
 
-        const string &data = nmsg()->payload;
+        const Payload &data = nmsg()->payload;
         bool need_more_frames = false;
         // Sets the destination bytes if needed. Adds the payload.
         if (Defs::get_mti_address(nmsg()->mti))
@@ -263,6 +264,7 @@ class AddressedCanMessageWriteFlow : public CanMessageWriteFlow
 public:
     AddressedCanMessageWriteFlow(IfCan *if_can)
         : CanMessageWriteFlow(if_can)
+        , verifyDst_(0)
         , timer_(this)
     {
     }
@@ -288,6 +290,7 @@ protected:
             // messages. Longer data usually travels via datagrams or streams.
             HASSERT(nmsg()->payload.size() < 256);
         }
+        verifyDst_ = 0;
         NodeHandle &dst_ = nmsg()->dst;
         HASSERT(dst_.id || dst_.alias); // We must have some kind of address.
         if (dst_.id)
@@ -301,6 +304,11 @@ protected:
                     nmsg()->dst.id);
                 return call_immediately(STATE(send_finished));
             }
+            // A mapping restored from a snapshot is used right away, but we
+            // ask the bus to confirm it. The AMD reply confirms or replaces
+            // the cache entry (see RemoteAliasCacheUpdater).
+            verifyDst_ = dstAlias_ &&
+                !if_can()->remote_aliases()->is_verified(dstAlias_);
         }
         else if (dst_.alias)
         {
@@ -340,6 +348,30 @@ protected:
         }
     }
 
+    Action src_alias_lookup_done() override
+    {
+        if (verifyDst_)
+        {
+            return allocate_and_call(
+                if_can()->frame_write_flow(), STATE(send_verify_ame_frame));
+        }
+        return call_immediately(STATE(get_can_frame_buffer));
+    }
+
+    /// Sends an AME frame for a destination whose cached alias was not yet
+    /// seen on the bus, then continues with sending the message.
+    Action send_verify_ame_frame()
+    {
+        auto *b = get_allocation_result(if_can()->frame_write_flow());
+        struct can_frame *f = b->data()->mutable_frame();
+        CanDefs::control_init(*f, srcAlias_, CanDefs::AME_FRAME, 0);
+        f->can_dlc = 6;
+        uint64_t rd = htobe64(nmsg()->dst.id);
+        memcpy(f->data, reinterpret_cast<uint8_t *>(&rd) + 2, 6);
+        if_can()->frame_write_flow()->send(b);
+        return call_immediately(STATE(get_can_frame_buffer));
+    }
+
     Action find_remote_alias()
     {
         aliasListener_.RegisterLocalHandler();
@@ -506,6 +538,8 @@ protected:
 
     friend class AliasDefListener;
 
+    /// 1 if the destination alias came from an unverified cache entry.
+    unsigned verifyDst_ : 1;
     StateFlowTimer timer_;
 };
 } // namespace openlcb
@@ -34,10 +34,14 @@
 
 #include "openlcb/MemoryConfig.hxx"
 
+#include <algorithm>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include "nmranet_config.h"
+#include "openlcb/ConfigEntry.hxx"
 #include "openmrn_features.h"
 #include "utils/logging.h"
 #ifdef __FreeRTOS__
@@ -65,6 +69,63 @@ void reboot()
 namespace openlcb
 {
 
+long long MEMORY_CONFIG_SESSION_TIMEOUT_NSEC = SEC_TO_NSEC(1);
+
+void memory_config_report_write(uint8_t space_number, MemorySpace *space,
+    MemorySpace::address_t address, size_t len)
+{
+    if (!len || !Singleton<ConfigUpdateService>::exists())
+    {
+        return;
+    }
+    ConfigUpdateService *s = Singleton<ConfigUpdateService>::instance();
+    MemorySpace::address_t offset;
+    if (space_number == MemoryConfigDefs::SPACE_CONFIG &&
+        space->config_file_offset(address, &offset))
+    {
+        s->config_written(offset, len);
+    }
+    else
+    {
+        // We do not know how this space maps to the config file.
+        s->config_written(0, UINT_MAX);
+    }
+}
+
+size_t MemorySpace::read_bulk(
+    const Range *ranges, unsigned count, errorcode_t *error, Notifiable *again)
+{
+    size_t total = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        size_t ret =
+            read(ranges[i].address, ranges[i].data, ranges[i].len, error, again);
+        total += ret;
+        if (*error || ret < ranges[i].len)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+size_t MemorySpace::write_bulk(
+    const Range *ranges, unsigned count, errorcode_t *error, Notifiable *again)
+{
+    size_t total = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        size_t ret = write(
+            ranges[i].address, ranges[i].data, ranges[i].len, error, again);
+        total += ret;
+        if (*error || ret < ranges[i].len)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
 FileMemorySpace::FileMemorySpace(int fd, address_t len)
     : fileSize_(len)
     , name_(nullptr)
@@ -132,7 +193,19 @@ size_t FileMemorySpace::write(address_t destination, const uint8_t *data,
         *error = Defs::ERROR_PERMANENT;
         return 0;
     }
-    else if ((size_t)ret < len)
+    if (cacheLen_)
+    {
+        // Write-through to the overlapping part of the readahead window.
+        address_t begin = std::max(destination, cacheStart_);
+        address_t end = std::min(
+            address_t(destination + ret), address_t(cacheStart_ + cacheLen_));
+        if (begin < end)
+        {
+            memcpy(cache_.get() + (begin - cacheStart_),
+                data + (begin - destination), end - begin);
+        }
+    }
+    if ((size_t)ret < len)
     {
 #ifdef __FreeRTOS__
         *error = ERROR_AGAIN;
@@ -155,12 +228,6 @@ size_t FileMemorySpace::read(address_t destination, uint8_t *dst, size_t len,
         *error = Defs::ERROR_PERMANENT;
         return 0;
     }
-    off_t actual_position = lseek(fd_, destination, SEEK_SET);
-    if ((address_t)actual_position != destination)
-    {
-        *error = Defs::ERROR_PERMANENT;
-        return 0;
-    }
     if (destination >= fileSize_)
     {
         *error = MemoryConfigDefs::ERROR_OUT_OF_BOUNDS;
@@ -170,7 +237,12 @@ size_t FileMemorySpace::read(address_t destination, uint8_t *dst, size_t len,
     {
         len = fileSize_ - destination;
     }
-    ssize_t ret = ::read(fd_, dst, len);
+    if (len < cacheSize_ && fill_readahead(destination, len))
+    {
+        memcpy(dst, cache_.get() + (destination - cacheStart_), len);
+        return len;
+    }
+    ssize_t ret = read_file(destination, dst, len);
     if (ret < 0)
     {
         LOG(INFO, "Error reading from fd %d: %s", fd_, strerror(errno));
@@ -191,4 +263,476 @@ size_t FileMemorySpace::read(address_t destination, uint8_t *dst, size_t len,
     }
 }
 
+size_t FileMemorySpace::read_bulk(
+    const Range *ranges, unsigned count, errorcode_t *error, Notifiable *again)
+{
+    ensure_file_open();
+    if (!cacheSize_ || !count || fd_ < 0)
+    {
+        return MemorySpace::read_bulk(ranges, count, error, again);
+    }
+    address_t begin = ranges[0].address;
+    address_t end = begin;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (ranges[i].address < end)
+        {
+            // Not in ascending order.
+            return MemorySpace::read_bulk(ranges, count, error, again);
+        }
+        end = ranges[i].address + ranges[i].len;
+    }
+    if (end > fileSize_ || end - begin >= cacheSize_ ||
+        !fill_readahead(begin, end - begin))
+    {
+        return MemorySpace::read_bulk(ranges, count, error, again);
+    }
+    size_t total = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        memcpy(ranges[i].data, cache_.get() + (ranges[i].address - cacheStart_),
+            ranges[i].len);
+        total += ranges[i].len;
+    }
+    return total;
+}
+
+ssize_t FileMemorySpace::read_file(address_t offset, uint8_t *dst, size_t len)
+{
+    if (lseek(fd_, offset, SEEK_SET) != (off_t)offset)
+    {
+        return -1;
+    }
+    return ::read(fd_, dst, len);
+}
+
+bool FileMemorySpace::fill_readahead(address_t source, size_t len)
+{
+    long long now = os_get_time_monotonic();
+    unsigned generation = ConfigEntryBase::write_generation();
+    if (cacheLen_ &&
+        (now - cacheTime_ > cacheMaxAge_ || generation != cacheGeneration_))
+    {
+        cacheLen_ = 0;
+    }
+    if (cacheLen_ && source >= cacheStart_ &&
+        source + len <= cacheStart_ + cacheLen_)
+    {
+        return true;
+    }
+    cacheLen_ = 0;
+    if (!cache_)
+    {
+        cache_.reset(new uint8_t[cacheSize_]);
+    }
+    size_t fill = std::min(cacheSize_, size_t(fileSize_ - source));
+    ssize_t ret = read_file(source, cache_.get(), fill);
+    if (ret < (ssize_t)len)
+    {
+        // Errors and partial reads are reported by the direct path.
+        return false;
+    }
+    cacheStart_ = source;
+    cacheLen_ = ret;
+    cacheTime_ = now;
+    cacheGeneration_ = generation;
+    return true;
+}
+
+void FileMemorySpace::set_readahead(size_t size, long long max_age_nsec)
+{
+    cacheSize_ = size;
+    cacheMaxAge_ = max_age_nsec;
+    end_session();
+}
+
+void FileMemorySpace::end_session()
+{
+    cache_.reset();
+    cacheLen_ = 0;
+}
+
+MemoryConfigStreamFlow::MemoryConfigStreamFlow(
+    DatagramService *dg, StreamService *streams)
+    : StateFlowBase(dg)
+    , dgService_(dg)
+    , streamService_(streams)
+{
+}
+
+void MemoryConfigStreamFlow::start(Node *node, NodeHandle remote,
+    MemorySpace *space, const DatagramPayload &cmd)
+{
+    HASSERT(!is_busy());
+    node_ = node;
+    remote_ = remote;
+    space_ = space;
+    unsigned ofs = MemoryConfigDefs::get_payload_offset(cmd);
+    header_.assign(cmd.data(), ofs);
+    address_ = MemoryConfigDefs::get_address(cmd);
+    const uint8_t *bytes = MemoryConfigDefs::payload_bytes(cmd);
+    if ((bytes[1] & MemoryConfigDefs::COMMAND_MASK) ==
+        MemoryConfigDefs::COMMAND_READ_STREAM)
+    {
+        // bytes[ofs] is the source stream ID, which is ours to assign.
+        remoteStreamId_ = bytes[ofs + 1];
+        remaining_ = 0;
+        if (cmd.size() >= ofs + 6)
+        {
+            remaining_ = bytes[ofs + 2];
+            remaining_ <<= 8;
+            remaining_ |= bytes[ofs + 3];
+            remaining_ <<= 8;
+            remaining_ |= bytes[ofs + 4];
+            remaining_ <<= 8;
+            remaining_ |= bytes[ofs + 5];
+        }
+        start_flow(STATE(read_stream));
+    }
+    else
+    {
+        remoteStreamId_ = bytes[ofs];
+        start_flow(STATE(write_stream));
+    }
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_stream()
+{
+    space_->set_node(node_);
+    if (address_ < space_->min_address() || address_ > space_->max_address())
+    {
+        return send_failure(MemoryConfigDefs::COMMAND_READ_STREAM_FAILED,
+            MemoryConfigDefs::ERROR_OUT_OF_BOUNDS);
+    }
+    // A length of zero reads until the end of the space.
+    uint64_t available = (uint64_t)space_->max_address() - address_ + 1;
+    if (!remaining_ || remaining_ > available)
+    {
+        remaining_ = available;
+    }
+    return allocate_and_call(
+        STATE(read_sender_allocated), streamService_->sender_allocator());
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_sender_allocated()
+{
+    sender_ = full_allocation_result(streamService_->sender_allocator());
+    set_reply_header(MemoryConfigDefs::COMMAND_READ_STREAM_REPLY);
+    reply_.push_back(sender_->local_stream_id());
+    reply_.push_back(remoteStreamId_);
+    uint32_t len = remaining_;
+    reply_.push_back(0xff & (len >> 24));
+    reply_.push_back(0xff & (len >> 16));
+    reply_.push_back(0xff & (len >> 8));
+    reply_.push_back(0xff & len);
+    return send_reply(STATE(read_reply_sent));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_reply_sent()
+{
+    if (!(dgResult_ & DatagramClient::OPERATION_SUCCESS))
+    {
+        LOG(WARNING, "MemoryConfig: Failed to send stream read reply. error "
+                     "code %x",
+            (unsigned)dgResult_);
+        return call_immediately(STATE(finish));
+    }
+    return invoke_subflow_and_wait(sender_, STATE(read_stream_opened),
+        StreamSendRequest::OPEN, node_, remote_,
+        (uint16_t)config_memory_config_stream_buffer_size(),
+        STREAM_TIMEOUT_NSEC, remoteStreamId_);
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_stream_opened()
+{
+    auto b = get_buffer_deleter(full_allocation_result(sender_));
+    if (b->data()->resultCode)
+    {
+        LOG(WARNING, "MemoryConfig: Failed to open stream for read. error "
+                     "code %x",
+            (unsigned)b->data()->resultCode);
+        return call_immediately(STATE(finish));
+    }
+    return call_immediately(STATE(read_chunk));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_chunk()
+{
+    if (!remaining_)
+    {
+        return call_immediately(STATE(close_stream));
+    }
+    size_t len = config_memory_config_stream_buffer_size();
+    if (remaining_ < len)
+    {
+        len = remaining_;
+    }
+    data_.resize(len);
+    filled_ = 0;
+    return call_immediately(STATE(try_read));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::try_read()
+{
+    errorcode_t error = 0;
+    space_->set_node(node_);
+    MemorySpace::Range range = {address_ + filled_, (uint8_t *)&data_[filled_],
+        data_.size() - filled_};
+    size_t count = space_->read_bulk(&range, 1, &error, this);
+    filled_ += count;
+    if (error == MemorySpace::ERROR_AGAIN)
+    {
+        return wait();
+    }
+    if (!error && count && filled_ < data_.size())
+    {
+        return again();
+    }
+    if (error || filled_ < data_.size())
+    {
+        if (error && error != MemoryConfigDefs::ERROR_OUT_OF_BOUNDS)
+        {
+            LOG(WARNING, "MemoryConfig: Stream read from address 0x%x "
+                         "failed. error code %x",
+                (unsigned)(address_ + filled_), (unsigned)error);
+        }
+        // Sends what we have, then closes the stream.
+        data_.resize(filled_);
+        remaining_ = filled_;
+        if (!filled_)
+        {
+            return call_immediately(STATE(close_stream));
+        }
+    }
+    return invoke_subflow_and_wait(sender_, STATE(read_chunk_sent),
+        StreamSendRequest::WRITE, std::move(data_));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::read_chunk_sent()
+{
+    auto b = get_buffer_deleter(full_allocation_result(sender_));
+    if (b->data()->resultCode)
+    {
+        LOG(WARNING, "MemoryConfig: Failed to send stream data. error code %x",
+            (unsigned)b->data()->resultCode);
+        return call_immediately(STATE(close_stream));
+    }
+    address_ += filled_;
+    remaining_ -= filled_;
+    return call_immediately(STATE(read_chunk));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::close_stream()
+{
+    return invoke_subflow_and_wait(
+        sender_, STATE(stream_closed), StreamSendRequest::CLOSE);
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::stream_closed()
+{
+    auto b = get_buffer_deleter(full_allocation_result(sender_));
+    return call_immediately(STATE(finish));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::write_stream()
+{
+    return allocate_and_call(STATE(write_receiver_allocated),
+        streamService_->receiver_allocator());
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::write_receiver_allocated()
+{
+    receiver_ = full_allocation_result(streamService_->receiver_allocator());
+    error_ = 0;
+    data_.clear();
+    // The receiver has to be listening by the time the remote node gets our
+    // reply and opens the stream.
+    mainBufferPool->alloc(&receiveRequest_);
+    receiveRequest_->data()->reset(StreamReceiveRequest::ACCEPT, node_,
+        remote_, remoteStreamId_, &sink_,
+        (uint16_t)config_memory_config_stream_buffer_size());
+    receiveRequest_->data()->done.reset(n_.reset(this)->new_child());
+    receiver_->send(receiveRequest_->ref());
+
+    set_reply_header(MemoryConfigDefs::COMMAND_WRITE_STREAM_REPLY);
+    reply_.push_back(remoteStreamId_);
+    reply_.push_back(receiver_->local_stream_id());
+    return send_reply(STATE(write_reply_sent));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::write_reply_sent()
+{
+    if (!(dgResult_ & DatagramClient::OPERATION_SUCCESS))
+    {
+        // The receiver will time out waiting for the stream.
+        LOG(WARNING, "MemoryConfig: Failed to send stream write reply. error "
+                     "code %x",
+            (unsigned)dgResult_);
+    }
+    n_.notify();
+    return wait_and_call(STATE(write_stream_done));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::write_stream_done()
+{
+    if (receiveRequest_->data()->resultCode)
+    {
+        LOG(WARNING, "MemoryConfig: Stream write failed. error code %x",
+            (unsigned)receiveRequest_->data()->resultCode);
+    }
+    // Writes out the last partial chunk.
+    Buffer<GenMessage> *b;
+    mainBufferPool->alloc(&b);
+    b->data()->payload.clear();
+    b->set_done(n_.reset(this));
+    sink_.send(b);
+    return wait_and_call(STATE(write_flushed));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::write_flushed()
+{
+    if (error_)
+    {
+        return send_failure(
+            MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED, error_);
+    }
+    return call_immediately(STATE(finish));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::send_failure(
+    uint8_t cmd, errorcode_t error)
+{
+    set_reply_header(cmd);
+    reply_.push_back(error >> 8);
+    reply_.push_back(error & 0xff);
+    return send_reply(STATE(finish));
+}
+
+void MemoryConfigStreamFlow::set_reply_header(uint8_t cmd)
+{
+    reply_ = header_;
+    reply_[1] = cmd | (header_[1] & ~MemoryConfigDefs::COMMAND_MASK);
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::send_reply(Callback c)
+{
+    afterReply_ = c;
+    return allocate_and_call(
+        STATE(reply_client_allocated), dgService_->client_allocator());
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::reply_client_allocated()
+{
+    dgClient_ = full_allocation_result(dgService_->client_allocator());
+    return allocate_and_call(
+        dgService_->iface()->dispatcher(), STATE(send_reply_datagram));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::send_reply_datagram()
+{
+    auto *b = get_allocation_result(dgService_->iface()->dispatcher());
+    b->set_done(dgDone_.reset(this));
+    b->data()->reset(
+        Defs::MTI_DATAGRAM, node_->node_id(), remote_, EMPTY_PAYLOAD);
+    b->data()->payload.swap(reply_);
+    dgClient_->write_datagram(b);
+    return wait_and_call(STATE(reply_sent));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::reply_sent()
+{
+    dgResult_ = dgClient_->result();
+    dgService_->client_allocator()->typed_insert(dgClient_);
+    dgClient_ = nullptr;
+    return call_immediately(afterReply_);
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::finish()
+{
+    if (sender_)
+    {
+        streamService_->sender_allocator()->typed_insert(sender_);
+        sender_ = nullptr;
+    }
+    if (receiver_)
+    {
+        streamService_->receiver_allocator()->typed_insert(receiver_);
+        receiver_ = nullptr;
+    }
+    if (receiveRequest_)
+    {
+        receiveRequest_->unref();
+        receiveRequest_ = nullptr;
+    }
+    // Releases the chunk buffer until the next transfer.
+    string().swap(data_);
+    if (space_)
+    {
+        space_->end_session();
+    }
+    return exit();
+}
+
+MemoryConfigStreamFlow::DataSink::DataSink(MemoryConfigStreamFlow *parent)
+    : StateFlow<Buffer<GenMessage>, QList<1>>(parent->service())
+    , parent_(parent)
+{
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::DataSink::entry()
+{
+    const Payload &payload = message()->data()->payload;
+    if (parent_->error_)
+    {
+        // Drops the rest of the stream after a failed write.
+        return release_and_exit();
+    }
+    parent_->data_.append(payload);
+    if (!payload.empty() &&
+        parent_->data_.size() < (size_t)config_memory_config_stream_buffer_size())
+    {
+        return release_and_exit();
+    }
+    parent_->filled_ = 0;
+    return call_immediately(STATE(try_write));
+}
+
+StateFlowBase::Action MemoryConfigStreamFlow::DataSink::try_write()
+{
+    MemoryConfigStreamFlow *p = parent_;
+    errorcode_t error = 0;
+    if (p->filled_ < p->data_.size())
+    {
+        p->space_->set_node(p->node_);
+        size_t count = p->space_->write(p->address_,
+            (const uint8_t *)p->data_.data() + p->filled_,
+            p->data_.size() - p->filled_, &error, this);
+        memory_config_report_write(MemoryConfigDefs::get_space(p->header_),
+            p->space_, p->address_, count);
+        p->filled_ += count;
+        p->address_ += count;
+        if (error == MemorySpace::ERROR_AGAIN)
+        {
+            return wait();
+        }
+        if (!error && p->filled_ < p->data_.size())
+        {
+            if (count)
+            {
+                return again();
+            }
+            error = MemoryConfigDefs::ERROR_OUT_OF_BOUNDS;
+        }
+    }
+    if (error)
+    {
+        LOG(WARNING, "MemoryConfig: Stream write to address 0x%x failed. "
+                     "error code %x",
+            (unsigned)p->address_, (unsigned)error);
+        p->error_ = error;
+    }
+    p->data_.clear();
+    return release_and_exit();
+}
+
 } // namespace openlcb
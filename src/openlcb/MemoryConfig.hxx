@@ -39,6 +39,7 @@
 #include "openlcb/DatagramDefs.hxx"
 #include "openlcb/DatagramHandlerDefault.hxx"
 #include "openlcb/MemoryConfig.hxx"
+#include "openlcb/Stream.hxx"
 #include "utils/Destructable.hxx"
 #include "utils/ConfigUpdateService.hxx"
 
@@ -55,6 +56,10 @@ extern void reboot();
 namespace openlcb
 {
 
+/// The MemoryConfigHandler calls MemorySpace::end_session() when no datagram
+/// read arrived for a memory space for this long.
+extern long long MEMORY_CONFIG_SESSION_TIMEOUT_NSEC;
+
 /// Static constants and helper functions related to the Memory Configuration
 /// Protocol.
 struct MemoryConfigDefs {
@@ -78,6 +83,8 @@ struct MemoryConfigDefs {
         COMMAND_READ_REPLY        = 0x50, /**< reply to read data from address space */
         COMMAND_READ_FAILED       = 0x58, /**< failed to read data from address space */
         COMMAND_READ_STREAM       = 0x60, /**< command to read data using a stream */
+        COMMAND_READ_STREAM_REPLY = 0x70, /**< reply to read data using a stream */
+        COMMAND_READ_STREAM_FAILED= 0x78, /**< failed to read data using a stream */
         COMMAND_MAX_FOR_RW        = 0x80, /**< command <= this value have fixed bit arrangement. */
         COMMAND_OPTIONS           = 0x80,
         COMMAND_OPTIONS_REPLY     = 0x82,
@@ -202,6 +209,63 @@ struct MemoryConfigDefs {
         return p;
     }
 
+    /// Creates a read stream command datagram.
+    /// @param space is the memory space to read from.
+    /// @param offset is the address of the first byte to read.
+    /// @param dst_stream_id is the stream ID at the requester the data
+    /// should be sent to.
+    /// @param length is the number of bytes to read; 0 reads until the end of
+    /// the memory space.
+    static DatagramPayload read_stream_datagram(uint8_t space,
+        uint32_t offset, uint8_t dst_stream_id, uint32_t length = 0)
+    {
+        DatagramPayload p;
+        p.reserve(13);
+        p.push_back(DatagramDefs::CONFIGURATION);
+        p.push_back(COMMAND_READ_STREAM);
+        p.push_back(0xff & (offset >> 24));
+        p.push_back(0xff & (offset >> 16));
+        p.push_back(0xff & (offset >> 8));
+        p.push_back(0xff & (offset));
+        if (is_special_space(space)) {
+            p[1] |= space & ~SPACE_SPECIAL;
+        } else {
+            p.push_back(space);
+        }
+        p.push_back(0xff); // source stream ID, assigned by the sender
+        p.push_back(dst_stream_id);
+        p.push_back(0xff & (length >> 24));
+        p.push_back(0xff & (length >> 16));
+        p.push_back(0xff & (length >> 8));
+        p.push_back(0xff & (length));
+        return p;
+    }
+
+    /// Creates a write stream command datagram.
+    /// @param space is the memory space to write to.
+    /// @param offset is the address of the first byte to write.
+    /// @param src_stream_id is the stream ID at the requester that the data
+    /// will be sent from.
+    static DatagramPayload write_stream_datagram(
+        uint8_t space, uint32_t offset, uint8_t src_stream_id)
+    {
+        DatagramPayload p;
+        p.reserve(8);
+        p.push_back(DatagramDefs::CONFIGURATION);
+        p.push_back(COMMAND_WRITE_STREAM);
+        p.push_back(0xff & (offset >> 24));
+        p.push_back(0xff & (offset >> 16));
+        p.push_back(0xff & (offset >> 8));
+        p.push_back(0xff & (offset));
+        if (is_special_space(space)) {
+            p[1] |= space & ~SPACE_SPECIAL;
+        } else {
+            p.push_back(space);
+        }
+        p.push_back(src_stream_id);
+        return p;
+    }
+
     /// @return true if the payload has minimum number of bytes you need in a
     /// read or write datagram message to cover for the necessary fields
     /// (command, offset, space).
@@ -336,6 +400,49 @@ public:
     virtual size_t read(address_t source, uint8_t *dst, size_t len,
                         errorcode_t *error, Notifiable *again) = 0;
 
+    /// One address range of a bulk (scatter/gather) operation.
+    struct Range
+    {
+        /// First address of the range in this memory space.
+        address_t address;
+        /// Data buffer; read_bulk fills it in, write_bulk takes the data
+        /// from it.
+        uint8_t *data;
+        /// Number of bytes in the range.
+        size_t len;
+    };
+
+    /** Reads a list of ranges in one call. The default implementation calls
+     * read() for each range in turn; implementations backed by slow storage
+     * may override it to coalesce the accesses. The memory config datagram
+     * and stream read paths use this call.
+     *
+     * @param ranges array of the ranges to fill in.
+     * @param count number of entries in ranges.
+     * @param error same as for read(). On error the operation stops at the
+     * failing range.
+     * @param again same as for read().
+     * @return the total number of bytes read across the ranges (in order). On
+     * ERROR_AGAIN the caller should call read_bulk once more with the ranges
+     * adjusted by the previously returned bytes. */
+    virtual size_t read_bulk(const Range *ranges, unsigned count,
+                             errorcode_t *error, Notifiable *again);
+
+    /** Writes a list of ranges in one call. Semantics are the same as for
+     * read_bulk(), but the data is taken from the ranges and written using
+     * write(). */
+    virtual size_t write_bulk(const Range *ranges, unsigned count,
+                              errorcode_t *error, Notifiable *again);
+
+    /** Notifies the memory space that a sequence of accesses is over. The
+     * MemoryConfigHandler calls this when a stream transfer is done, and when
+     * no datagram read arrived for the space for
+     * MEMORY_CONFIG_SESSION_TIMEOUT_NSEC. Implementations that cache data
+     * for sequential access should drop the cache here. */
+    virtual void end_session()
+    {
+    }
+
     /** Handles space freeze command. Returns an error code, or 0 for
      * success. */
     virtual errorcode_t freeze() {
@@ -347,8 +454,34 @@ public:
     virtual errorcode_t unfreeze() {
         return Defs::ERROR_INVALID_ARGS;
     }
+
+    /** Maps an address of this space to the offset of the same byte in the
+     * configuration file (the one the ConfigUpdateListeners read). Used for
+     * telling the listeners which part of the configuration was written.
+     * @param address is an address in this space.
+     * @param offset will be filled with the file offset.
+     * @return true if the address maps to the configuration file, false if
+     * the mapping is not known (this is the default). */
+    virtual bool config_file_offset(address_t address, address_t *offset)
+    {
+        return false;
+    }
 };
 
+/// Reports a write to a memory space to the ConfigUpdateService (if there is
+/// one), so that the next update complete command only re-applies the config
+/// listeners that are affected. Writes to SPACE_CONFIG are reported with the
+/// file range given by MemorySpace::config_file_offset(). Writes to other
+/// spaces, or to a config space that cannot tell its file offsets, mark the
+/// entire configuration as changed.
+///
+/// @param space_number the memory space number that was written.
+/// @param space the memory space object that was written.
+/// @param address first address written.
+/// @param len number of bytes written.
+void memory_config_report_write(uint8_t space_number, MemorySpace *space,
+    MemorySpace::address_t address, size_t len);
+
 /// Memory space implementation that exports a some memory-mapped data as a
 /// read-only memory space. The data must be given as a const void* pointer,
 /// which can point both to RAM or flash (either rodata or specific flash
@@ -505,13 +638,70 @@ public:
     size_t read(address_t source, uint8_t *dst, size_t len, errorcode_t *error,
                 Notifiable *again) OVERRIDE;
 
+    /** If readahead is enabled and the ranges are in ascending order and fit
+     * into the readahead window together, fills all of them from a single
+     * file read. Otherwise reads them one by one. */
+    size_t read_bulk(const Range *ranges, unsigned count, errorcode_t *error,
+                     Notifiable *again) OVERRIDE;
+
+    void end_session() OVERRIDE;
+
+    /** The space addresses are the file offsets. @return true. */
+    bool config_file_offset(address_t address, address_t *offset) OVERRIDE
+    {
+        *offset = address;
+        return true;
+    }
+
+    /** Enables a readahead window. Reads shorter than the window are served
+     * from a RAM copy of the file, which is filled with a single read of up
+     * to @param size bytes. This way a sequential scan in small steps (such
+     * as 64-byte datagram reads) hits the file once per window. Writes
+     * through this object update the cached copy, and writes through a
+     * ConfigEntry discard it (see ConfigEntryBase::write_generation()). The
+     * buffer is allocated at the first read and released in end_session().
+     *
+     * @param max_age_nsec the cached data is discarded this long after it
+     * was read from the file. This bounds how long changes made with raw
+     * writes to the file descriptor can remain invisible.
+     *
+     * A size of 0 disables the readahead (this is the default). */
+    void set_readahead(size_t size, long long max_age_nsec = SEC_TO_NSEC(1));
+
 private:
     /** Makes fd a valid parameter, and ensures fileSize is filled in. */
     void ensure_file_open();
 
+    /** Reads from the file (one lseek and one read call).
+     * @param offset is the file offset to read from.
+     * @param dst is where to put the data.
+     * @param len is the number of bytes to read.
+     * @return the number of bytes read, or -1 on error. */
+    ssize_t read_file(address_t offset, uint8_t *dst, size_t len);
+
+    /** Ensures that the readahead window covers [source, source + len).
+     * @return true if the window is valid, false if the caller has to read
+     * the file directly. */
+    bool fill_readahead(address_t source, size_t len);
+
     address_t fileSize_;
     const char *name_;
     int fd_;
+
+    /// Cached copy of the file for readahead, or null.
+    std::unique_ptr<uint8_t[]> cache_;
+    /// Size of the readahead window in bytes. 0 if readahead is disabled.
+    size_t cacheSize_{0};
+    /// File offset of the first byte in cache_.
+    address_t cacheStart_{0};
+    /// Number of valid bytes in cache_.
+    size_t cacheLen_{0};
+    /// When the cache_ was filled (os_get_time_monotonic).
+    long long cacheTime_{0};
+    /// ConfigEntryBase::write_generation() when the cache_ was filled.
+    unsigned cacheGeneration_{0};
+    /// How long the cached data remains valid.
+    long long cacheMaxAge_{0};
 };
 
 /// Memory space implementation that exports the contents of a file as a memory
@@ -547,6 +737,142 @@ public:
     }
 };
 
+/// Executes the stream read and stream write commands of the memory config
+/// protocol for MemoryConfigHandler. The handler validates and acknowledges
+/// the incoming command datagram, then this flow sends the reply datagram and
+/// moves the data between the memory space and the stream. The memory space
+/// is accessed in large chunks of config_memory_config_stream_buffer_size()
+/// bytes instead of the 64 bytes a datagram can carry.
+///
+/// One transfer is executed at a time; the handler rejects stream commands
+/// with a temporary error while this flow is busy.
+class MemoryConfigStreamFlow : public StateFlowBase
+{
+public:
+    typedef MemorySpace::address_t address_t;
+    typedef MemorySpace::errorcode_t errorcode_t;
+
+    /// Constructor.
+    /// @param dg is the datagram service to send the reply datagrams with.
+    /// @param streams is the stream service to take the senders (for stream
+    /// reads) and the receivers (for stream writes) from.
+    MemoryConfigStreamFlow(DatagramService *dg, StreamService *streams);
+
+    /// @return the stream service used for the transfers.
+    StreamService *stream_service()
+    {
+        return streamService_;
+    }
+
+    /// @return true if a transfer is in progress.
+    bool is_busy()
+    {
+        return !is_terminated();
+    }
+
+    /// Starts executing a stream read or write command. The flow must not be
+    /// busy.
+    /// @param node is the local node the command was sent to.
+    /// @param remote is the node that sent the command.
+    /// @param space is the memory space to transfer data from or to.
+    /// @param cmd is the payload of the command datagram. The caller has
+    /// already checked that it contains the address, the memory space and
+    /// the stream ID(s).
+    void start(Node *node, NodeHandle remote, MemorySpace *space,
+        const DatagramPayload &cmd);
+
+private:
+    /// Receives the data messages of a stream write command and writes their
+    /// contents to the memory space once a chunk is collected. An empty
+    /// message writes out the remaining data.
+    class DataSink : public StateFlow<Buffer<GenMessage>, QList<1>>
+    {
+    public:
+        DataSink(MemoryConfigStreamFlow *parent);
+
+    private:
+        Action entry() override;
+        Action try_write();
+
+        /// Flow owning the transfer state.
+        MemoryConfigStreamFlow *parent_;
+    };
+
+    Action read_stream();
+    Action read_sender_allocated();
+    Action read_reply_sent();
+    Action read_stream_opened();
+    Action read_chunk();
+    Action try_read();
+    Action read_chunk_sent();
+    Action close_stream();
+    Action stream_closed();
+
+    Action write_stream();
+    Action write_receiver_allocated();
+    Action write_reply_sent();
+    Action write_stream_done();
+    Action write_flushed();
+
+    /// Sends a datagram with the command header of the current transfer and
+    /// an error code. @param cmd is the failure command.
+    /// @param error is the error code. Proceeds to finish.
+    Action send_failure(uint8_t cmd, errorcode_t error);
+    /// Sends reply_ as a datagram to the remote node. @param c is the state
+    /// to continue in; the outcome is in dgResult_.
+    Action send_reply(Callback c);
+    Action reply_client_allocated();
+    Action send_reply_datagram();
+    Action reply_sent();
+    /// Returns the stream flows and terminates.
+    Action finish();
+
+    /// Copies the command header (command byte, address and space) into
+    /// reply_. @param cmd is the reply command.
+    void set_reply_header(uint8_t cmd);
+
+    /// Datagram service for the replies.
+    DatagramService *dgService_;
+    /// Where the stream senders and receivers come from.
+    StreamService *streamService_;
+    /// Local node executing the command.
+    Node *node_;
+    /// Node that sent the command.
+    NodeHandle remote_;
+    /// Memory space of the transfer.
+    MemorySpace *space_;
+    /// Command datagram header: command byte, address and space.
+    DatagramPayload header_;
+    /// Next reply datagram to send.
+    DatagramPayload reply_;
+    /// Current chunk of data.
+    string data_;
+    /// Next address of the memory space to read or write.
+    address_t address_;
+    /// Number of bytes still to read.
+    uint64_t remaining_;
+    /// Number of bytes of data_ already processed.
+    size_t filled_;
+    /// Outcome of the last reply datagram.
+    uint32_t dgResult_;
+    /// Error writing to the memory space during a stream write.
+    errorcode_t error_;
+    /// Stream ID announced by the remote node.
+    uint8_t remoteStreamId_;
+    /// Stream flow for stream reads.
+    StreamSender *sender_{nullptr};
+    /// Stream flow for stream writes.
+    StreamReceiver *receiver_{nullptr};
+    /// Request sent to the receiver.
+    Buffer<StreamReceiveRequest> *receiveRequest_{nullptr};
+    /// Where to continue after a reply datagram was sent.
+    Callback afterReply_;
+    /// Datagram client sending the reply.
+    DatagramClient *dgClient_{nullptr};
+    DataSink sink_{this};
+    BarrierNotifiable n_;
+    BarrierNotifiable dgDone_;
+};
 
 /// Implementation of the Memory Access Configuration Protocol for OpenLCB.
 ///
@@ -567,6 +893,7 @@ public:
         : DefaultDatagramHandler(if_dg)
         , responseFlow_(nullptr)
         , registry_(registry_size)
+        , sessionTimer_(this)
     {
         dg_service()->registry()->insert(node, DATAGRAM_ID, this);
     }
@@ -574,6 +901,7 @@ public:
     ~MemoryConfigHandler()
     {
         /// @TODO(balazs.racz): unregister *this!
+        sessionTimer_.cancel();
     }
 
     typedef TypedNodeHandlerMap<Node, MemorySpace> Registry;
@@ -633,6 +961,29 @@ public:
         HASSERT(client_ == client);
         client_ = nullptr;
     }
+
+    /// Sets the stream service to use for the stream read and write
+    /// commands. Stream reads need senders and stream writes need receivers
+    /// in this service.
+    void set_stream_service(StreamService *streams)
+    {
+        HASSERT(!streamFlow_ || !streamFlow_->is_busy());
+        if (streams)
+        {
+            streamFlow_.reset(new MemoryConfigStreamFlow(dg_service(), streams));
+        }
+        else
+        {
+            streamFlow_.reset();
+        }
+    }
+
+    /// @return the stream service for large transfers, or nullptr if streams
+    /// are not supported.
+    StreamService *stream_service()
+    {
+        return streamFlow_ ? streamFlow_->stream_service() : nullptr;
+    }
     
 private:
     typedef MemorySpace::address_t address_t;
@@ -662,6 +1013,13 @@ private:
         {
             return call_immediately(STATE(handle_write));
         }
+        else if ((cmd & MemoryConfigDefs::COMMAND_MASK) ==
+                     MemoryConfigDefs::COMMAND_READ_STREAM ||
+                 (cmd & MemoryConfigDefs::COMMAND_MASK) ==
+                     MemoryConfigDefs::COMMAND_WRITE_STREAM)
+        {
+            return call_immediately(STATE(handle_stream));
+        }
         switch (cmd)
         {
             case MemoryConfigDefs::COMMAND_LOCK:
@@ -694,7 +1052,8 @@ private:
             }
             case MemoryConfigDefs::COMMAND_UPDATE_COMPLETE:
             {
-                Singleton<ConfigUpdateService>::instance()->trigger_update();
+                Singleton<ConfigUpdateService>::instance()
+                    ->trigger_partial_update();
                 return respond_ok(0);
             }
             case MemoryConfigDefs::COMMAND_RESET:
@@ -718,6 +1077,8 @@ private:
             case MemoryConfigDefs::COMMAND_WRITE_STREAM_FAILED:
             case MemoryConfigDefs::COMMAND_READ_REPLY:
             case MemoryConfigDefs::COMMAND_READ_FAILED:
+            case MemoryConfigDefs::COMMAND_READ_STREAM_REPLY:
+            case MemoryConfigDefs::COMMAND_READ_STREAM_FAILED:
             case MemoryConfigDefs::COMMAND_OPTIONS_REPLY:
             case MemoryConfigDefs::COMMAND_INFORMATION_REPLY:
             case MemoryConfigDefs::COMMAND_LOCK_REPLY:
@@ -737,6 +1098,13 @@ private:
 
     Action ok_response_sent() OVERRIDE
     {
+        if (streamPending_)
+        {
+            // The reply datagram is sent by the stream flow.
+            streamPending_ = false;
+            streamFlow_->start(message()->data()->dst, message()->data()->src,
+                get_space(), message()->data()->payload);
+        }
         if (!response_.empty())
         {
             return allocate_and_call(STATE(client_allocated),
@@ -810,9 +1178,14 @@ private:
         response_.push_back(available_commands >> 8);
         response_.push_back(available_commands & 0xff);
         // Write lengths
-        response_.push_back(static_cast<char> (
-            MemoryConfigDefs::LENGTH_1 | MemoryConfigDefs::LENGTH_2 |
-            MemoryConfigDefs::LENGTH_4 | MemoryConfigDefs::LENGTH_ARBITRARY));
+        uint8_t write_lengths = MemoryConfigDefs::LENGTH_1 |
+            MemoryConfigDefs::LENGTH_2 | MemoryConfigDefs::LENGTH_4 |
+            MemoryConfigDefs::LENGTH_ARBITRARY;
+        if (streamFlow_)
+        {
+            write_lengths |= MemoryConfigDefs::LENGTH_STREAM;
+        }
+        response_.push_back(static_cast<char>(write_lengths));
 
         uint8_t min_space = 0xFF;
         uint8_t max_space = 0;
@@ -901,6 +1274,7 @@ private:
             ++response_data_offset;
         }
         size_t response_len = response_data_offset + read_len;
+        start_session(space);
         currentOffset_ = 0;
         char c = 0;
         response_.assign(response_len, c);
@@ -923,8 +1297,10 @@ private:
         uint8_t *response_bytes = out_bytes();
         if (read_len > 0)
         {
-            int byte_read = space->read(address,
-                response_bytes + response_data_offset, read_len, &error, this);
+            MemorySpace::Range range = {
+                address, response_bytes + response_data_offset,
+                (size_t)read_len};
+            int byte_read = space->read_bulk(&range, 1, &error, this);
             currentOffset_ += byte_read;
             read_len -= byte_read;
             if (error == MemorySpace::ERROR_AGAIN)
@@ -1021,6 +1397,8 @@ private:
                 return again();
             }
         }
+        memory_config_report_write(
+            get_space_number(), space, get_address(), currentOffset_);
         char c = 0;
         int response_len = 6;
         if (has_custom_space())
@@ -1042,6 +1420,40 @@ private:
         return respond_ok(DatagramClient::REPLY_PENDING);
     }
 
+    /// Validates a stream read or write command. The transfer itself is
+    /// started by ok_response_sent after the datagram was acknowledged.
+    Action handle_stream()
+    {
+        bool is_read = (in_bytes()[1] & MemoryConfigDefs::COMMAND_MASK) ==
+            MemoryConfigDefs::COMMAND_READ_STREAM;
+        // Reads carry the source and destination stream IDs, writes only
+        // the source stream ID.
+        if (!MemoryConfigDefs::payload_min_length_check(
+                message()->data()->payload, is_read ? 2 : 1))
+        {
+            return respond_reject(Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT);
+        }
+        if (!streamFlow_)
+        {
+            return respond_reject(Defs::ERROR_UNIMPLEMENTED_SUBCMD);
+        }
+        MemorySpace *space = get_space();
+        if (!space)
+        {
+            return respond_reject(MemoryConfigDefs::ERROR_SPACE_NOT_KNOWN);
+        }
+        if (!is_read && space->read_only())
+        {
+            return respond_reject(MemoryConfigDefs::ERROR_WRITE_TO_RO);
+        }
+        if (streamFlow_->is_busy())
+        {
+            return respond_reject(DatagramDefs::BUFFER_UNAVAILABLE);
+        }
+        streamPending_ = true;
+        return respond_ok(DatagramClient::REPLY_PENDING);
+    }
+
     /// @return true iff we have a custom space
     bool has_custom_space()
     {
@@ -1074,6 +1486,65 @@ private:
         return bytes[6];
     }
 
+    /** Records a datagram read from a memory space. Ends the session of the
+     * previously read space if it is a different one; the session of this
+     * space ends when no further read arrives for
+     * MEMORY_CONFIG_SESSION_TIMEOUT_NSEC.
+     * @param space is the memory space being read. */
+    void start_session(MemorySpace *space)
+    {
+        if (sessionSpace_ && sessionSpace_ != space)
+        {
+            sessionSpace_->end_session();
+        }
+        sessionSpace_ = space;
+        lastSessionRead_ = os_get_time_monotonic();
+        if (!sessionTimerRunning_)
+        {
+            // A running timer will see the new lastSessionRead_ when it
+            // expires.
+            sessionTimerRunning_ = true;
+            sessionTimer_.start(MEMORY_CONFIG_SESSION_TIMEOUT_NSEC);
+        }
+    }
+
+    /// Ends the datagram read session of a memory space when it has been idle
+    /// for long enough.
+    class SessionTimer : public ::Timer
+    {
+    public:
+        /// Constructor.
+        /// @param parent the handler that owns this timer.
+        SessionTimer(MemoryConfigHandler *parent)
+            : ::Timer(parent->service()->executor()->active_timers())
+            , parent_(parent)
+        {
+        }
+
+        long long timeout() override
+        {
+            if (!parent_->sessionSpace_)
+            {
+                parent_->sessionTimerRunning_ = false;
+                return NONE;
+            }
+            long long left = parent_->lastSessionRead_ +
+                MEMORY_CONFIG_SESSION_TIMEOUT_NSEC - os_get_time_monotonic();
+            if (left > 0)
+            {
+                return left;
+            }
+            parent_->sessionSpace_->end_session();
+            parent_->sessionSpace_ = nullptr;
+            parent_->sessionTimerRunning_ = false;
+            return NONE;
+        }
+
+    private:
+        /// Handler that owns this timer.
+        MemoryConfigHandler *parent_;
+    };
+
     /** Looks up the memory space for the current datagram. Returns NULL if no
      * space was registered (for neither the current node, nor global). */
     MemorySpace *get_space()
@@ -1203,9 +1674,23 @@ private:
     //NodeID lockNode_; //< Holds the node ID that locked us.
 
     Registry registry_;         //< holds the known memory spaces
+    /// Memory space of the current datagram read session, or nullptr.
+    MemorySpace *sessionSpace_{nullptr};
+    /// When the last datagram read arrived for sessionSpace_.
+    long long lastSessionRead_{0};
+    /// True while sessionTimer_ is scheduled or its timeout is pending.
+    bool sessionTimerRunning_{false};
+    /// Calls end_session() on sessionSpace_ when it has been idle.
+    SessionTimer sessionTimer_;
     /// If there is a memory config client, we will forward response traffic to
     /// it.
     DatagramHandlerFlow* client_{nullptr};
+    /// Executes the stream read and write commands. Null if there is no
+    /// stream service.
+    std::unique_ptr<MemoryConfigStreamFlow> streamFlow_;
+    /// True if the incoming datagram is a stream command to be started once
+    /// the datagram is acknowledged.
+    bool streamPending_{false};
 
     /** Offset withing the current write/read datagram. This does not include
      * the offset from the incoming datagram. */
@@ -35,6 +35,8 @@
 #ifndef _OPENLCB_MEMORYCONFIGCLIENT_HXX_
 #define _OPENLCB_MEMORYCONFIGCLIENT_HXX_
 
+#include <functional>
+
 #include "executor/CallableFlow.hxx"
 #include "openlcb/MemoryConfig.hxx"
 #include "openlcb/DatagramHandlerDefault.hxx"
@@ -54,6 +56,11 @@ struct MemoryConfigClientRequest : public CallableFlowRequestBase
         READ_PART
     };
 
+    enum ReadBulkCmd
+    {
+        READ_BULK
+    };
+
     enum WriteCmd
     {
         WRITE
@@ -112,6 +119,41 @@ struct MemoryConfigClientRequest : public CallableFlowRequestBase
         payload.clear();
     }
 
+    /// Sets up a command to read a part of a memory space with multiple read
+    /// requests outstanding at the same time. The replies may arrive in any
+    /// order; they are assembled into payload by their address.
+    ///
+    /// If the memory config handler has a stream service with receivers and
+    /// more than one datagram worth of data is requested from a remote node,
+    /// the data is first requested with a read stream command. If the
+    /// remote node does not accept that command, the read falls back to
+    /// datagrams. Writes always use datagrams.
+    /// @param ReadBulkCmd polymorphic matching arg; always set to READ_BULK.
+    /// @param d is the destination node to query
+    /// @param space is the memory space to read out
+    /// @param offset if the address of the first byte to read
+    /// @param size is the number of bytes to read; 0xffffffff reads until the
+    /// end of the memory space.
+    /// @param window is how many read requests may be outstanding when
+    /// reading with datagrams.
+    /// @param progress if not empty, will be called after every reply or
+    /// stream data message with the number of bytes read so far and the
+    /// total size (zero if the size is unknown).
+    void reset(ReadBulkCmd, NodeHandle d, uint8_t space, unsigned offset,
+        unsigned size, unsigned window = DEFAULT_READ_WINDOW,
+        std::function<void(unsigned, unsigned)> progress = nullptr)
+    {
+        reset_base();
+        cmd = CMD_READ_BULK;
+        memory_space = space;
+        dst = d;
+        this->address = offset;
+        this->size = size;
+        this->window = window;
+        progress_callback = std::move(progress);
+        payload.clear();
+    }
+
     /// Sets up a command to read a part of a memory space.
     /// @param WriteCmd polymorphic matching arg; always set to WRITE.
     /// @param d is the destination node to query
@@ -198,9 +240,19 @@ struct MemoryConfigClientRequest : public CallableFlowRequestBase
     {
         CMD_READ,
         CMD_READ_PART,
+        CMD_READ_BULK,
         CMD_WRITE,
         CMD_META_REQUEST
     };
+
+    enum
+    {
+        /// How many read requests READ_BULK keeps outstanding by default.
+        DEFAULT_READ_WINDOW = 4,
+        /// Upper limit on the window of READ_BULK.
+        MAX_READ_WINDOW = 16,
+    };
+
     Command cmd;
     uint8_t memory_space;
     unsigned address;
@@ -208,6 +260,10 @@ struct MemoryConfigClientRequest : public CallableFlowRequestBase
     /// Node to send the request to.
     NodeHandle dst;
     string payload;
+    /// Number of outstanding read requests for READ_BULK.
+    unsigned window;
+    /// Progress report for READ_BULK.
+    std::function<void(unsigned, unsigned)> progress_callback;
 };
 
 class MemoryConfigClient : public CallableFlow<MemoryConfigClientRequest>
@@ -254,6 +310,9 @@ private:
             case MemoryConfigClientRequest::CMD_READ_PART:
                 return allocate_and_call(
                     STATE(do_read), dg_service()->client_allocator());
+            case MemoryConfigClientRequest::CMD_READ_BULK:
+                return allocate_and_call(
+                    STATE(do_read_bulk), dg_service()->client_allocator());
             case MemoryConfigClientRequest::CMD_WRITE:
                 return allocate_and_call(
                     STATE(do_write), dg_service()->client_allocator());
@@ -391,6 +450,398 @@ private:
         return return_ok();
     }
 
+    Action do_read_bulk()
+    {
+        dgClient_ = full_allocation_result(dg_service()->client_allocator());
+        offset_ = request()->address;
+        bulkEnd_ = request()->address + request()->size;
+        if (request()->size == 0xffffffffu || bulkEnd_ < request()->address)
+        {
+            bulkEnd_ = 0xffffffffu;
+        }
+        bulkBytes_ = 0;
+        bulkError_ = 0;
+        chunks_.clear();
+        window_ = std::min(std::max(request()->window, 1u),
+            (unsigned)MemoryConfigClientRequest::MAX_READ_WINDOW);
+        NodeHandle dst = request()->dst;
+        dg_service()->iface()->canonicalize_handle(&dst);
+        bool is_local = dst.id == node_->node_id();
+        if (is_local)
+        {
+            // Our read request and the read reply would be sent between the
+            // same two nodes. They cannot be both outstanding.
+            window_ = 1;
+        }
+        memoryConfigHandler_->set_client(&responseFlow_);
+        StreamService *streams = memoryConfigHandler_->stream_service();
+        if (streams && streams->has_receivers() && !is_local &&
+            request()->size > MemoryConfigDefs::MAX_DATAGRAM_RW_BYTES)
+        {
+            return allocate_and_call(
+                STATE(bulk_stream_start), streams->receiver_allocator());
+        }
+        return call_immediately(STATE(bulk_send_next));
+    }
+
+    /// Starts listening for the stream, then sends the read stream command.
+    Action bulk_stream_start()
+    {
+        StreamService *streams = memoryConfigHandler_->stream_service();
+        receiver_ = full_allocation_result(streams->receiver_allocator());
+        streamLength_ = 0;
+        streamError_ = 0;
+        streamRejected_ = 0;
+        // The receiver has to be listening by the time the remote node got
+        // our command and opens the stream.
+        mainBufferPool->alloc(&streamRequest_);
+        streamRequest_->data()->reset(StreamReceiveRequest::ACCEPT, node_,
+            request()->dst, StreamDefs::INVALID_STREAM_ID, &sink_);
+        streamRequest_->data()->done.reset(
+            streamBn_.reset(this)->new_child());
+        receiver_->send(streamRequest_->ref());
+        return allocate_and_call(dg_service()->iface()->dispatcher(),
+            STATE(bulk_stream_send_command));
+    }
+
+    Action bulk_stream_send_command()
+    {
+        auto *b = get_allocation_result(dg_service()->iface()->dispatcher());
+        b->set_done(bn_.reset(this));
+        uint32_t length =
+            request()->size == 0xffffffffu ? 0 : request()->size;
+        b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(), request()->dst,
+            MemoryConfigDefs::read_stream_datagram(request()->memory_space,
+                request()->address, receiver_->local_stream_id(), length));
+        dgClient_->write_datagram(b);
+        return wait_and_call(STATE(bulk_stream_command_sent));
+    }
+
+    Action bulk_stream_command_sent()
+    {
+        if (!(dgClient_->result() & DatagramClient::OPERATION_SUCCESS))
+        {
+            // The remote node does not do streams, or not right now.
+            streamRejected_ = 1;
+            receiver_->cancel();
+        }
+        streamBn_.notify();
+        return wait_and_call(STATE(bulk_stream_done));
+    }
+
+    /// Handles a read stream reply datagram during a bulk read.
+    /// @param p is the reply datagram payload.
+    void bulk_stream_reply(const string &p)
+    {
+        const uint8_t *bytes = MemoryConfigDefs::payload_bytes(p);
+        unsigned ofs = MemoryConfigDefs::get_payload_offset(p);
+        if (!MemoryConfigDefs::payload_min_length_check(p, 2))
+        {
+            streamError_ = Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT;
+            receiver_->cancel();
+            return;
+        }
+        if ((bytes[1] & MemoryConfigDefs::COMMAND_MASK) ==
+            MemoryConfigDefs::COMMAND_READ_STREAM_FAILED)
+        {
+            streamError_ = bytes[ofs];
+            streamError_ <<= 8;
+            streamError_ |= bytes[ofs + 1];
+            receiver_->cancel();
+            return;
+        }
+        if (p.size() >= ofs + 6)
+        {
+            streamLength_ = bytes[ofs + 2];
+            streamLength_ <<= 8;
+            streamLength_ |= bytes[ofs + 3];
+            streamLength_ <<= 8;
+            streamLength_ |= bytes[ofs + 4];
+            streamLength_ <<= 8;
+            streamLength_ |= bytes[ofs + 5];
+        }
+    }
+
+    /// Called by the stream receiver with each data message.
+    /// @param data is the stream data.
+    void bulk_stream_data(const string &data)
+    {
+        request()->payload.append(data);
+        bulkBytes_ += data.size();
+        if (request()->progress_callback)
+        {
+            request()->progress_callback(bulkBytes_,
+                request()->size == 0xffffffffu ? streamLength_
+                                               : request()->size);
+        }
+    }
+
+    Action bulk_stream_done()
+    {
+        int error = streamRequest_->data()->resultCode;
+        streamRequest_->unref();
+        streamRequest_ = nullptr;
+        memoryConfigHandler_->stream_service()->receiver_allocator()
+            ->typed_insert(receiver_);
+        receiver_ = nullptr;
+        if (streamRejected_)
+        {
+            LOG(INFO, "Memory Config client: read stream command rejected; "
+                      "reading with datagrams.");
+            request()->payload.clear();
+            bulkBytes_ = 0;
+            return call_immediately(STATE(bulk_send_next));
+        }
+        if (streamError_ == MemoryConfigDefs::ERROR_OUT_OF_BOUNDS)
+        {
+            // Nothing to read at this address.
+            request()->payload.clear();
+            streamError_ = 0;
+            error = 0;
+        }
+        if (streamError_)
+        {
+            error = streamError_;
+        }
+        if (!error && streamLength_ && request()->payload.size() < streamLength_)
+        {
+            // The remote node closed the stream early.
+            error = Defs::ERROR_TEMPORARY;
+        }
+        cleanup_read();
+        if (error)
+        {
+            return return_with_error(error);
+        }
+        return return_ok();
+    }
+
+    /// Sends the next read request if the window allows, otherwise waits for
+    /// replies.
+    Action bulk_send_next()
+    {
+        unsigned num_sent = 0;
+        ReadChunk *next = nullptr;
+        for (auto it = chunks_.begin(); it != chunks_.end();)
+        {
+            if (!it->sent && (bulkError_ || it->address >= bulkEnd_))
+            {
+                // Not needed anymore.
+                it = chunks_.erase(it);
+                continue;
+            }
+            if (it->sent)
+            {
+                ++num_sent;
+            }
+            else if (!next)
+            {
+                next = &*it;
+            }
+            ++it;
+        }
+        if (num_sent < window_ && !bulkError_)
+        {
+            if (!next && offset_ < bulkEnd_)
+            {
+                ReadChunk c;
+                c.address = offset_;
+                c.size = std::min(bulkEnd_ - offset_,
+                    (uint32_t)MemoryConfigDefs::MAX_DATAGRAM_RW_BYTES);
+                c.sent = 0;
+                offset_ += c.size;
+                chunks_.push_back(c);
+                next = &chunks_.back();
+            }
+            if (next)
+            {
+                next->sent = 1;
+                sendAddress_ = next->address;
+                sendSize_ = next->size;
+                return allocate_and_call(dg_service()->iface()->dispatcher(),
+                    STATE(bulk_send_datagram));
+            }
+        }
+        if (chunks_.empty())
+        {
+            return call_immediately(STATE(bulk_finish));
+        }
+        bulkProgress_ = 0;
+        isWaitingForTimer_ = 1;
+        return sleep_and_call(
+            &timer_, SEC_TO_NSEC(3), STATE(bulk_wakeup));
+    }
+
+    Action bulk_send_datagram()
+    {
+        auto *b = get_allocation_result(dg_service()->iface()->dispatcher());
+        b->set_done(bn_.reset(this));
+        b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(), request()->dst,
+            MemoryConfigDefs::read_datagram(
+                request()->memory_space, sendAddress_, sendSize_));
+        isWaitingForTimer_ = 0;
+        dgClient_->write_datagram(b);
+        return wait_and_call(STATE(bulk_datagram_sent));
+    }
+
+    Action bulk_datagram_sent()
+    {
+        uint32_t result = dgClient_->result();
+        if (result & DatagramClient::OPERATION_SUCCESS)
+        {
+            return call_immediately(STATE(bulk_send_next));
+        }
+        ReadChunk *c = find_chunk(sendAddress_);
+        unsigned num_sent = 0;
+        for (auto &ch : chunks_)
+        {
+            num_sent += ch.sent;
+        }
+        if (c && (result & DatagramClient::RESEND_OK) && num_sent > 1)
+        {
+            // The destination cannot take this many requests at once. Sends
+            // this one again when a reply came back.
+            c->sent = 0;
+            window_ = num_sent - 1;
+            LOG(INFO, "Memory Config client: reducing read window to %u",
+                window_);
+        }
+        else
+        {
+            if (c)
+            {
+                chunks_.erase(chunks_.begin() + (c - &chunks_[0]));
+            }
+            if (!bulkError_)
+            {
+                bulkError_ = result & DatagramClient::RESPONSE_CODE_MASK;
+            }
+        }
+        return call_immediately(STATE(bulk_send_next));
+    }
+
+    Action bulk_wakeup()
+    {
+        isWaitingForTimer_ = 0;
+        if (!bulkProgress_)
+        {
+            // No reply arrived in time; the outstanding requests are lost.
+            chunks_.clear();
+            if (!bulkError_)
+            {
+                bulkError_ = Defs::OPENMRN_TIMEOUT;
+            }
+        }
+        return call_immediately(STATE(bulk_send_next));
+    }
+
+    /// Handles a read reply datagram during a bulk read.
+    /// @param p is the reply datagram payload.
+    void bulk_reply(const string &p)
+    {
+        if (!MemoryConfigDefs::payload_min_length_check(p, 0))
+        {
+            return;
+        }
+        const uint8_t *bytes = MemoryConfigDefs::payload_bytes(p);
+        unsigned ofs = MemoryConfigDefs::get_payload_offset(p);
+        uint32_t address = MemoryConfigDefs::get_address(p);
+        if (MemoryConfigDefs::get_space(p) != request()->memory_space)
+        {
+            return;
+        }
+        ReadChunk *c = find_chunk(address);
+        if (!c || !c->sent)
+        {
+            return;
+        }
+        unsigned size = c->size;
+        chunks_.erase(chunks_.begin() + (c - &chunks_[0]));
+        bulkProgress_ = 1;
+        uint8_t cmd = bytes[1] & MemoryConfigDefs::COMMAND_MASK;
+        if (cmd == MemoryConfigDefs::COMMAND_READ_FAILED)
+        {
+            uint16_t error = Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT;
+            if (p.size() >= ofs + 2)
+            {
+                error = bytes[ofs];
+                error <<= 8;
+                error |= bytes[ofs + 1];
+            }
+            if (error == MemoryConfigDefs::ERROR_OUT_OF_BOUNDS)
+            {
+                bulkEnd_ = std::min(bulkEnd_, address);
+            }
+            else if (!bulkError_)
+            {
+                bulkError_ = error;
+            }
+            return;
+        }
+        unsigned dlen = std::min((unsigned)p.size() - ofs, size);
+        if (dlen < size)
+        {
+            // Reached the end of the memory space.
+            bulkEnd_ = std::min(bulkEnd_, address + dlen);
+        }
+        if (address >= bulkEnd_)
+        {
+            return;
+        }
+        dlen = std::min(dlen, bulkEnd_ - address);
+        string &payload = request()->payload;
+        unsigned pos = address - request()->address;
+        if (payload.size() < pos + dlen)
+        {
+            payload.resize(pos + dlen);
+        }
+        memcpy(&payload[pos], bytes + ofs, dlen);
+        bulkBytes_ += dlen;
+        if (request()->progress_callback)
+        {
+            request()->progress_callback(bulkBytes_,
+                request()->size == 0xffffffffu ? 0 : request()->size);
+        }
+    }
+
+    Action bulk_finish()
+    {
+        cleanup_read();
+        if (bulkError_)
+        {
+            return return_with_error(bulkError_);
+        }
+        if (bulkEnd_ != 0xffffffffu)
+        {
+            request()->payload.resize(bulkEnd_ - request()->address);
+        }
+        return return_ok();
+    }
+
+    /// One read request of a bulk read.
+    struct ReadChunk
+    {
+        /// Address of the first byte.
+        uint32_t address;
+        /// Number of bytes requested.
+        uint8_t size;
+        /// 1 if the request was sent out.
+        uint8_t sent;
+    };
+
+    /// @return the outstanding read request for a given address, or nullptr.
+    ReadChunk *find_chunk(uint32_t address)
+    {
+        for (auto &c : chunks_)
+        {
+            if (c.address == address)
+            {
+                return &c;
+            }
+        }
+        return nullptr;
+    }
+
     Action do_write()
     {
         dgClient_ = full_allocation_result(dg_service()->client_allocator());
@@ -588,6 +1039,16 @@ private:
                 case MemoryConfigDefs::COMMAND_READ_REPLY:
                 case MemoryConfigDefs::COMMAND_READ_FAILED:
                 {
+                    if (parent_->request()->cmd ==
+                        MemoryConfigClientRequest::CMD_READ_BULK)
+                    {
+                        parent_->bulk_reply(message()->data()->payload);
+                        if (parent_->isWaitingForTimer_)
+                        {
+                            parent_->timer_.trigger();
+                        }
+                        return respond_ok(0);
+                    }
                     if (parent_->request()->cmd !=
                             MemoryConfigClientRequest::CMD_READ &&
                         parent_->request()->cmd !=
@@ -603,6 +1064,16 @@ private:
                     }
                     return respond_ok(0);
                 }
+                case MemoryConfigDefs::COMMAND_READ_STREAM_REPLY:
+                case MemoryConfigDefs::COMMAND_READ_STREAM_FAILED:
+                    if (parent_->request()->cmd !=
+                            MemoryConfigClientRequest::CMD_READ_BULK ||
+                        !parent_->receiver_)
+                    {
+                        break;
+                    }
+                    parent_->bulk_stream_reply(message()->data()->payload);
+                    return respond_ok(0);
                 case MemoryConfigDefs::COMMAND_WRITE_REPLY:
                 case MemoryConfigDefs::COMMAND_WRITE_FAILED:
                     if (parent_->request()->cmd !=
@@ -624,6 +1095,26 @@ private:
         MemoryConfigClient *parent_;        
     };
 
+    /// Target of the stream receiver in a bulk read; copies the stream data
+    /// into the request payload.
+    class StreamSink : public MessageHandler
+    {
+    public:
+        StreamSink(MemoryConfigClient *parent)
+            : parent_(parent)
+        {
+        }
+
+        void send(Buffer<GenMessage> *message, unsigned priority) override
+        {
+            parent_->bulk_stream_data(message->data()->payload);
+            message->unref();
+        }
+
+    private:
+        MemoryConfigClient *parent_;
+    };
+
     DatagramService *dg_service()
     {
         return static_cast<DatagramService *>(service());
@@ -638,6 +1129,15 @@ private:
     DatagramClient *dgClient_{nullptr};
     /// Handler for the incoming reply datagrams.
     ResponseFlow responseFlow_{this};
+    /// Receives the data of a bulk read done with a stream.
+    StreamSink sink_{this};
+    /// Receiver of a bulk read done with a stream; nullptr otherwise.
+    StreamReceiver *receiver_{nullptr};
+    /// Request we sent to receiver_.
+    Buffer<StreamReceiveRequest> *streamRequest_{nullptr};
+    /// Notified when both the read stream command was sent and the receiver
+    /// is done.
+    BarrierNotifiable streamBn_;
     /// Notify helper.
     BarrierNotifiable bn_;
     /// Next byte to read from the memory space.
@@ -649,11 +1149,35 @@ private:
     /// timing helper
     StateFlowTimer timer_{this};
     /// The data that came back from reading.
-    string responsePayload_;
+    Payload responsePayload_;
     /// error code that came with the response. 0 for success.
     int responseCode_;
+    /// Read requests of a bulk read that are outstanding or need to be
+    /// sent again.
+    std::vector<ReadChunk> chunks_;
+    /// End address (exclusive) of a bulk read.
+    uint32_t bulkEnd_;
+    /// Number of bytes received in a bulk read.
+    uint32_t bulkBytes_;
+    /// First error of a bulk read; 0 if none.
+    int bulkError_;
+    /// Number of bytes the remote node announced in the read stream reply;
+    /// 0 if unknown.
+    uint32_t streamLength_;
+    /// Error from the read stream failed reply; 0 if none.
+    uint16_t streamError_;
+    /// Address of the read request being sent in a bulk read.
+    uint32_t sendAddress_;
+    /// How many read requests a bulk read keeps outstanding.
+    uint8_t window_;
+    /// Size of the read request being sent in a bulk read.
+    uint8_t sendSize_;
     /// 1 if we are pending on the timer.
     uint8_t isWaitingForTimer_ : 1;
+    /// 1 if a reply arrived while a bulk read was waiting.
+    uint8_t bulkProgress_ : 1;
+    /// 1 if the remote node did not accept the read stream command.
+    uint8_t streamRejected_ : 1;
 };
 
 } // namespace openlcb
@@ -253,6 +253,13 @@ public:
         }
     }
 
+    bool config_range(unsigned *offset, unsigned *size) OVERRIDE
+    {
+        *offset = offset_.offset();
+        *size = config_entry_type::size() * size_;
+        return true;
+    }
+
     /// Factory reset helper function. Sets all names to something 1..N.
     /// @param fd pased on from factory reset argument.
     /// @param basename name of repeats.
@@ -0,0 +1,154 @@
+/** \copyright
+ * Copyright (c) 2026, Balazs Racz
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are  permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file Payload.cxx
+ *
+ * Implementation of the payload container of NMRAnet messages.
+ *
+ * @author Balazs Racz
+ * @date 17 Oct 2026
+ */
+
+#include "openlcb/Payload.hxx"
+
+#include <algorithm>
+
+namespace openlcb
+{
+
+constexpr size_t Payload::INLINE_CAPACITY;
+constexpr size_t Payload::SPILL_CAPACITY;
+constexpr size_t Payload::npos;
+
+void Payload::resize(size_t n, char c)
+{
+    make_room(std::max(n, size_t(size_)));
+    if (n > size_)
+    {
+        memset(mutable_data() + size_, c, n - size_);
+    }
+    set_size(n);
+}
+
+Payload &Payload::append(const char *s, size_t len)
+{
+    const char *old = data();
+    bool self = s >= old && s < old + size_;
+    make_room(size_ + len);
+    char *p = mutable_data();
+    if (self)
+    {
+        // The source was inside our own storage, which might have moved.
+        s = p + (s - old);
+    }
+    memmove(p + size_, s, len);
+    set_size(size_ + len);
+    return *this;
+}
+
+Payload &Payload::erase(size_t pos, size_t len)
+{
+    HASSERT(pos <= size_);
+    len = std::min(len, size_ - pos);
+    if (len)
+    {
+        char *p = mutable_data();
+        memmove(p + pos, p + pos + len, size_ - pos - len);
+        set_size(size_ - len);
+    }
+    return *this;
+}
+
+Payload Payload::substr(size_t pos, size_t len) const
+{
+    HASSERT(pos <= size_);
+    return Payload(data() + pos, std::min(len, size_ - pos));
+}
+
+size_t Payload::find(char c, size_t pos) const
+{
+    if (pos >= size_)
+    {
+        return npos;
+    }
+    const char *p = data();
+    const void *r = memchr(p + pos, c, size_ - pos);
+    return r ? static_cast<const char *>(r) - p : npos;
+}
+
+size_t Payload::find(const char *s, size_t pos, size_t len) const
+{
+    const char *p = data();
+    for (; pos + len <= size_; ++pos)
+    {
+        if (memcmp(p + pos, s, len) == 0)
+        {
+            return pos;
+        }
+    }
+    return npos;
+}
+
+int Payload::compare(const char *s, size_t len) const
+{
+    int r = memcmp(data(), s, std::min(len, size_t(size_)));
+    if (r)
+    {
+        return r;
+    }
+    if (size_ < len)
+    {
+        return -1;
+    }
+    return size_ > len ? 1 : 0;
+}
+
+void Payload::grow(size_t n)
+{
+    if (spilled_)
+    {
+        move_to(std::max(n, 2 * chunk_capacity(u_.chunk_)));
+    }
+    else
+    {
+        move_to(std::max(n, SPILL_CAPACITY));
+    }
+}
+
+void Payload::move_to(size_t cap)
+{
+    HASSERT(cap >= size_);
+    ChunkBuffer *b;
+    init_main_buffer_pool()->alloc_with_tail(&b, cap + 1);
+    char *p = chunk_data(b);
+    memcpy(p, data(), size_);
+    p[size_] = 0;
+    release();
+    u_.chunk_ = b;
+    spilled_ = 1;
+}
+
+} // namespace openlcb
@@ -26,8 +26,7 @@
  *
  * \file Payload.hxx
  *
- * Forward declaration of the class storing the payload value in an NMRAnet
- * message object.
+ * Class storing the payload value in an NMRAnet message object.
  *
  * @author Balazs Racz
  * @date 18 May 2014
@@ -36,11 +35,575 @@
 #ifndef _OPENLCB_PAYLOAD_HXX_
 #define _OPENLCB_PAYLOAD_HXX_
 
+#include <string.h>
 #include <string>
 
-namespace openlcb {
+#include "utils/Buffer.hxx"
+#include "utils/macros.h"
 
-typedef string Payload;
+namespace openlcb
+{
+
+/// Header of the spill storage of a Payload. The payload bytes follow the
+/// Buffer holding this structure.
+struct PayloadChunk
+{
+};
+
+/// Container that carries the data bytes in an OpenLCB message.
+///
+/// Payloads of up to INLINE_CAPACITY bytes (every single-frame CAN message,
+/// event IDs, node IDs) are stored inside the object and never touch the
+/// heap. Longer payloads spill to a chunk allocated from the main buffer
+/// pool; the first spill is large enough for a full datagram, so the pool
+/// recycles these chunks. Chunks are reference counted: copying a Payload
+/// shares the chunk, and the first mutating call on a shared chunk makes a
+/// private copy. Read-only access (data(), size(), const operator[]) never
+/// copies.
+///
+/// The interface is a subset of std::string. Writing through the pointer
+/// returned by data() is not allowed; use the non-const operator[] or
+/// begin() instead, which make the storage private first.
+class Payload
+{
+public:
+    typedef char value_type;
+    typedef size_t size_type;
+    typedef char *iterator;
+    typedef const char *const_iterator;
+
+    /// Number of bytes stored without a heap allocation.
+    static constexpr size_t INLINE_CAPACITY = 16;
+    /// Minimum capacity of the spill chunk. This is the maximum size of a
+    /// datagram.
+    static constexpr size_t SPILL_CAPACITY = 72;
+    /// Return value of find() when nothing was found.
+    static constexpr size_t npos = std::string::npos;
+
+    /// Creates an empty payload.
+    Payload()
+        : size_(0)
+        , spilled_(0)
+    {
+        u_.inline_[0] = 0;
+    }
+
+    /// Creates a payload from a NUL-terminated string. @param s is the string.
+    Payload(const char *s)
+        : Payload()
+    {
+        append(s, strlen(s));
+    }
+
+    /// Creates a payload from a memory area. @param s is the start of the
+    /// data. @param len is the number of bytes.
+    Payload(const char *s, size_t len)
+        : Payload()
+    {
+        append(s, len);
+    }
+
+    /// Creates a payload repeating a single byte. @param count is the number
+    /// of bytes. @param c is the byte to fill with.
+    Payload(size_t count, char c)
+        : Payload()
+    {
+        append(count, c);
+    }
+
+    /// Creates a payload from a string. @param s is the string to copy.
+    Payload(const std::string &s)
+        : Payload()
+    {
+        append(s.data(), s.size());
+    }
+
+    /// Copy constructor. Shares the spill chunk. @param o is the payload to
+    /// copy.
+    Payload(const Payload &o)
+        : size_(o.size_)
+        , spilled_(o.spilled_)
+    {
+        if (spilled_)
+        {
+            u_.chunk_ = o.u_.chunk_->ref();
+        }
+        else
+        {
+            memcpy(u_.inline_, o.u_.inline_, size_ + 1);
+        }
+    }
+
+    /// Move constructor. @param o is the payload to take the contents of;
+    /// left empty.
+    Payload(Payload &&o)
+        : Payload()
+    {
+        swap(o);
+    }
+
+    ~Payload()
+    {
+        release();
+    }
+
+    /// Assignment. Shares the spill chunk. @param o is the payload to copy.
+    /// @return *this
+    Payload &operator=(const Payload &o)
+    {
+        Payload(o).swap(*this);
+        return *this;
+    }
+
+    /// Move assignment. @param o is the payload to take the contents of.
+    /// @return *this
+    Payload &operator=(Payload &&o)
+    {
+        swap(o);
+        return *this;
+    }
+
+    /// Assignment from a string. @param s is the string to copy. @return
+    /// *this
+    Payload &operator=(const std::string &s)
+    {
+        assign(s.data(), s.size());
+        return *this;
+    }
+
+    /// Assignment from a NUL-terminated string. @param s is the string to
+    /// copy. @return *this
+    Payload &operator=(const char *s)
+    {
+        assign(s, strlen(s));
+        return *this;
+    }
+
+    /// @return a copy of the payload bytes as a string.
+    operator std::string() const
+    {
+        return std::string(data(), size_);
+    }
+
+    /// @return the number of bytes in the payload.
+    size_t size() const
+    {
+        return size_;
+    }
+
+    /// @return the number of bytes in the payload.
+    size_t length() const
+    {
+        return size_;
+    }
+
+    /// @return true if the payload has no bytes.
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    /// @return the number of bytes the payload can hold without allocating.
+    size_t capacity() const
+    {
+        return spilled_ ? chunk_capacity(u_.chunk_) : INLINE_CAPACITY;
+    }
+
+    /// @return true if the payload bytes live in a spill chunk.
+    bool spilled() const
+    {
+        return spilled_;
+    }
+
+    /// @return pointer to the payload bytes. The bytes are followed by a
+    /// NUL. Must not be written to.
+    const char *data() const
+    {
+        return spilled_ ? chunk_data(u_.chunk_) : u_.inline_;
+    }
+
+    /// @return pointer to the NUL-terminated payload bytes.
+    const char *c_str() const
+    {
+        return data();
+    }
+
+    /// @param pos is the offset. @return the byte at offset pos.
+    const char &operator[](size_t pos) const
+    {
+        return data()[pos];
+    }
+
+    /// @param pos is the offset. @return modifiable reference to the byte at
+    /// offset pos.
+    char &operator[](size_t pos)
+    {
+        return mutable_data()[pos];
+    }
+
+    /// @return the first byte.
+    char front() const
+    {
+        return data()[0];
+    }
+
+    /// @return the last byte.
+    char back() const
+    {
+        return data()[size_ - 1];
+    }
+
+    /// @return read-only iterator to the first byte.
+    const_iterator begin() const
+    {
+        return data();
+    }
+
+    /// @return read-only iterator past the last byte.
+    const_iterator end() const
+    {
+        return data() + size_;
+    }
+
+    /// @return iterator to the first byte.
+    iterator begin()
+    {
+        return mutable_data();
+    }
+
+    /// @return iterator past the last byte.
+    iterator end()
+    {
+        return mutable_data() + size_;
+    }
+
+    /// Makes sure that the storage is not shared with any other payload.
+    void unshare()
+    {
+        mutable_data();
+    }
+
+    /// Removes all bytes. Keeps a private spill chunk for reuse.
+    void clear()
+    {
+        if (spilled_ && u_.chunk_->references() > 1)
+        {
+            release();
+            spilled_ = 0;
+        }
+        set_size(0);
+    }
+
+    /// Makes sure that at least n bytes can be stored without further
+    /// allocation. @param n is the required capacity.
+    void reserve(size_t n)
+    {
+        make_room(n);
+    }
+
+    /// Changes the size. @param n is the new size. @param c is the value of
+    /// the added bytes when growing.
+    void resize(size_t n, char c = 0);
+
+    /// Appends a byte. @param c is the byte to add.
+    void push_back(char c)
+    {
+        make_room(size_ + 1);
+        char *p = mutable_data();
+        p[size_] = c;
+        set_size(size_ + 1);
+    }
+
+    /// Removes the last byte.
+    void pop_back()
+    {
+        HASSERT(size_);
+        make_room(size_);
+        set_size(size_ - 1);
+    }
+
+    /// Appends a memory area. @param s is the start of the data. @param len
+    /// is the number of bytes. @return *this
+    Payload &append(const char *s, size_t len);
+
+    /// Appends a NUL-terminated string. @param s is the string. @return *this
+    Payload &append(const char *s)
+    {
+        return append(s, strlen(s));
+    }
+
+    /// Appends a string. @param s is the string. @return *this
+    Payload &append(const std::string &s)
+    {
+        return append(s.data(), s.size());
+    }
+
+    /// Appends another payload. @param o is the payload. @return *this
+    Payload &append(const Payload &o)
+    {
+        return append(o.data(), o.size());
+    }
+
+    /// Appends a byte repeatedly. @param count is the number of bytes. @param
+    /// c is the byte to add. @return *this
+    Payload &append(size_t count, char c)
+    {
+        resize(size_ + count, c);
+        return *this;
+    }
+
+    /// Appends a byte. @param c is the byte to add. @return *this
+    Payload &operator+=(char c)
+    {
+        push_back(c);
+        return *this;
+    }
+
+    /// Appends a NUL-terminated string. @param s is the string. @return *this
+    Payload &operator+=(const char *s)
+    {
+        return append(s);
+    }
+
+    /// Appends a string. @param s is the string. @return *this
+    Payload &operator+=(const std::string &s)
+    {
+        return append(s);
+    }
+
+    /// Appends another payload. @param o is the payload. @return *this
+    Payload &operator+=(const Payload &o)
+    {
+        return append(o);
+    }
+
+    /// Replaces the contents. @param s is the start of the data. @param len
+    /// is the number of bytes. @return *this
+    Payload &assign(const char *s, size_t len)
+    {
+        clear();
+        return append(s, len);
+    }
+
+    /// Replaces the contents. @param s is a NUL-terminated string. @return
+    /// *this
+    Payload &assign(const char *s)
+    {
+        return assign(s, strlen(s));
+    }
+
+    /// Replaces the contents. @param s is a string. @return *this
+    Payload &assign(const std::string &s)
+    {
+        return assign(s.data(), s.size());
+    }
+
+    /// Replaces the contents. @param count is the number of bytes. @param c
+    /// is the byte to fill with. @return *this
+    Payload &assign(size_t count, char c)
+    {
+        clear();
+        return append(count, c);
+    }
+
+    /// Removes bytes. @param pos is the offset of the first byte to remove.
+    /// @param len is the number of bytes to remove. @return *this
+    Payload &erase(size_t pos = 0, size_t len = npos);
+
+    /// @param pos is the offset of the first byte. @param len is the maximum
+    /// number of bytes. @return a copy of a part of the payload.
+    Payload substr(size_t pos = 0, size_t len = npos) const;
+
+    /// Searches for a byte. @param c is the byte to find. @param pos is the
+    /// offset to start at. @return the offset of the byte or npos.
+    size_t find(char c, size_t pos = 0) const;
+
+    /// Searches for a byte sequence. @param s is the sequence to find.
+    /// @param pos is the offset to start at. @param len is the length of s.
+    /// @return the offset of the match or npos.
+    size_t find(const char *s, size_t pos, size_t len) const;
+
+    /// Searches for a NUL-terminated string. @param s is the string to find.
+    /// @param pos is the offset to start at. @return the offset of the match
+    /// or npos.
+    size_t find(const char *s, size_t pos = 0) const
+    {
+        return find(s, pos, strlen(s));
+    }
+
+    /// Byte-wise comparison. @param s is the start of the data to compare
+    /// to. @param len is its length. @return <0, 0 or >0 like memcmp.
+    int compare(const char *s, size_t len) const;
+
+    /// Exchanges the contents with another payload. Never allocates. @param
+    /// o is the other payload.
+    void swap(Payload &o)
+    {
+        std::swap(size_, o.size_);
+        std::swap(spilled_, o.spilled_);
+        std::swap(u_, o.u_);
+    }
+
+private:
+    /// Buffer type holding the spilled bytes.
+    typedef Buffer<PayloadChunk> ChunkBuffer;
+
+    /// @param b is a spill chunk. @return the bytes stored in it.
+    static char *chunk_data(ChunkBuffer *b)
+    {
+        return reinterpret_cast<char *>(b + 1);
+    }
+
+    /// @param b is a spill chunk. @return the number of bytes it can hold
+    /// (excluding the NUL terminator).
+    static size_t chunk_capacity(ChunkBuffer *b)
+    {
+        return b->size() - sizeof(ChunkBuffer) - 1;
+    }
+
+    /// @return pointer to the payload bytes that may be written; makes the
+    /// spill chunk private if it is shared.
+    char *mutable_data()
+    {
+        if (spilled_)
+        {
+            if (u_.chunk_->references() > 1)
+            {
+                move_to(chunk_capacity(u_.chunk_));
+            }
+            return chunk_data(u_.chunk_);
+        }
+        return u_.inline_;
+    }
+
+    /// Ensures the storage is private and can hold n bytes. @param n is the
+    /// required capacity.
+    void make_room(size_t n)
+    {
+        if (n > capacity())
+        {
+            grow(n);
+        }
+        else if (spilled_ && u_.chunk_->references() > 1)
+        {
+            move_to(chunk_capacity(u_.chunk_));
+        }
+    }
+
+    /// Moves the contents to a new spill chunk that can hold at least n
+    /// bytes. @param n is the required capacity.
+    void grow(size_t n);
+
+    /// Moves the contents to a new private spill chunk. @param cap is the
+    /// capacity of the new chunk.
+    void move_to(size_t cap);
+
+    /// Drops the reference to the spill chunk, if any. Does not change
+    /// spilled_.
+    void release()
+    {
+        if (spilled_)
+        {
+            u_.chunk_->unref();
+        }
+    }
+
+    /// Sets the size and writes the terminating NUL. The storage must be
+    /// private. @param n is the new size.
+    void set_size(size_t n)
+    {
+        HASSERT(n <= capacity());
+        size_ = n;
+        (spilled_ ? chunk_data(u_.chunk_) : u_.inline_)[n] = 0;
+    }
+
+    /// Storage of the payload bytes.
+    union Storage
+    {
+        /// Inline bytes with a terminating NUL. Valid when spilled_ is 0.
+        char inline_[INLINE_CAPACITY + 1];
+        /// Spill chunk. Valid when spilled_ is 1.
+        ChunkBuffer *chunk_;
+    } u_;
+    /// Number of bytes in the payload.
+    uint16_t size_;
+    /// 1 if the bytes are in a spill chunk, 0 if they are inline.
+    uint8_t spilled_;
+};
+
+/// @return true if the two payloads have the same bytes. @param a payload
+/// @param b payload
+inline bool operator==(const Payload &a, const Payload &b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/// @return true if the payload has the same bytes as the string. @param a
+/// payload @param b string
+inline bool operator==(const Payload &a, const std::string &b)
+{
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/// @return true if the payload has the same bytes as the string. @param a
+/// string @param b payload
+inline bool operator==(const std::string &a, const Payload &b)
+{
+    return b == a;
+}
+
+/// @return true if the payload has the same bytes as the string. @param a
+/// payload @param b NUL-terminated string
+inline bool operator==(const Payload &a, const char *b)
+{
+    return a.compare(b, strlen(b)) == 0;
+}
+
+/// @return true if the payload has the same bytes as the string. @param a
+/// NUL-terminated string @param b payload
+inline bool operator==(const char *a, const Payload &b)
+{
+    return b == a;
+}
+
+/// @return true if the bytes differ. @param a payload @param b payload
+inline bool operator!=(const Payload &a, const Payload &b)
+{
+    return !(a == b);
+}
+
+/// @return true if the bytes differ. @param a payload @param b string
+inline bool operator!=(const Payload &a, const std::string &b)
+{
+    return !(a == b);
+}
+
+/// @return true if the bytes differ. @param a string @param b payload
+inline bool operator!=(const std::string &a, const Payload &b)
+{
+    return !(b == a);
+}
+
+/// @return true if the bytes differ. @param a payload @param b
+/// NUL-terminated string
+inline bool operator!=(const Payload &a, const char *b)
+{
+    return !(a == b);
+}
+
+/// @return true if the bytes differ. @param a NUL-terminated string @param b
+/// payload
+inline bool operator!=(const char *a, const Payload &b)
+{
+    return !(b == a);
+}
+
+/// @return true if a sorts before b byte-wise. @param a payload @param b
+/// payload
+inline bool operator<(const Payload &a, const Payload &b)
+{
+    return a.compare(b.data(), b.size()) < 0;
+}
 
 } // namespace openlcb
 
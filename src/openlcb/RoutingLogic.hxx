@@ -36,12 +36,17 @@
 #ifndef _OPENLCB_ROUTNGLOGIC_HXX_
 #define _OPENLCB_ROUTNGLOGIC_HXX_
 
-#include <set>
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <map>
-#include <unordered_map>
+#include <memory>
+#include <vector>
 
+#include "nmranet_config.h"
 #include "os/OS.hxx"
 #include "openlcb/EventHandler.hxx"
+#include "utils/logging.h"
 
 namespace openlcb
 {
@@ -57,19 +62,200 @@ namespace openlcb
  */
 uint8_t event_range_to_bit_count(EventId *event);
 
+/** Open-addressing hash table with a single writer and lock-free readers. Used
+ * for the published copies of the routing tables. Entries can be added and
+ * their values overwritten while readers are looking at the table, but not
+ * removed. Key must be a type for which std::hash is defined; Value must be a
+ * pointer type so that it can be stored atomically.
+ */
+template <class Key, class Value> class PublishedHashMap
+{
+public:
+    typedef Key key_type;
+    typedef Value mapped_type;
+
+    /// Creates an empty table.
+    ///
+    /// @param max_entries is the number of entries the table can take.
+    PublishedHashMap(size_t max_entries)
+        : maxEntries_(max_entries)
+    {
+        bits_ = 1;
+        while ((size_t(1) << bits_) < max_entries * 2)
+        {
+            ++bits_;
+        }
+        slots_.reset(new Slot[size_t(1) << bits_]);
+    }
+
+    /// @return true if there is no space for another new key.
+    bool full() const
+    {
+        return size_ >= maxEntries_;
+    }
+
+    /// @return the number of keys in the table.
+    size_t size() const
+    {
+        return size_;
+    }
+
+    /// Adds or overwrites an entry. Only one thread may call this at a time,
+    /// but it may be concurrent with find() calls.
+    ///
+    /// @param key is the key to insert.
+    /// @param value is the value to store for key.
+    /// @return false if the key is new and the table is full. The table is
+    /// not modified in this case.
+    bool insert(const Key &key, Value value)
+    {
+        size_t i = slot(key);
+        while (__atomic_load_n(&slots_[i].used_, __ATOMIC_ACQUIRE))
+        {
+            if (slots_[i].key_ == key)
+            {
+                __atomic_store_n(&slots_[i].value_, value, __ATOMIC_RELEASE);
+                return true;
+            }
+            i = next(i);
+        }
+        if (full())
+        {
+            return false;
+        }
+        slots_[i].key_ = key;
+        slots_[i].value_ = value;
+        // Readers will only look at the key and value after seeing this.
+        __atomic_store_n(&slots_[i].used_, true, __ATOMIC_RELEASE);
+        ++size_;
+        return true;
+    }
+
+    /// Looks up a key.
+    ///
+    /// @param key is the key to look up.
+    /// @param value will be set to the value stored for key.
+    /// @return true if the key is in the table.
+    bool find(const Key &key, Value *value) const
+    {
+        size_t i = slot(key);
+        while (__atomic_load_n(&slots_[i].used_, __ATOMIC_ACQUIRE))
+        {
+            if (slots_[i].key_ == key)
+            {
+                *value = __atomic_load_n(&slots_[i].value_, __ATOMIC_ACQUIRE);
+                return true;
+            }
+            i = next(i);
+        }
+        return false;
+    }
+
+    /// Calls a function for every entry. Must be called on the writer.
+    ///
+    /// @param fn is called with (key, value) for each entry.
+    template <class F> void for_each(F fn) const
+    {
+        for (size_t i = 0; i < (size_t(1) << bits_); ++i)
+        {
+            if (slots_[i].used_)
+            {
+                fn(slots_[i].key_, slots_[i].value_);
+            }
+        }
+    }
+
+private:
+    /// @return the home slot of a given key.
+    size_t slot(const Key &key) const
+    {
+        uint64_t h = std::hash<Key>()(key);
+        return (h * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - bits_);
+    }
+
+    /// @return the slot after i in the probe sequence.
+    size_t next(size_t i) const
+    {
+        return (i + 1) & ((size_t(1) << bits_) - 1);
+    }
+
+    /// One entry in the table.
+    struct Slot
+    {
+        Key key_;
+        Value value_;
+        /// true if this slot is filled.
+        bool used_{false};
+    };
+    /// Storage. The size is a power of two and at least twice maxEntries_, so
+    /// every probe sequence ends at an empty slot.
+    std::unique_ptr<Slot[]> slots_;
+    /// log2 of the number of slots.
+    unsigned bits_;
+    /// Number of keys in the table.
+    size_t size_{0};
+    /// Capacity before the table needs to be replaced by a bigger one.
+    size_t maxEntries_;
+};
+
 /** Routing table for gateways and routers in OpenLCB.
  *
  * The routing table contains which direction to send addressed packets as well
  * as filters for the event IDs that have listeners in a given port.
+ *
+ * The lookup calls (lookup_port_for_address, check_pcer) are on the per-frame
+ * path and do not take a mutex. They read open-addressing hash tables which
+ * the writers (under a mutex) update in place: new addresses and changed
+ * routes are visible right away, and a table is only copied when it needs to
+ * grow, which is amortized O(1) per new entry. Replaced tables and filters are
+ * freed once all readers that might have seen them have left, using a
+ * two-phase reader epoch counter.
+ *
+ * The event registrations of each port are kept as a minimal set of disjoint
+ * event ID intervals: every registration is merged with the overlapping and
+ * adjacent intervals on insertion, so repeated identified messages for the
+ * same events do not grow the table, and check_pcer is a single binary
+ * search. If a port needs more intervals than the configured budget, the
+ * intervals are dropped and every event report is forwarded to that port.
+ *
+ * The published filter of a port is a sorted copy of its intervals. Small
+ * filters are rebuilt on every change. For large filters a rebuild is only
+ * done once a number of changes or lookups proportional to the filter size
+ * accumulated; in between the port conservatively gets all event reports. This
+ * keeps identify storms linear instead of copying the filter on every frame.
  */
 template <class Port, typename Address> class RoutingLogic
 {
 public:
-    RoutingLogic()
+    /// Constructor.
+    ///
+    /// @param max_intervals is the maximum number of event intervals kept per
+    /// port; 0 for unlimited.
+    RoutingLogic(
+        unsigned max_intervals = config_routing_max_event_intervals())
+        : addresses_(new AddressTable(INITIAL_TABLE_SIZE))
+        , ports_(new PortTable(INITIAL_TABLE_SIZE))
+        , maxIntervals_(max_intervals)
     {
+        matchAll_.matchAll_ = true;
     }
+
     ~RoutingLogic()
     {
+        for (auto &it : eventRoutingTable_)
+        {
+            delete it.second.filter_;
+        }
+        delete addresses_;
+        delete ports_;
+        for (auto *r : retired_)
+        {
+            delete r;
+        }
+        for (auto *r : graveyard_)
+        {
+            delete r;
+        }
     }
 
     /** Clears all entries in the routing table related to a given port, as the
@@ -80,19 +266,33 @@ public:
     void remove_port(Port *port)
     {
         OSMutexLock l(&lock_);
-        eventRoutingTable_.erase(port);
-        // Removing entries from a hashmap invalidates an iterator, thus it is
-        // safer to null them out than actually remove. Having a null value
-        // will cause address lookup to return null for a node that has not
-        // been seen since then elsewhere, which is exactly the behavior we
-        // want.
-        for (auto &it : addressRoutingTable_)
+        auto ip = eventRoutingTable_.find(port);
+        if (ip != eventRoutingTable_.end())
         {
-            if (it.second == port)
+            set_filter(port, nullptr);
+            if (ip->second.filter_)
+            {
+                retired_.push_back(ip->second.filter_);
+            }
+            eventRoutingTable_.erase(ip);
+        }
+        // Entries cannot be removed from the published table. Having a null
+        // value will cause address lookup to return null for a node that has
+        // not been seen since then elsewhere, which is exactly the behavior we
+        // want.
+        AddressTable *t = addresses_;
+        std::vector<Address> moved;
+        t->for_each([port, &moved](Address a, Port *p) {
+            if (p == port)
             {
-                it.second = nullptr;
+                moved.push_back(a);
             }
+        });
+        for (Address a : moved)
+        {
+            t->insert(a, nullptr);
         }
+        reclaim();
     }
 
     /** Declares that a given node ID is reachable via a specific port. Used
@@ -104,8 +304,23 @@ public:
      */
     void add_node_id_to_route(Port *port, Address source)
     {
+        {
+            // Fast path: this is called for every incoming frame, and almost
+            // always re-declares a route we already know.
+            ReadSection r(this);
+            Port *p;
+            if (r.addresses()->find(source, &p) && p == port)
+            {
+                return;
+            }
+        }
         OSMutexLock l(&lock_);
-        addressRoutingTable_[source] = port;
+        if (!addresses_->insert(source, port))
+        {
+            grow(&addresses_);
+            HASSERT(addresses_->insert(source, port));
+            reclaim();
+        }
     }
 
     /** Looks up which port an addressed packet should be sent to.
@@ -117,11 +332,9 @@ public:
      */
     Port *lookup_port_for_address(Address dest)
     {
-        OSMutexLock l(&lock_);
-        auto it = addressRoutingTable_.find(dest);
-        if (it == addressRoutingTable_.end())
-            return nullptr;
-        return it->second;
+        ReadSection r(this);
+        Port *p;
+        return r.addresses()->find(dest, &p) ? p : nullptr;
     }
 
     /** Declares that there is a consumer for the given event ID on the given
@@ -132,8 +345,7 @@ public:
      * that port. */
     void register_consumer(Port *port, EventId event)
     {
-        OSMutexLock l(&lock_);
-        eventRoutingTable_[port].registeredConsumers_[0].insert(event);
+        add_event_entry(port, event, event);
     }
 
     /** Declares that there is a consumer for the given event ID range on the
@@ -144,10 +356,11 @@ public:
      * method. */
     void register_consumer_range(Port *port, EventId encoded_range)
     {
-        OSMutexLock l(&lock_);
         uint8_t bit_count = event_range_to_bit_count(&encoded_range);
-        eventRoutingTable_[port].registeredConsumers_[bit_count].insert(
-            encoded_range);
+        EventId last = bit_count >= 64
+            ? UINT64_MAX
+            : encoded_range + ((UINT64_C(1) << bit_count) - 1);
+        add_event_entry(port, encoded_range, last);
     }
 
     /** Declares that there is a producer for the given event ID on the given
@@ -183,54 +396,383 @@ public:
      *
      * @return true if the given event has a consumer on the given port. */
     bool check_pcer(Port *port, EventId event)
+    {
+        if (__atomic_load_n(&deferredLookups_, __ATOMIC_RELAXED))
+        {
+            count_deferred_lookup();
+        }
+        ReadSection r(this);
+        const PortFilter *f;
+        if (!r.ports()->find(port, &f) || !f)
+        {
+            return false;
+        }
+        return f->matches(event);
+    }
+
+    /** Rebuilds the filters of all ports whose filter rebuild was postponed.
+     * Calling this is optional; the filters are rebuilt after enough further
+     * changes or lookups. */
+    void flush()
+    {
+        OSMutexLock l(&lock_);
+        for (auto &it : eventRoutingTable_)
+        {
+            if (it.second.deferred_)
+            {
+                rebuild_filter(it.first, &it.second);
+            }
+        }
+        __atomic_store_n(&deferredLookups_, 0, __ATOMIC_RELAXED);
+        reclaim();
+    }
+
+    /** @return the number of disjoint event intervals stored for a port, or
+     * -1 if the port is in forward-all mode because it exceeded the interval
+     * budget. */
+    int num_event_intervals(Port *port)
     {
         OSMutexLock l(&lock_);
         auto ip = eventRoutingTable_.find(port);
         if (ip == eventRoutingTable_.end())
         {
-            return false;
+            return 0;
+        }
+        if (ip->second.overflow_)
+        {
+            return -1;
+        }
+        return ip->second.intervals_.size();
+    }
+
+private:
+    enum
+    {
+        /// Number of entries the address and port tables start with.
+        INITIAL_TABLE_SIZE = 16,
+        /// Filters with at most this many intervals are rebuilt on every
+        /// change.
+        SMALL_FILTER = 64,
+        /// A postponed filter rebuild happens after (filter size / this many)
+        /// changes or lookups.
+        REBUILD_DIVISOR = 8,
+    };
+
+    /// Base class for objects that readers may hold a pointer to. These are
+    /// freed via the retired_ / graveyard_ lists.
+    struct Retirable
+    {
+        virtual ~Retirable()
+        {
         }
-        for (auto im = ip->second.registeredConsumers_.begin();
-             im != ip->second.registeredConsumers_.end(); ++im)
+    };
+
+    /// Published copy of the event filter of a single port.
+    struct PortFilter : public Retirable
+    {
+        /// @return true if event matches any registration in this filter.
+        bool matches(EventId event) const
         {
-            if (im->first == 0)
+            if (matchAll_)
             {
-                if (im->second.find(event) != im->second.end())
-                    return true;
+                return true;
             }
-            else if (im->first == 64)
+            auto it = std::upper_bound(firsts_.begin(), firsts_.end(), event);
+            if (it == firsts_.begin())
             {
-                if (!im->second.empty())
-                    return true;
+                return false;
             }
-            else
+            return event <= lasts_[it - firsts_.begin() - 1];
+        }
+
+        /// First event of each interval. Sorted.
+        std::vector<EventId> firsts_;
+        /// Last event (inclusive) of the interval starting at firsts_[i].
+        std::vector<EventId> lasts_;
+        /// true if every event should be forwarded.
+        bool matchAll_{false};
+    };
+
+    /// Published routing table for addresses.
+    struct AddressTable : public Retirable,
+                          public PublishedHashMap<Address, Port *>
+    {
+        using PublishedHashMap<Address, Port *>::PublishedHashMap;
+    };
+
+    /// Published table of the per-port event filters. The values are not
+    /// owned.
+    struct PortTable : public Retirable,
+                       public PublishedHashMap<Port *, const PortFilter *>
+    {
+        using PublishedHashMap<Port *, const PortFilter *>::PublishedHashMap;
+    };
+
+    /// RAII object for the duration of a lock-free lookup. Ensures that the
+    /// tables and filters it returns are not freed while the object is alive.
+    class ReadSection
+    {
+    public:
+        ReadSection(RoutingLogic *parent)
+            : parent_(parent)
+        {
+            while (true)
             {
-                EventId masked_range =
-                    event & ~((UINT64_C(1) << im->first) - 1);
-                if (im->second.find(masked_range) != im->second.end())
-                    return true;
+                epoch_ = __atomic_load_n(&parent_->epoch_, __ATOMIC_SEQ_CST);
+                __atomic_fetch_add(
+                    &parent_->readers_[epoch_ & 1], 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&parent_->epoch_, __ATOMIC_SEQ_CST) ==
+                    epoch_)
+                {
+                    break;
+                }
+                // Raced with an epoch flip. Retry in the new epoch.
+                __atomic_fetch_sub(
+                    &parent_->readers_[epoch_ & 1], 1, __ATOMIC_SEQ_CST);
             }
         }
-        return false;
-    }
 
-private:
-    /// Protects all internal data structures.
-    OSMutex lock_;
+        ~ReadSection()
+        {
+            __atomic_fetch_sub(
+                &parent_->readers_[epoch_ & 1], 1, __ATOMIC_SEQ_CST);
+        }
+
+        /// @return the address table to perform the lookup on.
+        const AddressTable *addresses()
+        {
+            return __atomic_load_n(&parent_->addresses_, __ATOMIC_ACQUIRE);
+        }
+
+        /// @return the port filter table to perform the lookup on.
+        const PortTable *ports()
+        {
+            return __atomic_load_n(&parent_->ports_, __ATOMIC_ACQUIRE);
+        }
 
-    /// Stores all known addresses and which port they route to.
-    std::unordered_map<Address, Port *> addressRoutingTable_;
+    private:
+        RoutingLogic *parent_;
+        unsigned epoch_;
+    };
 
-    /// The per-port event information.
+    /// Per-port event information (master copy).
     struct EventSet
     {
-        /// key: number of bits set in the mask part. Valid values:
-        /// 0..64. Value of 0 means individual event.
-        std::map<uint8_t, std::set<EventId>> registeredConsumers_;
+        /// Disjoint, non-adjacent intervals of registered event IDs. Key: first
+        /// event, value: last event (inclusive).
+        std::map<EventId, EventId> intervals_;
+        /// true if the port exceeded the interval budget and all events are
+        /// forwarded to it.
+        bool overflow_{false};
+        /// true if the published filter is matchAll_ until the next rebuild.
+        bool deferred_{false};
+        /// Number of changes to intervals_ since filter_ was built.
+        unsigned pendingChanges_{0};
+        /// Published copy of intervals_. Owned. May be nullptr if nothing
+        /// was published yet.
+        PortFilter *filter_{nullptr};
     };
 
+    /// Adds an interval of events to the event routing table of a port,
+    /// merging it with the overlapping and adjacent intervals.
+    ///
+    /// @param port is the port where the registration came from.
+    /// @param first is the first event of the registration.
+    /// @param last is the last event (inclusive) of the registration.
+    void add_event_entry(Port *port, EventId first, EventId last)
+    {
+        OSMutexLock l(&lock_);
+        EventSet &s = eventRoutingTable_[port];
+        if (s.overflow_)
+        {
+            return;
+        }
+        auto &m = s.intervals_;
+        auto it = m.upper_bound(first);
+        if (it != m.begin())
+        {
+            auto prev = std::prev(it);
+            if (prev->second >= last)
+            {
+                // Already covered. This is the common case for repeated
+                // identified messages.
+                return;
+            }
+            if (prev->second == UINT64_MAX || prev->second + 1 >= first)
+            {
+                first = prev->first;
+                it = prev;
+            }
+        }
+        while (it != m.end() && (last == UINT64_MAX || it->first <= last + 1))
+        {
+            if (it->second > last)
+            {
+                last = it->second;
+            }
+            it = m.erase(it);
+        }
+        m.emplace_hint(it, first, last);
+        if (maxIntervals_ && m.size() > maxIntervals_)
+        {
+            LOG(INFO,
+                "RoutingLogic: port %p exceeded %u event intervals. Forwarding "
+                "all events.",
+                port, maxIntervals_);
+            s.overflow_ = true;
+            m.clear();
+        }
+        ++s.pendingChanges_;
+        unsigned budget = rebuild_budget(s);
+        if (s.overflow_ || m.size() <= SMALL_FILTER ||
+            s.pendingChanges_ >= budget)
+        {
+            rebuild_filter(port, &s);
+        }
+        else if (!s.deferred_)
+        {
+            // Forwards everything to this port until the rebuild.
+            s.deferred_ = true;
+            set_filter(port, &matchAll_);
+            if (__atomic_load_n(&deferredLookups_, __ATOMIC_RELAXED) == 0)
+            {
+                __atomic_store_n(&deferredLookups_, budget, __ATOMIC_RELAXED);
+            }
+        }
+        reclaim();
+    }
+
+    /// @return how many changes or lookups a postponed rebuild of a port's
+    /// filter may wait for. @param s is the port's event set.
+    static unsigned rebuild_budget(const EventSet &s)
+    {
+        return std::max<unsigned>(
+            SMALL_FILTER, s.intervals_.size() / REBUILD_DIVISOR);
+    }
+
+    /// Called by lookups while some filter rebuild is postponed. The lookup
+    /// that uses up the budget rebuilds the filters.
+    void count_deferred_lookup()
+    {
+        unsigned v = __atomic_load_n(&deferredLookups_, __ATOMIC_RELAXED);
+        while (v)
+        {
+            if (__atomic_compare_exchange_n(&deferredLookups_, &v, v - 1,
+                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                if (v == 1)
+                {
+                    flush();
+                }
+                return;
+            }
+        }
+    }
+
+    /// Publishes a new filter for a port from its intervals. Must be called
+    /// with lock_ held.
+    ///
+    /// @param port is the port to rebuild the filter of.
+    /// @param s is the event set of port.
+    void rebuild_filter(Port *port, EventSet *s)
+    {
+        PortFilter *f = new PortFilter();
+        f->matchAll_ = s->overflow_;
+        f->firsts_.reserve(s->intervals_.size());
+        f->lasts_.reserve(s->intervals_.size());
+        for (const auto &it : s->intervals_)
+        {
+            f->firsts_.push_back(it.first);
+            f->lasts_.push_back(it.second);
+        }
+        set_filter(port, f);
+        if (s->filter_)
+        {
+            retired_.push_back(s->filter_);
+        }
+        s->filter_ = f;
+        s->deferred_ = false;
+        s->pendingChanges_ = 0;
+    }
+
+    /// Publishes the filter of a port. Must be called with lock_ held.
+    ///
+    /// @param port is the port whose filter changes.
+    /// @param f is the new filter (not owned).
+    void set_filter(Port *port, const PortFilter *f)
+    {
+        if (!ports_->insert(port, f))
+        {
+            grow(&ports_);
+            HASSERT(ports_->insert(port, f));
+        }
+    }
+
+    /// Replaces a published table with one of twice the capacity, containing
+    /// the same entries. Must be called with lock_ held.
+    ///
+    /// @param table is the published table pointer to replace.
+    template <class Table> void grow(Table **table)
+    {
+        Table *old = *table;
+        Table *t = new Table(old->size() * 2);
+        old->for_each([t](const typename Table::key_type &k,
+                          typename Table::mapped_type v) { t->insert(k, v); });
+        __atomic_store_n(table, t, __ATOMIC_RELEASE);
+        retired_.push_back(old);
+    }
+
+    /// Frees retired objects when it is safe to do so. Objects retired in
+    /// epoch e are moved to the graveyard at the flip to e+1, and freed at the
+    /// flip to e+2, which requires all readers that entered in epoch e to have
+    /// left. Must be called with lock_ held.
+    void reclaim()
+    {
+        if (retired_.empty() && graveyard_.empty())
+        {
+            return;
+        }
+        unsigned e = __atomic_load_n(&epoch_, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&readers_[(e + 1) & 1], __ATOMIC_SEQ_CST) != 0)
+        {
+            // Readers from the previous epoch are still active.
+            return;
+        }
+        for (auto *r : graveyard_)
+        {
+            delete r;
+        }
+        graveyard_.swap(retired_);
+        retired_.clear();
+        __atomic_store_n(&epoch_, e + 1, __ATOMIC_SEQ_CST);
+    }
+
+    /// Protects all master data structures and the writes to the published
+    /// tables.
+    OSMutex lock_;
+
     /// Stores per-port event information.
     std::map<Port *, EventSet> eventRoutingTable_;
+
+    /// Published address routing table. Read without locking.
+    AddressTable *addresses_;
+    /// Published port filter table. Read without locking.
+    PortTable *ports_;
+    /// Filter published for ports whose rebuild is postponed.
+    PortFilter matchAll_;
+    /// Objects replaced in the current epoch.
+    std::vector<Retirable *> retired_;
+    /// Objects replaced in the previous epoch.
+    std::vector<Retirable *> graveyard_;
+    /// Reader epoch counter. Only the low bit is used to index readers_.
+    unsigned epoch_{0};
+    /// Number of active readers that entered in an even/odd epoch.
+    unsigned readers_[2] = {0, 0};
+    /// Number of lookups left until the postponed filter rebuilds are done.
+    /// 0 if there is nothing postponed.
+    unsigned deferredLookups_{0};
+    /// Maximum number of event intervals per port, 0 for unlimited.
+    unsigned maxIntervals_;
 };
 
 } // namespace openlcb
@@ -25,506 +25,637 @@
  * POSSIBILITY OF SUCH DAMAGE.
  *
  * \file Stream.cxx
- * This file defines NMRAnet streams.
+ * Stream service: sender and receiver flows for the OpenLCB stream
+ * transport protocol.
  *
  * @author Stuart W. Baker
  * @date 20 October 2013
  */
 
 #include "openlcb/Stream.hxx"
-#include "openlcb/NMRAnetNode.hxx"
-#include "openlcb/NMRAnetMessageID.hxx"
-#include "utils/macros.h"
 
 namespace openlcb
 {
 
-/** Open a stream.
- * @param dst destination node for stream
- * @param timeout 0 = do not wait for success, deliver success asynchronously
- *                > 0, wait for success, or fail on timeout
- * @return NULL on fail, else stream handle on success or pending success
- */
-Stream::StreamHandle Stream::sopen(NodeHandle dst, long long timeout)
-{
-    StreamHandle handle = NULL;
-
-    Node::mutex.lock();
-    if (count < CHANNELS_PER_NODE)
-    {
-        Metadata* metadata = new Metadata;
-        metadata->data = RingBuffer<uint8_t>::create(MAX_BUFFER_SIZE * 2);
-        metadata->size = MAX_BUFFER_SIZE;
-        metadata->count = 0;
-        metadata->srcID = 0;
-        metadata->nodeHandle = dst;
-        RBTree<uint8_t, Metadata*>::Node *last = outboundTree.last();
-        
-        if (last != NULL)
-        {
-            metadata->srcID = last->key + 1;
-            while (outboundTree.find(metadata->srcID) != NULL)
+long long STREAM_TIMEOUT_NSEC = SEC_TO_NSEC(3);
+
+StreamSender::StreamSender(StreamService *service, uint8_t local_stream_id)
+    : CallableFlow<StreamSendRequest>(service)
+    , streamService_(service)
+    , node_(nullptr)
+    , timeoutNsec_(0)
+    , available_(0)
+    , offset_(0)
+    , totalBytes_(0)
+    , bufferSize_(0)
+    , localStreamId_(local_stream_id)
+    , remoteStreamId_(StreamDefs::INVALID_STREAM_ID)
+    , streamFlags_(0)
+    , streamAdditionalFlags_(0)
+    , state_(CLOSED)
+    , sleeping_(0)
+    , replied_(0)
+{
+}
+
+StateFlowBase::Action StreamSender::entry()
+{
+    switch (request()->cmd)
+    {
+        case StreamSendRequest::CMD_OPEN:
+            if (state_ != CLOSED)
             {
-                metadata->srcID++;
+                return return_with_error(Defs::ERROR_INVALID_ARGS);
             }
-        }
-        
-        Buffer *buffer = buffer_alloc(6);
-        uint8_t *data = (uint8_t*)buffer->start();
-        
-        data[0] = (MAX_BUFFER_SIZE >> 8) & 0xFF;
-        data[1] = (MAX_BUFFER_SIZE >> 0) & 0xFF;
-        data[2] = 0;
-        data[3] = 0;
-        data[4] = metadata->srcID;
-        data[5] = 0;
-
-        buffer->advance(6);
-        
-        RBTree<uint8_t, Metadata*>::Node *node =
-            new RBTree<uint8_t, Metadata*>::Node(metadata->srcID, metadata);
-
-        outboundTree.insert(node);
-        
-        write(Defs::MTI_STREAM_INITIATE_REQUEST, dst, buffer);
-        
-        if (timeout)
-        {
-            metadata->state = WAITING_O;
-
-            Node::mutex.unlock();
-            int result = sem.timedwait(timeout);
-            Node::mutex.lock();
-
-            if (result != 0 || metadata->state != CONNECTED_O)
+            node_ = request()->src;
+            dst_ = request()->dst;
+            timeoutNsec_ = request()->timeout_nsec;
+            totalBytes_ = 0;
+            bufferSize_ = 0;
+            remoteStreamId_ = StreamDefs::INVALID_STREAM_ID;
+            replied_ = 0;
+            state_ = OPENING;
+            return allocate_and_call(
+                node_->iface()->addressed_message_write_flow(),
+                STATE(send_initiate));
+        case StreamSendRequest::CMD_WRITE:
+            if (state_ != OPEN)
             {
-                outboundTree.remove(node);
-                metadata->data->destroy();
-                delete node;
-                delete metadata;
+                return return_with_error(Defs::ERROR_INVALID_ARGS);
             }
-            else
+            offset_ = 0;
+            return call_immediately(STATE(send_data));
+        case StreamSendRequest::CMD_CLOSE:
+            if (state_ != OPEN)
             {
-                count++;
-                handle = (StreamHandle)metadata;
+                return return_ok();
             }
-            /** @todo (Stuart Baker) is there a race between connected and timeout */
-        }
-        else
-        {
-            metadata->state = PENDING_O;
-            count++;
-            handle = (StreamHandle)metadata;
-        }
-    }    
-    Node::mutex.unlock();
+            return allocate_and_call(
+                node_->iface()->addressed_message_write_flow(),
+                STATE(send_complete));
+    }
+    return return_with_error(Defs::ERROR_INVALID_ARGS);
+}
 
-    return handle;
+StateFlowBase::Action StreamSender::send_initiate()
+{
+    auto *b =
+        get_allocation_result(node_->iface()->addressed_message_write_flow());
+    b->data()->reset(Defs::MTI_STREAM_INITIATE_REQUEST, node_->node_id(), dst_,
+        StreamDefs::create_initiate_request(
+            request()->max_buffer_size, false, localStreamId_,
+            request()->dst_stream_id));
+    node_->iface()->addressed_message_write_flow()->send(b);
+    sleeping_ = 1;
+    return sleep_and_call(&timer_, timeoutNsec_, STATE(initiate_done));
 }
 
-/** Close a stream.
- * @param handle to stream to close
- */
-void Stream::sclose(StreamHandle handle)
-{
-    Metadata *metadata = (Metadata*)handle;
-    
-    Node::mutex.lock();
-    if (metadata->data->items() == 0)
-    {
-        /* no more data left to send.  Hooray! */
-        Buffer *buffer = buffer_alloc(4);
-        uint8_t *data = (uint8_t*)buffer->start();
-        data[0] = metadata->srcID;
-        data[1] = metadata->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        write(Defs::MTI_STREAM_COMPLETE, metadata->nodeHandle, buffer);
-    
-        /* no more data left in the buffer */
-        RBTree<uint8_t, Metadata*>::Node *node = outboundTree.remove(metadata->srcID);
-        metadata->data->destroy();
-        delete metadata;
-        delete node;
-    }
-    else
-    {
-        /* we have some data left to send, but mark us as closed */
-        metadata->state = CLOSED_O;
-    }
-    Node::mutex.unlock();
-}
-
-/** Write data to a stream.
- * @param handle handle to stream to write to
- * @param buf buffer to copy data from
- * @param size size in bytes to write to stream
- * @return number of bytes written, else -1 on error with errno set to indicate error
- */
-ssize_t Stream::swrite(StreamHandle handle, const void *buf, size_t size)
+void StreamSender::initiate_reply_arrived(GenMessage *m)
 {
-    Metadata *metadata = (Metadata*)handle;
-    
-    ssize_t result = 0;
-    
-    Node::mutex.lock();
-    if (metadata->data->items() || metadata->count >= metadata->size)
+    if (state_ != OPENING || !is_from_remote(m))
     {
-        /* there is already some data in flight, so lets just add to the back
-         * of the buffer.
-         */
-        result = metadata->data->put((uint8_t*)buf, size);
+        return;
     }
-    else
+    const auto &payload = m->payload;
+    if (payload.size() < 6)
     {
-        size_t buffer_size;
-        if (size > (metadata->size - metadata->count))
-        {
-            buffer_size = metadata->size - metadata->count;
-        }
-        else
-        {
-            buffer_size = size;
-        }
-
-        Buffer *buffer = buffer_alloc(buffer_size + 2);
-        uint8_t *data = (uint8_t*)buffer->start();
-        memcpy(data, buf, buffer_size);
-        data[buffer_size + 0] = metadata->srcID;
-        data[buffer_size + 1] = metadata->dstID;
-        buffer->advance(buffer_size + 2);
-        write(Defs::MTI_STREAM_DATA, metadata->nodeHandle, buffer);
-        
-        result = buffer_size;
-        size -= buffer_size;
-        metadata->count += buffer_size;
-
-        if (size)
-        {
-            result += metadata->data->put((uint8_t*)buf + buffer_size, size);
-        }
+        return;
+    }
+    bufferSize_ = (uint8_t(payload[0]) << 8) | uint8_t(payload[1]);
+    streamFlags_ = payload[2];
+    streamAdditionalFlags_ = payload[3];
+    remoteStreamId_ = payload[5];
+    // We save the remote alias here if we haven't got any yet.
+    if (m->src.alias)
+    {
+        dst_.alias = m->src.alias;
+    }
+    replied_ = 1;
+    if (sleeping_)
+    {
+        sleeping_ = 0;
+        timer_.trigger();
     }
-    Node::mutex.unlock();
-
-    return result;
 }
 
-/** Read data from a stream.
- * @param handle handle to stream to read from
- * @param buf buffer to copy data to
- * @param size size in bytes to read from stream
- * @return number of bytes read, else -1 on error with errno set to indicate error
- */
-ssize_t Stream::sread(StreamHandle handle, void *buf, size_t size)
-{
-    Metadata *metadata = (Metadata*)handle;
-    
-    ssize_t result = 0;
-    
-    Node::mutex.lock();
-    size_t space = metadata->data->space();
-    result = metadata->data->get((uint8_t*)buf, size);
-
-    if (space < metadata->size && metadata->data->space() >= metadata->size)
-    {
-        /* proceed since we made room for the next data set */
-        Buffer *buffer = buffer_alloc(4);
-        uint8_t *data = (uint8_t*)buffer->start();
-        data[0] = metadata->srcID;
-        data[1] = metadata->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        metadata->count = 0;
-        
-        write(Defs::MTI_STREAM_PROCEED, metadata->nodeHandle, buffer);
-    }
-    Node::mutex.unlock();
-
-    return result;
-}
-
-/** Handle incoming stream initiate request messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::initiate_request(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamSender::initiate_done()
 {
-    if (count < CHANNELS_PER_NODE && buffer->used() >= 6)
+    sleeping_ = 0;
+    if (!replied_)
     {
-        uint8_t *data = (uint8_t*)buffer->start();
-        
-        size_t buffer_size = (data[0] << 8) + data[1];
-        
-        if (MAX_BUFFER_SIZE < buffer_size)
+        state_ = CLOSED;
+        return return_with_error(Defs::OPENMRN_TIMEOUT);
+    }
+    if (!(streamFlags_ & StreamDefs::FLAG_ACCEPT))
+    {
+        state_ = CLOSED;
+        if (streamFlags_ & StreamDefs::FLAG_PERMANENT_ERROR)
         {
-            buffer_size = MAX_BUFFER_SIZE;
+            return return_with_error(
+                Defs::ERROR_PERMANENT | streamAdditionalFlags_);
         }
+        return return_with_error(
+            Defs::ERROR_TEMPORARY | streamAdditionalFlags_);
+    }
+    if (!bufferSize_)
+    {
+        LOG(WARNING, "Stream accepted with zero buffer size.");
+        state_ = CLOSED;
+        return return_with_error(Defs::ERROR_PERMANENT);
+    }
+    available_ = bufferSize_;
+    state_ = OPEN;
+    return return_ok();
+}
 
-        Metadata* metadata = new Metadata;
-        metadata->protocol = DISCOVER_1;
-        metadata->data = RingBuffer<uint8_t>::create(MAX_BUFFER_SIZE * 2);
-        metadata->nodeHandle = src;
-        metadata->size = buffer_size;
-        metadata->count = 0;
-        metadata->state = CONNECTED_I;
-        metadata->srcID = data[4];
-        metadata->dstID = 0;
-
-        RBTree<uint8_t, Metadata*>::Node *last = inboundTree.last();
-        
-        if (last != NULL)
-        {
-            metadata->dstID = last->key + 1;
-            while (inboundTree.find(metadata->dstID) != NULL)
-            {
-                metadata->dstID++;
-            }
-        }
-        
-        /* reuse buffer to reply since we are otherwise done with it */
-        buffer->zero();
-        
-        data[0] = (buffer_size >> 8) & 0xFF;
-        data[1] = (buffer_size >> 0) & 0xFF;
-        data[2] = ACCEPT;
-        data[3] = 0;
-        data[4] = metadata->srcID;
-        data[5] = metadata->dstID;
-
-        buffer->advance(6);
-        
-        write(Defs::MTI_STREAM_INITIATE_REPLY, src, buffer);
-        
-        RBTree<uint8_t, Metadata*>::Node *node =
-            new RBTree<uint8_t, Metadata*>::Node(metadata->dstID, metadata);
-
-        inboundTree.insert(node);
-        
-        buffer = buffer_alloc(sizeof(IdStreamType));
-        IdStreamType* type = (IdStreamType*)buffer->start();
-        type->stream = (StreamHandle)node->value;
-        buffer->id(ID_STREAM_NEW_CONNECTION);
-        buffer->advance(sizeof(IdStreamType));
-        
-        rx_queue()->insert(buffer);
-    }
-}
-
-/** Handle incoming stream initiate reply messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::initiate_reply(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamSender::send_data()
 {
-    uint8_t *data = (uint8_t*)buffer->start();
-    
-    size_t buffer_size = (data[0] << 8) + data[1];
-    
-    RBTree<uint8_t, Metadata*>::Node *node = outboundTree.find(data[4]);
-    
-    HASSERT(node);
-    
-    if (node->value->size > buffer_size)
+    if (offset_ >= request()->payload.size())
     {
-        node->value->size = buffer_size;
+        return return_ok();
     }
+    if (!available_)
+    {
+        return call_immediately(STATE(wait_for_proceed));
+    }
+    return allocate_and_call(
+        streamService_->data_write_flow(), STATE(fill_data));
+}
 
-    node->value->dstID = data[5];
-
-    buffer = buffer_alloc(sizeof(IdStreamType));
-    IdStreamType* type = (IdStreamType*)buffer->start();
-    type->stream = (StreamHandle)node->value;
-    buffer->id(ID_STREAM_COMPLETED_CONNECTION);
-    buffer->advance(sizeof(IdStreamType));
-    
-    if (node->value->state == WAITING_O)
+StateFlowBase::Action StreamSender::fill_data()
+{
+    auto *b = get_allocation_result(streamService_->data_write_flow());
+    const string &data = request()->payload;
+    size_t len = data.size() - offset_;
+    if (len > available_)
     {
-        node->value->state = CONNECTED_O;
-        sem.post();
+        len = available_;
     }
-    else
+    if (len > StreamService::MAX_DATA_MESSAGE_SIZE)
     {
-        node->value->state = CONNECTED_O;
-        rx_queue()->insert(buffer);
+        len = StreamService::MAX_DATA_MESSAGE_SIZE;
     }
+    string payload;
+    payload.reserve(len + 1);
+    payload.push_back(remoteStreamId_);
+    payload.append(data, offset_, len);
+    b->data()->reset(
+        Defs::MTI_STREAM_DATA, node_->node_id(), dst_, std::move(payload));
+    b->set_done(n_.reset(this));
+    offset_ += len;
+    totalBytes_ += len;
+    available_ -= len;
+    streamService_->data_write_flow()->send(b);
+    return wait_and_call(STATE(send_data));
 }
 
-/** Handle incoming stream data messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::handle_data(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamSender::wait_for_proceed()
 {
-    bool wakeup;
-    uint8_t *data = (uint8_t*)buffer->start();
-
-    RBTree<uint8_t, Metadata*>::Node *node = inboundTree.find(data[buffer->used() - 1]);
+    sleeping_ = 1;
+    return sleep_and_call(&timer_, timeoutNsec_, STATE(proceed_wakeup));
+}
 
-    /* we only wakeup if starting from zero, otherwise, the node already knows
-     * there is data available, so no need to re-notify it.
-     */
-    if (node->value->data->items() == 0)
+void StreamSender::proceed_arrived(GenMessage *m)
+{
+    if (state_ != OPEN || !is_from_remote(m))
     {
-        wakeup = true;
+        return;
     }
-    else
+    const auto &payload = m->payload;
+    if (payload.size() < 2 || uint8_t(payload[1]) != remoteStreamId_)
     {
-        wakeup = false;
+        return;
     }
-    
-    /* last two bytes represent source and destination ID */
-    size_t len = buffer->size() - buffer->available();
-
-    /* some sanity tests that will help us debug this */
-    HASSERT(node->value->state == CONNECTED_I);
-    HASSERT(len > 2);
-    HASSERT(node->value->data->space() >= (len - 2));
+    available_ += bufferSize_;
+    if (sleeping_)
+    {
+        sleeping_ = 0;
+        timer_.trigger();
+    }
+}
 
-    while ((node->value->protocol & DISCOVER_MASK) != DISCOVERED && len > 2)
+StateFlowBase::Action StreamSender::proceed_wakeup()
+{
+    sleeping_ = 0;
+    if (!available_)
+    {
+        LOG(INFO, "Stream %u: timed out waiting for data proceed.",
+            localStreamId_);
+        // The receiver still has the stream open; tell it we are giving up
+        // before this sender can be reused for a different stream.
+        return allocate_and_call(
+            node_->iface()->addressed_message_write_flow(),
+            STATE(send_abort));
+    }
+    if (request()->progress_callback)
     {
-        int shift = (node->value->protocol >> DISCOVER_SHIFT) - 1;
-        node->value->protocol |= (*data) << (shift * 8);
-        data++;
-        len--;
-        node->value->protocol-= DISCOVERED_DEC;
+        request()->progress_callback(offset_);
     }
+    return call_immediately(STATE(send_data));
+}
+
+StateFlowBase::Action StreamSender::send_complete()
+{
+    send_complete_message();
+    return return_ok();
+}
 
-    node->value->count += (len - 2);
-    HASSERT(node->value->count <= node->value->size);
+StateFlowBase::Action StreamSender::send_abort()
+{
+    send_complete_message();
+    return return_with_error(Defs::OPENMRN_TIMEOUT);
+}
 
-    node->value->data->put(data, len - 2);
+void StreamSender::send_complete_message()
+{
+    auto *b =
+        get_allocation_result(node_->iface()->addressed_message_write_flow());
+    b->data()->reset(Defs::MTI_STREAM_COMPLETE, node_->node_id(), dst_,
+        StreamDefs::create_close_request(localStreamId_, remoteStreamId_));
+    node_->iface()->addressed_message_write_flow()->send(b);
+    state_ = CLOSED;
+}
 
-    /* release buffer, we are done with it */
-    buffer->free();
+bool StreamSender::is_from_remote(GenMessage *m)
+{
+    return m->dstNode == node_ &&
+        node_->iface()->matching_node(dst_, m->src);
+}
 
-    /* this operation must come before proceed because proceed will release the
-     * critical Node::mutex and cause a race condition.
-     */
-    if (wakeup && (node->value->protocol & DISCOVER_MASK) == DISCOVERED)
+StreamReceiver::StreamReceiver(StreamService *service, uint8_t local_stream_id)
+    : CallableFlow<StreamReceiveRequest>(service)
+    , streamService_(service)
+    , pendingBytes_(0)
+    , sinceProceed_(0)
+    , bufferSize_(0)
+    , localStreamId_(local_stream_id)
+    , state_(IDLE)
+    , sleeping_(0)
+    , completed_(0)
+{
+}
+
+StreamReceiver::~StreamReceiver()
+{
+    clear_queue();
+}
+
+StateFlowBase::Action StreamReceiver::entry()
+{
+    HASSERT(state_ == IDLE);
+    clear_queue();
+    sinceProceed_ = 0;
+    completed_ = 0;
+    state_ = LISTENING;
+    sleeping_ = 1;
+    return sleep_and_call(
+        &timer_, request()->timeout_nsec, STATE(open_wakeup));
+}
+
+bool StreamReceiver::initiate_arrived(GenMessage *m)
+{
+    if (state_ != LISTENING || m->dstNode != request()->dst)
+    {
+        return false;
+    }
+    const auto &payload = m->payload;
+    if (payload.size() < 5)
+    {
+        return false;
+    }
+    uint8_t src_stream_id = payload[4];
+    if (request()->src_stream_id != StreamDefs::INVALID_STREAM_ID &&
+        request()->src_stream_id != src_stream_id)
     {
-        buffer = buffer_alloc(sizeof(IdStreamType));
-        IdStreamType* type = (IdStreamType*)buffer->start();
-        type->stream = (StreamHandle)node->value;
-        buffer->id(ID_STREAM_DATA_POSTED);
-        buffer->advance(sizeof(IdStreamType));
+        return false;
+    }
+    if (payload.size() >= 6 &&
+        (uint8_t)payload[5] != StreamDefs::INVALID_STREAM_ID &&
+        (uint8_t)payload[5] != localStreamId_)
+    {
+        // The sender was told to use a different receiver.
+        return false;
+    }
+    if ((request()->src.id || request()->src.alias) &&
+        !streamService_->iface()->matching_node(request()->src, m->src))
+    {
+        return false;
+    }
+    uint16_t proposed = (uint8_t(payload[0]) << 8) | uint8_t(payload[1]);
+    bufferSize_ = request()->buffer_size;
+    if (proposed && proposed < bufferSize_)
+    {
+        bufferSize_ = proposed;
+    }
+    request()->src = m->src;
+    request()->src_stream_id = src_stream_id;
+
+    auto *flow = streamService_->iface()->addressed_message_write_flow();
+    auto *b = flow->alloc();
+    b->data()->reset(Defs::MTI_STREAM_INITIATE_REPLY, request()->dst->node_id(),
+        m->src,
+        StreamDefs::create_initiate_response(bufferSize_,
+            StreamDefs::FLAG_ACCEPT, 0, src_stream_id, localStreamId_));
+    flow->send(b);
+
+    state_ = OPEN;
+    wakeup();
+    return true;
+}
 
-        rx_queue()->insert(buffer);
+StateFlowBase::Action StreamReceiver::open_wakeup()
+{
+    sleeping_ = 0;
+    if (state_ != OPEN)
+    {
+        state_ = IDLE;
+        return return_with_error(Defs::OPENMRN_TIMEOUT);
     }
+    return call_immediately(STATE(next_data));
+}
 
-    if (node->value->count == node->value->size &&
-        node->value->data->space() >= MAX_BUFFER_SIZE)
+void StreamReceiver::data_arrived(Buffer<GenMessage> *b)
+{
+    if (state_ != OPEN || completed_ ||
+        b->data()->dstNode != request()->dst ||
+        !streamService_->iface()->matching_node(
+            request()->src, b->data()->src))
     {
-        /* proceed since we already have room for the next data set */
-        buffer = buffer_alloc(4);
-        data = (uint8_t*)buffer->start();
-        data[0] = node->value->srcID;
-        data[1] = node->value->dstID;
-        data[2] = 0;
-        data[3] = 0;
-        buffer->advance(4);
-        
-        node->value->count = 0;
-        
-        write(Defs::MTI_STREAM_PROCEED, src, buffer);
+        b->unref();
+        return;
     }
+    queue_.push_back(b);
+    wakeup();
 }
 
-/** Handle incoming stream proceed messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::proceed(NodeHandle src, Buffer *buffer)
+void StreamReceiver::complete_arrived(GenMessage *m)
 {
-    uint8_t *data = (uint8_t*)buffer->start();
+    if (state_ != OPEN || m->dstNode != request()->dst ||
+        !streamService_->iface()->matching_node(request()->src, m->src))
+    {
+        return;
+    }
+    completed_ = 1;
+    wakeup();
+}
 
-    RBTree<uint8_t, Metadata*>::Node *node = outboundTree.find(data[1]);
+void StreamReceiver::cancel()
+{
+    if (state_ == LISTENING)
+    {
+        wakeup();
+    }
+}
 
-    node->value->count = 0;
-    
-    buffer->free();
+void StreamReceiver::wakeup()
+{
+    if (sleeping_)
+    {
+        sleeping_ = 0;
+        timer_.trigger();
+    }
+}
 
-    if (node->value->data->items())
+StateFlowBase::Action StreamReceiver::next_data()
+{
+    if (!queue_.empty())
     {
-        size_t segment_size;
-        if (node->value->data->items() < node->value->size)
-        {
-            segment_size = node->value->data->items();
-        }
-        else
+        Buffer<GenMessage> *b = queue_.front();
+        queue_.pop_front();
+        // Removes the destination stream ID.
+        b->data()->payload.erase(0, 1);
+        pendingBytes_ = b->data()->payload.size();
+        if (request()->target)
         {
-            segment_size = node->value->size;
+            b->set_done(n_.reset(this));
+            request()->target->send(b);
+            return wait_and_call(STATE(data_consumed));
         }
-        
-        buffer = buffer_alloc(segment_size + 2);
-        data = (uint8_t*)buffer->start();
-        node->value->data->get(data, segment_size);
-        data[segment_size + 0] = node->value->srcID;
-        data[segment_size + 1] = node->value->dstID;
-        buffer->advance(segment_size + 2);
-        node->value->count = segment_size;
+        request()->payload.append(b->data()->payload);
+        b->unref();
+        return call_immediately(STATE(data_consumed));
+    }
+    if (completed_)
+    {
+        return call_immediately(STATE(finish));
+    }
+    sleeping_ = 1;
+    return sleep_and_call(
+        &timer_, request()->timeout_nsec, STATE(data_wakeup));
+}
 
-        write(Defs::MTI_STREAM_DATA, src, buffer);
+StateFlowBase::Action StreamReceiver::data_wakeup()
+{
+    if (sleeping_)
+    {
+        // Timer expired without any traffic from the sender.
+        sleeping_ = 0;
+        LOG(INFO, "Stream %u: timed out waiting for data.", localStreamId_);
+        state_ = IDLE;
+        clear_queue();
+        return return_with_error(Defs::OPENMRN_TIMEOUT);
     }
+    return call_immediately(STATE(next_data));
 }
 
-/** Handle incoming stream complete messages.
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::complete(NodeHandle src, Buffer *buffer)
+StateFlowBase::Action StreamReceiver::data_consumed()
 {
-    uint8_t *data = (uint8_t*)buffer->start();
+    request()->total_bytes += pendingBytes_;
+    sinceProceed_ += pendingBytes_;
+    pendingBytes_ = 0;
+    return call_immediately(STATE(check_proceed));
+}
 
-    RBTree<uint8_t, Metadata*>::Node *node = inboundTree.find(data[2]);
+StateFlowBase::Action StreamReceiver::check_proceed()
+{
+    if (sinceProceed_ < bufferSize_ || completed_)
+    {
+        return call_immediately(STATE(next_data));
+    }
+    sinceProceed_ -= bufferSize_;
+    return allocate_and_call(
+        streamService_->iface()->addressed_message_write_flow(),
+        STATE(send_proceed));
+}
+
+StateFlowBase::Action StreamReceiver::send_proceed()
+{
+    auto *flow = streamService_->iface()->addressed_message_write_flow();
+    auto *b = get_allocation_result(flow);
+    b->data()->reset(Defs::MTI_STREAM_PROCEED, request()->dst->node_id(),
+        request()->src,
+        StreamDefs::create_data_proceed(
+            request()->src_stream_id, localStreamId_));
+    flow->send(b);
+    return call_immediately(STATE(check_proceed));
+}
+
+StateFlowBase::Action StreamReceiver::finish()
+{
+    state_ = IDLE;
+    return return_ok();
+}
 
-    if (node->value->data->items() == 0)
+void StreamReceiver::clear_queue()
+{
+    while (!queue_.empty())
     {
-        /* no more data left in the buffer */
-        outboundTree.remove(node);
-        node->value->data->destroy();
-        delete node->value;
-        delete node;
+        queue_.front()->unref();
+        queue_.pop_front();
     }
-    else
+}
+
+StreamService::StreamService(If *iface, MessageHandler *data_write_flow,
+    unsigned num_senders, unsigned num_receivers, uint8_t first_stream_id)
+    : Service(iface->executor())
+    , iface_(iface)
+    , dataWriteFlow_(data_write_flow)
+    , firstStreamId_(first_stream_id)
+{
+    HASSERT(first_stream_id + num_senders + num_receivers <=
+        StreamDefs::INVALID_STREAM_ID);
+    for (unsigned i = 0; i < num_senders; ++i)
+    {
+        senders_.emplace_back(new StreamSender(this, first_stream_id + i));
+        senderAllocator_.typed_insert(senders_.back().get());
+    }
+    for (unsigned i = 0; i < num_receivers; ++i)
+    {
+        receivers_.emplace_back(new StreamReceiver(
+            this, first_stream_id + num_senders + i));
+        receiverAllocator_.typed_insert(receivers_.back().get());
+    }
+    auto *d = iface_->dispatcher();
+    if (num_senders)
     {
-        /* we have some data left, give the application a chance to get it */
-        node->value->state = CLOSED_I;
+        d->register_handler(
+            &handler_, Defs::MTI_STREAM_INITIATE_REPLY, Defs::MTI_EXACT);
+        d->register_handler(
+            &handler_, Defs::MTI_STREAM_PROCEED, Defs::MTI_EXACT);
+    }
+    if (num_receivers)
+    {
+        d->register_handler(
+            &handler_, Defs::MTI_STREAM_INITIATE_REQUEST, Defs::MTI_EXACT);
+        d->register_handler(&handler_, Defs::MTI_STREAM_DATA, Defs::MTI_EXACT);
+        d->register_handler(
+            &handler_, Defs::MTI_STREAM_COMPLETE, Defs::MTI_EXACT);
     }
 }
 
-/** Handle incoming stream messages.
- * @param mti Message Type Indicator
- * @param src source Node ID
- * @param data datagram to post
- */
-void Stream::packet(Defs::MTI mti, NodeHandle src, Buffer *data)
+StreamService::~StreamService()
+{
+    iface_->dispatcher()->unregister_handler_all(&handler_);
+}
+
+StreamSender *StreamService::find_sender(uint8_t id)
 {
-    switch (mti)
+    unsigned ofs = id - firstStreamId_;
+    if (id >= firstStreamId_ && ofs < senders_.size())
+    {
+        return senders_[ofs].get();
+    }
+    return nullptr;
+}
+
+StreamReceiver *StreamService::find_receiver(uint8_t id)
+{
+    unsigned ofs = id - firstStreamId_;
+    if (id >= firstStreamId_ && ofs >= senders_.size() &&
+        ofs - senders_.size() < receivers_.size())
+    {
+        return receivers_[ofs - senders_.size()].get();
+    }
+    return nullptr;
+}
+
+void StreamService::message_arrived(Buffer<GenMessage> *b)
+{
+    auto rb = get_buffer_deleter(b);
+    GenMessage *m = b->data();
+    if (!m->dstNode || m->payload.empty())
+    {
+        return;
+    }
+    const Payload &payload = m->payload;
+    switch (m->mti)
     {
-        default:
-            HASSERT(0);
-            break;
-        case Defs::MTI_STREAM_INITIATE_REQUEST:
-            initiate_request(src, data);
-            break;
         case Defs::MTI_STREAM_INITIATE_REPLY:
-            initiate_reply(src, data);
-            break;
-        case Defs::MTI_STREAM_DATA:
-            handle_data(src, data);
-            break;
+        {
+            if (payload.size() < 6)
+            {
+                return;
+            }
+            StreamSender *s = find_sender(payload[4]);
+            if (s)
+            {
+                s->initiate_reply_arrived(m);
+            }
+            return;
+        }
         case Defs::MTI_STREAM_PROCEED:
-            proceed(src, data);
-            break;
+        {
+            StreamSender *s = find_sender(payload[0]);
+            if (s)
+            {
+                s->proceed_arrived(m);
+            }
+            return;
+        }
+        case Defs::MTI_STREAM_INITIATE_REQUEST:
+        {
+            for (auto &r : receivers_)
+            {
+                if (r->initiate_arrived(m))
+                {
+                    return;
+                }
+            }
+            reject_initiate(m);
+            return;
+        }
+        case Defs::MTI_STREAM_DATA:
+        {
+            StreamReceiver *r = find_receiver(payload[0]);
+            if (r)
+            {
+                r->data_arrived(rb.release());
+            }
+            return;
+        }
         case Defs::MTI_STREAM_COMPLETE:
-            complete(src, data);
-            break;
+        {
+            if (payload.size() < 2)
+            {
+                return;
+            }
+            StreamReceiver *r = find_receiver(payload[1]);
+            if (r)
+            {
+                r->complete_arrived(m);
+            }
+            return;
+        }
+        default:
+            return;
     }
 }
 
-};
+void StreamService::reject_initiate(GenMessage *m)
+{
+    if (m->payload.size() < 5)
+    {
+        return;
+    }
+    auto *flow = iface_->addressed_message_write_flow();
+    auto *b = flow->alloc();
+    b->data()->reset(Defs::MTI_STREAM_INITIATE_REPLY, m->dstNode->node_id(),
+        m->src,
+        StreamDefs::create_initiate_response(0,
+            StreamDefs::FLAG_PERMANENT_ERROR,
+            StreamDefs::REJECT_PERMANENT_INVALID_REQUEST, m->payload[4],
+            StreamDefs::INVALID_STREAM_ID));
+    flow->send(b);
+}
 
+} // namespace openlcb
@@ -25,7 +25,8 @@
  * POSSIBILITY OF SUCH DAMAGE.
  *
  * \file Stream.hxx
- * This file defines NMRAnet streams.
+ * Stream service: sender and receiver flows for the OpenLCB stream
+ * transport protocol.
  *
  * @author Stuart W. Baker
  * @date 20 October 2013
@@ -34,202 +35,475 @@
 #ifndef _OPENLCB_STREAM_HXX_
 #define _OPENLCB_STREAM_HXX_
 
-#include "openlcb/NMRAnetIf.hxx"
-#include "utils/RBTree.hxx"
-#include "utils/RingBuffer.hxx"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "executor/CallableFlow.hxx"
+#include "openlcb/If.hxx"
+#include "openlcb/StreamDefs.hxx"
 
 namespace openlcb
 {
 
-/**
-   Base service for OpenLCB streaming protocol.
+class StreamService;
 
-   This code does not work yet.
- */
-class Stream
+/// Defines how long the stream flows wait for the remote node by default:
+/// for an initiate reply, a data proceed message, or the next data message.
+extern long long STREAM_TIMEOUT_NSEC;
+
+/// Request structure for StreamSender. A stream is opened, written to any
+/// number of times and then closed, each of these being a separate request
+/// to the same sender.
+struct StreamSendRequest : public CallableFlowRequestBase
+{
+    enum OpenCmd
+    {
+        OPEN
+    };
+
+    enum WriteCmd
+    {
+        WRITE
+    };
+
+    enum CloseCmd
+    {
+        CLOSE
+    };
+
+    enum Command
+    {
+        CMD_OPEN,
+        CMD_WRITE,
+        CMD_CLOSE
+    };
+
+    /// Sets up a command to open a stream to a remote node.
+    /// @param OpenCmd polymorphic matching arg; always set to OPEN.
+    /// @param src is the local node sending the stream.
+    /// @param d is the node to send the stream to.
+    /// @param max_buffer_size is the largest window we ask the receiver for.
+    /// @param timeout_nsec is how long to wait for the initiate reply and
+    /// later for each data proceed message.
+    /// @param dst_stream_id if not StreamDefs::INVALID_STREAM_ID, is sent in
+    /// the initiate request as the suggested destination stream ID. Used
+    /// when the receiver has already announced its stream ID.
+    void reset(OpenCmd, Node *src, NodeHandle d,
+        uint16_t max_buffer_size = StreamDefs::MAX_PAYLOAD,
+        long long timeout_nsec = STREAM_TIMEOUT_NSEC,
+        uint8_t dst_stream_id = StreamDefs::INVALID_STREAM_ID)
+    {
+        reset_base();
+        cmd = CMD_OPEN;
+        this->src = src;
+        dst = d;
+        this->max_buffer_size = max_buffer_size;
+        this->timeout_nsec = timeout_nsec;
+        this->dst_stream_id = dst_stream_id;
+        payload.clear();
+        progress_callback = nullptr;
+    }
+
+    /// Sets up a command to send data on an open stream. Returns when all
+    /// data has been handed to the interface.
+    /// @param WriteCmd polymorphic matching arg; always set to WRITE.
+    /// @param data is the data to send.
+    /// @param progress if not empty, will be called upon every data proceed
+    /// message with the number of bytes of data sent so far.
+    void reset(WriteCmd, string data,
+        std::function<void(size_t)> progress = nullptr)
+    {
+        reset_base();
+        cmd = CMD_WRITE;
+        payload = std::move(data);
+        progress_callback = std::move(progress);
+    }
+
+    /// Sets up a command to close the stream by sending the data complete
+    /// message.
+    /// @param CloseCmd polymorphic matching arg; always set to CLOSE.
+    void reset(CloseCmd)
+    {
+        reset_base();
+        cmd = CMD_CLOSE;
+        payload.clear();
+        progress_callback = nullptr;
+    }
+
+    Command cmd;
+    /// Local node sending the stream.
+    Node *src;
+    /// Node receiving the stream.
+    NodeHandle dst;
+    /// Largest window to propose in the initiate request.
+    uint16_t max_buffer_size;
+    /// Suggested destination stream ID for the initiate request.
+    uint8_t dst_stream_id;
+    /// Timeout for the responses of the remote node.
+    long long timeout_nsec;
+    /// Data to send.
+    string payload;
+    /// Called with the number of bytes sent after every data proceed.
+    std::function<void(size_t)> progress_callback;
+};
+
+/// Flow that sends one outgoing stream at a time. Instances are owned by the
+/// StreamService and handed out by its sender_allocator(). After the stream
+/// is closed the sender has to be returned to the allocator.
+///
+/// The sender never has more data outstanding than the window granted by
+/// the receiver; it sleeps until the next data proceed message arrives when
+/// the window is exhausted.
+class StreamSender : public CallableFlow<StreamSendRequest>
 {
 public:
-    /** number of simultaneous open streams per virtual node instance */
-    static const size_t CHANNELS_PER_NODE;
-    
-    /** Max buffer size for stream transmission segments */
-    static const uint16_t MAX_BUFFER_SIZE;
-
-    /** Stream handle type */
-    typedef void *StreamHandle;
-    
-    /** Open a stream.
-     * @param dst destination node for stream
-     * @param timeout 0 = do not wait for success, deliver success asynchronously
-     *                > 0, wait for success, or fail on timeout
-     * @return NULL on fail, else stream handle on success or pending success
-     */
-    StreamHandle sopen(NodeHandle dst, long long timeout);
-
-    /** Close a stream.
-     * @param handle handle to stream to close
-     */
-    void sclose(StreamHandle handle);
-
-    /** Write data to a stream.
-     * @param handle handle to stream to write to
-     * @param buf buffer to copy data from
-     * @param size size in bytes to write to stream
-     * @return number of bytes written, else -1 on error with errno set to indicate error
-     */
-    ssize_t swrite(StreamHandle handle, const void *buf, size_t size);
-
-    /** Read data from a stream.
-     * @param handle handle to stream to read from
-     * @param buf buffer to copy data to
-     * @param size size in bytes to read from stream
-     * @return number of bytes read, else -1 on error with errno set to indicate error
-     */
-    ssize_t sread(StreamHandle handle, void *buf, size_t size);
-
-protected:
-    /** Default constructor.
-     */
-    Stream()
-        : outboundTree(),
-          inboundTree(),
-          count(0),
-          sem()
+    /// Constructor. @param service is the stream service owning this
+    /// sender. @param local_stream_id is the source stream ID used by this
+    /// sender on the wire.
+    StreamSender(StreamService *service, uint8_t local_stream_id);
+
+    /// @return the source stream ID. This is known before the stream is
+    /// opened so it can be announced, e.g. in a memory config write stream
+    /// command.
+    uint8_t local_stream_id()
     {
+        return localStreamId_;
     }
-    
-    /** Default destructor.
-     */
-    ~Stream()
+
+    /// @return the destination stream ID assigned by the receiver. Valid
+    /// after the stream was opened successfully.
+    uint8_t remote_stream_id()
     {
+        return remoteStreamId_;
     }
 
-    /** Handle incoming stream messages.
-     * @param mti Message Type Indicator
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void packet(Defs::MTI mti, NodeHandle src, Buffer *data);
+    /// @return the window negotiated with the receiver.
+    uint16_t buffer_size()
+    {
+        return bufferSize_;
+    }
 
-private:
-    /** possible flag values.
-     */
-    enum Flag
+    /// @return how many bytes of data were sent since the stream was opened.
+    size_t bytes_sent()
     {
-        PERMINATE_ERROR = 0x40, /**< a perminate error occured */
-        ACCEPT          = 0x80  /**< initiate request accepted */
-    };
-    
-    /** Possible stream states.
-     */
+        return totalBytes_;
+    }
+
+    /// @return true if the stream is open.
+    bool is_open()
+    {
+        return state_ == OPEN;
+    }
+
+private:
+    friend class StreamService;
+
     enum State
     {
-        PENDING_O,   /**< connection pending, outbound */
-        WAITING_O,   /**< waiting on a pending connection, outbound */
-        CONNECTED_O, /**< connection made, outbound */
-        CLOSED_O,    /**< connection closed, outbound */
-        PENDING_I,   /**< connection pending, inbound */
-        WAITING_I,   /**< waiting on a pending connection, inbound */
-        CONNECTED_I, /**< connection made, inbound */
-        CLOSED_I,    /**< connection closed, inbound */
-        
+        CLOSED,
+        OPENING,
+        OPEN
     };
-    
-    enum Protocol
-    {
-        DISCOVER_1     = 0x0600000000000000,
-        DISCOVER_2     = 0x0500000000000000,
-        DISCOVER_3     = 0x0400000000000000,
-        DISCOVER_4     = 0x0300000000000000,
-        DISCOVER_5     = 0x0200000000000000,
-        DISCOVER_6     = 0x0100000000000000,
-        DISCOVERED     = 0x0000000000000000,
-        DISCOVERED_DEC = 0x0100000000000000,
-        DISCOVER_MASK  = 0xFF00000000000000,
-        DISCOVER_SHIFT = 56,
+
+    Action entry() override;
+    Action send_initiate();
+    Action initiate_done();
+    Action send_data();
+    Action fill_data();
+    Action wait_for_proceed();
+    Action proceed_wakeup();
+    Action send_complete();
+    /// Sends the stream complete message after the receiver stopped
+    /// responding, then fails the pending write request with a timeout.
+    Action send_abort();
+    /// Sends the stream complete message using the allocated addressed
+    /// message write buffer and marks the stream closed.
+    void send_complete_message();
+
+    /// Called by the service upon an incoming initiate reply for our stream
+    /// ID. Does not take ownership of the message.
+    void initiate_reply_arrived(GenMessage *m);
+    /// Called by the service upon an incoming data proceed for our stream
+    /// ID. Does not take ownership of the message.
+    void proceed_arrived(GenMessage *m);
+    /// @return true if message m was sent by the remote end of our stream.
+    bool is_from_remote(GenMessage *m);
+
+    /// Parent service.
+    StreamService *streamService_;
+    /// Local node sending the stream.
+    Node *node_;
+    /// Remote node receiving the stream.
+    NodeHandle dst_;
+    /// Timeout for the remote node's responses.
+    long long timeoutNsec_;
+    /// How many bytes we may still send before we need a data proceed.
+    uint32_t available_;
+    /// Next byte of the current write request to send.
+    size_t offset_;
+    /// Total number of bytes sent on this stream.
+    size_t totalBytes_;
+    /// Window size granted by the receiver.
+    uint16_t bufferSize_;
+    /// Our stream ID.
+    uint8_t localStreamId_;
+    /// Stream ID at the receiver.
+    uint8_t remoteStreamId_;
+    /// Flags from the initiate reply.
+    uint8_t streamFlags_;
+    /// Additional flags from the initiate reply.
+    uint8_t streamAdditionalFlags_;
+    /// One of the State enum.
+    uint8_t state_ : 2;
+    /// True while we are sleeping on the timer for a remote response.
+    uint8_t sleeping_ : 1;
+    /// True if the initiate reply has arrived.
+    uint8_t replied_ : 1;
+    StateFlowTimer timer_{this};
+    BarrierNotifiable n_;
+};
+
+/// Request structure for StreamReceiver. One request receives one entire
+/// stream, from the initiate request until the data complete message.
+struct StreamReceiveRequest : public CallableFlowRequestBase
+{
+    enum AcceptCmd
+    {
+        ACCEPT
     };
-    
-    /** Stream metadata, often cast to @ref StreamHandle.
-     */
-    struct Metadata
-    {
-        uint64_t protocol; /**< stream protocol */
-        RingBuffer<uint8_t> *data; /**< stream data */
-        NodeHandle  nodeHandle; /**< node we are communicating with */
-
-        size_t  size;   /**< max buffer size */
-        size_t  count;  /**< count received before proceed required */
-        State   state;  /**< Stream state */
-        uint8_t srcID;  /**< unique source ID */
-        uint8_t dstID;  /**< unique destination ID */
+
+    enum
+    {
+        /// Default window granted to the sender.
+        DEFAULT_BUFFER_SIZE = 512
     };
 
-    /** Write a message from a node.  We should already have a mutex lock at this
-     * at this point.
-     * @param mti Message Type Indicator
-     * @param dst destination node ID, 0 if unavailable
-     * @param data NMRAnet packet data
-     * @return 0 upon success
-     */
-    virtual int write(Defs::MTI mti, NodeHandle dst, Buffer *data) = 0;
-
-     /** Get handle to the receive queue for incoming NMRAnet messages.
-     * @return handle to queue
-     */
-    virtual BufferQueueWait *rx_queue() = 0;
-
-    /** Handle incoming stream initiate request messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void initiate_request(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream initiate reply messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void initiate_reply(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream data messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void handle_data(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream proceed messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void proceed(NodeHandle src, Buffer *buffer);
-
-    /** Handle incoming stream complete messages.
-     * @param src source Node ID
-     * @param data datagram to post
-     */
-    void complete(NodeHandle src, Buffer *buffer);
-    
-    /** tree for keeping track of outbound streams */
-    RBTree <uint8_t, Metadata*> outboundTree;
-
-    /** tree for keeping track of inbound streams */
-    RBTree <uint8_t, Metadata*> inboundTree;
-
-    /** number of active streams for this node */
-    size_t count;
-
-    /** wait for completion semaphore */
-    OSSem sem;
-
-    DISALLOW_COPY_AND_ASSIGN(Stream);
+    /// Sets up a command to wait for and receive an incoming stream.
+    /// @param AcceptCmd polymorphic matching arg; always set to ACCEPT.
+    /// @param node is the local node receiving the stream.
+    /// @param src if not empty, only a stream from this node will be
+    /// accepted. Filled in with the actual sender upon return.
+    /// @param src_stream_id if not StreamDefs::INVALID_STREAM_ID, only a
+    /// stream with this source stream ID will be accepted. Filled in with the
+    /// actual source stream ID upon return.
+    /// @param target if not null, each data message is forwarded to this
+    /// flow; the payload contains the stream data only. The next data
+    /// proceed is not sent until the target released the buffers. If null,
+    /// the data is collected in payload.
+    /// @param buffer_size is the largest window we grant to the sender.
+    /// @param timeout_nsec is how long to wait for the stream to be opened
+    /// and then between data messages.
+    void reset(AcceptCmd, Node *node, NodeHandle src,
+        uint8_t src_stream_id = StreamDefs::INVALID_STREAM_ID,
+        MessageHandler *target = nullptr,
+        uint16_t buffer_size = DEFAULT_BUFFER_SIZE,
+        long long timeout_nsec = STREAM_TIMEOUT_NSEC)
+    {
+        reset_base();
+        dst = node;
+        this->src = src;
+        this->src_stream_id = src_stream_id;
+        this->target = target;
+        this->buffer_size = buffer_size;
+        this->timeout_nsec = timeout_nsec;
+        total_bytes = 0;
+        payload.clear();
+    }
+
+    /// Local node receiving the stream.
+    Node *dst;
+    /// Remote node sending the stream.
+    NodeHandle src;
+    /// Source stream ID.
+    uint8_t src_stream_id;
+    /// Where to forward the data messages.
+    MessageHandler *target;
+    /// Largest window to grant.
+    uint16_t buffer_size;
+    /// Timeout for the remote node.
+    long long timeout_nsec;
+    /// Number of data bytes received.
+    size_t total_bytes;
+    /// Received data when target is null.
+    string payload;
 };
 
-/// unused.
-struct IdStreamType
+/// Flow that receives one incoming stream at a time. Instances are owned by
+/// the StreamService and handed out by its receiver_allocator().
+class StreamReceiver : public CallableFlow<StreamReceiveRequest>
 {
-    Stream::StreamHandle stream;
+public:
+    /// Constructor. @param service is the stream service owning this
+    /// receiver. @param local_stream_id is the destination stream ID used by
+    /// this receiver on the wire.
+    StreamReceiver(StreamService *service, uint8_t local_stream_id);
+
+    ~StreamReceiver();
+
+    /// @return the destination stream ID of this receiver.
+    uint8_t local_stream_id()
+    {
+        return localStreamId_;
+    }
+
+    /// Stops waiting for an incoming stream. If the stream is not open yet,
+    /// the pending request returns with Defs::OPENMRN_TIMEOUT right away; an
+    /// open stream is not affected. Must be called on the service's
+    /// executor.
+    void cancel();
+
+private:
+    friend class StreamService;
+
+    enum State
+    {
+        IDLE,
+        LISTENING,
+        OPEN
+    };
+
+    Action entry() override;
+    Action open_wakeup();
+    Action next_data();
+    Action data_wakeup();
+    Action data_consumed();
+    Action check_proceed();
+    Action send_proceed();
+    Action finish();
+
+    /// Called by the service with an incoming initiate request. Sends the
+    /// initiate reply if the request matches what we are waiting for.
+    /// @return true if the stream was accepted by this receiver. Does not
+    /// take ownership of the message.
+    bool initiate_arrived(GenMessage *m);
+    /// Called by the service with an incoming data message for our stream
+    /// ID. Takes ownership of the buffer.
+    void data_arrived(Buffer<GenMessage> *b);
+    /// Called by the service with an incoming data complete message for our
+    /// stream ID. Does not take ownership of the message.
+    void complete_arrived(GenMessage *m);
+    /// Wakes up the flow if it is sleeping for incoming traffic.
+    void wakeup();
+    /// Drops all queued data.
+    void clear_queue();
+
+    /// Parent service.
+    StreamService *streamService_;
+    /// Data messages that arrived but not processed yet.
+    std::deque<Buffer<GenMessage> *> queue_;
+    /// Number of bytes in the data message currently at the target.
+    size_t pendingBytes_;
+    /// Number of bytes consumed since the last data proceed.
+    uint32_t sinceProceed_;
+    /// Negotiated window size.
+    uint16_t bufferSize_;
+    /// Our stream ID.
+    uint8_t localStreamId_;
+    /// One of the State enum.
+    uint8_t state_ : 2;
+    /// True while we are sleeping on the timer for incoming traffic.
+    uint8_t sleeping_ : 1;
+    /// True once the data complete message arrived.
+    uint8_t completed_ : 1;
+    StateFlowTimer timer_{this};
+    BarrierNotifiable n_;
 };
 
+/// Service that manages the streams of all local nodes on an interface. It
+/// owns a fixed number of senders and receivers, each with its own stream
+/// ID, so multiple streams can be in progress at the same time to the same
+/// or different nodes. Incoming stream control and data messages are routed
+/// to the sender or receiver by stream ID.
+///
+/// The stream data messages are sent via a separate flow, because on CAN
+/// they are rendered in a different frame format than other addressed
+/// messages (see CanStreamService). On other interfaces the addressed message
+/// write flow may be used.
+class StreamService : public Service
+{
+public:
+    /// Constructor.
+    /// @param iface is the interface to operate on.
+    /// @param data_write_flow is the flow to send MTI_STREAM_DATA messages
+    /// to. The message payload starts with the destination stream ID.
+    /// @param num_senders how many outgoing streams can be in progress at
+    /// the same time.
+    /// @param num_receivers how many incoming streams can be in progress at
+    /// the same time. If zero, incoming initiate requests are not handled.
+    /// @param first_stream_id is the local stream ID of the first sender;
+    /// the senders and then the receivers get consecutive IDs from here.
+    /// Every StreamService on the same interface must use a disjoint range
+    /// of stream IDs, otherwise they will steal each other's messages.
+    StreamService(If *iface, MessageHandler *data_write_flow,
+        unsigned num_senders, unsigned num_receivers,
+        uint8_t first_stream_id = 0);
+
+    ~StreamService();
+
+    enum
+    {
+        /// Largest number of data bytes to put into one data message. The
+        /// CAN write flows can only frame messages shorter than 256 bytes.
+        MAX_DATA_MESSAGE_SIZE = 224
+    };
+
+    If *iface()
+    {
+        return iface_;
+    }
+
+    /// @return the flow that sends stream data messages.
+    MessageHandler *data_write_flow()
+    {
+        return dataWriteFlow_;
+    }
 
+    /// Pool of outgoing stream flows.
+    TypedQAsync<StreamSender> *sender_allocator()
+    {
+        return &senderAllocator_;
+    }
+
+    /// Pool of incoming stream flows.
+    TypedQAsync<StreamReceiver> *receiver_allocator()
+    {
+        return &receiverAllocator_;
+    }
+
+    /// @return true if this service can receive streams.
+    bool has_receivers()
+    {
+        return !receivers_.empty();
+    }
+
+private:
+    /// Handler for all incoming stream messages.
+    void message_arrived(Buffer<GenMessage> *b);
+    /// Rejects an incoming initiate request that no receiver wanted.
+    void reject_initiate(GenMessage *m);
+    /// @return the sender with stream ID id, or nullptr.
+    StreamSender *find_sender(uint8_t id);
+    /// @return the receiver with stream ID id, or nullptr.
+    StreamReceiver *find_receiver(uint8_t id);
+
+    /// Interface we are operating on.
+    If *iface_;
+    /// Where to send stream data messages.
+    MessageHandler *dataWriteFlow_;
+    /// Local stream ID of senders_[0].
+    uint8_t firstStreamId_;
+    std::vector<std::unique_ptr<StreamSender>> senders_;
+    std::vector<std::unique_ptr<StreamReceiver>> receivers_;
+    TypedQAsync<StreamSender> senderAllocator_;
+    TypedQAsync<StreamReceiver> receiverAllocator_;
+    MessageHandler::GenericHandler handler_{
+        this, &StreamService::message_arrived};
+
+    DISALLOW_COPY_AND_ASSIGN(StreamService);
 };
 
+} // namespace openlcb
+
 #endif // _OPENLCB_STREAM_HXX_
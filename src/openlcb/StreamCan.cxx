@@ -0,0 +1,205 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file StreamCan.cxx
+ *
+ * CANbus-specific stream data parser and renderer flows.
+ *
+ * @author agent
+ * @date 17 Oct 2026
+ */
+
+#include "openlcb/StreamCan.hxx"
+
+#include "openlcb/IfCanImpl.hxx"
+
+namespace openlcb
+{
+
+/// Renders MTI_STREAM_DATA messages into CAN stream data frames. The first
+/// byte of the message payload is the destination stream ID, which is
+/// repeated in every frame.
+///
+/// The base class of AddressedCanMessageWriteFlow is responsible for the
+/// discovery and address resolution of the destination node.
+class CanStreamWriteFlow : public AddressedCanMessageWriteFlow
+{
+public:
+    CanStreamWriteFlow(IfCan *iface)
+        : AddressedCanMessageWriteFlow(iface)
+    {
+    }
+
+private:
+    Action fill_can_frame_buffer() override
+    {
+        auto *b = get_allocation_result(if_can()->frame_write_flow());
+        struct can_frame *f = b->data()->mutable_frame();
+        const Payload &data = nmsg()->payload;
+        HASSERT(nmsg()->mti == Defs::MTI_STREAM_DATA);
+        HASSERT(!data.empty());
+
+        uint32_t can_id;
+        CanDefs::set_datagram_fields(
+            &can_id, srcAlias_, dstAlias_, CanDefs::STREAM_DATA);
+        SET_CAN_FRAME_ID_EFF(*f, can_id);
+
+        // dataOffset_ counts the data bytes after the stream ID.
+        unsigned len = data.size() - 1 - dataOffset_;
+        if (len > 7)
+        {
+            len = 7;
+        }
+        f->data[0] = data[0];
+        memcpy(f->data + 1, &data[1 + dataOffset_], len);
+        dataOffset_ += len;
+        f->can_dlc = len + 1;
+        if_can()->frame_write_flow()->send(b);
+
+        if (1u + dataOffset_ < data.size())
+        {
+            return call_immediately(STATE(get_can_frame_buffer));
+        }
+        else
+        {
+            return call_immediately(STATE(send_finished));
+        }
+    }
+}; // CanStreamWriteFlow
+
+/// Frame handler that turns incoming stream data frames addressed to local
+/// nodes into MTI_STREAM_DATA messages.
+class CanStreamParser : public CanFrameStateFlow
+{
+public:
+    enum
+    {
+        CAN_FILTER = CanMessageData::CAN_EXT_FRAME_FILTER |
+            (CanDefs::NMRANET_MSG << CanDefs::FRAME_TYPE_SHIFT) |
+            (CanDefs::NORMAL_PRIORITY << CanDefs::PRIORITY_SHIFT) |
+            (CanDefs::STREAM_DATA << CanDefs::CAN_FRAME_TYPE_SHIFT),
+        CAN_MASK = CanMessageData::CAN_EXT_FRAME_MASK |
+            CanDefs::FRAME_TYPE_MASK | CanDefs::PRIORITY_MASK |
+            CanDefs::CAN_FRAME_TYPE_MASK,
+    };
+
+    CanStreamParser(IfCan *iface)
+        : CanFrameStateFlow(iface)
+    {
+        if_can()->frame_dispatcher()->register_handler(
+            this, CAN_FILTER, CAN_MASK);
+    }
+
+    ~CanStreamParser()
+    {
+        if_can()->frame_dispatcher()->unregister_handler_all(this);
+    }
+
+    /// Handler callback for incoming frames.
+    Action entry() override
+    {
+        const struct can_frame *f = &message()->data()->frame();
+        uint32_t id = GET_CAN_FRAME_ID_EFF(*f);
+        if (!f->can_dlc)
+        {
+            return release_and_exit();
+        }
+        srcAlias_ = (id & CanDefs::SRC_MASK) >> CanDefs::SRC_SHIFT;
+        dst_.alias = (id & CanDefs::DST_MASK) >> CanDefs::DST_SHIFT;
+        dst_.id = if_can()->local_aliases()->lookup(NodeAlias(dst_.alias));
+        dstNode_ = nullptr;
+        if (dst_.id)
+        {
+            dstNode_ = if_can()->lookup_local_node(dst_.id);
+        }
+        if (!dstNode_)
+        {
+            // Destination not local node.
+            return release_and_exit();
+        }
+        localBuffer_.assign(
+            reinterpret_cast<const char *>(&f->data[0]), f->can_dlc);
+        release();
+        return allocate_and_call(
+            if_can()->dispatcher(), STATE(send_to_dispatcher));
+    }
+
+    /// Hands the assembled message to the interface's dispatcher.
+    Action send_to_dispatcher()
+    {
+        auto *b = get_allocation_result(if_can()->dispatcher());
+        GenMessage *m = b->data();
+        m->mti = Defs::MTI_STREAM_DATA;
+        m->payload.swap(localBuffer_);
+        m->dst = dst_;
+        m->dstNode = dstNode_;
+        m->src.alias = srcAlias_;
+        m->src.id = if_can()->remote_aliases()->lookup(NodeAlias(srcAlias_));
+        if (!m->src.id)
+        {
+            m->src.id = if_can()->local_aliases()->lookup(NodeAlias(srcAlias_));
+        }
+        if_can()->dispatcher()->send(b);
+        return exit();
+    }
+
+private:
+    /// Payload of the frame being processed.
+    Payload localBuffer_;
+    /// Local node the frame is addressed to.
+    Node *dstNode_;
+    /// Destination of the frame.
+    NodeHandle dst_;
+    /// Source alias of the frame.
+    unsigned srcAlias_ : 12;
+};
+
+/// Creates the stream data write flow and hands its ownership to the
+/// interface. @param iface is the CAN interface. @return the new flow.
+static MessageHandler *create_stream_write_flow(IfCan *iface)
+{
+    auto *flow = new CanStreamWriteFlow(iface);
+    iface->add_owned_flow(flow);
+    return flow;
+}
+
+CanStreamService::CanStreamService(
+    IfCan *iface, unsigned num_senders, unsigned num_receivers,
+    uint8_t first_stream_id)
+    : StreamService(iface, create_stream_write_flow(iface), num_senders,
+          num_receivers, first_stream_id)
+{
+    if (num_receivers)
+    {
+        iface->add_owned_flow(new CanStreamParser(iface));
+    }
+}
+
+CanStreamService::~CanStreamService()
+{
+}
+
+} // namespace openlcb
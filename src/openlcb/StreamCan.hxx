@@ -0,0 +1,67 @@
+/** \copyright
+ * Copyright (c) 2026, agent
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \file StreamCan.hxx
+ *
+ * CANbus-specific stream data parser and renderer flows.
+ *
+ * @author agent
+ * @date 17 Oct 2026
+ */
+
+#ifndef _OPENLCB_STREAMCAN_HXX_
+#define _OPENLCB_STREAMCAN_HXX_
+
+#include "openlcb/IfCan.hxx"
+#include "openlcb/Stream.hxx"
+
+namespace openlcb
+{
+
+/// Implementation of the StreamService for the CANbus. Stream data messages
+/// are rendered into stream data frames (frame type 7), carrying the
+/// destination stream ID in the first byte and up to seven bytes of data
+/// each; incoming stream data frames are turned into MTI_STREAM_DATA
+/// messages, one per frame.
+class CanStreamService : public StreamService
+{
+public:
+    /// @param iface is the CAN interface.
+    /// @param num_senders how many outgoing streams can be in progress at
+    /// the same time.
+    /// @param num_receivers how many incoming streams can be in progress at
+    /// the same time.
+    /// @param first_stream_id is the first local stream ID used by this
+    /// service; see StreamService.
+    CanStreamService(IfCan *iface, unsigned num_senders,
+        unsigned num_receivers, uint8_t first_stream_id = 0);
+
+    ~CanStreamService();
+};
+
+} // namespace openlcb
+
+#endif // _OPENLCB_STREAMCAN_HXX_
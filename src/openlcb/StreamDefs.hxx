@@ -41,6 +41,10 @@ struct StreamDefs
 {
     static const uint16_t MAX_PAYLOAD = 0xffff;
 
+    /// Stream ID value that does not refer to any stream. Used in the
+    /// requests when the stream ID is not known yet.
+    static const uint8_t INVALID_STREAM_ID = 0xff;
+
     enum Flags
     {
         FLAG_CARRIES_ID = 0x01,
@@ -59,9 +63,18 @@ struct StreamDefs
         REJECT_TEMPORARY_OUT_OF_ORDER = 0x40,
     };
 
+    /// Creates the payload of a stream initiate request message.
+    /// @param max_buffer_size is the largest buffer size the sender wants.
+    /// @param has_ident true if the stream will carry a content UID.
+    /// @param src_stream_id is the stream ID at the sender of the stream.
+    /// @param dst_stream_id if not INVALID_STREAM_ID, is the stream ID the
+    /// receiver was told to expect the stream on, e.g. in a memory config
+    /// read stream command.
     static Payload create_initiate_request(uint16_t max_buffer_size,
                                            bool has_ident,
-                                           uint8_t src_stream_id)
+                                           uint8_t src_stream_id,
+                                           uint8_t dst_stream_id =
+                                               INVALID_STREAM_ID)
     {
         Payload p(5, 0);
         p[0] = max_buffer_size >> 8;
@@ -69,6 +82,41 @@ struct StreamDefs
         p[2] = has_ident ? FLAG_CARRIES_ID : 0;
         p[3] = 0;
         p[4] = src_stream_id;
+        if (dst_stream_id != INVALID_STREAM_ID)
+        {
+            p.push_back(dst_stream_id);
+        }
+        return p;
+    }
+
+    /// Creates the payload of a stream initiate reply message.
+    /// @param max_buffer_size is the negotiated buffer size (zero if the
+    /// stream is rejected).
+    /// @param flags is a bitmask of the Flags enum.
+    /// @param additional_flags is a bitmask of the AdditionalFlags enum.
+    /// @param src_stream_id is the stream ID at the sender of the stream.
+    /// @param dst_stream_id is the stream ID at the receiver of the stream.
+    static Payload create_initiate_response(uint16_t max_buffer_size,
+        uint8_t flags, uint8_t additional_flags, uint8_t src_stream_id,
+        uint8_t dst_stream_id)
+    {
+        Payload p(6, 0);
+        p[0] = max_buffer_size >> 8;
+        p[1] = max_buffer_size & 0xff;
+        p[2] = flags;
+        p[3] = additional_flags;
+        p[4] = src_stream_id;
+        p[5] = dst_stream_id;
+        return p;
+    }
+
+    /// Creates the payload of a stream data proceed message.
+    static Payload create_data_proceed(
+        uint8_t src_stream_id, uint8_t dst_stream_id)
+    {
+        Payload p(4, 0);
+        p[0] = src_stream_id;
+        p[1] = dst_stream_id;
         return p;
     }
 
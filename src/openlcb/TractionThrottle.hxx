@@ -485,7 +485,7 @@ private:
         }
 
         AutoReleaseBuffer<GenMessage> rb(handler_.response());
-        const string &payload = handler_.response()->data()->payload;
+        const Payload &payload = handler_.response()->data()->payload;
         if (payload.size() < 3)
         {
             return return_with_error(Defs::ERROR_INVALID_ARGS);
@@ -634,7 +634,7 @@ private:
         }
 
         AutoReleaseBuffer<GenMessage> rb(handler_.response());
-        const string &payload = handler_.response()->data()->payload;
+        const Payload &payload = handler_.response()->data()->payload;
         if (payload.size() < 9)
         {
             return return_with_error(Defs::ERROR_INVALID_ARGS);
@@ -691,7 +691,7 @@ private:
         }
 
         AutoReleaseBuffer<GenMessage> rb(handler_.response());
-        const string &payload = handler_.response()->data()->payload;
+        const Payload &payload = handler_.response()->data()->payload;
         if (payload.size() < 3)
         {
             return return_with_error(Defs::ERROR_INVALID_ARGS_MESSAGE_TOO_SHORT);
@@ -36,6 +36,9 @@
 /** Number of entries in the remote alias cache */
 DEFAULT_CONST(remote_alias_cache_size, 10);
 
+/** Whether the remote alias cache should use hash tables for lookups. */
+DEFAULT_CONST_FALSE(remote_alias_cache_hash_index);
+
 /** Number of entries in the local alias cache */
 DEFAULT_CONST(local_alias_cache_size, 3);
 
@@ -54,6 +57,23 @@ DEFAULT_CONST(num_datagram_clients, 2);
  * datagram handler. */
 DEFAULT_CONST(num_memory_spaces, 5);
 
+/** Number of bytes the MemoryConfig handler moves between the memory space
+ * and the stream in one step for stream read and write commands. */
+DEFAULT_CONST(memory_config_stream_buffer_size, 512);
+
+/** Readahead window in bytes for the configuration file memory space. 0
+ * disables the readahead (saves RAM). */
+DEFAULT_CONST(memory_config_file_readahead, 0);
+
+/** Largest config file that the ConfigUpdateFlow reads into RAM while calling
+ * the configuration listeners. Enabled by default only on hosts, where the RAM
+ * is cheap and every read is a syscall. */
+#if defined(__linux__) || defined(__MACH__)
+DEFAULT_CONST(update_snapshot_max_size, 4096);
+#else
+DEFAULT_CONST(update_snapshot_max_size, 0);
+#endif
+
 /** Set to CONSTANT_TRUE if you want to export an "all memory" memory space
  * from the SimpleStack. Note that this should not be enabled in production,
  * because there is no protection against segfaults in it. */
@@ -63,3 +83,9 @@ DEFAULT_CONST_FALSE(enable_all_memory_space);
  * identified messages at boot time. This is required by the OpenLCB
  * standard. */
 DEFAULT_CONST_TRUE(node_init_identify);
+
+/** Number of 8-bit counters in the event registry pre-filter. 0 to disable. */
+DEFAULT_CONST(event_registry_filter_size, 0);
+
+/** Maximum number of event ID intervals per port in the routing hub. */
+DEFAULT_CONST(routing_max_event_intervals, 4096);
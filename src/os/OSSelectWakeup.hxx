@@ -48,6 +48,13 @@
 #include <signal.h>
 #endif
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#endif
+
 #ifdef __WINNT__
 #include <winsock2.h>
 #elif OPENMRN_HAVE_SELECT
@@ -71,6 +78,12 @@ public:
     {
 #ifdef ESP32
         esp_deallocate_vfs_fd();
+#endif
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+        if (eventFd_ >= 0)
+        {
+            ::close(eventFd_);
+        }
 #endif
     }
 
@@ -110,6 +123,9 @@ public:
     void wakeup()
     {
         bool need_wakeup = false;
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+        bool in_epoll = false;
+#endif
         {
             AtomicHolder l(this);
             pendingWakeup_ = true;
@@ -117,7 +133,18 @@ public:
             {
                 need_wakeup = true;
             }
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+            in_epoll = inEpoll_;
+#endif
         }
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+        if (need_wakeup && in_epoll)
+        {
+            uint64_t one = 1;
+            HASSERT(::write(eventFd_, &one, sizeof(one)) == sizeof(one));
+            return;
+        }
+#endif
         if (need_wakeup)
         {
 #if OPENMRN_FEATURE_DEVICE_SELECT
@@ -240,7 +267,98 @@ public:
         return ret;
     }
 
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    /** Waits on an epoll set, and can be woken up asynchronously from a
+     * different thread like select(). There are no fd_sets involved, so any
+     * file descriptor number can be watched.
+     *
+     * @param epfd is the epoll set to wait on. An eventfd for the wakeup
+     * calls is added to it upon the first call.
+     * @param events is filled with the ready file descriptors, as with
+     * ::epoll_wait. The wakeup eventfd is never reported.
+     * @param maxevents is the size of the events array.
+     * @param deadline_nsec is the maximum time to sleep if no fd activity and
+     * no wakeup happens. 0 to return immediately.
+     *
+     * @return number of entries filled in events (0 in case of timeout), or
+     * -1 and errno==EINTR if the wait was woken up asynchronously
+     */
+    int epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+        long long deadline_nsec)
+    {
+        if (epfd != epollFd_)
+        {
+            if (eventFd_ < 0)
+            {
+                eventFd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+                HASSERT(eventFd_ >= 0);
+            }
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = eventFd_;
+            HASSERT(::epoll_ctl(epfd, EPOLL_CTL_ADD, eventFd_, &ev) == 0);
+            epollFd_ = epfd;
+        }
+        {
+            AtomicHolder l(this);
+            inSelect_ = true;
+            inEpoll_ = true;
+            if (pendingWakeup_)
+            {
+                deadline_nsec = 0;
+            }
+        }
+        int ret = epoll_wait_nsec(epfd, events, maxevents, deadline_nsec);
+        {
+            AtomicHolder l(this);
+            pendingWakeup_ = false;
+            inSelect_ = false;
+            inEpoll_ = false;
+        }
+        for (int i = 0; i < ret; ++i)
+        {
+            if (events[i].data.fd == eventFd_)
+            {
+                uint64_t count;
+                HASSERT(::read(eventFd_, &count, sizeof(count)) ==
+                    sizeof(count));
+                events[i] = events[--ret];
+                if (!ret)
+                {
+                    errno = EINTR;
+                    return -1;
+                }
+                break;
+            }
+        }
+        return ret;
+    }
+#endif // OPENMRN_FEATURE_EXECUTOR_EPOLL
+
 private:
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    /// ::epoll_wait with a timeout in nanoseconds. Falls back to rounding up
+    /// to milliseconds if the kernel does not have epoll_pwait2.
+    static int epoll_wait_nsec(int epfd, struct epoll_event *events,
+        int maxevents, long long deadline_nsec)
+    {
+#if defined(__GLIBC__)
+#if __GLIBC_PREREQ(2, 35)
+        struct timespec timeout;
+        timeout.tv_sec = deadline_nsec / 1000000000;
+        timeout.tv_nsec = deadline_nsec % 1000000000;
+        int ret = ::epoll_pwait2(epfd, events, maxevents, &timeout, nullptr);
+        if (ret >= 0 || errno != ENOSYS)
+        {
+            return ret;
+        }
+#endif
+#endif
+        return ::epoll_wait(
+            epfd, events, maxevents, (deadline_nsec + 999999) / 1000000);
+    }
+#endif
+
 #ifdef ESP32
     void esp_allocate_vfs_fd();
     void esp_deallocate_vfs_fd();
@@ -268,6 +386,14 @@ private:
     bool pendingWakeup_;
     /** True during the duration of a select operation. */
     bool inSelect_;
+#if OPENMRN_FEATURE_EXECUTOR_EPOLL
+    /** True if the current select operation is an epoll_wait. */
+    bool inEpoll_{false};
+    /// Written to for waking up epoll_wait(); -1 until the first call.
+    int eventFd_{-1};
+    /// The epoll set eventFd_ is registered in.
+    int epollFd_{-1};
+#endif
     /// ID of the main thread we are engaged upon.
     os_thread_t thread_;
 #if OPENMRN_FEATURE_DEVICE_SELECT
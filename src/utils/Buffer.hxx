@@ -43,6 +43,7 @@
 #include <cstdlib>
 #include <cstdarg>
 
+#include "openmrn_features.h"
 #include "executor/Executable.hxx"
 #include "executor/Notifiable.hxx"
 #include "os/OS.hxx"
@@ -198,7 +199,13 @@ public:
      */
     Buffer<T> *ref()
     {
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        // Buffers are handed between threads (e.g. hub fan-out), so on
+        // multi-core hosts the reference count must be updated atomically.
+        __atomic_fetch_add(&count_, 1, __ATOMIC_RELAXED);
+#else
         ++count_;
+#endif
         return this;
     }
 
@@ -298,6 +305,26 @@ public:
         }
     }
 
+    /** Get a free item out of the pool that has additional space after the
+     * typed payload. The allocation is synchronous.
+     * @param result pointer to a pointer to the result
+     * @param extra number of bytes to reserve after the payload. These bytes
+     *        start at (uint8_t*)*result + sizeof(Buffer<BufferType>) and are
+     *        not initialized.
+     */
+    template <class BufferType>
+    void alloc_with_tail(Buffer<BufferType> **result, size_t extra)
+    {
+        size_t size = sizeof(Buffer<BufferType>) + extra;
+        HASSERT(size <= UINT16_MAX);
+        *result =
+            static_cast<Buffer<BufferType> *>(alloc_untyped(size, nullptr));
+        new (*result) Buffer<BufferType>(this);
+        // The buffer constructor records the typed size; the pool needs the
+        // real one to return the memory to the right bucket.
+        (*result)->size_ = size;
+    }
+
     /** Get a free item out of the pool.
      * @param flow Executable to notify upon allocation
      */
@@ -658,7 +685,11 @@ private:
 template <class T> void Buffer<T>::unref()
 {
     HASSERT(sizeof(Buffer<T>) <= size_);
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+    if (__atomic_sub_fetch(&count_, 1, __ATOMIC_ACQ_REL) == 0)
+#else
     if (--count_ == 0)
+#endif
     {
         this->~Buffer();
         pool_->free(this);
@@ -69,7 +69,9 @@ void CanFrameReadFlow::send(Buffer<CanHubData> *message, unsigned priority)
     }
 
     // We typecast the incoming buffer to a different buffer type that should be
-    // the subset of the data.
+    // the subset of the data. The cast buffer will not be destructed as a
+    // CanHubData, so the reference to the rendering slot has to go first.
+    message->data()->reset_rendering();
     Buffer<CanMessageData> *incoming_buffer;
 
     // Checks that it fits.
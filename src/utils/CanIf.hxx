@@ -46,6 +46,8 @@ struct CanMessageData : public can_frame
 {
     /** Constructor. Resets the inlined frame to an empty extended frame. */
     CanMessageData()
+        : unusedRendering(nullptr)
+        , unused(nullptr)
     {
         can_id = 0;
         CLR_CAN_FRAME_ERR(*this);
@@ -101,6 +103,10 @@ struct CanMessageData : public can_frame
         return *this;
     }
 
+    /** This will be aliased onto CanHubData::rendering_. It must stay
+     * nullptr, because a buffer cast back to CanHubData will release it. */
+    void *unusedRendering;
+
     /** This will be aliased onto CanHubData::skipMember_. It is needed to keep
      * the two structures the same size for casting between them. */
     void *unused;
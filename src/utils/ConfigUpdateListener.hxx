@@ -96,6 +96,21 @@ public:
     /// @param fd is the file descriptor for the EEPROM file. The current
     /// offset in this file is unspecified, callees must do lseek.
     virtual void factory_reset(int fd) = 0;
+
+    /// Declares which part of the configuration file this component reads in
+    /// apply_configuration. When the configuration is changed by a
+    /// configuration tool, components whose range was not written to are not
+    /// called again.
+    ///
+    /// @param offset will be set to the offset of the first byte of the range.
+    /// @param size will be set to the number of bytes in the range.
+    ///
+    /// @return false if the component does not declare a range (this is the
+    /// default). Such components are called on every configuration update.
+    virtual bool config_range(unsigned *offset, unsigned *size)
+    {
+        return false;
+    }
 };
 
 
@@ -61,6 +61,26 @@ public:
 
     /// Executes an update in response to the configuration having changed.
     virtual void trigger_update() = 0;
+
+    /// Reports that a part of the configuration file was written, for example
+    /// by a configuration tool. The next \ref trigger_partial_update will only
+    /// call the listeners whose config range overlaps with the written data.
+    ///
+    /// @param offset offset of the first byte written.
+    /// @param len number of bytes written. Offset 0 with UINT_MAX marks the
+    /// entire configuration as changed.
+    ///
+    virtual void config_written(unsigned offset, unsigned len)
+    {
+    }
+
+    /// Executes an update in response to the configuration having changed,
+    /// calling only the listeners affected by the writes reported via \ref
+    /// config_written. If no writes were reported, all listeners are called.
+    virtual void trigger_partial_update()
+    {
+        trigger_update();
+    }
 };
 
 #endif // _UTILS_CONFIGUPDATESERVICE_HXX_
@@ -99,6 +99,9 @@ public:
         return availableSlots_;
     }
 
+    /// Number of times the flash was accessed via block().
+    unsigned blockAccess_{0};
+
 private:
     void flash_erase(unsigned sector) override {
         ASSERT_LE(0u, sector);
@@ -118,6 +121,7 @@ private:
     }
 
     const uint32_t* block(unsigned sector, unsigned index) override {
+        ++blockAccess_;
         EXPECT_GT(EELEN / SECTOR_SIZE, sector);
         EXPECT_GT(SECTOR_SIZE / BLOCK_SIZE, index);
         void* address = &foo::__eeprom_start[sector * SECTOR_SIZE + index * BLOCK_SIZE];
@@ -289,3 +293,71 @@ TEST_F(EepromTest, many_overflow) {
     EXPECT_AT(13, "abcd");
     EXPECT_EQ(s, e->activeSector_);
 }
+
+/// Writes and overflows with many different offsets, and checks the entire
+/// contents against a model after each step and after reboot.
+TEST_F(EepromTest, random_writes) {
+    create();
+    string model(eeprom_size, '\xFF');
+    unsigned seed = 42;
+    for (int i = 0; i < 3000; ++i) {
+        unsigned ofs = rand_r(&seed) % (eeprom_size - 8);
+        unsigned len = rand_r(&seed) % 8 + 1;
+        string payload;
+        for (unsigned j = 0; j < len; ++j) {
+            payload.push_back(rand_r(&seed) & 0xff);
+        }
+        write_to(ofs, payload);
+        model.replace(ofs, len, payload);
+        if (i % 500 == 0) {
+            EXPECT_AT(0, model);
+        }
+    }
+    EXPECT_LT(0, e->activeSector_);
+    EXPECT_AT(0, model);
+    create(false);
+    EXPECT_AT(0, model);
+}
+
+/// Benchmark: measures the cost of reads as the journal fills up.
+TEST_F(EepromTest, read_cost_benchmark) {
+    create();
+    const unsigned slots = e->slot_count();
+    string model(eeprom_size, '\xFF');
+    unsigned k = 0;
+    for (unsigned percent : {10, 50, 95}) {
+        // Every aligned write with new data takes one slot.
+        while ((slots - e->avail()) * 100 < slots * percent) {
+            unsigned ofs = (k * 2) % eeprom_size;
+            char d[2] = {(char)k, (char)(k >> 8)};
+            write_to(ofs, string(d, 2));
+            model.replace(ofs, 2, d, 2);
+            ++k;
+        }
+        static constexpr unsigned kReads = 200;
+        static constexpr unsigned kLen = 64;
+        string ret(kLen, 0);
+        e->blockAccess_ = 0;
+        long long start = os_get_time_monotonic();
+        for (unsigned i = 0; i < kReads; ++i) {
+            unsigned ofs = (i * 37) % (eeprom_size - kLen);
+            ee()->read(ofs, &ret[0], kLen);
+            ASSERT_EQ(model.substr(ofs, kLen), ret);
+        }
+        long long end = os_get_time_monotonic();
+        unsigned used = slots - e->avail();
+        unsigned cost = e->blockAccess_ / kReads;
+        fprintf(stderr,
+            "journal %u/%u slots: %u flash block accesses/read, %.2f "
+            "usec/read\n",
+            used, slots, cost, (end - start) / 1000.0 / kReads);
+        if (e->shadowInRam_) {
+            EXPECT_EQ(0u, cost);
+        } else if (e->index_) {
+            // Independent of the journal fill.
+            EXPECT_GE(kLen / EEPROMEmulation::BYTES_PER_BLOCK + 1, cost);
+        } else {
+            EXPECT_LE(used, cost);
+        }
+    }
+}
@@ -32,10 +32,76 @@
  * @date 26 May 2016
  */
 
+#include <stdint.h>
+#include <string.h>
 #include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "utils/GcStreamParser.hxx"
 #include "utils/gc_format.h"
+#include "can_frame.h"
+
+/// Finds the next frame delimiter (':' or ';') in a character range. The two
+/// delimiters differ only in the lowest bit, so we test (c | 1) == ';'.
+///
+/// @param p first character to look at.
+/// @param end past-the-end of the range.
+/// @return pointer to the first delimiter, or end if there is none.
+static const char *find_delimiter(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i semis = _mm_set1_epi8(';');
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int m = _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_or_si128(v, ones), semis));
+        if (m)
+        {
+            return p + __builtin_ctz(m);
+        }
+        p += 16;
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t ones = vdupq_n_u8(1);
+    const uint8x16_t semis = vdupq_n_u8(';');
+    while (end - p >= 16)
+    {
+        uint64x2_t m = vreinterpretq_u64_u8(vceqq_u8(
+            vorrq_u8(vld1q_u8((const uint8_t *)p), ones), semis));
+        if (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1))
+        {
+            // The byte loop below finds the exact position.
+            break;
+        }
+        p += 16;
+    }
+#else
+    // Word-at-a-time scan.
+    static const uintptr_t kOnes = UINTPTR_MAX / 0xff;
+    while (end - p >= (ptrdiff_t)sizeof(uintptr_t))
+    {
+        uintptr_t w;
+        memcpy(&w, p, sizeof(w));
+        w = (w | kOnes) ^ (kOnes * ';');
+        if ((w - kOnes) & ~w & (kOnes << 7))
+        {
+            break;
+        }
+        p += sizeof(w);
+    }
+#endif
+    while (p < end && (*p | 1) != ';')
+    {
+        ++p;
+    }
+    return p;
+}
 
 bool GcStreamParser::consume_byte(char c)
 {
@@ -75,6 +141,72 @@ bool GcStreamParser::consume_byte(char c)
     return false;
 }
 
+unsigned GcStreamParser::consume_buffer(const char *data, size_t len,
+    struct can_frame *frames, unsigned max_frames, size_t *consumed)
+{
+    const char *p = data;
+    const char *end = data + len;
+    unsigned num_frames = 0;
+    while (p < end && num_frames < max_frames)
+    {
+        if (offset_ < 0)
+        {
+            // Not in a frame: skips everything up to the next frame start.
+            p = static_cast<const char *>(memchr(p, ':', end - p));
+            if (!p)
+            {
+                p = end;
+                break;
+            }
+            ++p;
+            offset_ = 0;
+            continue;
+        }
+        const char *d = find_delimiter(p, end);
+        size_t run = d - p;
+        if (offset_ + run > sizeof(cbuf_) - 1)
+        {
+            // Overran the buffer. Looks for the sync byte again.
+            offset_ = -1;
+            p = d;
+            continue;
+        }
+        if (d == end)
+        {
+            // Partial frame; keeps it for the next call.
+            memcpy(cbuf_ + offset_, p, run);
+            offset_ += run;
+            p = end;
+            break;
+        }
+        if (*d == ':')
+        {
+            // Frame restarts here.
+            offset_ = 0;
+            p = d + 1;
+            continue;
+        }
+        // End of frame. Parses out of the input buffer if we can.
+        const char *frame = p;
+        size_t frame_len = run;
+        if (offset_ > 0)
+        {
+            memcpy(cbuf_ + offset_, p, run);
+            cbuf_[offset_ + run] = 0;
+            frame = cbuf_;
+            frame_len += offset_;
+        }
+        offset_ = -1;
+        p = d + 1;
+        if (gc_format_parse_n(frame, frame_len, &frames[num_frames]) == 0)
+        {
+            ++num_frames;
+        }
+    }
+    *consumed = p - data;
+    return num_frames;
+}
+
 void GcStreamParser::frame_buffer(std::string* payload) {
     if (offset_ >= 0) {
         payload->assign(cbuf_, offset_);
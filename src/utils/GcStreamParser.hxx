@@ -35,8 +35,11 @@
 #ifndef _UTILS_GCSTREAMPARSER_HXX_
 #define _UTILS_GCSTREAMPARSER_HXX_
 
+#include <stddef.h>
 #include <string>
 
+struct can_frame;
+
 /**
    Parses a sequence of characters; finds GridConnect protocol packet
    boundaries in the sequence of packets. Contains an internal buffer holding
@@ -66,6 +69,28 @@ public:
      * the frame is set to an error frame. */
     bool parse_frame_to_output(struct can_frame *output_frame);
 
+    /** Processes a chunk of the incoming character stream in bulk. The
+     * frame boundaries are found by scanning many characters at a time, and
+     * the complete frames are decoded straight out of the input chunk. A
+     * partial frame at the end of the chunk is kept in the internal buffer
+     * and completed by the next call. Frames with a format error are skipped.
+     *
+     * The result is the same as calling consume_byte for each character and
+     * parse_frame_to_output whenever it returns true, except that the frame
+     * buffer is not updated for frames that fit entirely into the chunk.
+     *
+     * @param data is the next chunk of characters from the source stream.
+     * @param len is the number of characters in data.
+     * @param frames is an output array; the decoded frames will be written
+     * here.
+     * @param max_frames is the number of entries in frames. Parsing stops
+     * after this many frames were found.
+     * @param consumed will be set to the number of characters from data that
+     * were processed. Less than len only if max_frames was reached.
+     * @return the number of frames written to frames. */
+    unsigned consume_buffer(const char *data, size_t len,
+        struct can_frame *frames, unsigned max_frames, size_t *consumed);
+
     /** @param payload fills with the current contents of the frame buffer. */
     void frame_buffer(std::string *payload);
 
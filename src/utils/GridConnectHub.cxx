@@ -67,6 +67,10 @@ public:
     {
         gc_side->register_port(&parser_);
         can_side->register_port(&formatter_);
+        if (formatter_.shares_rendering())
+        {
+            can_side->request_shared_rendering();
+        }
         isRegistered_ = 1;
     }
 
@@ -86,6 +90,10 @@ public:
     {
         gc_side_read->register_port(&parser_);
         can_side->register_port(&formatter_);
+        if (formatter_.shares_rendering())
+        {
+            can_side->request_shared_rendering();
+        }
         isRegistered_ = 1;
     }
 
@@ -99,6 +107,10 @@ public:
         if (isRegistered_)
         {
             parser_.destination()->unregister_port(&formatter_);
+            if (formatter_.shares_rendering())
+            {
+                parser_.destination()->release_shared_rendering();
+            }
             /// @todo(balazs.racz) This is incorrect if the 3-pipe constructor
             /// is used.
             formatter_.destination()->unregister_port(&parser_);
@@ -147,23 +159,39 @@ public:
             return delayPort_.shutdown();
         }
         
+        /// @return true if this port renders the same text as the other
+        /// gridconnect ports, so it can use the hub's shared rendering.
+        bool shares_rendering()
+        {
+            return !double_bytes_;
+        }
+
         Action entry() override
         {
             LOG(VERBOSE, "can packet arrived: %" PRIx32,
                 GET_CAN_FRAME_ID_EFF(*message()->data()));
-            char *end =
-                gc_format_generate(message()->data(), dbuf_, double_bytes_);
-            size_t size = (end - dbuf_);
+            const struct can_frame &frame = message()->data()->frame();
+            CanFrameRendering *r =
+                shares_rendering() ? message()->data()->rendering() : nullptr;
+            size_t size = 0;
+            const char *text = r ? r->get(frame, &size) : nullptr;
+            if (!text)
+            {
+                text = dbuf_;
+                size = gc_format_generate(&frame, dbuf_, double_bytes_) - dbuf_;
+                if (r && size)
+                {
+                    // The other gridconnect ports of the hub copy this text.
+                    r->put(frame, dbuf_, size);
+                }
+            }
             if (size)
             {
                 Buffer<HubData> *target_buffer = nullptr;
                 /// @todo(balazs.racz) switch to asynchronous allocation here.
                 mainBufferPool->alloc(&target_buffer);
                 target_buffer->data()->skipMember_ = skipMember_;
-                /// @todo(balazs.racz) try to use an assign function for better
-                /// performance.
-                target_buffer->data()->resize(size);
-                memcpy((char *)target_buffer->data()->data(), dbuf_, size);
+                target_buffer->data()->assign(text, size);
                 target_buffer->set_done(bn_.reset(this));
                 delayPort_.send(target_buffer, 0);
                 release();
@@ -234,49 +262,59 @@ public:
         {
             inBuf_ = message()->data()->data();
             inBufSize_ = message()->data()->size();
+            numFrames_ = 0;
+            nextFrame_ = 0;
             return call_immediately(STATE(parse_more_data));
         }
 
-        /// Matches the incoming characters to the pattern to form incoming
-        /// frames. @return next state.
+        /// Sends off the already parsed frames, then parses the next batch of
+        /// frames from the incoming characters. @return next state.
         Action parse_more_data()
         {
-            while (inBufSize_--)
+            if (nextFrame_ < numFrames_)
             {
-                char c = *inBuf_++;
-                if (streamSegmenter_.consume_byte(c))
-                {
-                    // End of frame. Allocate an output buffer and parse the
-                    // frame.
-                    return allocate_and_call(destination_, STATE(parse_to_output_frame), frameAllocator_.get());
-                }
+                return allocate_and_call(destination_,
+                    STATE(send_output_frame), frameAllocator_.get());
             }
-            // Will notify the caller.
-            return release_and_exit();
+            if (!inBufSize_)
+            {
+                // Will notify the caller.
+                return release_and_exit();
+            }
+            size_t consumed;
+            numFrames_ = streamSegmenter_.consume_buffer(
+                inBuf_, inBufSize_, frames_, MAX_BATCH, &consumed);
+            nextFrame_ = 0;
+            inBuf_ += consumed;
+            inBufSize_ -= consumed;
+            return again();
         }
 
-        /** Takes the completed frame in cbuf_, parses it into the allocation
-         * result (a can pipe buffer) and sends off frame. Then comes back to
-         * process buffer. @return next state. */
-        Action parse_to_output_frame()
+        /** Copies the next parsed frame into the allocation result (a can
+         * pipe buffer) and sends off frame. Then comes back to process
+         * buffer. @return next state. */
+        Action send_output_frame()
         {
             auto* b = get_allocation_result(destination_);
-            if (streamSegmenter_.parse_frame_to_output(b->data()))
-            {
-                b->data()->skipMember_ = skipMember_;
-                destination_->send(b);
-            }
-            else
-            {
-                // Releases the buffer.
-                b->unref();
-            }
+            *b->data()->mutable_frame() = frames_[nextFrame_++];
+            b->data()->skipMember_ = skipMember_;
+            destination_->send(b);
             return call_immediately(STATE(parse_more_data));
         }
 
     private:
+        /// How many frames we parse from the input in one go.
+        static constexpr unsigned MAX_BATCH = 8;
+
         /// Holds the state of the incoming characters and the boundary.
         GcStreamParser streamSegmenter_;
+
+        /// Frames parsed from the input that are not sent yet.
+        struct can_frame frames_[MAX_BATCH];
+        /// Number of valid entries in frames_.
+        unsigned numFrames_{0};
+        /// Index of the next entry in frames_ to send.
+        unsigned nextFrame_{0};
         
         /// The incoming characters.
         const char *inBuf_;
@@ -35,6 +35,7 @@
 #define _UTILS_HUB_HXX_
 
 #include <stdint.h>
+#include <string.h>
 #include <string>
 
 #include "executor/Dispatcher.hxx"
@@ -67,12 +68,117 @@ public:
     }
 };
 
+/// Text form of a CAN frame (e.g. GridConnect) that is shared between the
+/// copies a hub makes of the frame for its ports. The first port that needs
+/// the text fills it in; the other ports copy it instead of rendering the
+/// frame again. Ports may run on different threads: the slot is claimed
+/// atomically, and a port that finds it busy or holding a different frame
+/// renders on its own.
+struct CanFrameRendering
+{
+    /// Maximum number of characters that can be stored.
+    static constexpr unsigned MAX_SIZE = 32;
+
+    /// Constructor. Starts out empty.
+    CanFrameRendering()
+        : size_(0)
+        , state_(EMPTY)
+    {
+    }
+
+    /// Looks up the rendered text.
+    /// @param frame the frame whose text the caller needs.
+    /// @param size will be set to the number of characters.
+    /// @return the stored characters, or nullptr if the slot does not hold
+    /// the text of frame.
+    const char *get(const struct can_frame &frame, size_t *size)
+    {
+        if (load_state() != READY ||
+            memcmp(&frame, &frame_, sizeof(frame_)) != 0)
+        {
+            return nullptr;
+        }
+        *size = size_;
+        return text_;
+    }
+
+    /// Stores the rendered text of a frame, unless some other port has
+    /// claimed the slot already.
+    /// @param frame the frame that was rendered.
+    /// @param text rendered characters.
+    /// @param size number of characters in text.
+    void put(const struct can_frame &frame, const char *text, size_t size)
+    {
+        if (size > MAX_SIZE || !claim())
+        {
+            return;
+        }
+        frame_ = frame;
+        memcpy(text_, text, size);
+        size_ = size;
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        __atomic_store_n(&state_, READY, __ATOMIC_RELEASE);
+#else
+        state_ = READY;
+#endif
+    }
+
+private:
+    /// Values of state_.
+    enum
+    {
+        /// Nothing stored yet.
+        EMPTY,
+        /// A port is writing the text.
+        BUSY,
+        /// text_ holds the rendering of frame_.
+        READY
+    };
+
+    /// @return the current value of state_.
+    uint8_t load_state()
+    {
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        return __atomic_load_n(&state_, __ATOMIC_ACQUIRE);
+#else
+        return state_;
+#endif
+    }
+
+    /// Moves the slot from EMPTY to BUSY. @return true if it was EMPTY.
+    bool claim()
+    {
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        uint8_t expected = EMPTY;
+        return __atomic_compare_exchange_n(&state_, &expected, BUSY, false,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+#else
+        if (state_ != EMPTY)
+        {
+            return false;
+        }
+        state_ = BUSY;
+        return true;
+#endif
+    }
+
+    /// The frame that text_ was rendered from.
+    struct can_frame frame_;
+    /// Rendered characters.
+    char text_[MAX_SIZE];
+    /// Number of valid characters in text_.
+    uint8_t size_;
+    /// One of EMPTY, BUSY, READY.
+    uint8_t state_;
+};
+
 /// Container for (binary) CAN frames going through Hubs.
 struct CanFrameContainer : public StructContainer<can_frame>
 {
     /* Constructor. Sets up (outgoing) frames to be empty extended frames by
      * default. */
     CanFrameContainer()
+        : rendering_(nullptr)
     {
         can_id = 0;
         CLR_CAN_FRAME_ERR(*this);
@@ -81,6 +187,57 @@ struct CanFrameContainer : public StructContainer<can_frame>
         can_dlc = 0;
     }
 
+    /// Copy constructor. The copy shares the rendering slot.
+    CanFrameContainer(const CanFrameContainer &o)
+        : StructContainer<can_frame>(o)
+        , rendering_(o.rendering_ ? o.rendering_->ref() : nullptr)
+    {
+    }
+
+    /// Assignment operator. The copy shares the rendering slot.
+    CanFrameContainer &operator=(const CanFrameContainer &o)
+    {
+        StructContainer<can_frame>::operator=(o);
+        if (o.rendering_ != rendering_)
+        {
+            reset_rendering();
+            rendering_ = o.rendering_ ? o.rendering_->ref() : nullptr;
+        }
+        return *this;
+    }
+
+    ~CanFrameContainer()
+    {
+        reset_rendering();
+    }
+
+    /// @return the rendering slot shared with the other copies of this
+    /// frame, or nullptr if the hub did not attach one.
+    CanFrameRendering *rendering()
+    {
+        return rendering_ ? rendering_->data() : nullptr;
+    }
+
+    /// Attaches an empty rendering slot unless there is one already. Called
+    /// by the hub before making copies of the frame.
+    void share_rendering()
+    {
+        if (!rendering_)
+        {
+            mainBufferPool->alloc(&rendering_);
+        }
+    }
+
+    /// Drops this copy's reference to the rendering slot.
+    void reset_rendering()
+    {
+        if (rendering_)
+        {
+            rendering_->unref();
+            rendering_ = nullptr;
+        }
+    }
+
     /** @returns a mutable pointer to the embedded CAN frame. */
     struct can_frame *mutable_frame()
     {
@@ -91,6 +248,11 @@ struct CanFrameContainer : public StructContainer<can_frame>
     {
         return *this;
     }
+
+private:
+    /// Rendering slot shared between the hub copies of this frame, or
+    /// nullptr.
+    Buffer<CanFrameRendering> *rendering_;
 };
 
 /// Data type wrapper for sending data through a Hub. It adds the @ref
@@ -133,6 +295,19 @@ typedef HubContainer<string> HubData;
  */
 typedef HubContainer<CanFrameContainer> CanHubData;
 
+/// Called by the hub before it copies a message for more than one port, if
+/// a port asked for shared rendering. No-op for message types without a
+/// rendering slot.
+template <class D> inline void hub_share_rendering(D *)
+{
+}
+
+/// Attaches the rendering slot to a CAN frame before the hub copies it.
+inline void hub_share_rendering(CanHubData *d)
+{
+    d->share_rendering();
+}
+
 /** All ports interfacing via a hub will have to derive from this flow. */
 typedef FlowInterface<Buffer<HubData>> HubPortInterface;
 /// Base class for a port to an ascii hub that is implemented as a stateflow.
@@ -176,6 +351,54 @@ public:
         this->unregister_handler(port, reinterpret_cast<uintptr_t>(port),
                                  POINTER_MASK);
     }
+
+    /// Asks the hub to attach a shared rendering slot to every message that
+    /// it copies for more than one port (see CanFrameRendering). Called by
+    /// ports that convert each message to text, so that the conversion
+    /// happens once per message instead of once per port. Must be balanced
+    /// by a call to release_shared_rendering().
+    void request_shared_rendering()
+    {
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        __atomic_fetch_add(&sharedRendering_, 1, __ATOMIC_RELAXED);
+#else
+        ++sharedRendering_;
+#endif
+    }
+
+    /// Undoes a previous request_shared_rendering().
+    void release_shared_rendering()
+    {
+        HASSERT(sharedRendering_);
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        __atomic_fetch_sub(&sharedRendering_, 1, __ATOMIC_RELAXED);
+#else
+        --sharedRendering_;
+#endif
+    }
+
+protected:
+    /// Attaches the rendering slot, if requested, before the dispatcher
+    /// copies the message. @return next state.
+    StateFlowBase::Action allocate_and_clone() override
+    {
+        // A port that registers concurrently with a message may miss the
+        // slot on that message, which only costs an extra render.
+#if OPENMRN_FEATURE_MUTEX_PTHREAD
+        unsigned shared = __atomic_load_n(&sharedRendering_, __ATOMIC_RELAXED);
+#else
+        unsigned shared = sharedRendering_;
+#endif
+        if (shared)
+        {
+            hub_share_rendering(this->message()->data());
+        }
+        return DispatchFlow<Buffer<D>, 1>::allocate_and_clone();
+    }
+
+private:
+    /// Number of ports that asked for shared rendering.
+    unsigned sharedRendering_{0};
 };
 
 /** A generic hub that proxies packets of untyped (aka string) data. */
@@ -42,7 +42,13 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
+#include <memory>
+#include <vector>
+#if defined(OPENMRN_FEATURE_BSD_SOCKETS) && !defined(__WINNT__)
+#include <sys/socket.h>
+#endif
 
 #include "executor/StateFlow.hxx"
 #include "utils/Hub.hxx"
@@ -76,6 +82,11 @@ template <> struct SelectBufferInfo<HubFlow::buffer_type>
     {
         return false;
     }
+    /// @return the number of bytes read into a buffer at once.
+    static size_t unit_size()
+    {
+        return 64;
+    }
 };
 
 /// Partial template specialization of buffer traits for struct-typed hubs.
@@ -102,6 +113,11 @@ struct SelectBufferInfo<Buffer<HubContainer<StructContainer<T>>>>
     {
         return true;
     }
+    /// @return the number of bytes in one buffer.
+    static size_t unit_size()
+    {
+        return sizeof(T);
+    }
 };
 
 /// Partial template specialization of buffer traits for CAN frame-typed
@@ -130,6 +146,11 @@ struct SelectBufferInfo<Buffer<CanHubData>> {
     {
         return true;
     }
+    /// @return the number of bytes in one buffer.
+    static size_t unit_size()
+    {
+        return sizeof(struct can_frame);
+    }
 };
 
 /// State flow implementing select-aware fd reads.
@@ -170,9 +191,56 @@ public:
         return static_cast<FdHubPortService *>(this->service());
     }
 
+    /// Switches to batched reading: every read call will ask for up to
+    /// `frames` units (e.g. CAN frames) at once into a staging array, and the
+    /// complete units that arrived are then forwarded as a burst. Only
+    /// supported for hubs with fixed-size buffers. Should be called right
+    /// after construction; takes effect after the currently pending read.
+    ///
+    /// @param frames how many units to read at most in one call. 0 or 1
+    /// disables batching.
+    /// @param message_fd true if the fd delivers one unit per datagram (e.g.
+    /// socketcan). These are received with recvmmsg where available.
+    void set_read_batch(unsigned frames, bool message_fd)
+    {
+        HASSERT(SelectBufferInfo<buffer_type>::needs_read_fully());
+        if (frames <= 1)
+        {
+            batchSize_ = 0;
+            batch_.reset();
+            return;
+        }
+        batchSize_ = frames * SelectBufferInfo<buffer_type>::unit_size();
+        batch_.reset(new uint8_t[batchSize_]);
+        batchFill_ = 0;
+        batchOfs_ = 0;
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        msgs_.clear();
+        iov_.clear();
+        if (message_fd)
+        {
+            size_t unit = SelectBufferInfo<buffer_type>::unit_size();
+            iov_.resize(frames);
+            msgs_.resize(frames);
+            memset(msgs_.data(), 0, frames * sizeof(msgs_[0]));
+            for (unsigned i = 0; i < frames; ++i)
+            {
+                iov_[i].iov_base = batch_.get() + i * unit;
+                iov_[i].iov_len = unit;
+                msgs_[i].msg_hdr.msg_iov = &iov_[i];
+                msgs_[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+#endif
+    }
+
     /// Allocates a new buffer for incoming data. @return next state.
     Action allocate_buffer()
     {
+        if (batchSize_)
+        {
+            return this->call_immediately(STATE(read_batch));
+        }
         return this->allocate_and_call(dst_, STATE(try_read));
     }
 
@@ -217,6 +285,115 @@ public:
         return this->call_immediately(STATE(allocate_buffer));
     }
 
+    /// Reads as many units as fit into the free space of the staging
+    /// array. @return next state.
+    Action read_batch()
+    {
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        if (!msgs_.empty())
+        {
+            return this->call_immediately(STATE(recv_batch));
+        }
+#endif
+        return this->read_single(&selectHelper_, device()->fd(),
+            batch_.get() + batchFill_, batchSize_ - batchFill_,
+            STATE(batch_read_done), 0);
+    }
+
+    /// Called when the batched read call is completed. @return next state.
+    Action batch_read_done()
+    {
+        if (selectHelper_.hasError_)
+        {
+            notify_barrier();
+            set_terminated();
+            device()->report_read_error();
+            return exit();
+        }
+        batchFill_ = batchSize_ - selectHelper_.remaining_;
+        batchOfs_ = 0;
+        return this->call_immediately(STATE(dispatch_next));
+    }
+
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+    /// Receives as many datagrams as are waiting (up to the batch size) in
+    /// one call, one unit per datagram. Datagrams of the wrong size are
+    /// dropped. @return next state.
+    Action recv_batch()
+    {
+        int fd = device()->fd();
+        int ret = ::recvmmsg(fd, msgs_.data(), msgs_.size(), 0, nullptr);
+        if (ret < 0 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        {
+            selectHelper_.reset(Selectable::READ, fd, 0);
+            selectHelper_.set_wakeup(this);
+            this->service()->executor()->select(&selectHelper_);
+            return this->wait_and_call(STATE(recv_batch));
+        }
+        size_t unit = SelectBufferInfo<buffer_type>::unit_size();
+        batchFill_ = 0;
+        batchOfs_ = 0;
+        for (int i = 0; i < ret; ++i)
+        {
+            if (msgs_[i].msg_len == 0)
+            {
+                // EOF.
+                ret = -1;
+                break;
+            }
+            if (msgs_[i].msg_len != unit ||
+                (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC))
+            {
+                LOG(WARNING, "HubDeviceSelect: dropped datagram of %u bytes",
+                    (unsigned)msgs_[i].msg_len);
+                continue;
+            }
+            if (batchFill_ != i * unit)
+            {
+                memmove(batch_.get() + batchFill_, batch_.get() + i * unit,
+                    unit);
+            }
+            batchFill_ += unit;
+        }
+        if (ret <= 0)
+        {
+            selectHelper_.hasError_ = 1;
+            return this->call_immediately(STATE(batch_read_done));
+        }
+        return this->call_immediately(STATE(dispatch_next));
+    }
+#endif
+
+    /// Forwards the next complete unit from the staging array, or goes back
+    /// to reading if there are none left. @return next state.
+    Action dispatch_next()
+    {
+        size_t unit = SelectBufferInfo<buffer_type>::unit_size();
+        if (batchFill_ - batchOfs_ >= unit)
+        {
+            return this->allocate_and_call(dst_, STATE(dispatch_frame));
+        }
+        // Keeps the partial unit for the next read.
+        memmove(batch_.get(), batch_.get() + batchOfs_, batchFill_ - batchOfs_);
+        batchFill_ -= batchOfs_;
+        batchOfs_ = 0;
+        return this->call_immediately(STATE(read_batch));
+    }
+
+    /// Copies one unit from the staging array into a newly allocated buffer
+    /// and sends it off. @return next state.
+    Action dispatch_frame()
+    {
+        auto *b = this->get_allocation_result(dst_);
+        size_t unit = SelectBufferInfo<buffer_type>::unit_size();
+        b->data()->skipMember_ = skipMember_;
+        memcpy((void *)b->data()->data(), batch_.get() + batchOfs_, unit);
+        batchOfs_ += unit;
+        dst_->send(b, 0);
+        return this->call_immediately(STATE(dispatch_next));
+    }
+
 private:
     /** Calls into the parent flow's barrier notify, but makes sure to
      * only do this once in the lifetime of *this. */
@@ -239,6 +416,21 @@ private:
     typename HFlow::port_type *dst_;
     /// What should be the source port designation.
     typename HFlow::port_type *skipMember_;
+    /// Staging array for batched reads. nullptr if batching is disabled.
+    std::unique_ptr<uint8_t[]> batch_;
+    /// Size of batch_ in bytes, 0 if batching is disabled.
+    size_t batchSize_{0};
+    /// How many bytes in batch_ have been filled by reads.
+    size_t batchFill_{0};
+    /// Offset in batch_ of the next unit to forward.
+    size_t batchOfs_{0};
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+    /// One message header per slot of batch_ for recvmmsg. Empty unless the
+    /// fd is datagram-oriented and batching is enabled.
+    std::vector<struct mmsghdr> msgs_;
+    /// Buffer descriptors for msgs_.
+    std::vector<struct iovec> iov_;
+#endif
 };
 
 /// HubPort that connects a select-aware device to a strongly typed Hub.
@@ -282,7 +474,7 @@ public:
     /// @param on_error notifiable that will be called when a write or read
     /// error is encountered.
     HubDeviceSelect(HFlow *hub, int fd, Notifiable *on_error = nullptr)
-        : FdHubPortService(hub->service()->executor(), fd)
+        : FdHubPortService(hub->service()->executor(), set_nonblocking(fd))
         , hub_(hub)
         , readFlow_(this, hub, &writeFlow_)
         , writeFlow_(this)
@@ -291,12 +483,6 @@ public:
         barrier_.reset(
             on_error ? on_error : EmptyNotifiable::DefaultInstance());
         barrier_.new_child();
-#ifdef __WINNT__
-        unsigned long par = 1;
-        ioctlsocket(fd_, FIONBIO, &par);
-#else
-        ::fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK);
-#endif
         hub_->register_port(write_port());
     }
 
@@ -350,6 +536,42 @@ public:
         writeFlow_.send(b);
     }
 
+    /// Enables batched I/O on this port. Batched reads ask for many units at
+    /// once from the device and forward them as a burst; batched writes
+    /// coalesce the buffers waiting in the write queue into a single write
+    /// call. Should be called right after construction.
+    ///
+    /// Datagram sockets (e.g. socketcan, which rejects any write that is not
+    /// exactly one frame) are never coalesced: there the queued buffers are
+    /// sent as separate datagrams with a single sendmmsg call, and batched
+    /// reads use recvmmsg. Where these calls are not available, writes to
+    /// such fds stay one buffer per call.
+    ///
+    /// @param read_frames how many units (e.g. CAN frames) to read in one
+    /// call. Only valid for hubs with fixed-size buffers; 0 leaves reads
+    /// unbatched.
+    /// @param write_bytes largest number of bytes to write in one call. 0
+    /// leaves writes unbatched.
+    /// @param max_write_delay_nsec latency cap: how long an outgoing buffer
+    /// may be held back waiting for more data to fill the batch. 0 means
+    /// writes are never delayed, only the data already queued is coalesced.
+    void enable_batching(unsigned read_frames, unsigned write_bytes,
+        long long max_write_delay_nsec = 0)
+    {
+        bool message_fd = is_message_fd(fd_);
+        if (read_frames)
+        {
+            readFlow_.set_read_batch(read_frames, message_fd);
+        }
+#ifndef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        if (message_fd)
+        {
+            write_bytes = 0;
+        }
+#endif
+        writeFlow_.set_batch(write_bytes, max_write_delay_nsec, message_fd);
+    }
+
     /// @return true if there is no pending data to write. Can be used to check
     /// safe destruction.
     bool write_done()
@@ -398,32 +620,270 @@ protected:
             return static_cast<HubDeviceSelect *>(this->service());
         }
 
+        /// Enables coalescing of queued buffers into a single write call.
+        /// @param max_bytes is the largest write to assemble; 0 disables
+        /// coalescing. @param max_delay_nsec is how long the first buffer of a
+        /// batch may wait for more data to arrive when the queue is empty.
+        /// @param message_fd true if every buffer has to be written as a
+        /// separate datagram. The batch is then sent with sendmmsg.
+        void set_batch(
+            unsigned max_bytes, long long max_delay_nsec, bool message_fd)
+        {
+            batchBytes_ = max_bytes;
+            batchDelay_ = max_delay_nsec;
+            messageFd_ = message_fd;
+            batch_.clear();
+            if (!message_fd)
+            {
+                batch_.reserve(max_bytes);
+            }
+        }
+
+        /// State flow call. @return next state.
         StateFlowBase::Action entry() OVERRIDE
         {
             if (device()->fd() < 0) {
                 return this->release_and_exit();
             }
+            if (batchBytes_)
+            {
+                batchLen_ = this->message()->data()->size();
+                delayed_ = false;
+                return this->call_immediately(STATE(collect));
+            }
             return this->write_repeated(&selectHelper_, device()->fd(),
                 this->message()->data()->data(),
                 this->message()->data()->size(), STATE(write_done),
                 this->priority());
         }
 
+        /// Takes further buffers from the queue as long as they fit into the
+        /// batch, then writes the batch out in one call. @return next state.
+        StateFlowBase::Action collect()
+        {
+            if (device()->fd() < 0) {
+                return this->call_immediately(STATE(write_done));
+            }
+            while (!carry_)
+            {
+                unsigned prio;
+                QMember *q;
+                {
+                    AtomicHolder h(this);
+                    q = this->queue_next(&prio);
+                }
+                if (!q)
+                {
+                    break;
+                }
+                auto *b = static_cast<typename HFlow::buffer_type *>(q);
+                if (batchLen_ + b->data()->size() > batchBytes_)
+                {
+                    // Goes into the next batch.
+                    carry_ = b;
+                    carryPriority_ = prio;
+                    break;
+                }
+                batchLen_ += b->data()->size();
+                pending_.push_back(b);
+            }
+            if (!carry_ && batchDelay_ && !delayed_ && batchLen_ < batchBytes_)
+            {
+                delayed_ = true;
+                return this->sleep_and_call(
+                    &timer_, batchDelay_, STATE(collect));
+            }
+            if (pending_.empty())
+            {
+                return this->write_repeated(&selectHelper_, device()->fd(),
+                    this->message()->data()->data(), batchLen_,
+                    STATE(write_done), this->priority());
+            }
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+            if (messageFd_)
+            {
+                return this->call_immediately(STATE(send_messages));
+            }
+#endif
+            batch_.clear();
+            append(this->message());
+            for (auto *b : pending_)
+            {
+                append(b);
+            }
+            return this->write_repeated(&selectHelper_, device()->fd(),
+                batch_.data(), batch_.size(), STATE(write_done),
+                this->priority());
+        }
+
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        /// Sends the current message and the pending buffers as separate
+        /// datagrams with as few sendmmsg calls as the device accepts.
+        /// @return next state.
+        StateFlowBase::Action send_messages()
+        {
+            iov_.clear();
+            add_message(this->message());
+            for (auto *b : pending_)
+            {
+                add_message(b);
+            }
+            msgs_.resize(iov_.size());
+            memset(msgs_.data(), 0, msgs_.size() * sizeof(msgs_[0]));
+            for (unsigned i = 0; i < msgs_.size(); ++i)
+            {
+                msgs_[i].msg_hdr.msg_iov = &iov_[i];
+                msgs_[i].msg_hdr.msg_iovlen = 1;
+            }
+            sent_ = 0;
+            selectHelper_.hasError_ = 0;
+            return this->call_immediately(STATE(try_send_messages));
+        }
+
+        /// Calls sendmmsg for the datagrams not sent yet, waiting for the fd
+        /// to become writable when the device is busy. @return next state.
+        StateFlowBase::Action try_send_messages()
+        {
+            int fd = device()->fd();
+            while (fd >= 0 && sent_ < msgs_.size())
+            {
+                int ret = ::sendmmsg(
+                    fd, msgs_.data() + sent_, msgs_.size() - sent_, 0);
+                if (ret > 0)
+                {
+                    sent_ += ret;
+                    continue;
+                }
+                if (ret < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    selectHelper_.reset(Selectable::WRITE, fd, this->priority());
+                    selectHelper_.set_wakeup(this);
+                    this->service()->executor()->select(&selectHelper_);
+                    return this->wait_and_call(STATE(try_send_messages));
+                }
+                selectHelper_.hasError_ = 1;
+                break;
+            }
+            return this->call_immediately(STATE(write_done));
+        }
+#endif
+
         /// State flow call. @return next state.
         StateFlowBase::Action write_done()
         {
             if (selectHelper_.hasError_) {
                 device()->report_write_error();
             }
+            for (auto *b : pending_)
+            {
+                b->unref();
+            }
+            pending_.clear();
+            if (carry_)
+            {
+                this->release();
+                this->reset_message(carry_, carryPriority_);
+                carry_ = nullptr;
+                return this->call_immediately(STATE(entry));
+            }
             return this->release_and_exit();
         }
 
     private:
+        /// Appends the payload of a buffer to the batch.
+        /// @param b the buffer to copy.
+        void append(typename HFlow::buffer_type *b)
+        {
+            const uint8_t *d =
+                static_cast<const uint8_t *>((const void *)b->data()->data());
+            batch_.insert(batch_.end(), d, d + b->data()->size());
+        }
+
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        /// Adds the payload of a buffer as the next datagram to send.
+        /// @param b the buffer to send.
+        void add_message(typename HFlow::buffer_type *b)
+        {
+            struct iovec v;
+            v.iov_base = (void *)b->data()->data();
+            v.iov_len = b->data()->size();
+            iov_.push_back(v);
+        }
+#endif
+
         /// Helper class for asynchronous writes.
         StateFlowBase::StateFlowSelectHelper selectHelper_{this};
+        /// Timer for holding back a small batch.
+        StateFlowBase::StateFlowTimer timer_{this};
+        /// Coalesced data to write.
+        std::vector<uint8_t> batch_;
+#ifdef OPENMRN_HAVE_BSD_SOCKETS_MMSG
+        /// Datagram headers for sendmmsg, one per buffer in the batch.
+        std::vector<struct mmsghdr> msgs_;
+        /// Payload descriptors for msgs_.
+        std::vector<struct iovec> iov_;
+        /// How many entries of msgs_ have been sent.
+        unsigned sent_{0};
+#endif
+        /// Buffers (besides the current message) that are in the current
+        /// batch. These will be released when the write is done.
+        std::vector<typename HFlow::buffer_type *> pending_;
+        /// Buffer taken from the queue that did not fit into the current
+        /// batch. Will be processed as the next message.
+        typename HFlow::buffer_type *carry_{nullptr};
+        /// Priority of carry_.
+        unsigned carryPriority_{0};
+        /// Largest number of bytes to coalesce into a write. 0 if batching
+        /// is disabled.
+        unsigned batchBytes_{0};
+        /// How long a small batch may wait for more data.
+        long long batchDelay_{0};
+        /// Number of bytes in the current batch, including the message.
+        size_t batchLen_{0};
+        /// True if the fd keeps datagram boundaries, so buffers must not be
+        /// merged into one write.
+        bool messageFd_{false};
+        /// True if the current batch already waited for more data.
+        bool delayed_{false};
     };
 
 protected:
+    /// Puts a file descriptor into non-blocking mode. This has to happen
+    /// before the read flow is constructed, because the read flow might issue
+    /// its first read right away on the executor thread.
+    /// @param fd the file descriptor to set up.
+    /// @return fd.
+    static int set_nonblocking(int fd)
+    {
+#ifdef __WINNT__
+        unsigned long par = 1;
+        ioctlsocket(fd, FIONBIO, &par);
+#else
+        ::fcntl(fd, F_SETFL, O_RDWR | O_NONBLOCK);
+#endif
+        return fd;
+    }
+
+    /// @param fd the file descriptor to check.
+    /// @return true if fd is a socket that keeps datagram boundaries (e.g. a
+    /// socketcan CAN_RAW socket), false for byte streams (TCP, pipes, serial
+    /// devices).
+    static bool is_message_fd(int fd)
+    {
+#if defined(OPENMRN_FEATURE_BSD_SOCKETS) && defined(SO_TYPE)
+        int type = 0;
+        socklen_t len = sizeof(type);
+        if (::getsockopt(fd, SOL_SOCKET, SO_TYPE, (char *)&type, &len) == 0)
+        {
+            return type != SOCK_STREAM;
+        }
+#endif
+        return false;
+    }
 
     /** The assumption here is that the write flow still has entries in its
      * queue that need to be removed. */
@@ -38,6 +38,7 @@
 #include "utils/async_if_test_helper.hxx"
 #include "openlcb/Datagram.hxx"
 #include "openlcb/DatagramCan.hxx"
+#include "openlcb/DatagramHandlerDefault.hxx"
 
 namespace openlcb {
 
@@ -45,7 +46,7 @@ namespace openlcb {
 class AsyncDatagramTest : public AsyncNodeTest
 {
 protected:
-    AsyncDatagramTest() : datagram_support_(ifCan_.get(), 10, 2)
+    AsyncDatagramTest() : datagram_support_(ifCan_.get(), 10, 2, 4)
     {
     }
 
@@ -121,12 +122,126 @@ protected:
         // expect_packet(":X19170225N02010D000103;"); // node ID verified
     }
 
+    /// Datagram handler that accepts every datagram.
+    class AcceptAllHandler : public DefaultDatagramHandler
+    {
+    public:
+        AcceptAllHandler(DatagramService *if_dg)
+            : DefaultDatagramHandler(if_dg)
+        {
+        }
+
+        Action entry() override
+        {
+            ++count_;
+            last_ = message()->data()->payload;
+            return respond_ok(0);
+        }
+
+        /// How many datagrams arrived.
+        unsigned count_ {0};
+        /// Payload of the last datagram.
+        DatagramPayload last_;
+    };
+
+    enum
+    {
+        /// Datagram ID accepted by the sink nodes.
+        SINK_DATAGRAM_ID = 0x7B,
+        /// Alias of the first sink node.
+        SINK_NODE_ALIAS = 0x300,
+    };
+
+    /// Creates virtual nodes on the other interface that accept every
+    /// datagram with SINK_DATAGRAM_ID. Call after setup_other_node(true).
+    /// @param count how many nodes to create.
+    void setup_sink_nodes(unsigned count)
+    {
+        clear_expect();
+        sinkHandler_.reset(new AcceptAllHandler(otherNodeDatagram_));
+        otherNodeDatagram_->registry()->insert(
+            nullptr, SINK_DATAGRAM_ID, sinkHandler_.get());
+        for (unsigned i = 0; i < count; ++i)
+        {
+            NodeID id = sink_node_id(i);
+            run_x([this, id, i]() {
+                otherNodeIf_->local_aliases()->add(id, SINK_NODE_ALIAS + i);
+            });
+            sinkNodes_.emplace_back(new DefaultNode(otherNodeIf_, id));
+        }
+        wait();
+    }
+
+    /// @return the node ID of the i-th sink node.
+    NodeID sink_node_id(unsigned i)
+    {
+        return OTHER_NODE_ID + 1 + i;
+    }
+
+    /// Sends datagrams to the sink nodes in a round-robin fashion and waits
+    /// for all of them to be acknowledged.
+    /// @param count how many datagrams to send.
+    /// @param pipelined if true, uses the datagram pipeline, otherwise a
+    /// single DatagramClient that sends one datagram after the other.
+    /// @return the time it took in nanoseconds.
+    long long send_to_sinks(unsigned count, bool pipelined)
+    {
+        DatagramPayload payload(16, 0x55);
+        payload[0] = SINK_DATAGRAM_ID;
+        long long start = os_get_time_monotonic();
+        if (pipelined)
+        {
+            vector<BufferPtr<DatagramSendRequest>> requests;
+            SyncNotifiable n;
+            BarrierNotifiable all(&n);
+            for (unsigned i = 0; i < count; ++i)
+            {
+                Buffer<DatagramSendRequest> *b;
+                mainBufferPool->alloc(&b);
+                b->data()->reset(node_->node_id(),
+                    {sink_node_id(i % sinkNodes_.size()), 0}, payload);
+                b->data()->done.reset(all.new_child());
+                requests.emplace_back(b->ref());
+                datagram_support_.pipeline()->send(b);
+            }
+            all.maybe_done();
+            n.wait_for_notification();
+            for (auto &r : requests)
+            {
+                EXPECT_EQ(0, r->data()->resultCode);
+            }
+        }
+        else
+        {
+            DatagramClient *c =
+                datagram_support_.client_allocator()->next_blocking();
+            for (unsigned i = 0; i < count; ++i)
+            {
+                auto *b = ifCan_->addressed_message_write_flow()->alloc();
+                b->data()->reset(Defs::MTI_DATAGRAM, node_->node_id(),
+                    {sink_node_id(i % sinkNodes_.size()), 0}, payload);
+                b->set_done(get_notifiable());
+                // The client is still finishing the previous datagram on the
+                // executor when the notification arrives.
+                run_x([c, b]() { c->write_datagram(b); });
+                wait_for_notification();
+                EXPECT_TRUE(c->result() & DatagramClient::OPERATION_SUCCESS);
+            }
+            datagram_support_.client_allocator()->insert(c);
+        }
+        return os_get_time_monotonic() - start;
+    }
+
     std::unique_ptr<DefaultNode> otherNode_;
     // Second objects if we want a bus-traffic test.
     std::unique_ptr<IfCan> otherIfCan_;
     IfCan* otherNodeIf_;
     std::unique_ptr<CanDatagramService> otherDatagramSupport_;
     CanDatagramService* otherNodeDatagram_;
+    /// Accepts the datagrams sent to the sink nodes.
+    std::unique_ptr<AcceptAllHandler> sinkHandler_;
+    /// Virtual nodes on the other interface for throughput tests.
+    vector<std::unique_ptr<DefaultNode>> sinkNodes_;
 };
 
 } // namespace
@@ -34,6 +34,12 @@
 //#define LOGLEVEL VERBOSE
 
 #include <stdint.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include "utils/logging.h"
 #include "utils/gc_format.h"
 #include "can_frame.h"
@@ -78,6 +84,101 @@ static int ascii_to_nibble(const char c)
     return -1;
 }
 
+/** Branch-light variant of ascii_to_nibble for the bulk parser.
+    @param c is the character to convert.
+    @return a converted value, or -1 if an invalid character was encountered.
+*/
+static inline int hex_to_nibble(unsigned char c)
+{
+    unsigned d = c - '0';
+    if (d < 10)
+    {
+        return d;
+    }
+    d = (c | 0x20) - 'a';
+    if (d < 6)
+    {
+        return d + 10;
+    }
+    return -1;
+}
+
+/** Decodes a string of hex digits into bytes.
+    @param src the hex characters, two for each output byte.
+    @param len number of characters in src, even and at most 16.
+    @param dst output buffer for len / 2 bytes.
+    @return true on success, false if there was a non-hex character.
+*/
+static bool hex_decode_payload(const char *src, unsigned len, uint8_t *dst)
+{
+#if defined(__SSE2__)
+    // Pads the input to a full vector with '0' characters so that the load
+    // does not run over the end of the source buffer.
+    char in[16];
+    memset(in, '0', sizeof(in));
+    memcpy(in, src, len);
+    __m128i v = _mm_loadu_si128((const __m128i *)in);
+    __m128i digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i is_digit =
+        _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    __m128i letter = _mm_sub_epi8(
+        _mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_letter =
+        _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF)
+    {
+        return false;
+    }
+    __m128i nibbles = _mm_or_si128(_mm_and_si128(is_digit, digit),
+        _mm_andnot_si128(is_digit, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    // Each 16-bit lane has the high nibble in its low byte and the low nibble
+    // in its high byte.
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xff)), 4);
+    __m128i lo = _mm_srli_epi16(nibbles, 8);
+    uint8_t out[16];
+    _mm_storeu_si128((__m128i *)out,
+        _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128()));
+    memcpy(dst, out, len / 2);
+    return true;
+#elif defined(__ARM_NEON)
+    char in[16];
+    memset(in, '0', sizeof(in));
+    memcpy(in, src, len);
+    uint8x16_t v = vld1q_u8((const uint8_t *)in);
+    uint8x16_t digit = vsubq_u8(v, vdupq_n_u8('0'));
+    uint8x16_t is_digit = vcleq_u8(digit, vdupq_n_u8(9));
+    uint8x16_t letter =
+        vsubq_u8(vorrq_u8(v, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    uint8x16_t is_letter = vcleq_u8(letter, vdupq_n_u8(5));
+    uint8x16_t valid = vorrq_u8(is_digit, is_letter);
+    // There is no movemask on NEON; folds the two halves into one word.
+    uint8x8_t all_valid = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+    if (vget_lane_u64(vreinterpret_u64_u8(all_valid), 0) != UINT64_MAX)
+    {
+        return false;
+    }
+    uint8x16_t nibbles =
+        vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+    // val[0] gets the even (high) nibbles, val[1] the odd (low) nibbles.
+    uint8x8x2_t pairs = vuzp_u8(vget_low_u8(nibbles), vget_high_u8(nibbles));
+    uint8_t out[8];
+    vst1_u8(out, vorr_u8(vshl_n_u8(pairs.val[0], 4), pairs.val[1]));
+    memcpy(dst, out, len / 2);
+    return true;
+#else
+    for (unsigned i = 0; i < len; i += 2)
+    {
+        int nh = hex_to_nibble(src[i]);
+        int nl = hex_to_nibble(src[i + 1]);
+        if ((nh | nl) < 0)
+        {
+            return false;
+        }
+        *dst++ = (nh << 4) | nl;
+    }
+    return true;
+#endif
+}
 
 int gc_format_parse(const char* buf, struct can_frame* can_frame)
 {
@@ -152,6 +253,77 @@ int gc_format_parse(const char* buf, struct can_frame* can_frame)
     return 0;
 }
 
+int gc_format_parse_n(const char* buf, size_t len, struct can_frame* can_frame)
+{
+    const char *end = buf + len;
+    CLR_CAN_FRAME_ERR(*can_frame);
+    if (len && *buf == 'X')
+    {
+        SET_CAN_FRAME_EFF(*can_frame);
+    }
+    else if (len && *buf == 'S')
+    {
+        CLR_CAN_FRAME_EFF(*can_frame);
+    }
+    else
+    {
+        // Unknown packet type.
+        SET_CAN_FRAME_ERR(*can_frame);
+        return -1;
+    }
+    buf++;
+    uint32_t id = 0;
+    while (1)
+    {
+        if (buf == end)
+        {
+            SET_CAN_FRAME_ERR(*can_frame);
+            return -1;
+        }
+        int nibble = hex_to_nibble(*buf);
+        if (nibble >= 0)
+        {
+            id <<= 4;
+            id |= nibble;
+            ++buf;
+        }
+        else if (*buf == 'N')
+        {
+            CLR_CAN_FRAME_RTR(*can_frame);
+            ++buf;
+            break;
+        }
+        else if (*buf == 'R')
+        {
+            SET_CAN_FRAME_RTR(*can_frame);
+            ++buf;
+            break;
+        }
+        else
+        {
+            SET_CAN_FRAME_ERR(*can_frame);
+            return -1;
+        }
+    } // while parsing ID
+    if (IS_CAN_FRAME_EFF(*can_frame))
+    {
+        SET_CAN_FRAME_ID_EFF(*can_frame, id);
+    }
+    else
+    {
+        SET_CAN_FRAME_ID(*can_frame, id);
+    }
+    unsigned payload_len = end - buf;
+    if ((payload_len & 1) || payload_len > 16 ||
+        !hex_decode_payload(buf, payload_len, can_frame->data))
+    {
+        SET_CAN_FRAME_ERR(*can_frame);
+        return -1;
+    }
+    can_frame->can_dlc = payload_len / 2;
+    return 0;
+}
+
 /// Helper function for appending to a buffer ONCE.
 ///
 /// @param dst buffer to append data to
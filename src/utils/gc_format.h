@@ -34,6 +34,8 @@
 #ifndef _UTILS_GC_FORMAT_H_
 #define _UTILS_GC_FORMAT_H_
 
+#include <stddef.h>
+
 #include "utils/constants.hxx"
 
 #ifdef __cplusplus
@@ -60,6 +62,24 @@ DECLARE_CONST(gc_generate_newlines);
 */
 int gc_format_parse(const char* buf, struct can_frame* can_frame);
 
+/** Parses a GridConnect packet that is not NUL-terminated. The payload bytes
+    are decoded with SIMD instructions where available.
+
+    @param buf points to the first character of the packet after the leading
+    ":".
+
+    @param len is the number of characters in the packet, not counting the
+    leading ':' and trailing ';'.
+
+    @param can_frame is the CAN frame that will be filled based on the source
+    packet.
+
+    @return 0 in case of success, -1 if there was a packet format error
+    (including more than 8 data bytes; in this case the frame is set to an
+    error frame).
+*/
+int gc_format_parse_n(const char* buf, size_t len, struct can_frame* can_frame);
+
 /** Formats a can frame in the GridConnect protocol.
 
     If requested, it can create the double protocol with leading !!, trailing ;;